@@ -8,29 +8,97 @@
 #include "hardware/spi.h"
 
 #define SPI_PORT spi0
-#define RSTPIN 22
 #define PIN_MISO 4
-#define PIN_CS   5
 #define PIN_SCK  6
 #define PIN_MOSI 7
 
-static inline void cs_select() {
+// Time on top of the current timeout that the wait loop in PCD_CommunicateWithPICC() allows before the emergency break.
+// Covers the transmission of the frame itself; a full 64 byte FIFO takes about 6 ms at 106 kBd.
+#define PCD_EMERGENCY_BREAK_MARGIN_US 10000
+
+// Upper bound for the oscillator to come back after a hard or soft reset.
+// Section 8.8.2 in the datasheet says the start-up time is the start up time of the crystal + 37,74us; crystals take well below 1ms.
+#define PCD_RESET_TIMEOUT_US 50000
+
+// Failed REQA/select attempts after which PICC_Inventory() gives up on the PICCs in the field.
+#define PICC_INVENTORY_MAX_ERRORS 3
+
+// ModWidthReg for each PCD_BitRate. The modulation pulse has to shrink with the bit period.
+static const uint8_t bitRateModWidth[] = { 0x26, 0x15, 0x0A, 0x05 };
+
+// Number of emergency breaks in a row after which PCD_CheckHealth() re-initializes the chip.
+#define PCD_HEALTH_MAX_EMERGENCY_BREAKS 3
+
+// Wait after a failed recovery before PCD_CheckHealth() tries again. It doubles with every further
+// failure up to the maximum, so a reader that is unplugged or dead does not cost a blocking reset per check.
+#define PCD_RECOVERY_BACKOFF_US 500000
+#define PCD_RECOVERY_BACKOFF_MAX_US 30000000
+
+// Configuration registers restored by PCD_RestoreRegisterImage(), in the order they are written back.
+// TxControlReg is last so the antenna is only switched on once everything else is in place.
+static const uint8_t imageRegisters[] = {
+	MFRC522::TxModeReg,
+	MFRC522::RxModeReg,
+	MFRC522::ModWidthReg,
+	MFRC522::TxASKReg,
+	MFRC522::ModeReg,
+	MFRC522::RFCfgReg,
+	MFRC522::TxControlReg
+};
+
+// Timeout for each PCD_TimeoutProfile, in microseconds.
+static const uint32_t timeoutProfileMicros[MFRC522::TIMEOUT_PROFILE_COUNT] = {
+	25000,	// TIMEOUT_DEFAULT
+	500,	// TIMEOUT_REQA
+	500,	// TIMEOUT_ANTICOLLISION
+	1000,	// TIMEOUT_SELECT
+	1000,	// TIMEOUT_HALT
+	10000,	// TIMEOUT_MIFARE_AUTH
+	5000,	// TIMEOUT_MIFARE_READ
+	10000,	// TIMEOUT_MIFARE_WRITE
+	25000	// TIMEOUT_ISO_DEP, only used when no FWT is known
+};
+
+// Set once the shared SPI bus has been configured by the first MFRC522 instance.
+static bool spiBusReady = false;
+
+static inline void cs_select(uint8_t pin) {
 	asm volatile("nop \n nop \n nop");
-	gpio_put(PIN_CS, 0);  // Active low
+	gpio_put(pin, 0);  // Active low
 	asm volatile("nop \n nop \n nop");
 }
 
-static inline void cs_deselect() {
+static inline void cs_deselect(uint8_t pin) {
 	asm volatile("nop \n nop \n nop");
-	gpio_put(PIN_CS, 1);
+	gpio_put(pin, 1);
 	asm volatile("nop \n nop \n nop");
 }
 
+// RxGain settings swept by PCD_CalibrateAntennaGain(). 010b and 011b are duplicates of 000b and 001b.
+static const uint8_t calibrationGains[MFRC522::GAIN_STEPS] = {
+	MFRC522::RxGain_18dB,
+	MFRC522::RxGain_23dB,
+	MFRC522::RxGain_33dB,
+	MFRC522::RxGain_38dB,
+	MFRC522::RxGain_43dB,
+	MFRC522::RxGain_48dB
+};
+
 /**
  * Constructor.
  * Prepares the output pins.
+ * Several readers can share spi0 as long as each one has its own CS pin. All CS pins must be driven high
+ * before the first instance is constructed, otherwise a reader that is not set up yet answers on MISO too.
  */
-MFRC522::MFRC522(){
+MFRC522::MFRC522(uint8_t rxGain,	///< RxGain for PCD_Init() to apply, eg from PCD_CalibrateAntennaGain(). 0xFF => reset default.
+				uint8_t csPin,		///< Chip select of this reader.
+				uint8_t rstPin		///< NRSTPD of this reader. A RST line shared between readers resets all of them on recovery.
+				)
+	: _csPin(csPin), _rstPin(rstPin), _timeoutMicros(0), _timerPrescaler(0xFFFF), _timerReload(0),
+	  _registerImageValid(false), _version(0), _rxGain(rxGain), _emergencyBreaks(0), _health(), _failedInRow(0), _recoveryNotBefore(0), _retryPolicy(NULL), _uidFilter(NULL),
+	  _txRate(BITRATE_106), _rxRate(BITRATE_106), _bitRateCap(BITRATE_848),
+	  _pendingWaitIRq(0), _pendingDeadline(0) {
+	static_assert(sizeof(imageRegisters) == REGISTER_IMAGE_SIZE, "imageRegisters and REGISTER_IMAGE_SIZE differ");
 	// Set SPI bus to work with MFRC522 chip.
 	setSPIConfig();
 	PCD_Init();
@@ -47,33 +115,170 @@ bool MFRC522::Uid::operator==(const Uid& id) const {
 
 bool MFRC522::isCardPresent( Uid id )
 {
-	if( !this->PICC_IsNewCardPresent() || !this->PICC_ReadCardSerial() )
-		return false;
-	return id == this->uid;
+	return this->PICC_ConfirmUid( &id ) == STATUS_OK;
 }
 
+/**
+ * Checks that one particular PICC is in the field: REQA/WUPA followed by a SELECT with the complete UID at each cascade level.
+ * Compared to PICC_Activate() and a compare afterwards this skips every ANTICOLLISION round trip, a 7 byte UID
+ * takes 3 frames instead of 5. Other PICCs in the field do not answer the SELECT and are left alone.
+ * On success the PICC is ACTIVE and this->uid holds its UID and SAK.
+ * 
+ * @return STATUS_OK if the PICC answered, STATUS_TIMEOUT if it is not there, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::PICC_ConfirmUid(	const Uid *expected,	///< The UID to look for. Only size and uidByte are used.
+				bool wakeup		///< True => use WUPA, which also reaches the PICC in state HALT.
+				) {
+	if (expected->size != 4 && expected->size != 7 && expected->size != 10) {
+	return STATUS_INVALID;
+	}
+	this->uid = *expected;
+	return PICC_Activate(&this->uid, wakeup, expected->size * 8);
+} // End PICC_ConfirmUid()
+
+/**
+ * Lists every PICC in the field: REQA, select, HLTA, and again until no PICC answers the REQA any more.
+ * Stacked cards all show up, not just the one the anticollision happens to pick.
+ * The UID filter is only consulted while a single PICC answers the REQA. With several PICCs each one has
+ * to be selected completely so it can be halted, otherwise the same PICC would win every anticollision.
+ * All listed PICCs are left in state HALT; use PICC_ConfirmUid() with wakeup to talk to one of them.
+ * 
+ * @return STATUS_OK if the field is empty now, STATUS_NO_ROOM if *uids filled up first,
+ *         STATUS_TIMEOUT if budgetUs ran out, STATUS_??? if the PICCs kept failing.
+ */
+uint8_t MFRC522::PICC_Inventory(	Uid *uids,			///< Out: the UIDs and SAKs found.
+				uint8_t maxUids,	///< Number of entries in *uids.
+				uint8_t *found,		///< Out: number of entries filled in.
+				uint32_t budgetUs	///< Upper bound for the whole call in microseconds.
+				) {
+	uint64_t start = time_us_64();
+	uint8_t bufferATQA[2];
+	uint8_t bufferSize;
+	uint8_t errors = 0;
+	uint8_t status;
+	UidFilter filter = _uidFilter;
+	
+	*found = 0;
+	while (1) {
+	if (time_us_64() - start >= budgetUs) {
+		return STATUS_TIMEOUT;
+	}
+	bufferSize = sizeof(bufferATQA);
+	status = PICC_RequestA(bufferATQA, &bufferSize);
+	if (status == STATUS_TIMEOUT) {		// Everybody is halted or gone
+		return STATUS_OK;
+	}
+	if (status != STATUS_OK && status != STATUS_COLLISION) {
+		if (++errors >= PICC_INVENTORY_MAX_ERRORS) {
+			return status;
+		}
+		continue;
+	}
+	if (*found >= maxUids) {
+		return STATUS_NO_ROOM;
+	}
+	_uidFilter = status == STATUS_COLLISION ? NULL : filter;
+	status = PICC_Select(&uids[*found]);
+	_uidFilter = filter;
+	if (status == STATUS_UNKNOWN_CARD) {	// The last PICC in the field, and not one we look for
+		return STATUS_OK;
+	}
+	if (status != STATUS_OK) {
+		if (++errors >= PICC_INVENTORY_MAX_ERRORS) {
+			return status;
+		}
+		continue;
+	}
+	PICC_HaltA();
+	(*found)++;
+	}
+} // End PICC_Inventory()
+
+/**
+ * Brings a PICC from IDLE (or HALT with wakeup) to ACTIVE: REQA/WUPA followed by PICC_Select().
+ * After every failed step the policy set with PICC_SetRetryPolicy() decides whether to try again
+ * straight away, so a marginal read can still succeed within the same tap.
+ * An empty field (no answer to the first REQA/WUPA) is never retried.
+ * 
+ * @return STATUS_OK on success, otherwise the status of the last attempt.
+ */
+uint8_t MFRC522::PICC_Activate(	Uid *uid,		///< Out: the UID and SAK of the selected PICC. In: the known UID if validBits is set.
+				bool wakeup,		///< True => start with WUPA, which also reaches PICCs in state HALT.
+				uint8_t validBits	///< Number of known UID bits in *uid, passed on to PICC_Select(). Normally 0.
+				) {
+	uint8_t bufferATQA[2];
+	uint8_t bufferSize;
+	uint8_t command = wakeup ? PICC_CMD_WUPA : PICC_CMD_REQA;
+	uint8_t retries[3] = {0, 0, 0};		// Collision, error and timeout retries so far
+	bool cardSeen = false;
+	uint8_t status;
+	uint64_t start = time_us_64();
+	uint32_t backoffUs;
+	
+	if (_retryPolicy) {
+	_retryPolicy->stats.activations++;
+	}
+	while (1) {
+	bufferSize = sizeof(bufferATQA);
+	status = PICC_REQA_or_WUPA(command, bufferATQA, &bufferSize);
+	if (status == STATUS_OK || status == STATUS_COLLISION) {	// Several PICCs answering at once is fine, anticollision sorts them out.
+		cardSeen = true;
+		// A PICC with the wrong UID size cannot be the one we look for
+		if (validBits && status == STATUS_OK && PICC_UidSizeFromATQA(bufferATQA) != uid->size) {
+			return STATUS_TIMEOUT;
+		}
+		if (!validBits && _uidFilter && status == STATUS_OK && !_uidFilter(NULL, 0, PICC_UidSizeFromATQA(bufferATQA))) {
+			return STATUS_UNKNOWN_CARD;		// Nothing we look for has a UID of this size; the PICC just goes back to IDLE.
+		}
+		status = PICC_Select(uid, validBits);
+	}
+	if (status == STATUS_OK) {
+		if (_retryPolicy) {
+			_retryPolicy->stats.successes++;
+			if (retries[0] || retries[1] || retries[2]) {
+				_retryPolicy->stats.retrySuccesses++;
+			}
+		}
+		return STATUS_OK;
+	}
+	if (!PICC_RetryAllowed(status, cardSeen, retries, start, &backoffUs)) {
+		return status;
+	}
+	if (_retryPolicy->wakeupOnRetry) {
+		command = PICC_CMD_WUPA;
+	}
+	if (backoffUs) {
+		sleep_us(backoffUs);
+	}
+	}
+} // End PICC_Activate()
+
 /**
  * Set SPI bus to work with MFRC522 chip.
  * Please call this function if you have changed the SPI config since the MFRC522 constructor was run.
  */
 void MFRC522::setSPIConfig() {
 	
-	spi_init(SPI_PORT, 4000000);
-	gpio_set_function(PIN_MISO, GPIO_FUNC_SPI);
-	gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
-	gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+	if (!spiBusReady) {		// The bus is shared, only the first reader sets it up.
+		spi_init(SPI_PORT, 4000000);
+		gpio_set_function(PIN_MISO, GPIO_FUNC_SPI);
+		gpio_set_function(PIN_SCK, GPIO_FUNC_SPI);
+		gpio_set_function(PIN_MOSI, GPIO_FUNC_SPI);
+		spiBusReady = true;
+	}
 	// Make the SPI pins available to picotool
 	bi_decl(bi_3pins_with_func(PIN_MISO, PIN_MOSI, PIN_SCK, GPIO_FUNC_SPI));
 
-	gpio_init(PIN_CS);
-	gpio_set_dir(PIN_CS, GPIO_OUT);
-	gpio_put(PIN_CS, 1);
-	// Make the CS pin available to picotool
-	bi_decl(bi_1pin_with_name(PIN_CS, "SPI CS"));
+	gpio_init(_csPin);
+	gpio_set_dir(_csPin, GPIO_OUT);
+	gpio_put(_csPin, 1);
+	// Make the CS pin of the first reader available to picotool
+	bi_decl(bi_1pin_with_name(MFRC522_PIN_CS, "SPI CS"));
 
-	gpio_init(RSTPIN);
-	gpio_set_dir(PIN_CS, GPIO_OUT);
-	gpio_put(PIN_CS, 1);
+	// Held in power down until PCD_Init() releases it, so that waits for the oscillator.
+	gpio_init(_rstPin);
+	gpio_set_dir(_rstPin, GPIO_OUT);
+	gpio_put(_rstPin, 0);
 	
 } // End setSPIConfig()
 
@@ -92,11 +297,9 @@ void MFRC522::PCD_WriteRegister(	uint8_t reg,		///< The register to write to. On
 	uint8_t data[2];
 	data[0] = reg;
 	data[1] = value;
-	cs_select();
+	cs_select(_csPin);
 	spi_write_blocking(SPI_PORT, data, 2);
-	cs_deselect();
-	sleep_ms(1);
-	
+	cs_deselect(_csPin);
 } // End PCD_WriteRegister()
 
 /**
@@ -107,12 +310,10 @@ void MFRC522::PCD_WriteRegister(	uint8_t reg,		///< The register to write to. On
 					uint8_t count,		///< The number of bytes to write to the register
 					uint8_t *values	///< The values to write. uint8_t array.
 					) {
-	cs_select();
+	cs_select(_csPin);
 	spi_write_blocking(SPI_PORT, &reg, 1);
 	spi_write_blocking(SPI_PORT, values, count);
-	cs_deselect();
-	sleep_ms(1);
-
+	cs_deselect(_csPin);
 } // End PCD_WriteRegister()
 
 /**
@@ -126,9 +327,9 @@ uint8_t MFRC522::PCD_ReadRegister(	uint8_t reg	///< The register to read from. O
 	uint8_t recive[2];
 	data[0] = 0x80 | reg;
 	data[1] = 0;
-	cs_select();
+	cs_select(_csPin);
 	spi_write_read_blocking(SPI_PORT, data, recive, 2);
-	cs_deselect();
+	cs_deselect(_csPin);
 	return recive[1];
 } // End PCD_ReadRegister()
 
@@ -147,7 +348,7 @@ void MFRC522::PCD_ReadRegister(	uint8_t reg,		///< The register to read from. On
 	//Serial.print(F("Reading ")); 	Serial.print(count); Serial.println(F(" bytes from register."));
 	uint8_t address = 0x80 | reg;				// MSB == 1 is for reading. LSB is not used in address. Datasheet section 8.1.2.3.
 	uint8_t index = 0;							// Index in values array.
-	cs_select();
+	cs_select(_csPin);
 	count--;								// One read is performed outside of the loop
 	spi_write_blocking(SPI_PORT, &address, 1);
 	if (rxAlign) {		// Only update bit positions rxAlign..7 in values[0]
@@ -165,7 +366,7 @@ void MFRC522::PCD_ReadRegister(	uint8_t reg,		///< The register to read from. On
 		index++;
 	}
 	spi_write_read_blocking(SPI_PORT, 0, &values[index], 1 );		// Read the final byte. Send 0 to stop reading.
-	cs_deselect();
+	cs_deselect(_csPin);
 } // End PCD_ReadRegister()
 
 /**
@@ -215,6 +416,7 @@ uint8_t MFRC522::PCD_CalculateCRC(	uint8_t *data,		///< In: Pointer to the data
 		break;
 	}
 	if (--i == 0) {						// The emergency break. We will eventually terminate on this one after 89ms. Communication with the MFRC522 might be down.
+		_emergencyBreaks++;
 		return STATUS_TIMEOUT;
 	}
 	}
@@ -235,49 +437,248 @@ uint8_t MFRC522::PCD_CalculateCRC(	uint8_t *data,		///< In: Pointer to the data
  * Initializes the MFRC522 chip.
  */
 void MFRC522::PCD_Init() {
-	gpio_set_dir(RSTPIN, GPIO_IN);
-	if ( !gpio_get( RSTPIN ) ) {	//The MFRC522 chip is in power down mode.
-		gpio_set_dir(RSTPIN, GPIO_OUT);
-		gpio_put( RSTPIN, 0 );		// Exit power down mode. This triggers a hard reset.
-		sleep_us( 2 );
-		gpio_put( RSTPIN, 1 );
-		// Section 8.8.2 in the datasheet says the oscillator start-up time is the start up time of the crystal + 37,74�s. Let us be generous: 50ms.
-		sleep_ms( 50 );
+	if ( !gpio_get_out_level( _rstPin ) ) {	// The MFRC522 chip is in power down mode, always the case after setSPIConfig().
+		sleep_us( 2 );				// Section 8.8.1 in the datasheet: the reset pulse must be at least 100ns.
+		gpio_put( _rstPin, 1 );		// Exit power down mode. This triggers a hard reset.
+		PCD_WaitForOscillator();
 	}
 	// Reset baud rates
 	PCD_WriteRegister(TxModeReg, 0x00);
 	PCD_WriteRegister(RxModeReg, 0x00);
 	// Reset ModWidthReg
 	PCD_WriteRegister(ModWidthReg, 0x26);
+	_txRate = BITRATE_106;
+	_rxRate = BITRATE_106;
 	
 	// When communicating with a PICC we need a timeout if something goes wrong.
-	// f_timer = 13.56 MHz / (2*TPreScaler+1) where TPreScaler = [TPrescaler_Hi:TPrescaler_Lo].
-	// TPrescaler_Hi are the four low bits in TModeReg. TPrescaler_Lo is TPrescalerReg.
-	PCD_WriteRegister(TModeReg, 0x80);			// TAuto=1; timer starts automatically at the end of the transmission in all communication modes at all speeds
-	PCD_WriteRegister(TPrescalerReg, 0xA9);		// TPreScaler = TModeReg[3..0]:TPrescalerReg, ie 0x0A9 = 169 => f_timer=40kHz, ie a timer period of 25�s.
-	PCD_WriteRegister(TReloadRegH, 0x03);		// Reload timer with 0x3E8 = 1000, ie 25ms before timeout.
-	PCD_WriteRegister(TReloadRegL, 0xE8);
+	// The chip may have been reset, so forget what we programmed before and start with the default profile.
+	_timeoutMicros = 0;
+	_timerPrescaler = 0xFFFF;
+	_timerReload = 0;
+	PCD_SetTimeoutProfile(TIMEOUT_DEFAULT);
 	
 	PCD_WriteRegister(TxASKReg, 0x40);		// Default 0x00. Force a 100 % ASK modulation independent of the ModGsPReg register setting
 	PCD_WriteRegister(ModeReg, 0x3D);		// Default 0x3F. Set the preset value for the CRC coprocessor for the CalcCRC command to 0x6363 (ISO 14443-3 part 6.2.4)
+	if (_rxGain != 0xFF) {
+		PCD_SetAntennaGain(_rxGain);		// Calibrated for this unit, see PCD_CalibrateAntennaGain()
+	}
 	PCD_AntennaOn();						// Enable the antenna driver pins TX1 and TX2 (they were disabled by the reset)
+	
+	// Remember what a healthy chip looks like, see PCD_CheckHealth().
+	_version = PCD_ReadRegister(VersionReg);
+	_emergencyBreaks = 0;
+	PCD_CacheRegisterImage();
 } // End PCD_Init()
 
+/**
+ * Programs the timer for one of the PCD_TimeoutProfile command classes.
+ * Nothing is written to the MFRC522 if the timeout does not change.
+ */
+void MFRC522::PCD_SetTimeoutProfile(	uint8_t profile,	///< One of the PCD_TimeoutProfile enums.
+						uint32_t fwtMicros	///< Frame waiting time for TIMEOUT_ISO_DEP. 0 => use the profile default.
+						) {
+	if (profile >= TIMEOUT_PROFILE_COUNT) {
+		profile = TIMEOUT_DEFAULT;
+	}
+	if (profile == TIMEOUT_ISO_DEP && fwtMicros) {
+		PCD_SetTimeout(fwtMicros);
+	}
+	else {
+		PCD_SetTimeout(timeoutProfileMicros[profile]);
+	}
+} // End PCD_SetTimeoutProfile()
+
+/**
+ * Programs TPrescaler/TReload for a timeout of at least the given number of microseconds.
+ * Only the registers whose value changes are written.
+ */
+void MFRC522::PCD_SetTimeout(uint32_t micros	///< Time from the end of the transmission until TimerIRq.
+						) {
+	if (micros == _timeoutMicros) {
+		return;
+	}
+	// f_timer = 13.56 MHz / (2*TPreScaler+1) where TPreScaler = [TPrescaler_Hi:TPrescaler_Lo].
+	// TPrescaler_Hi are the four low bits in TModeReg. TPrescaler_Lo is TPrescalerReg.
+	// 0x0A9 = 169 => f_timer=40kHz, ie a timer period of 25us, good for up to 1.6s.
+	// Longer timeouts (ISO-DEP allows up to 4.9s) use 0xFFF => a timer period of 604us.
+	uint16_t prescaler = (micros <= 0xFFFFUL * 25) ? 0x0A9 : 0xFFF;
+	uint32_t divider = 100 * (2 * prescaler + 1);
+	uint64_t ticks = ((uint64_t)micros * 1356 + divider - 1) / divider;
+	uint16_t reload = ticks == 0 ? 1 : (ticks > 0xFFFF ? 0xFFFF : (uint16_t)ticks);
+	
+	if (prescaler != _timerPrescaler) {
+		PCD_WriteRegister(TModeReg, 0x80 | (prescaler >> 8));	// TAuto=1; timer starts automatically at the end of the transmission in all communication modes at all speeds
+		PCD_WriteRegister(TPrescalerReg, prescaler & 0xFF);
+		_timerPrescaler = prescaler;
+	}
+	if (reload != _timerReload) {
+		PCD_WriteRegister(TReloadRegH, reload >> 8);
+		PCD_WriteRegister(TReloadRegL, reload & 0xFF);
+		_timerReload = reload;
+	}
+	_timeoutMicros = micros;
+} // End PCD_SetTimeout()
+
 /**
  * Performs a soft reset on the MFRC522 chip and waits for it to be ready again.
+ * 
+ * @return false if the chip did not come back within PCD_RESET_TIMEOUT_US.
  */
-void MFRC522::PCD_Reset() {
+bool MFRC522::PCD_Reset() {
 	PCD_WriteRegister(CommandReg, PCD_SoftReset);	// Issue the SoftReset command.
 	// The datasheet does not mention how long the SoftRest command takes to complete.
 	// But the MFRC522 might have been in soft power-down mode (triggered by bit 4 of CommandReg) 
-	// Section 8.8.2 in the datasheet says the oscillator start-up time is the start up time of the crystal + 37,74�s. Let us be generous: 50ms.
-	sleep_ms( 50 );
-	// Wait for the PowerDown bit in CommandReg to be cleared
-	while (PCD_ReadRegister(CommandReg) & (1<<4)) {
-	// PCD still restarting - unlikely after waiting 50ms, but better safe than sorry.
-	}
+	return PCD_WaitForOscillator();
 } // End PCD_Reset()
 
+/**
+ * Pulls the reset pin low to perform a hard reset and waits for the chip to be ready again.
+ * All registers are back at their reset values afterwards.
+ * 
+ * @return false if the chip did not come back within PCD_RESET_TIMEOUT_US.
+ */
+bool MFRC522::PCD_HardReset() {
+	gpio_set_dir(_rstPin, GPIO_OUT);
+	gpio_put( _rstPin, 0 );		// Section 8.8.1 in the datasheet: the reset pulse must be at least 100ns.
+	sleep_us( 2 );
+	gpio_put( _rstPin, 1 );
+	return PCD_WaitForOscillator();
+} // End PCD_HardReset()
+
+/**
+ * Waits until the PowerDown bit in CommandReg is cleared and VersionReg reads back a sane value.
+ * Section 8.8.2 in the datasheet says the oscillator start-up time is the start up time of the crystal + 37,74us.
+ * 
+ * @return false if that did not happen within PCD_RESET_TIMEOUT_US.
+ */
+bool MFRC522::PCD_WaitForOscillator() {
+	uint64_t deadline = time_us_64() + PCD_RESET_TIMEOUT_US;
+	while (1) {
+	sleep_us(50);
+	if (!(PCD_ReadRegister(CommandReg) & (1<<4))) {		// PowerDown bit cleared
+		uint8_t version = PCD_ReadRegister(VersionReg);
+		if (version != 0x00 && version != 0xFF) {		// A floating or shorted MISO line reads as 0xFF or 0x00
+			return true;
+		}
+	}
+	if (time_us_64() > deadline) {
+		return false;
+	}
+	}
+} // End PCD_WaitForOscillator()
+
+/**
+ * Reads the configuration registers listed in imageRegisters into _registerImage.
+ * Call this after changing any of them so PCD_CheckHealth() does not mistake the change for a reset.
+ */
+void MFRC522::PCD_CacheRegisterImage() {
+	for (uint8_t i = 0; i < REGISTER_IMAGE_SIZE; i++) {
+	_registerImage[i] = PCD_ReadRegister(imageRegisters[i]);
+	}
+	_registerImageValid = (_version != 0x00 && _version != 0xFF);
+} // End PCD_CacheRegisterImage()
+
+/**
+ * Writes _registerImage back to the chip and reprograms the current timeout.
+ */
+void MFRC522::PCD_RestoreRegisterImage() {
+	for (uint8_t i = 0; i < REGISTER_IMAGE_SIZE; i++) {
+	PCD_WriteRegister(imageRegisters[i], _registerImage[i]);
+	}
+	uint32_t timeout = _timeoutMicros;
+	_timeoutMicros = 0;
+	_timerPrescaler = 0xFFFF;
+	_timerReload = 0;
+	PCD_SetTimeout(timeout ? timeout : timeoutProfileMicros[TIMEOUT_DEFAULT]);
+} // End PCD_RestoreRegisterImage()
+
+/**
+ * Checks that the MFRC522 still answers the way it did after PCD_Init():
+ * VersionReg is unchanged, the configuration registers read back as written, and exchanges
+ * end on an IRQ rather than the emergency break. On any fault the chip is hard reset and
+ * re-initialized from the cached register image, which takes a few milliseconds.
+ * After a failed recovery the next one waits PCD_RECOVERY_BACKOFF_US, doubling with every failure in a row;
+ * faults found in between are only counted.
+ * Meant to be called periodically from the main loop; it costs about ten register reads.
+ * 
+ * @return HEALTH_OK, or the PCD_HealthFault that caused a recovery.
+ */
+uint8_t MFRC522::PCD_CheckHealth() {
+	uint8_t fault = HEALTH_OK;
+	_health.checks++;
+	
+	uint8_t version = PCD_ReadRegister(VersionReg);
+	if (version != _version || version == 0x00 || version == 0xFF) {
+	fault = HEALTH_VERSION_CHANGED;
+	}
+	else if (_emergencyBreaks >= PCD_HEALTH_MAX_EMERGENCY_BREAKS) {
+	fault = HEALTH_EMERGENCY_BREAKS;
+	}
+	else if (PCD_ReadRegister(TReloadRegL) != (_timerReload & 0xFF)) {
+	fault = HEALTH_READBACK_MISMATCH;
+	}
+	else {
+	for (uint8_t i = 0; i < REGISTER_IMAGE_SIZE; i++) {
+		if (PCD_ReadRegister(imageRegisters[i]) != _registerImage[i]) {
+			fault = HEALTH_READBACK_MISMATCH;
+			break;
+		}
+	}
+	}
+	
+	if (fault != HEALTH_OK) {
+	if (_failedInRow && time_us_64() < _recoveryNotBefore) {
+		_health.deferredRecoveries++;
+	}
+	else if (PCD_Recover(fault)) {
+		_failedInRow = 0;
+	}
+	else {
+		uint64_t backoff = (uint64_t)PCD_RECOVERY_BACKOFF_US << (_failedInRow < 6 ? _failedInRow : 6);
+		_recoveryNotBefore = time_us_64() + (backoff < PCD_RECOVERY_BACKOFF_MAX_US ? backoff : PCD_RECOVERY_BACKOFF_MAX_US);
+		if (_failedInRow < 0xFF) {
+			_failedInRow++;
+		}
+	}
+	}
+	return fault;
+} // End PCD_CheckHealth()
+
+/**
+ * Hard resets the MFRC522 and brings it back to the state PCD_Init() left it in.
+ * Uses the cached register image when there is one, otherwise runs PCD_Init() again.
+ * The attempt is recorded in _health.
+ * 
+ * @return true if the chip answers with the expected VersionReg afterwards.
+ */
+bool MFRC522::PCD_Recover(uint8_t fault	///< One of the PCD_HealthFault enums, for the record.
+						) {
+	uint64_t start = time_us_64();
+	bool success = PCD_HardReset();
+	if (success) {
+	if (_registerImageValid) {
+		PCD_RestoreRegisterImage();
+		success = PCD_ReadRegister(VersionReg) == _version;
+	}
+	else {
+		PCD_Init();
+		success = _registerImageValid;
+	}
+	}
+	_emergencyBreaks = 0;
+	
+	RecoveryRecord &record = _health.recent[_health.recoveries % HEALTH_HISTORY_SIZE];
+	record.timeMs = (uint32_t)(start / 1000);
+	record.durationUs = (uint32_t)(time_us_64() - start);
+	record.fault = fault;
+	record.success = success;
+	_health.recoveries++;
+	if (!success) {
+	_health.failedRecoveries++;
+	}
+	return success;
+} // End PCD_Recover()
+
 /**
  * Turns the antenna on by enabling pins TX1 and TX2.
  * After a reset these pins are disabled.
@@ -296,6 +697,26 @@ void MFRC522::PCD_AntennaOff() {
 	PCD_ClearRegisterBitMask(TxControlReg, 0x03);
 } // End PCD_AntennaOff()
 
+/**
+ * Puts the MFRC522 in soft power-down: oscillator, receiver and antenna drivers are off.
+ * Registers, FIFO and the Crypto1 state keep their contents and SPI access still works,
+ * so PCD_SoftPowerUp() needs no reconfiguration, only the oscillator start-up.
+ */
+void MFRC522::PCD_SoftPowerDown() {
+	PCD_WriteRegister(CommandReg, PCD_Idle);				// Stop any active command.
+	PCD_SetRegisterBitMask(CommandReg, 1<<4);			// PowerDown
+} // End PCD_SoftPowerDown()
+
+/**
+ * Leaves soft power-down and waits for the oscillator, see PCD_SoftPowerDown().
+ * 
+ * @return true if the MFRC522 came back within PCD_RESET_TIMEOUT_US.
+ */
+bool MFRC522::PCD_SoftPowerUp() {
+	PCD_ClearRegisterBitMask(CommandReg, 1<<4);			// The bit stays set until the oscillator runs
+	return PCD_WaitForOscillator();
+} // End PCD_SoftPowerUp()
+
 /**
  * Get the current MFRC522 Receiver Gain (RxGain[2:0]) value.
  * See 9.3.3.6 / table 98 in http://www.nxp.com/documents/data_sheet/MFRC522.pdf
@@ -319,6 +740,74 @@ void MFRC522::PCD_SetAntennaGain(uint8_t mask) {
 	}
 } // End PCD_SetAntennaGain()
 
+/**
+ * Finds the receiver gain that reads a reference card most reliably.
+ * The card must lie on the reader for the whole calibration, which takes up to GAIN_STEPS * attempts exchanges.
+ * For every RxGain setting WUPA + SELECT + HLTA is repeated attempts times; the setting with the fewest failed
+ * activations wins, then the one with the fewest CRC/parity errors. Among equal settings the highest gain is kept,
+ * it gives the longest read range.
+ * The winner is applied, becomes the gain PCD_Init() uses from now on and is returned in *bestGain so the caller can store it.
+ * 
+ * @return STATUS_OK on success, STATUS_TIMEOUT if the card was never activated (the old gain is kept then).
+ */
+uint8_t MFRC522::PCD_CalibrateAntennaGain(	uint8_t attempts,			///< Activations per gain setting
+						uint8_t *bestGain,			///< Out: the chosen PCD_RxGain value
+						GainCalibration *results	///< Out: NULL or room for GAIN_STEPS entries with the statistics per setting
+						) {
+	uint8_t previousGain = PCD_GetAntennaGain();
+	uint8_t best = 0xFF;
+	uint8_t bestFailures = 0xFF;
+	uint8_t bestErrors = 0xFF;
+	uint8_t bufferATQA[2];
+	uint8_t bufferSize;
+	Uid card;
+	
+	if (bestGain == NULL || attempts == 0) {
+	return STATUS_INVALID;
+	}
+	
+	for (uint8_t step = 0; step < GAIN_STEPS; step++) {
+	GainCalibration stat = {calibrationGains[step], 0, 0, 0};
+	PCD_SetAntennaGain(stat.gain);
+	for (uint8_t i = 0; i < attempts; i++) {
+		bufferSize = sizeof(bufferATQA);
+		uint8_t status = PICC_WakeupA(bufferATQA, &bufferSize);	// WUPA - the card was halted by the previous attempt
+		if (status == STATUS_OK) {
+			status = PICC_Select(&card);
+		}
+		if (status == STATUS_OK) {
+			stat.successes++;
+			PICC_HaltA();
+		}
+		else if (status == STATUS_TIMEOUT) {
+			stat.timeouts++;
+		}
+		else {
+			stat.errors++;
+		}
+	}
+	if (results) {
+		results[step] = stat;
+	}
+	uint8_t failures = attempts - stat.successes;
+	if (stat.successes && (failures < bestFailures || (failures == bestFailures && stat.errors <= bestErrors))) {
+		best = stat.gain;
+		bestFailures = failures;
+		bestErrors = stat.errors;
+	}
+	}
+	
+	if (best == 0xFF) {
+	PCD_SetAntennaGain(previousGain);
+	return STATUS_TIMEOUT;
+	}
+	PCD_SetAntennaGain(best);
+	_rxGain = best;
+	PCD_CacheRegisterImage();		// RFCfgReg changed, keep PCD_CheckHealth() from restoring the old value
+	*bestGain = best;
+	return STATUS_OK;
+} // End PCD_CalibrateAntennaGain()
+
 /**
  * Performs a self-test of the MFRC522
  * See 16.1.1 in http://www.nxp.com/documents/data_sheet/MFRC522.pdf
@@ -428,39 +917,102 @@ uint8_t MFRC522::PCD_CommunicateWithPICC(	uint8_t command,		///< The command to
 					uint8_t rxAlign,		///< In: Defines the bit position in backData[0] for the first bit received. Default 0.
 					bool checkCRC		///< In: True => The last two bytes of the response is assumed to be a CRC_A that must be validated.
 					) {
-	uint8_t n, _validBits;
-	unsigned int i;
+	uint8_t result = PCD_StartCommunication(command, waitIRq, sendData, sendLen, validBits ? *validBits : 0, rxAlign);
+	if (result != STATUS_OK) {
+	return result;
+	}
+	
+	// Wait for the command to complete.
+	while (!PCD_PollCommunication(&result)) {
+	}
+	if (result != STATUS_OK) {
+	return result;
+	}
+	return PCD_FinishCommunication(backData, backLen, validBits, rxAlign, checkCRC);
+} // End PCD_CommunicateWithPICC()
+
+/**
+ * First part of PCD_CommunicateWithPICC(): transfers data to the FIFO and starts the command.
+ * Follow up with PCD_PollCommunication() until it returns true, then PCD_FinishCommunication().
+ * The MFRC522 works on its own in between, so the caller is free to do other things.
+ *
+ * @return STATUS_OK if the command was started, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::PCD_StartCommunication(	uint8_t command,		///< The command to execute. One of the PCD_Command enums.
+					uint8_t waitIRq,		///< The bits in the ComIrqReg register that signals successful completion of the command.
+					uint8_t *sendData,		///< Pointer to the data to transfer to the FIFO.
+					uint8_t sendLen,		///< Number of bytes to transfer to the FIFO.
+					uint8_t txLastBits,	///< The number of valid bits in the last byte. 0 for 8 valid bits.
+					uint8_t rxAlign,		///< Defines the bit position in backData[0] for the first bit received.
+					const uint8_t *moreData,	///< NULL or more data to put in the FIFO after sendData, so a header and a payload need not be copied together.
+					uint8_t moreLen		///< Number of bytes in moreData.
+					) {
+	if (sendLen + moreLen > FIFO_SIZE) {		// Use PCD_TransceiveStream() for longer frames.
+	return STATUS_NO_ROOM;
+	}
 	
 	// Prepare values for BitFramingReg
-	uint8_t txLastBits = validBits ? *validBits : 0;
 	uint8_t bitFraming = (rxAlign << 4) + txLastBits;		// RxAlign = BitFramingReg[6..4]. TxLastBits = BitFramingReg[2..0]
 	
 	PCD_WriteRegister(CommandReg, PCD_Idle);			// Stop any active command.
 	PCD_WriteRegister(ComIrqReg, 0x7F);					// Clear all seven interrupt request bits
 	PCD_SetRegisterBitMask(FIFOLevelReg, 0x80);			// FlushBuffer = 1, FIFO initialization
 	PCD_WriteRegister(FIFODataReg, sendLen, sendData);	// Write sendData to the FIFO
+	if (moreLen) {
+	PCD_WriteRegister(FIFODataReg, moreLen, (uint8_t *)moreData);
+	}
 	PCD_WriteRegister(BitFramingReg, bitFraming);		// Bit adjustments
 	PCD_WriteRegister(CommandReg, command);				// Execute the command
 	if (command == PCD_Transceive) {
 	PCD_SetRegisterBitMask(BitFramingReg, 0x80);	// StartSend=1, transmission of data starts
 	}
 	
-	// Wait for the command to complete.
 	// In PCD_Init() we set the TAuto flag in TModeReg. This means the timer automatically starts when the PCD stops transmitting.
-	// Each iteration of the do-while-loop takes 17.86�s.
-	i = 2000;
-	while (1) {
-	n = PCD_ReadRegister(ComIrqReg);	// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq HiAlertIRq LoAlertIRq ErrIRq TimerIRq
-	if (n & waitIRq) {					// One of the interrupts that signal success has been set.
-		break;
-	}
-	if (n & 0x01) {						// Timer interrupt - nothing received in 25ms
-		return STATUS_TIMEOUT;
+	// The timer fires after the current timeout profile, see PCD_SetTimeoutProfile().
+	_pendingWaitIRq = waitIRq;
+	_pendingDeadline = time_us_64() + _timeoutMicros + (PCD_EMERGENCY_BREAK_MARGIN_US >> PCD_SlowestRate());
+	return STATUS_OK;
+} // End PCD_StartCommunication()
+
+/**
+ * Checks once whether the command started by PCD_StartCommunication() has completed. Costs one register read.
+ *
+ * @return true when the command is over; *status is then STATUS_OK or STATUS_TIMEOUT.
+ */
+bool MFRC522::PCD_PollCommunication(uint8_t *status	///< Out: the outcome once the command is over.
+					) {
+	uint8_t n = PCD_ReadRegister(ComIrqReg);	// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq HiAlertIRq LoAlertIRq ErrIRq TimerIRq
+	if (n & _pendingWaitIRq) {			// One of the interrupts that signal success has been set.
+	_emergencyBreaks = 0;
+	*status = STATUS_OK;
+	return true;
 	}
-	if (--i == 0) {						// The emergency break. If all other condions fail we will eventually terminate on this one after 35.7ms. Communication with the MFRC522 might be down.
-		return STATUS_TIMEOUT;
+	if (n & 0x01) {						// Timer interrupt - nothing received within the timeout
+	_emergencyBreaks = 0;
+	*status = STATUS_TIMEOUT;
+	return true;
 	}
+	if (time_us_64() > _pendingDeadline) {	// The emergency break. If all other condions fail we will eventually terminate on this one. Communication with the MFRC522 might be down.
+	_emergencyBreaks++;
+	*status = STATUS_TIMEOUT;
+	return true;
 	}
+	return false;
+} // End PCD_PollCommunication()
+
+/**
+ * Last part of PCD_CommunicateWithPICC(): checks for errors and transfers data back from the FIFO.
+ * Only call this after PCD_PollCommunication() reported STATUS_OK.
+ *
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::PCD_FinishCommunication(	uint8_t *backData,		///< NULL or pointer to buffer if data should be read back after executing the command.
+					uint8_t *backLen,		///< In: Max number of bytes to write to *backData. Out: The number of bytes returned.
+					uint8_t *validBits,	///< Out: The number of valid bits in the last byte. 0 for 8 valid bits.
+					uint8_t rxAlign,		///< In: Defines the bit position in backData[0] for the first bit received.
+					bool checkCRC		///< In: True => The last two bytes of the response is assumed to be a CRC_A that must be validated.
+					) {
+	uint8_t n, _validBits = 0;
 	
 	// Stop now if any errors except collisions were detected.
 	uint8_t errorRegValue = PCD_ReadRegister(ErrorReg); // ErrorReg[7..0] bits are: WrErr TempErr reserved BufferOvfl CollErr CRCErr ParityErr ProtocolErr
@@ -509,7 +1061,127 @@ uint8_t MFRC522::PCD_CommunicateWithPICC(	uint8_t command,		///< The command to
 	}
 	
 	return STATUS_OK;
-} // End PCD_CommunicateWithPICC()
+} // End PCD_FinishCommunication()
+
+/**
+ * Executes the Transceive command for frames that do not fit in the 64 byte FIFO.
+ * The FIFO is refilled while the MFRC522 transmits (LoAlert) and drained while it receives (HiAlert),
+ * using the level set in WaterLevelReg. Only whole bytes are sent and received.
+ * With useCRC the MFRC522 appends the CRC_A itself and checks and removes the CRC_A of the response.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::PCD_TransceiveStream(	const uint8_t *sendData,	///< Pointer to the data to send. Do NOT include the CRC_A if useCRC is set.
+					uint16_t sendLen,		///< Number of bytes to send.
+					uint8_t *backData,		///< Buffer for the response.
+					uint16_t *backLen,		///< In: Max number of bytes to write to *backData. Out: The number of bytes returned.
+					bool useCRC			///< True => CRC_A is added to the frame and checked in the response by the MFRC522.
+					) {
+	const uint8_t chunk = FIFO_SIZE - STREAM_WATER_LEVEL;	// Bytes that can be moved whenever LoAlert or HiAlert is set
+	uint8_t n, irq;
+	
+	if (sendData == NULL || backData == NULL || backLen == NULL) {
+	return STATUS_INVALID;
+	}
+	
+	PCD_WriteRegister(CommandReg, PCD_Idle);			// Stop any active command.
+	PCD_WriteRegister(ComIrqReg, 0x7F);					// Clear all seven interrupt request bits
+	PCD_SetRegisterBitMask(FIFOLevelReg, 0x80);			// FlushBuffer = 1, FIFO initialization
+	PCD_WriteRegister(WaterLevelReg, STREAM_WATER_LEVEL);
+	if (useCRC) {
+	PCD_SetRegisterBitMask(TxModeReg, 0x80);		// TxCRCEn
+	PCD_SetRegisterBitMask(RxModeReg, 0x80);		// RxCRCEn
+	}
+	
+	uint16_t sent = sendLen < FIFO_SIZE ? sendLen : FIFO_SIZE;
+	PCD_WriteRegister(FIFODataReg, sent, (uint8_t *)sendData);	// Prime the FIFO
+	PCD_WriteRegister(BitFramingReg, 0x00);				// Whole bytes, no alignment
+	PCD_WriteRegister(CommandReg, PCD_Transceive);
+	PCD_SetRegisterBitMask(BitFramingReg, 0x80);		// StartSend=1, transmission of data starts
+	
+	// At 106 kBd one byte with parity takes about 85us on air; allow 100us per byte in either direction, less at higher bit rates.
+	uint64_t deadline = time_us_64() + _timeoutMicros + ((PCD_EMERGENCY_BREAK_MARGIN_US + 100UL * (sendLen + *backLen)) >> PCD_SlowestRate());
+	uint8_t status = STATUS_OK;
+	uint16_t received = 0;
+	
+	// Refill the FIFO while the frame is on air. LoAlert means there are at least 'chunk' free bytes.
+	// An empty FIFO also sets LoAlert, so check for an underrun first: bytes added after it would go out as a second frame.
+	while (sent < sendLen) {
+	if (PCD_ReadRegister(ComIrqReg) & 0x40) {		// TxIRq before we were done - the FIFO ran empty and the frame ended
+		status = STATUS_ERROR;
+		break;
+	}
+	if (PCD_ReadRegister(Status1Reg) & 0x01) {		// Status1Reg[7..0] bits are: CRCOk CRCReady IRq TRunning reserved HiAlert LoAlert
+		n = (sendLen - sent) < chunk ? (sendLen - sent) : chunk;
+		PCD_WriteRegister(FIFODataReg, n, (uint8_t *)&sendData[sent]);
+		sent += n;
+	}
+	if (time_us_64() > deadline) {
+		status = STATUS_TIMEOUT;
+		break;
+	}
+	}
+	
+	// Drain the FIFO while the response comes in. HiAlert means there are at least 'chunk' bytes to read.
+	// Until TxIRq is set the FIFO still holds our own frame, so HiAlert is only meaningful after that.
+	bool txDone = false;
+	while (status == STATUS_OK) {
+	irq = PCD_ReadRegister(ComIrqReg);				// ComIrqReg[7..0] bits are: Set1 TxIRq RxIRq IdleIRq HiAlertIRq LoAlertIRq ErrIRq TimerIRq
+	if (irq & 0x40) {
+		txDone = true;
+	}
+	if (irq & 0x30) {								// RxIRq or IdleIRq - the rest of the frame is in the FIFO
+		_emergencyBreaks = 0;
+		break;
+	}
+	if (txDone && (PCD_ReadRegister(Status1Reg) & 0x02)) {	// HiAlert
+		if (received + chunk > *backLen) {
+			status = STATUS_NO_ROOM;
+			break;
+		}
+		PCD_ReadRegister(FIFODataReg, chunk, &backData[received]);
+		received += chunk;
+		continue;
+	}
+	if (irq & 0x01) {								// Timer interrupt - nothing received within the timeout
+		_emergencyBreaks = 0;
+		status = STATUS_TIMEOUT;
+	}
+	else if (time_us_64() > deadline) {				// The emergency break
+		_emergencyBreaks++;
+		status = STATUS_TIMEOUT;
+	}
+	}
+	
+	if (status == STATUS_OK) {
+	n = PCD_ReadRegister(FIFOLevelReg) & 0x7F;
+	if (received + n > *backLen) {
+		status = STATUS_NO_ROOM;
+	}
+	else {
+		PCD_ReadRegister(FIFODataReg, n, &backData[received]);
+		received += n;
+		uint8_t errorRegValue = PCD_ReadRegister(ErrorReg); // ErrorReg[7..0] bits are: WrErr TempErr reserved BufferOvfl CollErr CRCErr ParityErr ProtocolErr
+		if (errorRegValue & 0x13) {		// BufferOvfl ParityErr ProtocolErr
+			status = STATUS_ERROR;
+		}
+		else if (errorRegValue & 0x08) {	// CollErr
+			status = STATUS_COLLISION;
+		}
+		else if (useCRC && (errorRegValue & 0x04)) {	// CRCErr
+			status = STATUS_CRC_WRONG;
+		}
+	}
+	}
+	*backLen = received;
+	
+	PCD_WriteRegister(CommandReg, PCD_Idle);
+	if (useCRC && _txRate == BITRATE_106 && _rxRate == BITRATE_106) {	// Above 106 kBd the CRC has to stay on, see PCD_SetBitRate()
+	PCD_ClearRegisterBitMask(TxModeReg, 0x80);
+	PCD_ClearRegisterBitMask(RxModeReg, 0x80);
+	}
+	return status;
+} // End PCD_TransceiveStream()
 
 /**
  * Transmits a REQuest command, Type A. Invites PICCs in state IDLE to go to READY and prepare for anticollision or selection. 7 bit frame.
@@ -551,8 +1223,12 @@ uint8_t MFRC522::PICC_REQA_or_WUPA(	uint8_t command, 		///< The command to send
 	if (bufferATQA == NULL || *bufferSize < 2) {	// The ATQA response is 2 bytes long.
 	return STATUS_NO_ROOM;
 	}
+	if (_txRate != BITRATE_106 || _rxRate != BITRATE_106) {	// PICCs always wake up at 106 kBd
+	PCD_SetBitRate(BITRATE_106, BITRATE_106);
+	}
 	PCD_ClearRegisterBitMask(CollReg, 0x80);		// ValuesAfterColl=1 => Bits received after collision are cleared.
 	validBits = 7;									// For REQA and WUPA we need the short frame format - transmit only 7 bits of the last (and only) byte. TxLastBits = BitFramingReg[2..0]
+	PCD_SetTimeoutProfile(TIMEOUT_REQA);
 	status = PCD_TransceiveData(&command, 1, bufferATQA, bufferSize, &validBits);
 	if (status != STATUS_OK) {
 	return status;
@@ -698,6 +1374,7 @@ uint8_t MFRC522::PICC_Select(	Uid *uid,			///< Pointer to Uid struct. Normally o
 	}
 	txLastBits		= 0; // 0 => All 8 bits are valid.
 	bufferUsed		= 9;
+	PCD_SetTimeoutProfile(TIMEOUT_SELECT);
 	// Store response in the last 3 bytes of buffer (BCC and CRC_A - not needed after tx)
 	responseBuffer	= &buffer[6];
 	responseLength	= 3;
@@ -712,6 +1389,7 @@ uint8_t MFRC522::PICC_Select(	Uid *uid,			///< Pointer to Uid struct. Normally o
 	// Store response in the unused part of buffer
 	responseBuffer	= &buffer[index];
 	responseLength	= sizeof(buffer) - index;
+	PCD_SetTimeoutProfile(TIMEOUT_ANTICOLLISION);
 		}
 			
 		// Set bit adjustments
@@ -775,6 +1453,17 @@ uint8_t MFRC522::PICC_Select(	Uid *uid,			///< Pointer to Uid struct. Normally o
 	if ((buffer[2] != responseBuffer[1]) || (buffer[3] != responseBuffer[2])) {
 		return STATUS_CRC_WRONG;
 	}
+	// Give up as soon as the UID filter says no allowed PICC starts like this one.
+	// Only an ACTIVE PICC honours HLTA; one dropped at a lower cascade level falls back to IDLE.
+	if (!validBits && _uidFilter) {
+		bool last = !(responseBuffer[0] & 0x04);
+		uint8_t known = last ? 3 * cascadeLevel + 1 : 3 * cascadeLevel;
+		if (!_uidFilter(uid->uidByte, known, last ? known : 0)) {
+			uid->size = known;
+			PICC_HaltA();
+			return STATUS_UNKNOWN_CARD;
+		}
+	}
 	if (responseBuffer[0] & 0x04) { // Cascade bit set - UID not complete yes
 		cascadeLevel++;
 	}
@@ -813,6 +1502,7 @@ uint8_t MFRC522::PICC_HaltA() {
 	//		If the PICC responds with any modulation during a period of 1 ms after the end of the frame containing the
 	//		HLTA command, this response shall be interpreted as 'not acknowledge'.
 	// We interpret that this way: Only STATUS_TIMEOUT is an success.
+	PCD_SetTimeoutProfile(TIMEOUT_HALT);
 	result = PCD_TransceiveData(buffer, sizeof(buffer), NULL, 0);
 	if (result == STATUS_TIMEOUT) {
 	return STATUS_OK;
@@ -823,6 +1513,124 @@ uint8_t MFRC522::PICC_HaltA() {
 	return result;
 } // End PICC_HaltA()
 
+/**
+ * Switches the MFRC522 to another bit rate. Only do this right after a successful PPS, see PICC_PPS().
+ * Section 9.3.2.3 of the datasheet: TxCRCEn and RxCRCEn can only be cleared at 106 kBd, so above that the
+ * MFRC522 adds and checks the CRC_A itself and every frame has to be sent without a CRC_A from now on.
+ */
+void MFRC522::PCD_SetBitRate(	uint8_t txRate,		///< PCD to PICC. One of the PCD_BitRate enums.
+				uint8_t rxRate		///< PICC to PCD. One of the PCD_BitRate enums.
+				) {
+	uint8_t crc = (txRate != BITRATE_106 || rxRate != BITRATE_106) ? 0x80 : 0x00;
+	PCD_WriteRegister(TxModeReg, crc | (txRate << 4));		// TxModeReg[6..4] TxSpeed
+	PCD_WriteRegister(RxModeReg, crc | (rxRate << 4));		// RxModeReg[6..4] RxSpeed
+	PCD_WriteRegister(ModWidthReg, bitRateModWidth[txRate]);
+	_txRate = txRate;
+	_rxRate = rxRate;
+	PCD_CacheRegisterImage();		// Keep PCD_CheckHealth() from going back to 106 kBd behind our back
+} // End PCD_SetBitRate()
+
+/**
+ * Lowers the highest bit rate PICC_PPS() offers after a transfer at the current rate went wrong and switches the MFRC522 back to 106 kBd.
+ * The PICC stays at the negotiated rate until it is deactivated, so the caller has to deselect or halt it and run the activation again.
+ * 
+ * @return false if there is nothing left to fall back to.
+ */
+bool MFRC522::PCD_BitRateFallback() {
+	uint8_t current = _txRate > _rxRate ? _txRate : _rxRate;
+	if (current == BITRATE_106) {
+	return false;
+	}
+	_bitRateCap = current - 1;
+	PCD_SetBitRate(BITRATE_106, BITRATE_106);
+	return true;
+} // End PCD_BitRateFallback()
+
+/**
+ * Sends RATS (Request for Answer To Select) to an ACTIVE ISO/IEC 14443-4 PICC and returns its ATS.
+ * The PICC must have been selected with a SAK that has bit 6 set.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::PICC_RequestATS(	uint8_t *ats,		///< Out: the ATS, starting with TL. The CRC_A is included after it.
+				uint8_t *atsSize,	///< In: size of *ats, at least 3. Out: number of bytes returned including the CRC_A.
+				uint8_t fsdi,		///< Frame size we can receive, coded as in ISO/IEC 14443-4. 5 => 64 bytes.
+				uint8_t cid			///< Card identifier to assign, 0..14.
+				) {
+	uint8_t command[4];
+	uint8_t status;
+	
+	if (ats == NULL || *atsSize < 3) {
+	return STATUS_NO_ROOM;
+	}
+	command[0] = PICC_CMD_RATS;
+	command[1] = (fsdi << 4) | (cid & 0x0F);
+	status = PCD_CalculateCRC(command, 2, &command[2]);
+	if (status != STATUS_OK) {
+	return status;
+	}
+	PCD_SetTimeoutProfile(TIMEOUT_ISO_DEP);		// No FWT before the ATS, ISO/IEC 14443-4 gives the PICC ~5 ms
+	status = PCD_TransceiveData(command, sizeof(command), ats, atsSize, NULL, 0, true);
+	if (status != STATUS_OK) {
+	return status;
+	}
+	if (ats[0] + 2 != *atsSize) {		// TL counts itself but not the CRC_A
+	return STATUS_ERROR;
+	}
+	return STATUS_OK;
+} // End PICC_RequestATS()
+
+/**
+ * Negotiates the highest bit rate both the PICC (TA(1) of its ATS) and we support and switches the MFRC522 to it.
+ * Must follow PICC_RequestATS() directly. If the ATS has no TA(1), or only 106 kBd is possible, nothing is sent.
+ * A PICC that does not answer the PPS stays at 106 kBd, which is what ISO/IEC 14443-4 section 5.6 asks for.
+ * 
+ * @return STATUS_OK if both sides agree on a bit rate, STATUS_??? if the PPS exchange failed.
+ */
+uint8_t MFRC522::PICC_PPS(	const uint8_t *ats,	///< The ATS returned by PICC_RequestATS().
+				uint8_t cid			///< The CID sent with RATS.
+				) {
+	uint8_t command[5];
+	uint8_t response[3];
+	uint8_t responseLen = sizeof(response);
+	uint8_t status;
+	
+	if (ats[0] < 3 || !(ats[1] & 0x10)) {		// No TA(1): the PICC only does 106 kBd
+	return STATUS_OK;
+	}
+	uint8_t ta = ats[2];
+	// TA(1): b7..b5 DS (PICC to PCD) 212/424/848, b3..b1 DR (PCD to PICC) 212/424/848, b8 same rate both ways only.
+	uint8_t dsi = BITRATE_106, dri = BITRATE_106;
+	for (uint8_t rate = BITRATE_212; rate <= _bitRateCap; rate++) {
+	if (ta & (0x08 << rate)) dsi = rate;
+	if (ta & (0x01 << (rate - 1))) dri = rate;
+	}
+	if (ta & 0x80) {
+	dsi = dri = dsi < dri ? dsi : dri;
+	}
+	if (dsi == BITRATE_106 && dri == BITRATE_106) {
+	return STATUS_OK;
+	}
+	
+	command[0] = PICC_CMD_PPS | (cid & 0x0F);	// PPSS
+	command[1] = 0x11;							// PPS0: PPS1 follows
+	command[2] = (dsi << 2) | dri;				// PPS1
+	status = PCD_CalculateCRC(command, 3, &command[3]);
+	if (status != STATUS_OK) {
+	return status;
+	}
+	PCD_SetTimeoutProfile(TIMEOUT_ISO_DEP);
+	status = PCD_TransceiveData(command, sizeof(command), response, &responseLen, NULL, 0, true);
+	if (status != STATUS_OK) {
+	return status;
+	}
+	if (responseLen != 3 || response[0] != command[0]) {	// PPS response: PPSS and CRC_A
+	return STATUS_ERROR;
+	}
+	PCD_SetBitRate(dri, dsi);		// Our Tx is the PICC's Rx
+	return STATUS_OK;
+} // End PICC_PPS()
+
 
 /////////////////////////////////////////////////////////////////////////////////////
 // Functions for communicating with MIFARE PICCs
@@ -859,6 +1667,7 @@ uint8_t MFRC522::PCD_Authenticate(uint8_t command,		///< PICC_CMD_MF_AUTH_KEY_A
 	}
 	
 	// Start the authentication.
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_AUTH);
 	return PCD_CommunicateWithPICC(PCD_MFAuthent, waitIRq, &sendData[0], sizeof(sendData));
 } // End PCD_Authenticate()
 
@@ -908,9 +1717,54 @@ uint8_t MFRC522::MIFARE_Read(	uint8_t blockAddr, 	///< MIFARE Classic: The block
 	}
 	
 	// Transmit the buffer and receive the response, validate CRC_A.
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_READ);
 	return PCD_TransceiveData(buffer, 4, buffer, bufferSize, NULL, 0, true);
 } // End MIFARE_Read()
 
+/**
+ * Reads consecutive blocks of an authenticated MIFARE Classic sector, 16 bytes per block.
+ * 
+ * Unlike MIFARE_Read() the MFRC522 appends and checks the CRC_A itself, so there is no
+ * PCD_CalculateCRC() round trip per block and the data goes from the FIFO straight into buffer.
+ * The timeout profile is set once for all blocks. Only used at 106 kbit/s, which is all MIFARE Classic knows.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::MIFARE_ReadBlocks(	uint8_t firstBlock,	///< The first block to read. All blocks must be in the authenticated sector.
+					uint8_t count,		///< Number of blocks to read
+					uint8_t *buffer		///< count * 16 bytes for the data
+					) {
+	uint8_t result = STATUS_OK;
+	uint8_t command[2] = { PICC_CMD_MF_READ, 0 };
+	uint8_t backLen;
+	uint8_t validBits;
+	
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_READ);
+	PCD_SetRegisterBitMask(TxModeReg, 0x80);	// TxCRCEn
+	PCD_SetRegisterBitMask(RxModeReg, 0x80);	// RxCRCEn
+	for (uint8_t i = 0; i < count && result == STATUS_OK; i++) {
+	command[1] = firstBlock + i;
+	backLen = 16;
+	validBits = 0;		// In: TxLastBits, all 8 bits of the last byte. Out: what came back, 4 after a NAK.
+	result = PCD_CommunicateWithPICC(PCD_Transceive, 0x30, command, sizeof(command), buffer + 16 * i, &backLen, &validBits);
+	if (result != STATUS_OK) {
+		break;
+	}
+	if (backLen == 1 && validBits == 4) {		// 4 bit NAK, the CRC_A check fails on it as well
+		result = STATUS_MIFARE_NACK;
+	}
+	else if (PCD_ReadRegister(ErrorReg) & 0x04) {	// CRCErr
+		result = STATUS_CRC_WRONG;
+	}
+	else if (backLen != 16 || validBits != 0) {
+		result = STATUS_ERROR;
+	}
+	}
+	PCD_ClearRegisterBitMask(TxModeReg, 0x80);
+	PCD_ClearRegisterBitMask(RxModeReg, 0x80);
+	return result;
+} // End MIFARE_ReadBlocks()
+
 /**
  * Writes 16 bytes to the active PICC.
  * 
@@ -982,6 +1836,167 @@ uint8_t MFRC522::MIFARE_Ultralight_Write(	uint8_t page, 		///< The page (2-15) t
 	return STATUS_OK;
 } // End MIFARE_Ultralight_Write()
 
+/**
+ * Writes consecutive 4 byte pages to the active MIFARE Ultralight or NTAG PICC.
+ * 
+ * Unlike one MIFARE_Ultralight_Write() per page, the MFRC522 appends the CRC_A itself and
+ * the timeout profile is set once, so each page costs the WRITE frame and the EEPROM
+ * programming time of the PICC and nothing else.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::MIFARE_Ultralight_WritePages(	uint8_t firstPage,		///< The first page to write to
+						const uint8_t *buffer,	///< 4 * pageCount bytes to write
+						uint8_t pageCount		///< Number of pages
+						) {
+	uint8_t result = STATUS_OK;
+	uint8_t cmdBuffer[6];
+	uint8_t backLen;
+	uint8_t validBits;
+	
+	if (buffer == NULL) {
+	return STATUS_INVALID;
+	}
+	
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_WRITE);
+	PCD_SetRegisterBitMask(TxModeReg, 0x80);	// TxCRCEn. The 4 bit ACK has no CRC_A, so RxCRCEn stays off.
+	cmdBuffer[0] = PICC_CMD_UL_WRITE;
+	for (uint8_t i = 0; i < pageCount; i++) {
+	cmdBuffer[1] = firstPage + i;
+	memcpy(&cmdBuffer[2], &buffer[4 * i], 4);
+	backLen = 1;
+	validBits = 0;		// In: TxLastBits, all 8 bits of the last byte. Out: 4 after the ACK of the page before.
+	result = PCD_CommunicateWithPICC(PCD_Transceive, 0x30, cmdBuffer, sizeof(cmdBuffer), cmdBuffer, &backLen, &validBits);
+	if (result != STATUS_OK) {
+		break;
+	}
+	if (backLen != 1 || validBits != 4) {
+		result = STATUS_ERROR;
+		break;
+	}
+	if ((cmdBuffer[0] & 0x0F) != MF_ACK) {
+		result = STATUS_MIFARE_NACK;
+		break;
+	}
+	cmdBuffer[0] = PICC_CMD_UL_WRITE;
+	}
+	PCD_ClearRegisterBitMask(TxModeReg, 0x80);
+	return result;
+} // End MIFARE_Ultralight_WritePages()
+
+/**
+ * Identifies a MIFARE Ultralight EV1 or NTAG21x with GET_VERSION.
+ * The original Ultralight and Ultralight C answer with a NAK and go back to IDLE; select them again before the next command.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::MIFARE_Ultralight_GetVersion(uint8_t *version	///< UL_VERSION_SIZE bytes: header, vendor, type, subtype, major, minor, storage size, protocol
+					) {
+	uint8_t command = PICC_CMD_UL_GET_VERSION;
+	uint16_t backLen = UL_VERSION_SIZE;
+	uint8_t result;
+	
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_READ);
+	result = PCD_TransceiveStream(&command, 1, version, &backLen, true);
+	if (result == STATUS_OK && backLen != UL_VERSION_SIZE) {
+	return STATUS_ERROR;
+	}
+	return result;
+} // End MIFARE_Ultralight_GetVersion()
+
+/**
+ * Reads the pages startPage to endPage, both included, with a single FAST_READ.
+ * Answers longer than the FIFO are streamed with PCD_TransceiveStream(), which also adds and checks the CRC_A,
+ * so a whole NTAG216 can come in one exchange instead of one MIFARE_Read() per 4 pages.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::MIFARE_Ultralight_FastRead(	uint8_t startPage,		///< First page to read
+						uint8_t endPage,		///< Last page to read. Must exist on the PICC, or it answers with a NAK.
+						uint8_t *buffer,		///< The buffer to store the data in
+						uint16_t *bufferSize	///< In: at least 4 bytes per page. Out: number of bytes returned.
+						) {
+	uint8_t command[3] = { PICC_CMD_UL_FAST_READ, startPage, endPage };
+	uint16_t expected;
+	uint8_t result;
+	
+	if (buffer == NULL || endPage < startPage) {
+	return STATUS_INVALID;
+	}
+	expected = 4 * (endPage - startPage + 1);
+	if (*bufferSize < expected) {
+	return STATUS_NO_ROOM;
+	}
+	*bufferSize = expected;
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_READ);
+	result = PCD_TransceiveStream(command, sizeof(command), buffer, bufferSize, true);
+	if (result == STATUS_OK && *bufferSize != expected) {
+	return STATUS_ERROR;
+	}
+	return result;
+} // End MIFARE_Ultralight_FastRead()
+
+/**
+ * Reads one of the 24 bit one-way counters with READ_CNT.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::MIFARE_Ultralight_ReadCounter(	uint8_t counter,	///< 0..2 on Ultralight EV1, 2 (the NFC counter) on NTAG21x
+						uint32_t *value		///< Out: the counter value
+						) {
+	uint8_t command[2] = { PICC_CMD_UL_READ_CNT, counter };
+	uint8_t buffer[3];
+	uint16_t backLen = sizeof(buffer);
+	uint8_t result;
+	
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_READ);
+	result = PCD_TransceiveStream(command, sizeof(command), buffer, &backLen, true);
+	if (result != STATUS_OK) {
+	return result;
+	}
+	if (backLen != sizeof(buffer)) {
+	return STATUS_ERROR;
+	}
+	*value = (uint32_t)buffer[2] << 16 | (uint32_t)buffer[1] << 8 | buffer[0];	// LSB first
+	return STATUS_OK;
+} // End MIFARE_Ultralight_ReadCounter()
+
+/**
+ * Reads the ECC originality signature over the UID with READ_SIG.
+ * 
+ * @return STATUS_OK on success, STATUS_??? otherwise.
+ */
+uint8_t MFRC522::MIFARE_Ultralight_ReadSignature(uint8_t *signature	///< UL_SIGNATURE_SIZE bytes
+						) {
+	uint8_t command[2] = { PICC_CMD_UL_READ_SIG, 0x00 };	// The address is RFU, always 00h
+	uint16_t backLen = UL_SIGNATURE_SIZE;
+	uint8_t result;
+	
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_READ);
+	result = PCD_TransceiveStream(command, sizeof(command), signature, &backLen, true);
+	if (result == STATUS_OK && backLen != UL_SIGNATURE_SIZE) {
+	return STATUS_ERROR;
+	}
+	return result;
+} // End MIFARE_Ultralight_ReadSignature()
+
+/**
+ * Number of pages of the PICC described by a GET_VERSION answer, configuration pages included.
+ * 
+ * @return The page count, 0 if the storage size is not one we know.
+ */
+uint16_t MFRC522::MIFARE_Ultralight_PageCount(const uint8_t *version	///< Answer of MIFARE_Ultralight_GetVersion()
+						) {
+	switch (version[6]) {	// Storage size
+	case 0x0B:	return 20;	break;		// MF0UL11, NTAG210
+	case 0x0E:	return 41;	break;		// MF0UL21, NTAG212
+	case 0x0F:	return 45;	break;		// NTAG213
+	case 0x11:	return 135;	break;		// NTAG215
+	case 0x13:	return 231;	break;		// NTAG216
+	default:	return 0;	break;
+	}
+} // End MIFARE_Ultralight_PageCount()
+
 /**
  * MIFARE Decrement subtracts the delta from the value of the addressed block, and stores the result in a volatile memory.
  * For MIFARE Classic only. The sector containing the block must be authenticated before calling this function.
@@ -1164,6 +2179,7 @@ uint8_t MFRC522::PCD_MIFARE_Transceive(	uint8_t *sendData,		///< Pointer to the
 	sendLen += 2;
 	
 	// Transceive the data, store the reply in cmdBuffer[]
+	PCD_SetTimeoutProfile(TIMEOUT_MIFARE_WRITE);
 	uint8_t waitIRq = 0x30;		// RxIRq and IdleIRq
 	uint8_t cmdBufferSize = sizeof(cmdBuffer);
 	uint8_t validBits = 0;
@@ -1200,6 +2216,7 @@ const string MFRC522::GetStatusCodeName(uint8_t code	///< One of the StatusCode
 	case STATUS_INVALID:		return ("Invalid argument.");								break;
 	case STATUS_CRC_WRONG:		return ("The CRC_A does not match.");						break;
 	case STATUS_MIFARE_NACK:	return ("A MIFARE PICC responded with NAK.");				break;
+	case STATUS_UNKNOWN_CARD:	return ("The PICC is not one we are looking for.");		break;
 	default:					return ("Unknown error");									break;
 	}
 } // End GetStatusCodeName()
@@ -1515,8 +2532,38 @@ void MFRC522::PICC_DumpMifareUltralightToSerial() {
 	uint8_t byteCount;
 	uint8_t buffer[18];
 	uint8_t i;
+	uint8_t version[UL_VERSION_SIZE];
+	uint16_t pageCount = 0;
 	
 	printf("Page  0  1  2  3");
+	// Ultralight EV1 and NTAG21x tell their size and have FAST_READ.
+	if (MIFARE_Ultralight_GetVersion(version) == STATUS_OK) {
+	pageCount = MIFARE_Ultralight_PageCount(version);
+	}
+	else {
+	PICC_ConfirmUid(&uid, true);	// The NAK sent the PICC back to IDLE
+	}
+	if (pageCount) {
+	uint8_t pages[4 * UL_FAST_READ_PAGES];
+	for (uint16_t page = 0; page < pageCount; page += UL_FAST_READ_PAGES) {
+		uint16_t last = page + UL_FAST_READ_PAGES - 1 < pageCount ? page + UL_FAST_READ_PAGES - 1 : pageCount - 1;
+		uint16_t pagesSize = sizeof(pages);
+		status = MIFARE_Ultralight_FastRead(page, last, pages, &pagesSize);
+		if (status != STATUS_OK) {
+	printf("MIFARE_Ultralight_FastRead() failed: ");
+	printf("%s\n",GetStatusCodeName(status).c_str());
+	return;
+		}
+		for (uint16_t offset = 0; offset < pagesSize / 4; offset++) {
+	printf("\n %3u ", page + offset);
+	for (uint8_t index = 0; index < 4; index++) {
+		printf(" %02X", pages[4 * offset + index]);
+	}
+		}
+	}
+	printf("\n");
+	return;
+	}
 	// Try the mpages of the original Ultralight. Ultralight C has more pages.
 	for (uint8_t page = 0; page < 16; page +=4) { // Read returns data for 4 pages at a time.
 	// Read pages
@@ -1595,6 +2642,7 @@ bool MFRC522::MIFARE_OpenUidBackdoor(bool logErrors) {
 			 this will contain amount of valid response bits. */
 	uint8_t response[32]; // Card's response is written here
 	uint8_t received;
+	PCD_SetTimeoutProfile(TIMEOUT_DEFAULT);
 	uint8_t status = PCD_TransceiveData(&cmd, (uint8_t)1, response, &received, &validBits, (uint8_t)0, false); // 40
 	if(status != STATUS_OK) {
 	if(logErrors) {
@@ -1786,6 +2834,59 @@ bool MFRC522::PICC_IsNewCardPresent() {
 	return (result == STATUS_OK || result == STATUS_COLLISION);
 } // End PICC_IsNewCardPresent()
 
+/**
+ * Consults the retry policy after a failed step of PICC_Activate() or MFRC522Async::activate() and updates its statistics.
+ * The caller waits *backoffUs before the retry; it is only set for timeout retries.
+ * 
+ * @return true if the activation should try again.
+ */
+bool MFRC522::PICC_RetryAllowed(	uint8_t status,		///< The status of the failed step
+				bool cardSeen,		///< True if a PICC answered REQA/WUPA during this activation
+				uint8_t *retries,	///< In/Out: collision, error and timeout retries so far
+				uint64_t start,		///< time_us_64() of the first attempt
+				uint32_t *backoffUs	///< Out: pause before the retry
+				) {
+	RetryPolicy *policy = _retryPolicy;
+	*backoffUs = 0;
+	if (policy == NULL) {
+	return false;
+	}
+	if (policy->deadlineUs && time_us_64() - start >= policy->deadlineUs) {
+	policy->stats.deadlineExpired++;
+	return false;
+	}
+	switch (status) {
+	case STATUS_COLLISION:
+		if (retries[0] >= policy->collisionRetries) {
+			return false;
+		}
+		retries[0]++;
+		policy->stats.collisionRetries++;
+		return true;
+	
+	case STATUS_CRC_WRONG:
+	case STATUS_ERROR:
+		if (retries[1] >= policy->errorRetries) {
+			return false;
+		}
+		retries[1]++;
+		policy->stats.errorRetries++;
+		return true;
+	
+	case STATUS_TIMEOUT:
+		if (!cardSeen || retries[2] >= policy->timeoutRetries) {
+			return false;
+		}
+		*backoffUs = (uint32_t)policy->timeoutBackoffUs << retries[2];
+		retries[2]++;
+		policy->stats.timeoutRetries++;
+		return true;
+	
+	default:
+		return false;
+	}
+} // End PICC_RetryAllowed()
+
 /**
  * Simple wrapper around PICC_Select.
  * Returns true if a UID could be read.
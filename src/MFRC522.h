@@ -9,6 +9,10 @@ using namespace std;
 typedef uint8_t byte;
 typedef uint16_t word;
 
+// Wiring of the first reader on spi0. Further readers on the same bus need their own CS and RST pins.
+#define MFRC522_PIN_CS 5
+#define MFRC522_PIN_RST 22
+
 // Firmware data for self-test
 // Reference values based on firmware version; taken from 16.1.1 in spec.
 // Version 1.0
@@ -39,6 +43,10 @@ const uint8_t MFRC522_firmware_referenceV2_0[] = {
 
 
 class MFRC522 {
+	friend class MFRC522Async;
+	friend class IsoDep;
+	friend class MifareImage;
+	friend class Type2Tag;
 public:
 	// MFRC522 registers. Described in chapter 9 of the datasheet.
 	// When using SPI all addresses are shifted one bit left in the "SPI address byte" (section 8.1.2.3)
@@ -156,6 +164,8 @@ public:
 		PICC_CMD_SEL_CL2		= 0x95,		// Anti collision/Select, Cascade Level 2
 		PICC_CMD_SEL_CL3		= 0x97,		// Anti collision/Select, Cascade Level 3
 		PICC_CMD_HLTA			= 0x50,		// HaLT command, Type A. Instructs an ACTIVE PICC to go to state HALT.
+		PICC_CMD_RATS			= 0xE0,		// Request command for Answer To Reset. ISO/IEC 14443-4.
+		PICC_CMD_PPS			= 0xD0,		// Protocol and Parameter Selection, low nibble is the CID. ISO/IEC 14443-4.
 		// The commands used for MIFARE Classic (from http://www.nxp.com/documents/data_sheet/MF1S503x.pdf, Section 9)
 		// Use PCD_MFAuthent to authenticate access to a sector, then use these commands to read/write/modify the blocks on the sector.
 		// The read/write commands can also be used for MIFARE Ultralight.
@@ -169,7 +179,12 @@ public:
 		PICC_CMD_MF_TRANSFER	= 0xB0,		// Writes the contents of the internal data register to a block.
 		// The commands used for MIFARE Ultralight (from http://www.nxp.com/documents/data_sheet/MF0ICU1.pdf, Section 8.6)
 		// The PICC_CMD_MF_READ and PICC_CMD_MF_WRITE can also be used for MIFARE Ultralight.
-		PICC_CMD_UL_WRITE		= 0xA2		// Writes one 4 uint8_t page to the PICC.
+		PICC_CMD_UL_WRITE		= 0xA2,		// Writes one 4 uint8_t page to the PICC.
+		// MIFARE Ultralight EV1 and NTAG21x only (from http://www.nxp.com/docs/en/data-sheet/NTAG213_215_216.pdf, Section 10)
+		PICC_CMD_UL_GET_VERSION	= 0x60,		// Returns 8 bytes identifying vendor, product and memory size.
+		PICC_CMD_UL_READ_CNT	= 0x39,		// Reads a 24 bit one-way counter. NTAG21x only has counter 2, the NFC counter.
+		PICC_CMD_UL_FAST_READ	= 0x3A,		// Reads all pages from a start page to an end page in one frame.
+		PICC_CMD_UL_READ_SIG	= 0x3C		// Reads the 32 byte ECC originality signature.
 	};
 	
 	// MIFARE constants that does not fit anywhere else
@@ -202,7 +217,39 @@ public:
 		STATUS_INTERNAL_ERROR	= 6,	// Internal error in the code. Should not happen ;-)
 		STATUS_INVALID			= 7,	// Invalid argument.
 		STATUS_CRC_WRONG		= 8,	// The CRC_A does not match
-		STATUS_MIFARE_NACK		= 9		// A MIFARE PICC responded with NAK.
+		STATUS_MIFARE_NACK		= 9,	// A MIFARE PICC responded with NAK.
+		STATUS_UNKNOWN_CARD		= 10	// The UID filter ruled the PICC out before the select was complete.
+	};
+	
+	// Bit rates of TxModeReg/RxModeReg, the same coding as DSI/DRI in ISO/IEC 14443-4 PPS.
+	enum PCD_BitRate {
+		BITRATE_106				= 0,	// 106 kbit/s, the only rate during activation
+		BITRATE_212				= 1,
+		BITRATE_424				= 2,
+		BITRATE_848				= 3
+	};
+	
+	// Timeout classes for the MFRC522 timer. Each class gets its own TPrescaler/TReload, see PCD_SetTimeoutProfile().
+	// The values are the time from the end of our frame until the PICC must have started its answer.
+	enum PCD_TimeoutProfile {
+		TIMEOUT_DEFAULT			= 0,	// 25 ms, the value PCD_Init() has always used
+		TIMEOUT_REQA			= 1,	// REQA/WUPA. The ATQA follows after FDT = 1172/fc (~86 us).
+		TIMEOUT_ANTICOLLISION	= 2,	// ANTICOLLISION frames with an incomplete NVB
+		TIMEOUT_SELECT			= 3,	// SELECT with the complete UID of a cascade level
+		TIMEOUT_HALT			= 4,	// HLTA. ISO 14443-3 says any answer within 1 ms is a NAK.
+		TIMEOUT_MIFARE_AUTH		= 5,	// MFAuthent
+		TIMEOUT_MIFARE_READ		= 6,	// MIFARE/Ultralight READ
+		TIMEOUT_MIFARE_WRITE	= 7,	// MIFARE WRITE, value operations and Ultralight WRITE
+		TIMEOUT_ISO_DEP			= 8,	// ISO 14443-4. Uses the FWT given to PCD_SetTimeoutProfile().
+		TIMEOUT_PROFILE_COUNT	= 9
+	};
+	
+	// Faults found by PCD_CheckHealth().
+	enum PCD_HealthFault {
+		HEALTH_OK					= 0,	// Everything as expected
+		HEALTH_VERSION_CHANGED		= 1,	// VersionReg differs from PCD_Init(), or the chip does not answer on SPI
+		HEALTH_READBACK_MISMATCH	= 2,	// A configuration register lost its value, ie the chip has been reset behind our back
+		HEALTH_EMERGENCY_BREAKS		= 3		// Too many exchanges in a row ended in the emergency break instead of an IRQ
 	};
 	
 	// A struct used for passing the UID of a PICC.
@@ -213,23 +260,177 @@ public:
 		bool operator==(const Uid& id) const;
 	};
 	
+	// Asked by PICC_Activate() and PICC_Select() whether a PICC can still be one we care about, see PICC_SetUidFilter().
+	// uidBytes holds the count UID bytes known so far (0 right after the ATQA). uidSize is the full UID size if known, else 0.
+	typedef bool (*UidFilter)(const uint8_t *uidBytes, uint8_t count, uint8_t uidSize);
+	
 	// A struct used for passing a MIFARE Crypto1 key
 	typedef struct {
 		uint8_t		keyByte[MF_KEY_SIZE];
 	} MIFARE_Key;
 	
+	// One entry in the recovery history kept by PCD_CheckHealth().
+	struct RecoveryRecord {
+		uint32_t	timeMs;			// Milliseconds since boot when the recovery started
+		uint32_t	durationUs;		// How long the hard reset and register restore took
+		uint8_t		fault;			// One of the PCD_HealthFault enums
+		bool		success;		// VersionReg was back to the expected value afterwards
+	};
+	
+	// Counters kept per RetryPolicy by PICC_Activate() and MFRC522Async::activate().
+	struct RetryStats {
+		uint32_t	activations;		// Calls to PICC_Activate() with this policy
+		uint32_t	successes;			// Activations that ended with STATUS_OK
+		uint32_t	retrySuccesses;		// Successes that needed at least one retry
+		uint32_t	collisionRetries;	// Retries after STATUS_COLLISION
+		uint32_t	errorRetries;		// Retries after STATUS_CRC_WRONG or STATUS_ERROR
+		uint32_t	timeoutRetries;		// Retries after STATUS_TIMEOUT
+		uint32_t	deadlineExpired;	// Activations abandoned because deadlineUs passed
+	};
+	
+	// Tells PICC_Activate() which failures are worth another attempt within the same tap.
+	struct RetryPolicy {
+		uint8_t		collisionRetries;	// Immediate retries after STATUS_COLLISION
+		uint8_t		errorRetries;		// Immediate retries after STATUS_CRC_WRONG or STATUS_ERROR (parity, protocol, bad ATQA/SAK)
+		uint8_t		timeoutRetries;		// Retries after STATUS_TIMEOUT, only once a card has answered during this activation
+		uint16_t	timeoutBackoffUs;	// Pause before a timeout retry, doubled for every further one
+		bool		wakeupOnRetry;		// Retry with WUPA instead of REQA, a broken SELECT may have left the card in HALT
+		uint32_t	deadlineUs;			// No retries once this long has passed since the first attempt. 0 => no deadline.
+		RetryStats	stats;
+	};
+	
+	// Result of one RxGain setting during PCD_CalibrateAntennaGain().
+	struct GainCalibration {
+		uint8_t		gain;			// One of the PCD_RxGain enums
+		uint8_t		successes;		// WUPA + SELECT that went through
+		uint8_t		errors;			// CRC, parity, protocol and collision errors
+		uint8_t		timeouts;		// No answer at all
+	};
+	
+	// Default time limit of PICC_Inventory(). Each card costs about 3 ms with anticollision, select and HLTA.
+	static const uint32_t INVENTORY_BUDGET_US = 30000;
+	
+	// Number of distinct RxGain settings tried by PCD_CalibrateAntennaGain().
+	static const uint8_t GAIN_STEPS = 6;
+	
+	// Number of recoveries remembered in HealthStats::recent.
+	static const uint8_t HEALTH_HISTORY_SIZE = 4;
+	
+	// Counters maintained by PCD_CheckHealth().
+	struct HealthStats {
+		uint32_t		checks;			// Number of health checks performed
+		uint32_t		recoveries;		// Number of recoveries attempted, successful or not
+		uint32_t		failedRecoveries;
+		uint32_t		deferredRecoveries;	// Faults found while backing off after failed recoveries
+		RecoveryRecord	recent[HEALTH_HISTORY_SIZE];	// The last recoveries. Entry (recoveries - 1) % HEALTH_HISTORY_SIZE is the newest.
+	};
+	
 	// Member variables
 	Uid uid;								// Used by PICC_ReadCardSerial().
 	
 	// Size of the MFRC522 FIFO
 	static const uint8_t FIFO_SIZE = 64;		// The FIFO is 64 bytes.
+	// WaterLevelReg value used by PCD_TransceiveStream(). LoAlert fires at <= 16 bytes left, HiAlert at <= 16 bytes free.
+	static const uint8_t STREAM_WATER_LEVEL = 16;
 	
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for setting up the Raspberry Pi
 	/////////////////////////////////////////////////////////////////////////////////////
-	MFRC522();
+	MFRC522(uint8_t rxGain = 0xFF, uint8_t csPin = MFRC522_PIN_CS, uint8_t rstPin = MFRC522_PIN_RST);
 	bool isCardPresent( Uid id );
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Card activation with retries
+	/////////////////////////////////////////////////////////////////////////////////////
+	void PICC_SetRetryPolicy(RetryPolicy *policy) { _retryPolicy = policy; }
+	uint8_t PICC_Activate(Uid *uid, bool wakeup = false, uint8_t validBits = 0);
+	uint8_t PICC_ConfirmUid(const Uid *expected, bool wakeup = false);
+	uint8_t PICC_HaltA();
+	uint8_t PICC_Inventory(Uid *uids, uint8_t maxUids, uint8_t *found, uint32_t budgetUs = INVENTORY_BUDGET_US);
+	void PICC_SetUidFilter(UidFilter filter) { _uidFilter = filter; }
+	bool PICC_UidAllowed(const Uid *uid) const { return !_uidFilter || _uidFilter(uid->uidByte, uid->size, uid->size); }
+	// ATQA bits 7..6 give the UID size: 00b single, 01b double, 10b triple. 0 for the reserved 11b.
+	static uint8_t PICC_UidSizeFromATQA(const uint8_t *atqa) { uint8_t bits = (atqa[0] >> 6) & 0x03; return bits == 3 ? 0 : 3 * bits + 4; }
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Antenna calibration
+	/////////////////////////////////////////////////////////////////////////////////////
+	uint8_t PCD_CalibrateAntennaGain(uint8_t attempts, uint8_t *bestGain, GainCalibration *results = NULL);
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Timer configuration
+	/////////////////////////////////////////////////////////////////////////////////////
+	void PCD_SetTimeoutProfile(uint8_t profile, uint32_t fwtMicros = 0);
+	void PCD_SetTimeout(uint32_t micros);
+	uint32_t PCD_GetTimeout() const { return _timeoutMicros; }
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Health monitoring
+	/////////////////////////////////////////////////////////////////////////////////////
+	uint8_t PCD_CheckHealth();
+	const HealthStats &PCD_GetHealthStats() const { return _health; }
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Power saving
+	/////////////////////////////////////////////////////////////////////////////////////
+	void PCD_SoftPowerDown();
+	bool PCD_SoftPowerUp();
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// ISO/IEC 14443-4 activation and bit rates
+	/////////////////////////////////////////////////////////////////////////////////////
+	uint8_t PICC_RequestATS(uint8_t *ats, uint8_t *atsSize, uint8_t fsdi = 5, uint8_t cid = 0);
+	uint8_t PICC_PPS(const uint8_t *ats, uint8_t cid = 0);
+	void PCD_SetBitRate(uint8_t txRate, uint8_t rxRate);
+	bool PCD_BitRateFallback();
+	uint8_t PCD_GetTxBitRate() const { return _txRate; }
+	uint8_t PCD_GetRxBitRate() const { return _rxRate; }
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// Streaming transport for frames larger than the FIFO
+	/////////////////////////////////////////////////////////////////////////////////////
+	uint8_t PCD_TransceiveStream(const uint8_t *sendData, uint16_t sendLen, uint8_t *backData, uint16_t *backLen, bool useCRC = true);
+	
+	/////////////////////////////////////////////////////////////////////////////////////
+	// MIFARE Ultralight EV1 and NTAG21x
+	/////////////////////////////////////////////////////////////////////////////////////
+	uint8_t MIFARE_Ultralight_GetVersion(uint8_t *version);
+	uint8_t MIFARE_Ultralight_FastRead(uint8_t startPage, uint8_t endPage, uint8_t *buffer, uint16_t *bufferSize);
+	uint8_t MIFARE_Ultralight_ReadCounter(uint8_t counter, uint32_t *value);
+	uint8_t MIFARE_Ultralight_ReadSignature(uint8_t *signature);
+	static uint16_t MIFARE_Ultralight_PageCount(const uint8_t *version);
+	// Size of the GET_VERSION answer and of the READ_SIG answer
+	static const uint8_t UL_VERSION_SIZE = 8;
+	static const uint8_t UL_SIGNATURE_SIZE = 32;
+	// Pages fetched per FAST_READ by PICC_DumpMifareUltralightToSerial(), streamed through the FIFO
+	static const uint8_t UL_FAST_READ_PAGES = 64;
 private:
+	uint8_t _csPin;
+	uint8_t _rstPin;
+	uint32_t _timeoutMicros;				// Timeout currently programmed into TPrescaler/TReload. 0 until PCD_Init().
+	uint16_t _timerPrescaler;				// TPrescaler value currently in TModeReg[3..0]:TPrescalerReg. 0xFFFF => unknown.
+	uint16_t _timerReload;					// TReload value currently in TReloadRegH:TReloadRegL. 0 => unknown.
+	
+	// Number of configuration registers kept in _registerImage, see PCD_CacheRegisterImage().
+	static const uint8_t REGISTER_IMAGE_SIZE = 7;
+	uint8_t _registerImage[REGISTER_IMAGE_SIZE];	// Configuration registers as they were after PCD_Init()
+	bool _registerImageValid;				// False if the chip did not answer when the image was taken
+	uint8_t _version;						// VersionReg after PCD_Init()
+	uint8_t _rxGain;						// RxGain applied by PCD_Init(), 0xFF => leave the reset default
+	uint8_t _emergencyBreaks;				// Exchanges in a row that ended in the emergency break
+	HealthStats _health;
+	uint8_t _failedInRow;					// Recoveries in a row that did not bring the chip back
+	uint64_t _recoveryNotBefore;			// time_us_64() before which PCD_CheckHealth() does not recover again
+	RetryPolicy *_retryPolicy;				// NULL => PICC_Activate() and MFRC522Async::activate() make a single attempt
+	UidFilter _uidFilter;					// NULL => every PICC is selected completely
+	uint8_t _txRate;						// PCD_BitRate in TxModeReg
+	uint8_t _rxRate;						// PCD_BitRate in RxModeReg
+	uint8_t _bitRateCap;					// Highest rate PICC_PPS() offers, lowered by PCD_BitRateFallback()
+	uint8_t PCD_SlowestRate() const { return _txRate < _rxRate ? _txRate : _rxRate; }
+	uint8_t _pendingWaitIRq;				// waitIRq of the command started by PCD_StartCommunication()
+	uint64_t _pendingDeadline;				// Emergency break for that command, in time_us_64() terms
+	
+
 	void setSPIConfig();
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Basic interface functions for communicating with the MFRC522
@@ -246,7 +447,12 @@ private:
 	// Functions for manipulating the MFRC522
 	/////////////////////////////////////////////////////////////////////////////////////
 	void PCD_Init();
-	void PCD_Reset();
+	bool PCD_Reset();
+	bool PCD_HardReset();
+	bool PCD_WaitForOscillator();
+	void PCD_CacheRegisterImage();
+	void PCD_RestoreRegisterImage();
+	bool PCD_Recover(uint8_t fault);
 	void PCD_AntennaOn();
 	void PCD_AntennaOff();
 	uint8_t PCD_GetAntennaGain();
@@ -258,11 +464,13 @@ private:
 	/////////////////////////////////////////////////////////////////////////////////////
 	uint8_t PCD_TransceiveData(uint8_t *sendData, uint8_t sendLen, uint8_t *backData, uint8_t *backLen, uint8_t *validBits = NULL, uint8_t rxAlign = 0, bool checkCRC = false);
 	uint8_t PCD_CommunicateWithPICC(uint8_t command, uint8_t waitIRq, uint8_t *sendData, uint8_t sendLen, uint8_t *backData = NULL, uint8_t *backLen = NULL, uint8_t *validBits = NULL, uint8_t rxAlign = 0, bool checkCRC = false);
+	uint8_t PCD_StartCommunication(uint8_t command, uint8_t waitIRq, uint8_t *sendData, uint8_t sendLen, uint8_t txLastBits = 0, uint8_t rxAlign = 0, const uint8_t *moreData = NULL, uint8_t moreLen = 0);
+	bool PCD_PollCommunication(uint8_t *status);
+	uint8_t PCD_FinishCommunication(uint8_t *backData, uint8_t *backLen, uint8_t *validBits = NULL, uint8_t rxAlign = 0, bool checkCRC = false);
 	uint8_t PICC_RequestA(uint8_t *bufferATQA, uint8_t *bufferSize);
 	uint8_t PICC_WakeupA(uint8_t *bufferATQA, uint8_t *bufferSize);
 	uint8_t PICC_REQA_or_WUPA(uint8_t command, uint8_t *bufferATQA, uint8_t *bufferSize);
 	uint8_t PICC_Select(Uid *uid, uint8_t validBits = 0);
-	uint8_t PICC_HaltA();
 	
 	/////////////////////////////////////////////////////////////////////////////////////
 	// Functions for communicating with MIFARE PICCs
@@ -270,12 +478,14 @@ private:
 	uint8_t PCD_Authenticate(uint8_t command, uint8_t blockAddr, MIFARE_Key *key, Uid *uid);
 	void PCD_StopCrypto1();
 	uint8_t MIFARE_Read(uint8_t blockAddr, uint8_t *buffer, uint8_t *bufferSize);
+	uint8_t MIFARE_ReadBlocks(uint8_t firstBlock, uint8_t count, uint8_t *buffer);
 	uint8_t MIFARE_Write(uint8_t blockAddr, uint8_t *buffer, uint8_t bufferSize);
 	uint8_t MIFARE_Decrement(uint8_t blockAddr, long delta);
 	uint8_t MIFARE_Increment(uint8_t blockAddr, long delta);
 	uint8_t MIFARE_Restore(uint8_t blockAddr);
 	uint8_t MIFARE_Transfer(uint8_t blockAddr);
 	uint8_t MIFARE_Ultralight_Write(uint8_t page, uint8_t *buffer, uint8_t bufferSize);
+	uint8_t MIFARE_Ultralight_WritePages(uint8_t firstPage, const uint8_t *buffer, uint8_t pageCount);
 	uint8_t MIFARE_GetValue(uint8_t blockAddr, long *value);
 	uint8_t MIFARE_SetValue(uint8_t blockAddr, long value);
 	
@@ -300,6 +510,7 @@ private:
 	/////////////////////////////////////////////////////////////////////////////////////
 	bool PICC_IsNewCardPresent();
 	bool PICC_ReadCardSerial();
+	bool PICC_RetryAllowed(uint8_t status, bool cardSeen, uint8_t *retries, uint64_t start, uint32_t *backoffUs);
 	
 	uint8_t MIFARE_TwoStepHelper(uint8_t command, uint8_t blockAddr, long data);
 };
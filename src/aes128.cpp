@@ -0,0 +1,108 @@
+#include "aes128.h"
+#include <string.h>
+#include "zeroize.h"
+#if __has_include( "pico/stdlib.h" )
+#include "pico/stdlib.h"
+#else
+#define __not_in_flash( group )					// Host build, see tools/crypto_bench.cpp
+#define __not_in_flash_func( func ) func
+#endif
+
+static const uint8_t __not_in_flash( "aes128" ) sbox[ 256 ] = {
+	0x63, 0x7C, 0x77, 0x7B, 0xF2, 0x6B, 0x6F, 0xC5, 0x30, 0x01, 0x67, 0x2B, 0xFE, 0xD7, 0xAB, 0x76,
+	0xCA, 0x82, 0xC9, 0x7D, 0xFA, 0x59, 0x47, 0xF0, 0xAD, 0xD4, 0xA2, 0xAF, 0x9C, 0xA4, 0x72, 0xC0,
+	0xB7, 0xFD, 0x93, 0x26, 0x36, 0x3F, 0xF7, 0xCC, 0x34, 0xA5, 0xE5, 0xF1, 0x71, 0xD8, 0x31, 0x15,
+	0x04, 0xC7, 0x23, 0xC3, 0x18, 0x96, 0x05, 0x9A, 0x07, 0x12, 0x80, 0xE2, 0xEB, 0x27, 0xB2, 0x75,
+	0x09, 0x83, 0x2C, 0x1A, 0x1B, 0x6E, 0x5A, 0xA0, 0x52, 0x3B, 0xD6, 0xB3, 0x29, 0xE3, 0x2F, 0x84,
+	0x53, 0xD1, 0x00, 0xED, 0x20, 0xFC, 0xB1, 0x5B, 0x6A, 0xCB, 0xBE, 0x39, 0x4A, 0x4C, 0x58, 0xCF,
+	0xD0, 0xEF, 0xAA, 0xFB, 0x43, 0x4D, 0x33, 0x85, 0x45, 0xF9, 0x02, 0x7F, 0x50, 0x3C, 0x9F, 0xA8,
+	0x51, 0xA3, 0x40, 0x8F, 0x92, 0x9D, 0x38, 0xF5, 0xBC, 0xB6, 0xDA, 0x21, 0x10, 0xFF, 0xF3, 0xD2,
+	0xCD, 0x0C, 0x13, 0xEC, 0x5F, 0x97, 0x44, 0x17, 0xC4, 0xA7, 0x7E, 0x3D, 0x64, 0x5D, 0x19, 0x73,
+	0x60, 0x81, 0x4F, 0xDC, 0x22, 0x2A, 0x90, 0x88, 0x46, 0xEE, 0xB8, 0x14, 0xDE, 0x5E, 0x0B, 0xDB,
+	0xE0, 0x32, 0x3A, 0x0A, 0x49, 0x06, 0x24, 0x5C, 0xC2, 0xD3, 0xAC, 0x62, 0x91, 0x95, 0xE4, 0x79,
+	0xE7, 0xC8, 0x37, 0x6D, 0x8D, 0xD5, 0x4E, 0xA9, 0x6C, 0x56, 0xF4, 0xEA, 0x65, 0x7A, 0xAE, 0x08,
+	0xBA, 0x78, 0x25, 0x2E, 0x1C, 0xA6, 0xB4, 0xC6, 0xE8, 0xDD, 0x74, 0x1F, 0x4B, 0xBD, 0x8B, 0x8A,
+	0x70, 0x3E, 0xB5, 0x66, 0x48, 0x03, 0xF6, 0x0E, 0x61, 0x35, 0x57, 0xB9, 0x86, 0xC1, 0x1D, 0x9E,
+	0xE1, 0xF8, 0x98, 0x11, 0x69, 0xD9, 0x8E, 0x94, 0x9B, 0x1E, 0x87, 0xE9, 0xCE, 0x55, 0x28, 0xDF,
+	0x8C, 0xA1, 0x89, 0x0D, 0xBF, 0xE6, 0x42, 0x68, 0x41, 0x99, 0x2D, 0x0F, 0xB0, 0x54, 0xBB, 0x16,
+};
+
+static inline uint32_t ror( uint32_t w, uint8_t n )
+{
+	return ( w >> n ) | ( w << ( 32 - n ) );
+}
+
+// Multiplies all four bytes of w by x in GF(2^8)
+static inline uint32_t xtime4( uint32_t w )
+{
+	return ( ( w & 0x7F7F7F7F ) << 1 ) ^ ( ( ( w >> 7 ) & 0x01010101 ) * 0x1B );
+}
+
+// Column bytes a0..a3 from the low byte up: b_i = 2 a_i ^ 3 a_i+1 ^ a_i+2 ^ a_i+3
+static inline uint32_t mix_column( uint32_t w )
+{
+	uint32_t r = ror( w, 8 );
+	return xtime4( w ^ r ) ^ r ^ ror( w, 16 ) ^ ror( w, 24 );
+}
+
+// SubBytes and ShiftRows: row r of output column c comes from column c + r
+static inline uint32_t sub_shift( const uint8_t* b, uint8_t c )
+{
+	return sbox[ b[ 4 * c ] ] | sbox[ b[ 4 * ( ( c + 1 ) & 3 ) + 1 ] ] << 8 | sbox[ b[ 4 * ( ( c + 2 ) & 3 ) + 2 ] ] << 16 |
+		(uint32_t)sbox[ b[ 4 * ( ( c + 3 ) & 3 ) + 3 ] ] << 24;
+}
+
+void Aes128::expand( const uint8_t* key )
+{
+	memcpy( _roundKeys, key, AES_BLOCK_SIZE );
+	uint8_t rcon = 1;
+	for( uint8_t i = 4; i < 44; i++ )
+	{
+		uint32_t t = _roundKeys[ i - 1 ];
+		if( !( i & 3 ) )
+		{
+			// RotWord, SubWord and the round constant, bytes little-endian in the word
+			t = ( sbox[ ( t >> 8 ) & 0xFF ] ^ rcon ) | sbox[ ( t >> 16 ) & 0xFF ] << 8 | sbox[ t >> 24 ] << 16 | (uint32_t)sbox[ t & 0xFF ] << 24;
+			rcon = ( rcon << 1 ) ^ ( rcon & 0x80 ? 0x1B : 0 );
+		}
+		_roundKeys[i] = _roundKeys[ i - 4 ] ^ t;
+	}
+}
+
+void __not_in_flash_func( Aes128::encrypt )( const uint8_t* in, uint8_t* out ) const
+{
+	uint32_t s[4];
+	uint32_t t[4];
+	memcpy( s, in, AES_BLOCK_SIZE );
+	const uint32_t* rk = _roundKeys;
+	s[0] ^= rk[0];
+	s[1] ^= rk[1];
+	s[2] ^= rk[2];
+	s[3] ^= rk[3];
+	for( uint8_t round = 1; round <= 10; round++ )
+	{
+		rk += 4;
+		const uint8_t* b = (const uint8_t*)s;
+		t[0] = sub_shift( b, 0 );
+		t[1] = sub_shift( b, 1 );
+		t[2] = sub_shift( b, 2 );
+		t[3] = sub_shift( b, 3 );
+		if( round < 10 )
+		{
+			t[0] = mix_column( t[0] );
+			t[1] = mix_column( t[1] );
+			t[2] = mix_column( t[2] );
+			t[3] = mix_column( t[3] );
+		}
+		s[0] = t[0] ^ rk[0];
+		s[1] = t[1] ^ rk[1];
+		s[2] = t[2] ^ rk[2];
+		s[3] = t[3] ^ rk[3];
+	}
+	memcpy( out, s, AES_BLOCK_SIZE );
+}
+
+void Aes128::wipe()
+{
+	zeroize( _roundKeys, sizeof( _roundKeys ) );
+}
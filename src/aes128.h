@@ -0,0 +1,22 @@
+#ifndef _AES128_H_
+#define _AES128_H_
+#include <cstdint>
+
+#define AES_BLOCK_SIZE 16
+
+// AES-128 encryption (FIPS-197) for the Cortex-M0+.
+// The key schedule is expanded once by expand() and kept, so encrypting a block is just the
+// 10 rounds. The state is held as four column words: MixColumns works on a whole column with
+// shifts, masks and rotates, and the S-box is the only table, 256 bytes in RAM.
+// Only the forward cipher is needed, the vault uses it in counter mode.
+class Aes128
+{
+public:
+	void expand( const uint8_t* key );
+	void encrypt( const uint8_t* in, uint8_t* out ) const;
+	void wipe();
+private:
+	uint32_t _roundKeys[ 44 ];
+};
+
+#endif
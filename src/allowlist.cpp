@@ -0,0 +1,208 @@
+#include "allowlist.h"
+#include <string.h>
+#include "flash_storage.h"
+#include "mph_allowlist.h"
+#include "log.h"
+#include "bsp/board.h"
+
+static_assert( sizeof( uint32_t ) * ( 5 + ALLOWLIST_WORDS ) <= FLASH_ALLOWLIST_SLOT_SIZE, "Allowlist does not fit its flash slot" );
+static_assert( ALLOWLIST_WORDS <= UINT16_MAX, "Allowlist counts are 16 bit" );
+
+uint32_t Allowlist::_words[ ALLOWLIST_WORDS ];
+uint8_t Allowlist::_slot = 1;		// Nothing loaded, the first save goes to slot 0
+uint32_t Allowlist::_sequence = 0;
+uint16_t Allowlist::_count4 = 0;
+uint16_t Allowlist::_count7 = 0;
+uint16_t Allowlist::_count10 = 0;
+
+// Packs count bytes big-endian into the words of key, so word order is byte order. The rest is zero.
+template<uint8_t N> void Allowlist::pack( const uint8_t* bytes, uint8_t count, Packed<N>* key )
+{
+	for( uint8_t i = 0; i < N; i++ ) key->w[i] = 0;
+	for( uint8_t i = 0; i < count; i++ ) key->w[ i / 4 ] |= (uint32_t)bytes[i] << ( 24 - 8 * ( i % 4 ) );
+}
+
+template<uint8_t N> uint16_t Allowlist::lower_bound( const Packed<N>* entries, uint16_t count, const Packed<N>& key )
+{
+	uint16_t lo = 0, hi = count;
+	while( lo < hi )
+	{
+		uint16_t mid = ( lo + hi ) / 2;
+		const Packed<N>& entry = entries[ mid ];
+		uint8_t i = 0;
+		while( i < N - 1 && entry.w[i] == key.w[i] ) i++;
+		if( entry.w[i] < key.w[i] ) lo = mid + 1;
+		else hi = mid;
+	}
+	return lo;
+}
+
+template<uint8_t N> bool Allowlist::has_prefix( const Packed<N>* entries, uint16_t count, const uint8_t* bytes, uint8_t known )
+{
+	Packed<N> key;
+	pack( bytes, known, &key );
+	// Entries starting with the prefix are the ones from the prefix padded with zeros on
+	uint16_t i = lower_bound( entries, count, key );
+	if( i >= count ) return false;
+	const Packed<N>& entry = entries[i];
+	for( uint8_t w = 0; w < N && known; w++ )
+	{
+		uint8_t bytesHere = known < 4 ? known : 4;
+		uint32_t mask = 0xFFFFFFFFu << ( 32 - 8 * bytesHere );
+		if( ( entry.w[w] & mask ) != key.w[w] ) return false;
+		known -= bytesHere;
+	}
+	return true;
+}
+
+// Inserting or erasing moves the arrays of the larger UID sizes behind the entry along with it
+template<uint8_t N> bool Allowlist::insert( Packed<N>* entries, uint16_t* count, const uint8_t* bytes )
+{
+	Packed<N> key;
+	pack( bytes, N == 1 ? 4 : N == 2 ? 7 : 10, &key );
+	uint16_t i = lower_bound( entries, *count, key );
+	if( i < *count && !memcmp( &entries[i], &key, sizeof( key ) ) ) return true;
+	if( words_used() + N > ALLOWLIST_WORDS )
+	{
+		LOGS_ERROR( "Allowlist full, %d entries", Allowlist::count() );
+		return false;
+	}
+	const uint32_t* end = _words + words_used();
+	memmove( &entries[ i + 1 ], &entries[i], ( end - (const uint32_t*)( entries + i ) ) * sizeof( uint32_t ) );
+	entries[i] = key;
+	( *count )++;
+	return true;
+}
+
+template<uint8_t N> bool Allowlist::erase( Packed<N>* entries, uint16_t* count, const uint8_t* bytes )
+{
+	Packed<N> key;
+	pack( bytes, N == 1 ? 4 : N == 2 ? 7 : 10, &key );
+	uint16_t i = lower_bound( entries, *count, key );
+	if( i >= *count || memcmp( &entries[i], &key, sizeof( key ) ) ) return false;
+	const uint32_t* end = _words + words_used();
+	memmove( &entries[i], &entries[ i + 1 ], ( end - (const uint32_t*)( entries + i + 1 ) ) * sizeof( uint32_t ) );
+	( *count )--;
+	return true;
+}
+
+bool Allowlist::add( const MFRC522::Uid& uid )
+{
+	if( uid.size == 4 ) return insert( uid4(), &_count4, uid.uidByte );
+	if( uid.size == 7 ) return insert( uid7(), &_count7, uid.uidByte );
+	if( uid.size == 10 ) return insert( uid10(), &_count10, uid.uidByte );
+	return false;
+}
+
+bool Allowlist::remove( const MFRC522::Uid& uid )
+{
+	if( uid.size == 4 ) return erase( uid4(), &_count4, uid.uidByte );
+	if( uid.size == 7 ) return erase( uid7(), &_count7, uid.uidByte );
+	if( uid.size == 10 ) return erase( uid10(), &_count10, uid.uidByte );
+	return false;
+}
+
+bool Allowlist::contains( const MFRC522::Uid& uid )
+{
+	if( uid.size == 4 && has_prefix( uid4(), _count4, uid.uidByte, 4 ) ) return true;
+	if( uid.size == 7 && has_prefix( uid7(), _count7, uid.uidByte, 7 ) ) return true;
+	if( uid.size == 10 && has_prefix( uid10(), _count10, uid.uidByte, 10 ) ) return true;
+	return MphAllowlist::contains( uid.uidByte, uid.size );
+}
+
+bool Allowlist::matches( const uint8_t* uidBytes, uint8_t count, uint8_t uidSize )
+{
+	if( ( !uidSize || uidSize == 4 ) && count <= 4 && has_prefix( uid4(), _count4, uidBytes, count ) ) return true;
+	if( ( !uidSize || uidSize == 7 ) && count <= 7 && has_prefix( uid7(), _count7, uidBytes, count ) ) return true;
+	if( ( !uidSize || uidSize == 10 ) && count <= 10 && has_prefix( uid10(), _count10, uidBytes, count ) ) return true;
+	// The hashed list cannot answer for a prefix, only for a whole UID
+	if( !MphAllowlist::loaded() ) return false;
+	if( !uidSize || count < uidSize ) return true;
+	return MphAllowlist::contains( uidBytes, uidSize );
+}
+
+static uint32_t fnv1a( uint32_t hash, const uint8_t* p, uint32_t size )
+{
+	while( size-- ) hash = ( hash ^ *p++ ) * 16777619u;
+	return hash;
+}
+
+uint32_t Allowlist::checksum( const Header& header, const uint8_t* entries )
+{
+	uint32_t hash = fnv1a( 2166136261u, (const uint8_t*)&header.sequence, sizeof( header.sequence ) );
+	hash = fnv1a( hash, (const uint8_t*)&header.count4, 4 * sizeof( uint16_t ) );
+	return fnv1a( hash, entries, ( header.count4 + 2 * header.count7 + 3 * header.count10 ) * sizeof( uint32_t ) );
+}
+
+bool Allowlist::valid( uint8_t slot, Header* header )
+{
+	const uint8_t* flash = FlashStorage::xip( FLASH_ALLOWLIST_OFFSET + slot * FLASH_ALLOWLIST_SLOT_SIZE );
+	memcpy( header, flash, sizeof( *header ) );
+	return header->magic == ALLOWLIST_MAGIC && header->count4 + 2 * header->count7 + 3 * header->count10 <= ALLOWLIST_WORDS &&
+		checksum( *header, flash + sizeof( *header ) ) == header->checksum;
+}
+
+void Allowlist::load()
+{
+	Header headers[2];
+	bool ok[2] = { valid( 0, &headers[0] ), valid( 1, &headers[1] ) };
+	clear();
+	if( !ok[0] && !ok[1] )
+	{
+		LOGS_INFO( "No stored allowlist" );
+		return;
+	}
+	// The newer of two good slots; the sequence number may wrap
+	_slot = ok[0] && ok[1] ? (int32_t)( headers[1].sequence - headers[0].sequence ) > 0 : ok[1];
+	const Header& header = headers[ _slot ];
+	// Stored sorted and in pool order, so loading is a copy
+	memcpy( _words, FlashStorage::xip( FLASH_ALLOWLIST_OFFSET + _slot * FLASH_ALLOWLIST_SLOT_SIZE ) + sizeof( header ),
+		( header.count4 + 2 * header.count7 + 3 * header.count10 ) * sizeof( uint32_t ) );
+	_sequence = header.sequence;
+	_count4 = header.count4;
+	_count7 = header.count7;
+	_count10 = header.count10;
+	LOGS_INFO( "Allowlist loaded from slot %d, %d entries", _slot, count() );
+}
+
+bool Allowlist::save()
+{
+	Header header;
+	header.magic = ALLOWLIST_MAGIC;
+	header.sequence = _sequence + 1;
+	header.count4 = _count4;
+	header.count7 = _count7;
+	header.count10 = _count10;
+	header.reserved = 0;
+	header.checksum = checksum( header, (const uint8_t*)_words );
+	uint32_t total = sizeof( header ) + words_used() * sizeof( uint32_t );
+	uint8_t slot = _slot ^ 1;
+	uint32_t base = FLASH_ALLOWLIST_OFFSET + slot * FLASH_ALLOWLIST_SLOT_SIZE;
+
+	// Only the sectors the list occupies are erased. The page with the header goes out last,
+	// so the slot only looks written once all of it is.
+	if( !FlashStorage::erase( base, ( total + FLASH_SECTOR_SIZE - 1 ) / FLASH_SECTOR_SIZE * FLASH_SECTOR_SIZE ) ) return false;
+	uint32_t pages = ( total + FLASH_PAGE_SIZE - 1 ) / FLASH_PAGE_SIZE;
+	uint8_t page[ FLASH_PAGE_SIZE ];
+	for( uint32_t p = pages; p-- > 0; )
+	{
+		// Page p of the header followed by the pool, padded with erased bytes
+		memset( page, 0xFF, FLASH_PAGE_SIZE );
+		for( uint32_t i = 0; i < FLASH_PAGE_SIZE && p * FLASH_PAGE_SIZE + i < total; i++ )
+		{
+			uint32_t at = p * FLASH_PAGE_SIZE + i;
+			page[i] = at < sizeof( header ) ? ( (const uint8_t*)&header )[ at ] : ( (const uint8_t*)_words )[ at - sizeof( header ) ];
+		}
+		if( !FlashStorage::program( base + p * FLASH_PAGE_SIZE, page, FLASH_PAGE_SIZE ) ) return false;
+	}
+	Header stored;
+	if( !valid( slot, &stored ) || stored.sequence != header.sequence )
+	{
+		LOGS_ERROR( "Allowlist verify failed" );
+		return false;
+	}
+	// Only now does the new slot take over; until the next save the old one stays as it was
+	_slot = slot;
+	_sequence = header.sequence;
+	return true;
+}
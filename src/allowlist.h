@@ -0,0 +1,70 @@
+#ifndef _ALLOWLIST_H_
+#define _ALLOWLIST_H_
+#include <cstdint>
+#include "MFRC522.h"
+#include "flash_layout.h"
+
+// Words shared by the entries of all UID sizes: 1, 2 or 3 per entry, so 15000 4 byte NUIDs or 5000 10 byte UIDs.
+// Together with the flash header they must fit in FLASH_ALLOWLIST_SLOT_SIZE; it is also the RAM the list takes.
+#define ALLOWLIST_WORDS 15000
+#define ALLOWLIST_MAGIC 0x314C5741	// "AWL1"
+
+// UIDs of the cards that may type the password.
+// Each UID size has its own sorted array of UIDs packed big-endian into 32 bit words, so
+// lookups are a binary search with word compares, and a UID prefix (what the UID filter
+// sees during anticollision) narrows down to one contiguous range of entries.
+// The three arrays follow each other in one pool of words, so any mix of sizes fits.
+// save() writes the slot not in use and load() takes the valid slot with the higher sequence number,
+// so a save cut short by a reset leaves the list of the save before.
+// UIDs in the MphAllowlist count as listed too.
+class Allowlist
+{
+public:
+	static void load();		// From flash, at startup
+	static bool save();
+	static bool add( const MFRC522::Uid& uid );		// true if the UID is on the list afterwards
+	static bool remove( const MFRC522::Uid& uid );
+	static bool contains( const MFRC522::Uid& uid );
+	// MFRC522::UidFilter: true if some entry of size uidSize (any size if 0) starts with the count bytes given
+	static bool matches( const uint8_t* uidBytes, uint8_t count, uint8_t uidSize );
+	static uint16_t count() { return _count4 + _count7 + _count10; }
+	static uint16_t words_used() { return _count4 + 2 * _count7 + 3 * _count10; }
+	static void clear() { _count4 = _count7 = _count10 = 0; }
+private:
+	template<uint8_t N> struct Packed
+	{
+		uint32_t w[N];
+	};
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t sequence;		// One more than the other slot's when written
+		uint32_t checksum;		// FNV-1a over the sequence, the counts and the entries
+		uint16_t count4;
+		uint16_t count7;
+		uint16_t count10;
+		uint16_t reserved;
+	};
+
+	template<uint8_t N> static void pack( const uint8_t* bytes, uint8_t count, Packed<N>* key );
+	template<uint8_t N> static uint16_t lower_bound( const Packed<N>* entries, uint16_t count, const Packed<N>& key );
+	template<uint8_t N> static bool has_prefix( const Packed<N>* entries, uint16_t count, const uint8_t* bytes, uint8_t known );
+	template<uint8_t N> static bool insert( Packed<N>* entries, uint16_t* count, const uint8_t* bytes );
+	template<uint8_t N> static bool erase( Packed<N>* entries, uint16_t* count, const uint8_t* bytes );
+	static uint32_t checksum( const Header& header, const uint8_t* entries );
+	static bool valid( uint8_t slot, Header* header );
+
+	// The arrays in the pool: 4 byte UIDs first, then 7, then 10
+	static Packed<1>* uid4() { return (Packed<1>*)_words; }
+	static Packed<2>* uid7() { return (Packed<2>*)( _words + _count4 ); }
+	static Packed<3>* uid10() { return (Packed<3>*)( _words + _count4 + 2 * _count7 ); }
+
+	static uint32_t _words[ ALLOWLIST_WORDS ];
+	static uint8_t _slot;		// Slot the list was loaded from or last saved to
+	static uint32_t _sequence;
+	static uint16_t _count4;
+	static uint16_t _count7;
+	static uint16_t _count10;
+};
+
+#endif
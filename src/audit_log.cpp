@@ -0,0 +1,171 @@
+#include "audit_log.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "flash_storage.h"
+#include "totp.h"
+#include "zeroize.h"
+#include "log.h"
+#include "bsp/board.h"
+
+static_assert( sizeof( AuditLog::Record ) == 16, "Records are 16 bytes" );
+static_assert( AUDIT_SECTORS >= 3, "The ring needs the head, the sector erased ahead and one of history" );
+
+HmacSha256 AuditLog::_hmac;
+AuditLog::Record AuditLog::_page[ AUDIT_RECORDS_PER_PAGE ];
+uint32_t AuditLog::_pageStart = 0;
+uint32_t AuditLog::_next = 0;
+uint32_t AuditLog::_flushed = 0;
+uint32_t AuditLog::_oldest = 0;
+uint32_t AuditLog::_erased = 0;
+uint32_t AuditLog::_firstBuffered = 0;
+
+uint32_t AuditLog::offset( uint32_t sequence )
+{
+	return FLASH_AUDIT_OFFSET + ( sequence / AUDIT_RECORDS_PER_SECTOR % AUDIT_SECTORS ) * FLASH_SECTOR_SIZE +
+		sequence % AUDIT_RECORDS_PER_SECTOR * sizeof( Record );
+}
+
+// The record in the slot of sequence, if that is the record written there
+const AuditLog::Record* AuditLog::stored( uint32_t sequence )
+{
+	const Record* record = (const Record*)FlashStorage::xip( offset( sequence ) );
+	return record->sequence == sequence ? record : nullptr;
+}
+
+// The sector of sequence is erased
+bool AuditLog::blank( uint32_t sequence )
+{
+	const uint32_t* word = (const uint32_t*)FlashStorage::xip( offset( sequence - sequence % AUDIT_RECORDS_PER_SECTOR ) );
+	for( uint32_t i = 0; i < FLASH_SECTOR_SIZE / 4; i++ )
+	{
+		if( word[i] != 0xFFFFFFFF ) return false;
+	}
+	return true;
+}
+
+void AuditLog::load()
+{
+	uint32_t newest = 0;
+	bool empty = true;
+	_oldest = 0;
+	for( uint32_t s = 0; s < AUDIT_SECTORS; s++ )
+	{
+		// A sector's first record tells which records it holds
+		uint32_t sequence = ( (const Record*)FlashStorage::xip( FLASH_AUDIT_OFFSET + s * FLASH_SECTOR_SIZE ) )->sequence;
+		if( sequence % AUDIT_RECORDS_PER_SECTOR || sequence / AUDIT_RECORDS_PER_SECTOR % AUDIT_SECTORS != s ) continue;
+		if( empty || sequence > newest ) newest = sequence;
+		if( empty || sequence < _oldest ) _oldest = sequence;
+		empty = false;
+	}
+	_next = 0;
+	if( !empty )
+	{
+		_next = newest;
+		while( _next < newest + AUDIT_RECORDS_PER_SECTOR && stored( _next ) ) _next++;
+	}
+	// The rest of a started head sector is erased; a full one is followed by sectors that may be
+	_erased = _next % AUDIT_RECORDS_PER_SECTOR ? _next - _next % AUDIT_RECORDS_PER_SECTOR + AUDIT_RECORDS_PER_SECTOR : _next;
+	while( _erased < _next + 2 * AUDIT_RECORDS_PER_SECTOR && blank( _erased ) ) _erased += AUDIT_RECORDS_PER_SECTOR;
+	_pageStart = _next - _next % AUDIT_RECORDS_PER_PAGE;
+	_flushed = _next;
+	memset( _page, 0xFF, sizeof( _page ) );
+	LOGS_INFO( "Audit log: records %lu..%lu", _oldest, _next );
+}
+
+void AuditLog::init( const uint8_t* secret, size_t len )
+{
+	// Like DerivedPassword, a key of its own derived from the secret: HMAC( secret, "audit" )
+	uint8_t key[ SHA256_DIGEST_SIZE ];
+	HmacSha256 kdf;
+	kdf.set_key( secret, len );
+	kdf.compute( (const uint8_t*)AUDIT_KEY_LABEL, sizeof( AUDIT_KEY_LABEL ) - 1, key );
+	kdf.wipe();
+	_hmac.set_key( key, sizeof( key ) );
+	zeroize( key, sizeof( key ) );
+}
+
+uint32_t AuditLog::uid_hash( const MFRC522::Uid& uid )
+{
+	uint8_t mac[ SHA256_DIGEST_SIZE ];
+	_hmac.compute( uid.uidByte, uid.size, mac );
+	return (uint32_t)mac[0] << 24 | (uint32_t)mac[1] << 16 | (uint32_t)mac[2] << 8 | mac[3];
+}
+
+void AuditLog::record( const MFRC522::Uid& uid, uint8_t reader, Result result, uint8_t status, uint32_t latency_ms )
+{
+	if( _next == _pageStart + AUDIT_RECORDS_PER_PAGE ) flush();		// step() did not get to the full page
+	if( _next == _pageStart + AUDIT_RECORDS_PER_PAGE )
+	{
+		LOGS_ERROR( "Audit log: record %lu dropped", _next );
+		return;
+	}
+	Record& entry = _page[ _next - _pageStart ];
+	entry.sequence = _next;
+	entry.flags = result | ( reader & 0x07 ) << 2;
+	if( Totp::synced() ) entry.time = Totp::now();
+	else
+	{
+		entry.time = time_us_64() / 1000000;
+		entry.flags |= AUDIT_BOOT_TIME;
+	}
+	entry.uid_hash = uid_hash( uid );
+	entry.status = status;
+	entry.latency_ms = latency_ms < 0xFFFF ? latency_ms : 0xFFFF;
+	if( _flushed == _next ) _firstBuffered = board_millis();
+	_next++;
+}
+
+// Slots already programmed are programmed again with the same value, so a page can take several flushes
+bool AuditLog::flush()
+{
+	if( _flushed == _next ) return true;
+	if( _pageStart >= _erased && !erase_ahead() ) return false;
+	if( !FlashStorage::program( offset( _pageStart ), (const uint8_t*)_page, FLASH_PAGE_SIZE ) ) return false;
+	_flushed = _next;
+	if( _next == _pageStart + AUDIT_RECORDS_PER_PAGE )
+	{
+		_pageStart = _next;
+		memset( _page, 0xFF, sizeof( _page ) );
+	}
+	return true;
+}
+
+// Erases the sector after the erased ones, dropping the oldest records if it held any
+bool AuditLog::erase_ahead()
+{
+	if( !FlashStorage::erase( offset( _erased ), FLASH_SECTOR_SIZE ) ) return false;
+	_erased += AUDIT_RECORDS_PER_SECTOR;
+	if( _erased > AUDIT_SECTORS * AUDIT_RECORDS_PER_SECTOR && _oldest < _erased - AUDIT_SECTORS * AUDIT_RECORDS_PER_SECTOR )
+		_oldest = _erased - AUDIT_SECTORS * AUDIT_RECORDS_PER_SECTOR;
+	return true;
+}
+
+void AuditLog::step( uint32_t now_ms )
+{
+	if( _flushed != _next && ( _next == _pageStart + AUDIT_RECORDS_PER_PAGE || now_ms - _firstBuffered >= AUDIT_FLUSH_DELAY_MS ) )
+		flush();
+	// Keep the sector after the head erased, so the page that starts it never waits for an erase
+	else if( _erased < _next - _next % AUDIT_RECORDS_PER_SECTOR + 2 * AUDIT_RECORDS_PER_SECTOR ) erase_ahead();
+}
+
+uint32_t AuditLog::first( uint32_t from )
+{
+	return from < _oldest ? _oldest : from > _next ? _next : from;
+}
+
+bool AuditLog::stream( uint32_t from, void (*write)( const uint8_t* data, uint32_t len ) )
+{
+	if( !flush() )
+	{
+		LOGS_ERROR( "Audit log: records %lu..%lu not programmed, stream stopped", _flushed, _next );
+		return false;
+	}
+	for( uint32_t sequence = first( from ); sequence < _flushed; )
+	{
+		uint32_t n = AUDIT_RECORDS_PER_SECTOR - sequence % AUDIT_RECORDS_PER_SECTOR;
+		if( n > _flushed - sequence ) n = _flushed - sequence;
+		write( FlashStorage::xip( offset( sequence ) ), n * sizeof( Record ) );
+		sequence += n;
+	}
+	return true;
+}
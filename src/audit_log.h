@@ -0,0 +1,78 @@
+#ifndef _AUDIT_LOG_H_
+#define _AUDIT_LOG_H_
+#include <cstdint>
+#include "flash_layout.h"
+#include "MFRC522.h"
+#include "sha256.h"
+
+#define AUDIT_SECTORS ( FLASH_AUDIT_SIZE / FLASH_SECTOR_SIZE )
+#define AUDIT_RECORDS_PER_SECTOR ( FLASH_SECTOR_SIZE / 16 )
+#define AUDIT_RECORDS_PER_PAGE ( FLASH_PAGE_SIZE / 16 )
+#define AUDIT_FLUSH_DELAY_MS 5000	// Records are collected in the page buffer this long before it is programmed
+#define AUDIT_BOOT_TIME 0x80		// Record flag: the time is seconds since boot, the clock was not synced
+#define AUDIT_KEY_LABEL "audit"		// The UID hash key is HMAC-SHA256( device secret, AUDIT_KEY_LABEL )
+
+// Append-only log of every tap, a ring of 16 byte records over the FLASH_AUDIT_SIZE region.
+// Record n goes to slot n % AUDIT_RECORDS_PER_SECTOR of sector n / AUDIT_RECORDS_PER_SECTOR % AUDIT_SECTORS,
+// so where a record is follows from its sequence number: load() finds the newest one from the first
+// record of each sector, and a record whose sequence does not match its slot, a torn write, ends the log.
+// record() only fills a RAM copy of the page being written. step() programs it once it is full or
+// AUDIT_FLUSH_DELAY_MS after the first record in it, and erases the sector after the head ahead of
+// time, which drops the oldest AUDIT_RECORDS_PER_SECTOR records; so the flash work happens in the main
+// loop between taps and a tap never waits for an erase. The ring keeps at least
+// ( AUDIT_SECTORS - 2 ) * AUDIT_RECORDS_PER_SECTOR records.
+class AuditLog
+{
+public:
+	enum Result : uint8_t
+	{
+		ENROLLED = 0,	// Added to the allowlist by "enroll", or not for lack of room
+		ALLOWED = 1,	// On the allowlist and the password was typed
+		FAILED = 2,		// On the allowlist, nothing was typed
+		DENIED = 3		// Not on the allowlist
+	};
+	struct Record
+	{
+		uint32_t sequence;		// All ones: free
+		uint32_t time;			// Unix seconds, or seconds since boot with AUDIT_BOOT_TIME
+		uint32_t uid_hash;		// First four bytes of HMAC-SHA256 over the UID bytes, big-endian, see uid_hash()
+		uint8_t flags;			// Result in bits 0..1, reader in bits 2..4, AUDIT_BOOT_TIME
+		uint8_t status;			// MFRC522::StatusCode of the tap
+		uint16_t latency_ms;	// From the card showing up to the end of typing, or to the rejection
+	};
+
+	static void load();
+	// Keys the UID hash from the device secret, before the first record(). A plain hash of a 4 byte
+	// UID is undone by trying them all; without the secret the records do not tell which card it was.
+	static void init( const uint8_t* secret, size_t len );
+	static uint32_t uid_hash( const MFRC522::Uid& uid );		// What records of the card hold, for looking it up
+	static void record( const MFRC522::Uid& uid, uint8_t reader, Result result, uint8_t status, uint32_t latency_ms );
+	static bool flush();	// Programs the buffered page now, false if that failed
+	static void step( uint32_t now_ms );
+	static uint32_t oldest() { return _oldest; }
+	static uint32_t next() { return _next; }
+	static uint32_t buffered() { return _next - _flushed; }
+	// Sequence of the first record stream() sends when asked for the ones from sequence from:
+	// from itself, or the oldest one still kept if from was dropped already
+	static uint32_t first( uint32_t from );
+	// Programs the buffered page, then sends records first( from ) .. next() - 1 through write,
+	// straight from the XIP window a sector at a time. Sends nothing and returns false if the page
+	// could not be programmed, its slots would read as erased flash.
+	static bool stream( uint32_t from, void (*write)( const uint8_t* data, uint32_t len ) );
+private:
+	static uint32_t offset( uint32_t sequence );
+	static const Record* stored( uint32_t sequence );
+	static bool blank( uint32_t sequence );
+	static bool erase_ahead();
+
+	static HmacSha256 _hmac;
+	static Record _page[ AUDIT_RECORDS_PER_PAGE ];	// RAM copy of the page being filled, erased slots all ones
+	static uint32_t _pageStart;		// Sequence of the first record in _page
+	static uint32_t _next;			// Sequence of the next record
+	static uint32_t _flushed;		// Records below this are programmed
+	static uint32_t _oldest;
+	static uint32_t _erased;		// Records below this have an erased slot: the head sector and the one erased ahead
+	static uint32_t _firstBuffered;	// board_millis() of the first record not flushed
+};
+
+#endif
@@ -0,0 +1,61 @@
+#include "derived_password.h"
+#include <ctype.h>
+#include <string.h>
+#include "zeroize.h"
+
+HmacSha256 DerivedPassword::_hmac;
+char DerivedPassword::_alphabet[ DERIVE_MAX_ALPHABET ];
+uint8_t DerivedPassword::_alphabetLen = 0;
+uint8_t DerivedPassword::_alnumLen = 0;
+
+void DerivedPassword::init( const uint8_t* secret, size_t len, bool (*typeable)( char ) )
+{
+	// The device secret also keys the vault: the MAC key is HMAC( secret, "derive" ), never the secret itself
+	uint8_t key[ SHA256_DIGEST_SIZE ];
+	HmacSha256 kdf;
+	kdf.set_key( secret, len );
+	kdf.compute( (const uint8_t*)DERIVE_KEY_LABEL, sizeof( DERIVE_KEY_LABEL ) - 1, key );
+	kdf.wipe();
+	_hmac.set_key( key, sizeof( key ) );
+	zeroize( key, sizeof( key ) );
+	_alphabetLen = 0;
+	for( uint8_t pass = 0; pass < 2; pass++ )
+	{
+		for( char c = '!'; c <= '~'; c++ )
+		{
+			if( ( pass == 0 ) == ( isalnum( (unsigned char)c ) != 0 ) && typeable( c ) ) _alphabet[ _alphabetLen++ ] = c;
+		}
+		if( pass == 0 ) _alnumLen = _alphabetLen;
+	}
+}
+
+bool DerivedPassword::derive( const uint8_t* uid, uint8_t uidSize, const char* profile, uint8_t length, bool symbols, char* password )
+{
+	uint8_t n = alphabet_size( symbols );
+	size_t profileLen = strlen( profile );
+	if( !n || uidSize > 10 || profileLen > DERIVE_MAX_PROFILE ) return false;
+	// The largest multiple of n below 256: bytes above it would favour the first characters
+	uint16_t limit = 256 - 256 % n;
+	uint8_t message[ 1 + 10 + DERIVE_MAX_PROFILE + 1 ];
+	uint8_t len = 0;
+	message[ len++ ] = uidSize;
+	memcpy( &message[ len ], uid, uidSize );
+	len += uidSize;
+	memcpy( &message[ len ], profile, profileLen );
+	len += profileLen;
+	uint8_t& counter = message[ len++ ];
+	uint8_t mac[ SHA256_DIGEST_SIZE ];
+	uint8_t done = 0;
+	for( counter = 0; done < length; counter++ )
+	{
+		if( counter == 0xFF ) return false;		// 255 blocks without enough accepted bytes: never with a real alphabet
+		_hmac.compute( message, len, mac );
+		for( uint8_t i = 0; i < SHA256_DIGEST_SIZE && done < length; i++ )
+		{
+			if( mac[i] < limit ) password[ done++ ] = _alphabet[ mac[i] % n ];
+		}
+	}
+	password[ done ] = '\0';
+	zeroize( mac, sizeof( mac ) );
+	return true;
+}
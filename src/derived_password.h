@@ -0,0 +1,33 @@
+#ifndef _DERIVED_PASSWORD_H_
+#define _DERIVED_PASSWORD_H_
+#include <cstddef>
+#include <cstdint>
+#include "sha256.h"
+
+#define DERIVE_MAX_PROFILE 15
+#define DERIVE_MAX_ALPHABET 94		// Printable ASCII without the space
+#define DERIVE_KEY_LABEL "derive"	// The MAC key is HMAC-SHA256( device secret, DERIVE_KEY_LABEL )
+
+// Passwords computed from the card instead of stored: HMAC-SHA256( derive key, UID size, UID, profile,
+// block counter ), the derive key being HMAC-SHA256( device secret, DERIVE_KEY_LABEL ). The MAC bytes are mapped onto the alphabet by rejection sampling, so every character
+// is equally likely, and further blocks are computed while the password needs more characters.
+// The alphabet is the typeable characters, letters and digits first, so a profile without symbols
+// uses the leading part of it. The HMAC key blocks are hashed once by init(), so each block of
+// output costs two SHA-256 compressions.
+class DerivedPassword
+{
+public:
+	// typeable tells which printable characters the keyboard can type
+	static void init( const uint8_t* secret, size_t len, bool (*typeable)( char ) );
+	// Writes length characters and a NUL to password
+	static bool derive( const uint8_t* uid, uint8_t uidSize, const char* profile, uint8_t length, bool symbols, char* password );
+	static uint8_t alphabet_size( bool symbols ) { return symbols ? _alphabetLen : _alnumLen; }
+	static void wipe() { _hmac.wipe(); }
+private:
+	static HmacSha256 _hmac;
+	static char _alphabet[ DERIVE_MAX_ALPHABET ];
+	static uint8_t _alphabetLen;
+	static uint8_t _alnumLen;
+};
+
+#endif
@@ -0,0 +1,38 @@
+#ifndef _FLASH_LAYOUT_H_
+#define _FLASH_LAYOUT_H_
+#include "hardware/flash.h"
+
+// Data regions live at the top of flash, as offsets from the start of flash.
+// The firmware image must stay below the lowest region, FLASH_DATA_OFFSET; FlashStorage checks that
+// against the end of the image the linker reports.
+
+// Persistent settings, see settings.h
+#define FLASH_SETTINGS_OFFSET	( PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE )
+#define FLASH_SETTINGS_SIZE		FLASH_SECTOR_SIZE
+
+// Sorted UID arrays of the allowlist, see allowlist.h. Two slots, saves alternate between them.
+#define FLASH_ALLOWLIST_SLOT_SIZE	( 15 * FLASH_SECTOR_SIZE )
+#define FLASH_ALLOWLIST_SIZE	( 2 * FLASH_ALLOWLIST_SLOT_SIZE )
+#define FLASH_ALLOWLIST_OFFSET	( FLASH_SETTINGS_OFFSET - FLASH_ALLOWLIST_SIZE )
+
+// Minimal perfect hash allowlist written by tools/mph_build.cpp, see mph_format.h.
+// With 2 MB of flash it starts at 0x10161000 in the address space, the tool's default.
+#define FLASH_MPH_SIZE			( 512 * 1024 )
+#define FLASH_MPH_OFFSET		( FLASH_ALLOWLIST_OFFSET - FLASH_MPH_SIZE )
+
+// Log-structured credential store, see kv_store.h
+#define FLASH_KV_SIZE			( 16 * FLASH_SECTOR_SIZE )
+#define FLASH_KV_OFFSET			( FLASH_MPH_OFFSET - FLASH_KV_SIZE )
+
+// Device secret of the credential vault, written once and never erased with the settings, see settings.h
+#define FLASH_SECRET_SIZE		FLASH_SECTOR_SIZE
+#define FLASH_SECRET_OFFSET		( FLASH_KV_OFFSET - FLASH_SECRET_SIZE )
+
+// Ring of tap records, see audit_log.h
+#define FLASH_AUDIT_SIZE		( 16 * FLASH_SECTOR_SIZE )
+#define FLASH_AUDIT_OFFSET		( FLASH_SECRET_OFFSET - FLASH_AUDIT_SIZE )
+
+// Lowest data region, update it when a region is added below
+#define FLASH_DATA_OFFSET		FLASH_AUDIT_OFFSET
+
+#endif
@@ -0,0 +1,80 @@
+#include "flash_storage.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#include "tusb.h"
+#include "log.h"
+#include "bsp/board.h"
+
+// Nothing may execute from flash while it is erased or programmed. flash_safe_execute() parks core 1
+// if it runs and turns interrupts off, which also holds off the USB interrupt; the operations themselves
+// run from RAM. The work is split per sector and per page to keep each of those windows short, so the
+// USB stack gets to run in between and the host never sees the device stop answering.
+
+uint32_t FlashStorage::_maxPauseUs = 0;
+
+extern char __flash_binary_end;		// Defined by the SDK's linker script
+
+uint32_t FlashStorage::image_end()
+{
+	return (uint32_t)( (uintptr_t)&__flash_binary_end - XIP_BASE );
+}
+
+struct FlashOp
+{
+	uint32_t offset;
+	const uint8_t* data;
+	uint32_t size;
+};
+
+static void __no_inline_not_in_flash_func( erase_op )( void* param )
+{
+	FlashOp* op = (FlashOp*)param;
+	flash_range_erase( op->offset, op->size );
+}
+
+static void __no_inline_not_in_flash_func( program_op )( void* param )
+{
+	FlashOp* op = (FlashOp*)param;
+	flash_range_program( op->offset, op->data, op->size );
+}
+
+bool FlashStorage::run( void (*op)( void* ), uint32_t offset, const uint8_t* data, uint32_t size )
+{
+	// A region that grew into the firmware would erase the code running it
+	if( offset < image_end() )
+	{
+		LOGS_ERROR( "Flash operation at 0x%lx refused, the firmware ends at 0x%lx", offset, image_end() );
+		return false;
+	}
+	FlashOp args = { offset, data, size };
+	uint32_t start = time_us_32();
+	int rc = flash_safe_execute( op, &args, FLASH_LOCKOUT_TIMEOUT_MS );
+	uint32_t took = time_us_32() - start;
+	if( took > _maxPauseUs ) _maxPauseUs = took;
+	if( rc != PICO_OK )
+	{
+		LOGS_ERROR( "Flash operation at 0x%lx failed: %d", offset, rc );
+		return false;
+	}
+	return true;
+}
+
+bool FlashStorage::erase( uint32_t offset, uint32_t size )
+{
+	for( uint32_t done = 0; done < size; done += FLASH_SECTOR_SIZE )
+	{
+		if( done ) tud_task();		// Catch up on what the USB interrupt queued while it was masked
+		if( !run( erase_op, offset + done, nullptr, FLASH_SECTOR_SIZE ) ) return false;
+	}
+	return true;
+}
+
+bool FlashStorage::program( uint32_t offset, const uint8_t* data, uint32_t size )
+{
+	for( uint32_t done = 0; done < size; done += FLASH_PAGE_SIZE )
+	{
+		if( done ) tud_task();
+		if( !run( program_op, offset + done, data + done, FLASH_PAGE_SIZE ) ) return false;
+	}
+	return true;
+}
@@ -0,0 +1,25 @@
+#ifndef _FLASH_STORAGE_H_
+#define _FLASH_STORAGE_H_
+#include <cstdint>
+#include "flash_layout.h"
+
+#define FLASH_LOCKOUT_TIMEOUT_MS 100		// How long to wait for core 1 to park before giving up
+
+class FlashStorage
+{
+public:
+	// Direct read access through the XIP window. offset is from the start of flash.
+	static const uint8_t* xip( uint32_t offset ) { return (const uint8_t*)(uintptr_t)( XIP_BASE + offset ); }
+	static bool erase( uint32_t offset, uint32_t size );
+	static bool program( uint32_t offset, const uint8_t* data, uint32_t size );
+	// Offset of the first byte after the firmware image, from the linker's __flash_binary_end
+	static uint32_t image_end();
+	static bool image_fits() { return image_end() <= FLASH_DATA_OFFSET; }
+	// Longest time USB and core 1 were held off by one erase or program step
+	static uint32_t max_pause_us() { return _maxPauseUs; }
+private:
+	static bool run( void (*op)( void* ), uint32_t offset, const uint8_t* data, uint32_t size );
+	static uint32_t _maxPauseUs;
+};
+
+#endif
@@ -0,0 +1,285 @@
+#include "iso_dep.h"
+#include "pico/stdlib.h"
+
+// Protocol control bytes, ISO/IEC 14443-4 section 7.1.1. We never send CID or NAD.
+#define PCB_I_BLOCK		0x02
+#define PCB_R_ACK		0xA2
+#define PCB_R_NAK		0xB2
+#define PCB_S_DESELECT	0xC2
+#define PCB_S_WTX		0xF2
+#define PCB_CHAINING	0x10
+#define PCB_CID			0x08
+#define PCB_NAD			0x04
+#define PCB_BLOCK_NUMBER 0x01
+
+#define IS_I_BLOCK( pcb ) ( ( ( pcb ) & 0xE2 ) == 0x02 )
+#define IS_R_BLOCK( pcb ) ( ( ( pcb ) & 0xE6 ) == 0xA2 )
+#define IS_S_BLOCK( pcb ) ( ( ( pcb ) & 0xC7 ) == 0xC2 )
+
+// FSC for each FSCI, ISO/IEC 14443-4 table 1. Values above 8 are RFU and read as 256.
+static const uint16_t frameSizes[] = { 16, 24, 32, 40, 48, 64, 96, 128, 256 };
+
+IsoDep::IsoDep( MFRC522& pcd )
+	: _pcd( pcd ), _active( false ), _blockNumber( 0 ), _fsc( 32 ), _fwtUs( 0 ), _ats(), _atsLen( 0 ), _sInf( 0 ), _stats()
+{
+}
+
+uint8_t IsoDep::activate( uint8_t sak )
+{
+	if( !( sak & 0x20 ) )		// SAK bit 6: ISO/IEC 14443-4 compliant
+	{
+		return MFRC522::STATUS_INVALID;
+	}
+	_active = false;
+	_atsLen = sizeof( _ats );
+	uint8_t status = _pcd.PICC_RequestATS( _ats, &_atsLen, ISO_DEP_FSDI, 0 );
+	if( status != MFRC522::STATUS_OK )
+	{
+		return status;
+	}
+	_atsLen -= 2;		// CRC_A
+
+	// Defaults for everything the ATS leaves out, ISO/IEC 14443-4 section 5.2
+	uint8_t t0 = _atsLen > 1 ? _ats[1] : 0x02;
+	uint8_t tb = 0x40;
+	uint8_t index = 2;
+	if( t0 & 0x10 ) index++;						// TA(1), read by PICC_PPS()
+	if( ( t0 & 0x20 ) && index < _atsLen ) tb = _ats[ index++ ];
+	uint8_t fsci = t0 & 0x0F;
+	uint8_t fwi = tb >> 4;
+	uint8_t sfgi = tb & 0x0F;
+	_fsc = frameSizes[ fsci < sizeof( frameSizes ) / sizeof( frameSizes[0] ) ? fsci : 8 ];
+	if( fwi == 15 ) fwi = 4;
+	_fwtUs = ( 302UL << fwi ) + ISO_DEP_FWT_DELTA_US;		// FWT = 256 * 16 / fc * 2^FWI
+	if( sfgi && sfgi != 15 )
+	{
+		sleep_us( 302UL << sfgi );		// SFGT: the PICC needs this long before it listens again
+	}
+
+	// A failed PPS leaves both sides at 106 kbit/s, which still works
+	_pcd.PICC_PPS( _ats, 0 );
+	_blockNumber = 0;
+	_active = true;
+	return MFRC522::STATUS_OK;
+}
+
+uint8_t IsoDep::deselect()
+{
+	uint8_t rxPcb, rxLen;
+	_pcd.PCD_SetTimeoutProfile( MFRC522::TIMEOUT_ISO_DEP, _fwtUs );
+	uint8_t status = exchange( PCB_S_DESELECT, NULL, 0, &rxPcb, NULL, 0, &rxLen );
+	if( status == MFRC522::STATUS_OK && rxPcb != PCB_S_DESELECT )
+	{
+		status = MFRC522::STATUS_ERROR;
+	}
+	_active = false;
+	if( _pcd.PCD_GetTxBitRate() != MFRC522::BITRATE_106 || _pcd.PCD_GetRxBitRate() != MFRC522::BITRATE_106 )
+	{
+		_pcd.PCD_SetBitRate( MFRC522::BITRATE_106, MFRC522::BITRATE_106 );
+	}
+	return status;
+}
+
+uint8_t IsoDep::transceiveApdu( std::span<const uint8_t> command, std::span<uint8_t> response, size_t* responseLen )
+{
+	if( !_active )
+	{
+		return MFRC522::STATUS_INVALID;
+	}
+	uint64_t start = time_us_64();
+	// INF bytes per frame: what the PICC takes minus PCB and CRC_A, and what the FIFO takes minus PCB
+	size_t maxInf = _fsc - 3 < MFRC522::FIFO_SIZE - 1 ? _fsc - 3 : MFRC522::FIFO_SIZE - 1;
+	size_t sent = 0;
+	size_t received = 0;
+	uint8_t errors = 0;
+
+	// The first I-block; later ones follow as the PICC acknowledges them
+	uint8_t chunk = command.size() < maxInf ? command.size() : maxInf;
+	bool chaining = chunk < command.size();
+	uint8_t iPcb = PCB_I_BLOCK | _blockNumber | ( chaining ? PCB_CHAINING : 0 );
+	uint8_t pcb = iPcb;
+	const uint8_t* inf = command.data();
+	uint8_t infLen = chunk;
+	bool receiving = false;
+	*responseLen = 0;
+
+	for( ;; )
+	{
+		uint8_t rxPcb, rxLen = 0;
+		uint8_t status = transact( pcb, inf, infLen, &rxPcb, response.data() + received, response.size() - received, &rxLen );
+		_stats.blocks++;
+		if( status == MFRC522::STATUS_NO_ROOM )
+		{
+			return fail( status );
+		}
+		if( status != MFRC522::STATUS_OK )
+		{
+			// Rules 4 and 5: ask again, with R(ACK) while the PICC is chaining and R(NAK) otherwise
+			if( ++errors > ISO_DEP_MAX_RETRIES ) return fail( status );
+			_stats.retries++;
+			pcb = ( receiving ? PCB_R_ACK : PCB_R_NAK ) | _blockNumber;
+			inf = NULL;
+			infLen = 0;
+			continue;
+		}
+
+		if( IS_I_BLOCK( rxPcb ) )
+		{
+			if( chaining || ( rxPcb & PCB_BLOCK_NUMBER ) != _blockNumber )
+			{
+				return fail( MFRC522::STATUS_ERROR );
+			}
+			_blockNumber ^= 1;
+			received += rxLen;
+			errors = 0;
+			if( !( rxPcb & PCB_CHAINING ) )
+			{
+				break;
+			}
+			// The PICC is chaining, acknowledge and collect the next part
+			receiving = true;
+			pcb = PCB_R_ACK | _blockNumber;
+			inf = NULL;
+			infLen = 0;
+		}
+		else if( IS_R_BLOCK( rxPcb ) && !( rxPcb & 0x10 ) )
+		{
+			if( ( rxPcb & PCB_BLOCK_NUMBER ) != _blockNumber || !chaining )
+			{
+				// Rule 6: our last I-block did not make it, send it again
+				if( ++errors > ISO_DEP_MAX_RETRIES ) return fail( MFRC522::STATUS_ERROR );
+				_stats.retries++;
+				pcb = iPcb;
+				inf = command.data() + sent;
+				infLen = chunk;
+				continue;
+			}
+			// Rule 7: acknowledged, go on with the chain
+			_blockNumber ^= 1;
+			sent += chunk;
+			errors = 0;
+			chunk = command.size() - sent < maxInf ? command.size() - sent : maxInf;
+			chaining = sent + chunk < command.size();
+			iPcb = PCB_I_BLOCK | _blockNumber | ( chaining ? PCB_CHAINING : 0 );
+			pcb = iPcb;
+			inf = command.data() + sent;
+			infLen = chunk;
+		}
+		else
+		{
+			return fail( MFRC522::STATUS_ERROR );
+		}
+	}
+
+	*responseLen = received;
+	_stats.apdus++;
+	_stats.bytes_out += command.size();
+	_stats.bytes_in += received;
+	_stats.busy_us += time_us_64() - start;
+	return MFRC522::STATUS_OK;
+}
+
+// One block out, one block back, with any number of S(WTX) in between.
+uint8_t IsoDep::transact( uint8_t pcb, const uint8_t* inf, uint8_t infLen, uint8_t* rxPcb, uint8_t* rx, size_t room, uint8_t* rxLen )
+{
+	_pcd.PCD_SetTimeoutProfile( MFRC522::TIMEOUT_ISO_DEP, _fwtUs );
+	uint8_t status = exchange( pcb, inf, infLen, rxPcb, rx, room, rxLen );
+	for( uint8_t wtx = 0; status == MFRC522::STATUS_OK && IS_S_BLOCK( *rxPcb ) && ( *rxPcb & 0x30 ) == 0x30; wtx++ )
+	{
+		uint8_t wtxm = _sInf & 0x3F;
+		if( !wtxm || wtxm > 59 || wtx >= ISO_DEP_MAX_WTX )
+		{
+			return MFRC522::STATUS_ERROR;
+		}
+		_stats.wtx++;
+		// The extension only holds for the answer to our S(WTX) response
+		uint32_t fwt = _fwtUs * wtxm;
+		_pcd.PCD_SetTimeoutProfile( MFRC522::TIMEOUT_ISO_DEP, fwt < ISO_DEP_FWT_MAX_US ? fwt : ISO_DEP_FWT_MAX_US );
+		status = exchange( PCB_S_WTX, &wtxm, 1, rxPcb, rx, room, rxLen );
+	}
+	return status;
+}
+
+// Sends PCB + INF and reads back the PCB, skipping CID/NAD, with the INF going to rx.
+// The CRC_A is done by the MFRC522 in both directions.
+uint8_t IsoDep::exchange( uint8_t pcb, const uint8_t* inf, uint8_t infLen, uint8_t* rxPcb, uint8_t* rx, size_t room, uint8_t* rxLen )
+{
+	bool slow = _pcd.PCD_GetTxBitRate() == MFRC522::BITRATE_106 && _pcd.PCD_GetRxBitRate() == MFRC522::BITRATE_106;
+	if( slow )		// Above 106 kbit/s PCD_SetBitRate() has switched the CRC on for good
+	{
+		_pcd.PCD_SetRegisterBitMask( MFRC522::TxModeReg, 0x80 );
+		_pcd.PCD_SetRegisterBitMask( MFRC522::RxModeReg, 0x80 );
+	}
+	uint8_t status = _pcd.PCD_StartCommunication( MFRC522::PCD_Transceive, 0x30, &pcb, 1, 0, 0, inf, infLen );
+	if( status == MFRC522::STATUS_OK )
+	{
+		while( !_pcd.PCD_PollCommunication( &status ) )
+		{
+		}
+	}
+	if( status == MFRC522::STATUS_OK )
+	{
+		uint8_t error = _pcd.PCD_ReadRegister( MFRC522::ErrorReg );
+		uint8_t n = _pcd.PCD_ReadRegister( MFRC522::FIFOLevelReg ) & 0x7F;
+		if( error & 0x13 )				// BufferOvfl ParityErr ProtocolErr
+		{
+			status = MFRC522::STATUS_ERROR;
+		}
+		else if( error & 0x04 )			// CRCErr
+		{
+			status = MFRC522::STATUS_CRC_WRONG;
+		}
+		else if( n < 1 )
+		{
+			status = MFRC522::STATUS_ERROR;
+		}
+		else
+		{
+			uint8_t header[3];
+			_pcd.PCD_ReadRegister( MFRC522::FIFODataReg, 1, header );
+			*rxPcb = header[0];
+			uint8_t skip = ( header[0] & PCB_CID ? 1 : 0 ) + ( IS_I_BLOCK( header[0] ) && ( header[0] & PCB_NAD ) ? 1 : 0 );
+			n--;
+			if( skip > n )
+			{
+				status = MFRC522::STATUS_ERROR;
+			}
+			else
+			{
+				if( skip ) _pcd.PCD_ReadRegister( MFRC522::FIFODataReg, skip, &header[1] );
+				n -= skip;
+				if( IS_S_BLOCK( header[0] ) )
+				{
+					if( n ) _pcd.PCD_ReadRegister( MFRC522::FIFODataReg, 1, &_sInf );
+					*rxLen = 0;
+				}
+				else if( n > room )
+				{
+					status = MFRC522::STATUS_NO_ROOM;
+				}
+				else
+				{
+					if( n ) _pcd.PCD_ReadRegister( MFRC522::FIFODataReg, n, rx );
+					*rxLen = n;
+				}
+			}
+		}
+	}
+	if( slow )
+	{
+		_pcd.PCD_ClearRegisterBitMask( MFRC522::TxModeReg, 0x80 );
+		_pcd.PCD_ClearRegisterBitMask( MFRC522::RxModeReg, 0x80 );
+	}
+	return status;
+}
+
+// Gives up on the PICC. Errors at a raised bit rate make the next activation negotiate a lower one.
+uint8_t IsoDep::fail( uint8_t status )
+{
+	if( status != MFRC522::STATUS_NO_ROOM )
+	{
+		_pcd.PCD_BitRateFallback();
+		_active = false;
+	}
+	return status;
+}
@@ -0,0 +1,63 @@
+#ifndef _ISO_DEP_H_
+#define _ISO_DEP_H_
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "MFRC522.h"
+
+#define ISO_DEP_FSDI 5					// We accept frames of up to 64 bytes, what the FIFO holds without streaming
+#define ISO_DEP_ATS_SIZE 64
+#define ISO_DEP_MAX_RETRIES 2			// R(NAK)/R(ACK) or retransmissions per block before giving up
+#define ISO_DEP_MAX_WTX 16				// Waiting time extensions granted for one block
+#define ISO_DEP_FWT_DELTA_US 3625		// ISO/IEC 14443-4 allows the PICC FWT + 49152/fc
+#define ISO_DEP_FWT_MAX_US 4949000		// FWI 14, the longest FWT a PICC may ask for
+
+// ISO/IEC 14443-4 (T=CL, ISO-DEP) block transport on top of MFRC522.
+// A PICC selected with SAK bit 6 set is activated with RATS/PPS, then APDUs are exchanged
+// as I-block chains. Command bytes go from the caller's buffer into the FIFO and the
+// response goes from the FIFO straight into the caller's buffer; nothing is copied in between.
+class IsoDep
+{
+public:
+	struct Stats
+	{
+		uint32_t apdus;
+		uint32_t bytes_out;			// APDU bytes sent
+		uint32_t bytes_in;			// Response bytes received
+		uint32_t busy_us;			// Time spent in transceiveApdu(), for bytes per second
+		uint32_t blocks;			// Frames exchanged, including R- and S-blocks
+		uint32_t retries;
+		uint32_t wtx;
+	};
+
+	IsoDep( MFRC522& pcd );
+
+	// RATS, ATS parsing and PPS. The PICC must be ACTIVE, selected with this SAK.
+	uint8_t activate( uint8_t sak );
+	// Sends one APDU and collects the whole response. responseLen gets the number of bytes written to response.
+	uint8_t transceiveApdu( std::span<const uint8_t> command, std::span<uint8_t> response, size_t* responseLen );
+	// S(DESELECT); the PICC goes to HALT and the MFRC522 back to 106 kbit/s.
+	uint8_t deselect();
+
+	bool active() const { return _active; }
+	uint16_t fsc() const { return _fsc; }
+	uint32_t fwt_us() const { return _fwtUs; }
+	std::span<const uint8_t> ats() const { return std::span<const uint8_t>( _ats, _atsLen ); }
+	const Stats& stats() const { return _stats; }
+private:
+	uint8_t transact( uint8_t pcb, const uint8_t* inf, uint8_t infLen, uint8_t* rxPcb, uint8_t* rx, size_t room, uint8_t* rxLen );
+	uint8_t exchange( uint8_t pcb, const uint8_t* inf, uint8_t infLen, uint8_t* rxPcb, uint8_t* rx, size_t room, uint8_t* rxLen );
+	uint8_t fail( uint8_t status );
+
+	MFRC522& _pcd;
+	bool _active;
+	uint8_t _blockNumber;
+	uint16_t _fsc;					// Largest frame the PICC accepts, CRC_A included
+	uint32_t _fwtUs;
+	uint8_t _ats[ ISO_DEP_ATS_SIZE ];
+	uint8_t _atsLen;
+	uint8_t _sInf;					// INF byte of the last S-block received (WTXM)
+	Stats _stats;
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include "keymap.h"
+#include <ctype.h>
+
+bool Keymap::can_type( char c )
+{
+	uint8_t modifier;
+	return keycode( c, &modifier ) != 0;
+}
+
+uint8_t Keymap::keycode( char c, uint8_t* modifier )
+{
+	if( !c ) return 0;
+	*modifier = 0;
+
+	// Handle letters (A-Z, a-z)
+	// Cast first: a char above 0x7F is negative, which the <ctype.h> functions do not take
+	unsigned char u = (unsigned char)c;
+	if ( isalpha( u ) )
+	{
+		if ( isupper( u ) ) *modifier = KEYMAP_SHIFT;
+		return KEY_A + ( toupper( u ) - 'A' );
+	}
+
+	// Handle numbers (0-9), the usage IDs go 1..9 then 0
+	if ( isdigit( u ) )
+	{
+		return c == '0' ? KEY_0 : KEY_1 + ( c - '1' );
+	}
+
+	// Handle some punctuation, and Tab and Enter between a password and a TOTP
+	switch ( c )
+	{
+		case '\t': return KEY_TAB;
+		case '\n': return KEY_ENTER;
+		case '!': *modifier = KEYMAP_SHIFT; return KEY_1;
+		case '@': *modifier = KEYMAP_SHIFT; return KEY_2;
+		case '#': *modifier = KEYMAP_SHIFT; return KEY_3;
+		case '$': *modifier = KEYMAP_SHIFT; return KEY_4;
+		case '%': *modifier = KEYMAP_SHIFT; return KEY_5;
+		case '^': *modifier = KEYMAP_SHIFT; return KEY_6;
+		case '&': *modifier = KEYMAP_SHIFT; return KEY_7;
+		case '*': *modifier = KEYMAP_SHIFT; return KEY_8;
+		case '(': *modifier = KEYMAP_SHIFT; return KEY_9;
+		case ')': *modifier = KEYMAP_SHIFT; return KEY_0;
+		case '-': return KEY_MINUS;
+		case '_': *modifier = KEYMAP_SHIFT; return KEY_MINUS;
+		case '=': return KEY_EQUAL;
+		case '+': *modifier = KEYMAP_SHIFT; return KEY_EQUAL;
+		case '[': return KEY_BRACKET_LEFT;
+		case '{': *modifier = KEYMAP_SHIFT; return KEY_BRACKET_LEFT;
+		case ']': return KEY_BRACKET_RIGHT;
+		case '}': *modifier = KEYMAP_SHIFT; return KEY_BRACKET_RIGHT;
+		case '\\': return KEY_BACKSLASH;
+		case '|': *modifier = KEYMAP_SHIFT; return KEY_BACKSLASH;
+		case ';': return KEY_SEMICOLON;
+		case ':': *modifier = KEYMAP_SHIFT; return KEY_SEMICOLON;
+		case '\'': return KEY_APOSTROPHE;
+		case '\"': *modifier = KEYMAP_SHIFT; return KEY_APOSTROPHE;
+		case ',': return KEY_COMMA;
+		case '<': *modifier = KEYMAP_SHIFT; return KEY_COMMA;
+		case '.': return KEY_PERIOD;
+		case '>': *modifier = KEYMAP_SHIFT; return KEY_PERIOD;
+		case '/': return KEY_SLASH;
+		case '?': *modifier = KEYMAP_SHIFT; return KEY_SLASH;
+		default: return 0;
+	}
+}
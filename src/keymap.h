@@ -0,0 +1,42 @@
+#ifndef _KEYMAP_H_
+#define _KEYMAP_H_
+#include <cstdint>
+
+#define KEYMAP_SHIFT 0x02		// Left Shift in the modifier byte of a keyboard report
+
+// Which key types a character on a US layout, as HID keyboard usage IDs.
+// Pure, no USB stack behind it, so the host tools under tools/ ask the same table the device types from.
+class Keymap
+{
+public:
+	// Keyboard page usage IDs (HID Usage Tables, chapter 10); usb_device.cpp checks them against TinyUSB's HID_KEY_*
+	static constexpr uint8_t KEY_A = 0x04;
+	static constexpr uint8_t KEY_1 = 0x1E;
+	static constexpr uint8_t KEY_2 = 0x1F;
+	static constexpr uint8_t KEY_3 = 0x20;
+	static constexpr uint8_t KEY_4 = 0x21;
+	static constexpr uint8_t KEY_5 = 0x22;
+	static constexpr uint8_t KEY_6 = 0x23;
+	static constexpr uint8_t KEY_7 = 0x24;
+	static constexpr uint8_t KEY_8 = 0x25;
+	static constexpr uint8_t KEY_9 = 0x26;
+	static constexpr uint8_t KEY_0 = 0x27;
+	static constexpr uint8_t KEY_ENTER = 0x28;
+	static constexpr uint8_t KEY_TAB = 0x2B;
+	static constexpr uint8_t KEY_MINUS = 0x2D;
+	static constexpr uint8_t KEY_EQUAL = 0x2E;
+	static constexpr uint8_t KEY_BRACKET_LEFT = 0x2F;
+	static constexpr uint8_t KEY_BRACKET_RIGHT = 0x30;
+	static constexpr uint8_t KEY_BACKSLASH = 0x31;
+	static constexpr uint8_t KEY_SEMICOLON = 0x33;
+	static constexpr uint8_t KEY_APOSTROPHE = 0x34;
+	static constexpr uint8_t KEY_COMMA = 0x36;
+	static constexpr uint8_t KEY_PERIOD = 0x37;
+	static constexpr uint8_t KEY_SLASH = 0x38;
+
+	// Usage ID of the key for c, 0 if no key types it; *modifier gets the shift it needs
+	static uint8_t keycode( char c, uint8_t* modifier );
+	static bool can_type( char c );
+};
+
+#endif
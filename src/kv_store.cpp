@@ -0,0 +1,428 @@
+#include "kv_store.h"
+#include <string.h>
+#include "flash_storage.h"
+#include "log.h"
+#include "bsp/board.h"
+
+static_assert( KV_SECTORS <= 16, "Record offsets / 4 must fit the 16 bit index" );
+static_assert( KV_MAX_KEYS * ( ( 4 + KV_MAX_KEY + KV_MAX_VALUE + 3 ) & ~3 ) < ( KV_SECTORS - KV_SPARE_SECTORS - 2 ) * ( FLASH_SECTOR_SIZE - 16 ),
+	"Live records must leave room for compaction" );
+
+uint16_t KvStore::_index[ KV_INDEX_SLOTS ];
+uint16_t KvStore::_keys = 0;
+uint16_t KvStore::_live[ KV_SECTORS ];
+KvStore::SectorState KvStore::_state[ KV_SECTORS ];
+uint32_t KvStore::_sequence[ KV_SECTORS ];
+uint32_t KvStore::_erases[ KV_SECTORS ];
+uint32_t KvStore::_nextSequence = 0;
+uint32_t KvStore::_compactions = 0;
+int KvStore::_head = -1;
+uint32_t KvStore::_write = 0;
+uint32_t KvStore::_pageStart = FLASH_KV_SIZE;
+uint8_t KvStore::_page[ FLASH_PAGE_SIZE ];
+bool KvStore::_pageDirty = false;
+uint32_t KvStore::_lastPut = 0;
+
+static uint32_t fnv1a( uint32_t hash, const uint8_t* p, uint32_t size )
+{
+	while( size-- ) hash = ( hash ^ *p++ ) * 16777619u;
+	return hash;
+}
+
+static uint16_t home_slot( const uint8_t* key, uint8_t keyLen )
+{
+	return fnv1a( 2166136261u, key, keyLen ) & ( KV_INDEX_SLOTS - 1 );
+}
+
+uint16_t KvStore::check( const uint8_t* key, uint8_t keyLen, const uint8_t* value, uint8_t valueLen )
+{
+	uint8_t lens[2] = { keyLen, valueLen };
+	uint32_t hash = fnv1a( fnv1a( fnv1a( 2166136261u, lens, 2 ), key, keyLen ), value, valueLen );
+	return hash ^ ( hash >> 16 );
+}
+
+// Bytes of the page being filled come from the RAM copy, everything else is already in flash
+void KvStore::read( uint32_t offset, void* dst, uint32_t size )
+{
+	uint8_t* out = (uint8_t*)dst;
+	while( size )
+	{
+		uint32_t n;
+		if( offset >= _pageStart && offset < _pageStart + FLASH_PAGE_SIZE )
+		{
+			n = _pageStart + FLASH_PAGE_SIZE - offset < size ? _pageStart + FLASH_PAGE_SIZE - offset : size;
+			memcpy( out, &_page[ offset - _pageStart ], n );
+		}
+		else
+		{
+			n = offset < _pageStart && _pageStart - offset < size ? _pageStart - offset : size;
+			memcpy( out, FlashStorage::xip( FLASH_KV_OFFSET + offset ), n );
+		}
+		out += n;
+		offset += n;
+		size -= n;
+	}
+}
+
+bool KvStore::read_record( uint32_t offset, Record* record, uint8_t* key, uint8_t* value )
+{
+	read( offset, record, sizeof( Record ) );
+	if( !record->keyLen || record->keyLen > KV_MAX_KEY || record->valueLen > KV_MAX_VALUE ||
+		offset % FLASH_SECTOR_SIZE + record_size( record->keyLen, record->valueLen ) > FLASH_SECTOR_SIZE ) return false;
+	read( offset + sizeof( Record ), key, record->keyLen );
+	read( offset + sizeof( Record ) + record->keyLen, value, record->valueLen );
+	return record->check == check( key, record->keyLen, value, record->valueLen );
+}
+
+// Offset of the newest record of key, or NO_OFFSET. slot is where the key is or would go in the index.
+uint32_t KvStore::find( const uint8_t* key, uint8_t keyLen, uint16_t* slot )
+{
+	uint8_t stored[ sizeof( Record ) + KV_MAX_KEY ];
+	for( uint16_t i = home_slot( key, keyLen );; i = ( i + 1 ) & ( KV_INDEX_SLOTS - 1 ) )
+	{
+		if( !_index[i] )
+		{
+			*slot = i;
+			return NO_OFFSET;
+		}
+		uint32_t offset = ( _index[i] - 1 ) * 4;
+		read( offset, stored, sizeof( Record ) );
+		if( stored[0] != keyLen ) continue;
+		read( offset + sizeof( Record ), &stored[ sizeof( Record ) ], keyLen );
+		if( !memcmp( &stored[ sizeof( Record ) ], key, keyLen ) )
+		{
+			*slot = i;
+			return offset;
+		}
+	}
+}
+
+// Linear probing without tombstones: later entries of the probe run move up into the hole
+void KvStore::index_erase( uint16_t slot )
+{
+	uint8_t stored[ sizeof( Record ) + KV_MAX_KEY ];
+	_index[ slot ] = 0;
+	for( uint16_t i = ( slot + 1 ) & ( KV_INDEX_SLOTS - 1 ); _index[i]; i = ( i + 1 ) & ( KV_INDEX_SLOTS - 1 ) )
+	{
+		uint32_t offset = ( _index[i] - 1 ) * 4;
+		read( offset, stored, sizeof( Record ) );
+		read( offset + sizeof( Record ), &stored[ sizeof( Record ) ], stored[0] );
+		uint16_t home = home_slot( &stored[ sizeof( Record ) ], stored[0] );
+		// Moves if its home is not in the cyclic range (slot, i]
+		if( ( ( i - home ) & ( KV_INDEX_SLOTS - 1 ) ) >= ( ( i - slot ) & ( KV_INDEX_SLOTS - 1 ) ) )
+		{
+			_index[ slot ] = _index[i];
+			_index[i] = 0;
+			slot = i;
+		}
+	}
+}
+
+// Points the index at the record just read or written at offset
+void KvStore::apply( uint32_t offset, const uint8_t* key, uint8_t keyLen, uint8_t valueLen )
+{
+	uint16_t slot;
+	uint32_t old = find( key, keyLen, &slot );
+	if( old != NO_OFFSET )
+	{
+		Record record;
+		read( old, &record, sizeof( record ) );
+		_live[ old / FLASH_SECTOR_SIZE ] -= record_size( record.keyLen, record.valueLen );
+	}
+	if( !valueLen )
+	{
+		if( old == NO_OFFSET ) return;
+		index_erase( slot );
+		_keys--;
+		return;
+	}
+	if( old == NO_OFFSET ) _keys++;
+	_index[ slot ] = offset / 4 + 1;
+	_live[ offset / FLASH_SECTOR_SIZE ] += record_size( keyLen, valueLen );
+}
+
+void KvStore::load()
+{
+	memset( _index, 0, sizeof( _index ) );
+	memset( _live, 0, sizeof( _live ) );
+	_keys = 0;
+	_head = -1;
+	_pageStart = FLASH_KV_SIZE;
+	_pageDirty = false;
+	_nextSequence = 0;
+	for( uint8_t s = 0; s < KV_SECTORS; s++ )
+	{
+		SectorHeader header;
+		memcpy( &header, FlashStorage::xip( FLASH_KV_OFFSET + s * FLASH_SECTOR_SIZE ), sizeof( header ) );
+		_erases[s] = header.magic == KV_MAGIC ? header.erases : 0;
+		_sequence[s] = header.sequence;
+		if( header.magic != KV_MAGIC ) _state[s] = SECTOR_DIRTY;
+		else if( header.sequence == 0xFFFFFFFF ) _state[s] = SECTOR_FREE;
+		else _state[s] = SECTOR_USED;
+	}
+
+	// Replays the used sectors oldest first, so the newest record of a key ends up in the index
+	uint32_t records = 0;
+	bool torn = false;
+	for( int last = -1;; )
+	{
+		int s = -1;
+		for( uint8_t i = 0; i < KV_SECTORS; i++ )
+		{
+			if( _state[i] == SECTOR_USED && ( last < 0 || _sequence[i] > _sequence[ last ] ) &&
+				( s < 0 || _sequence[i] < _sequence[s] ) ) s = i;
+		}
+		if( s < 0 ) break;
+		last = s;
+		uint32_t offset = s * FLASH_SECTOR_SIZE + sizeof( SectorHeader );
+		uint32_t end = ( s + 1 ) * FLASH_SECTOR_SIZE;
+		torn = false;
+		while( offset + sizeof( Record ) <= end )
+		{
+			Record record;
+			uint8_t key[ KV_MAX_KEY ];
+			uint8_t value[ KV_MAX_VALUE ];
+			if( FlashStorage::xip( FLASH_KV_OFFSET + offset )[0] == 0xFF ) break;
+			if( !read_record( offset, &record, key, value ) )
+			{
+				LOGS_ERROR( "Credential store: bad record at 0x%lx, rest of the sector skipped", offset );
+				torn = true;
+				break;
+			}
+			apply( offset, key, record.keyLen, record.valueLen );
+			offset += record_size( record.keyLen, record.valueLen );
+			records++;
+		}
+		_head = s;
+		_write = offset;
+		_nextSequence = _sequence[s] + 1;
+	}
+	// A torn write at the end of the log may have left bits programmed past it, so a new sector takes the next record
+	if( torn ) _head = -1;
+	if( _head >= 0 && _write < ( _head + 1u ) * FLASH_SECTOR_SIZE )
+	{
+		_pageStart = _write & ~( FLASH_PAGE_SIZE - 1 );
+		memcpy( _page, FlashStorage::xip( FLASH_KV_OFFSET + _pageStart ), sizeof( _page ) );
+	}
+	LOGS_INFO( "Credential store: %u keys from %lu records", _keys, records );
+}
+
+bool KvStore::get( const uint8_t* key, uint8_t keyLen, uint8_t* value, uint8_t* valueLen )
+{
+	uint16_t slot;
+	uint8_t stored[ KV_MAX_KEY ];
+	Record record;
+	uint32_t offset = find( key, keyLen, &slot );
+	if( offset == NO_OFFSET || !read_record( offset, &record, stored, value ) ) return false;
+	*valueLen = record.valueLen;
+	return true;
+}
+
+void KvStore::write( const uint8_t* data, uint32_t size )
+{
+	while( size )
+	{
+		uint32_t n = _pageStart + FLASH_PAGE_SIZE - _write;
+		if( n > size ) n = size;
+		memcpy( &_page[ _write - _pageStart ], data, n );
+		_write += n;
+		data += n;
+		size -= n;
+		_pageDirty = true;
+		if( _write == _pageStart + FLASH_PAGE_SIZE )
+		{
+			flush();
+			// At the end of the sector there is no page to fill until the next one is opened
+			_pageStart = _write % FLASH_SECTOR_SIZE ? _write : FLASH_KV_SIZE;
+			memset( _page, 0xFF, sizeof( _page ) );
+		}
+	}
+}
+
+// Bits already programmed are programmed again with the same value, so a page can take several flushes
+void KvStore::flush()
+{
+	if( !_pageDirty ) return;
+	FlashStorage::program( FLASH_KV_OFFSET + _pageStart, _page, sizeof( _page ) );
+	_pageDirty = false;
+}
+
+bool KvStore::erase_sector( uint8_t sector )
+{
+	uint8_t page[ FLASH_PAGE_SIZE ];
+	SectorHeader header = { KV_MAGIC, _erases[ sector ] + 1, 0xFFFFFFFF, 0xFFFFFFFF };
+	memset( page, 0xFF, sizeof( page ) );
+	memcpy( page, &header, sizeof( header ) );
+	_state[ sector ] = SECTOR_DIRTY;
+	if( !FlashStorage::erase( FLASH_KV_OFFSET + sector * FLASH_SECTOR_SIZE, FLASH_SECTOR_SIZE ) ||
+		!FlashStorage::program( FLASH_KV_OFFSET + sector * FLASH_SECTOR_SIZE, page, sizeof( page ) ) ) return false;
+	_erases[ sector ]++;
+	_state[ sector ] = SECTOR_FREE;
+	return true;
+}
+
+// Continues the log in the free sector erased the fewest times, erasing a dirty one if there is none
+bool KvStore::open_sector()
+{
+	flush();
+	int pick = -1;
+	for( uint8_t s = 0; s < KV_SECTORS; s++ )
+	{
+		if( _state[s] == SECTOR_FREE && ( pick < 0 || _erases[s] < _erases[ pick ] ) ) pick = s;
+	}
+	for( uint8_t s = 0; s < KV_SECTORS && pick < 0; s++ )
+	{
+		if( _state[s] == SECTOR_DIRTY ) pick = s;
+	}
+	if( pick < 0 || ( _state[ pick ] == SECTOR_DIRTY && !erase_sector( pick ) ) )
+	{
+		LOGS_ERROR( "Credential store: no sector to write to" );
+		return false;
+	}
+	_head = pick;
+	_state[ pick ] = SECTOR_USED;
+	_sequence[ pick ] = _nextSequence++;
+	_live[ pick ] = 0;
+	_pageStart = pick * FLASH_SECTOR_SIZE;
+	memcpy( _page, FlashStorage::xip( FLASH_KV_OFFSET + _pageStart ), sizeof( _page ) );
+	( (SectorHeader*)_page )->sequence = _sequence[ pick ];
+	_write = _pageStart + sizeof( SectorHeader );
+	_pageDirty = true;
+	return true;
+}
+
+bool KvStore::append( const uint8_t* key, uint8_t keyLen, const uint8_t* value, uint8_t valueLen )
+{
+	uint8_t buffer[ ( sizeof( Record ) + KV_MAX_KEY + KV_MAX_VALUE + 3 ) & ~3u ];
+	uint32_t size = record_size( keyLen, valueLen );
+	if( _head < 0 || _write + size > ( _head + 1u ) * FLASH_SECTOR_SIZE )
+	{
+		if( !open_sector() ) return false;
+	}
+	Record record = { keyLen, valueLen, check( key, keyLen, value, valueLen ) };
+	memset( buffer, 0xFF, size );
+	memcpy( buffer, &record, sizeof( record ) );
+	memcpy( &buffer[ sizeof( record ) ], key, keyLen );
+	if( valueLen ) memcpy( &buffer[ sizeof( record ) + keyLen ], value, valueLen );
+	uint32_t offset = _write;
+	write( buffer, size );
+	apply( offset, key, keyLen, valueLen );
+	_lastPut = board_millis();
+	return true;
+}
+
+uint8_t KvStore::count_sectors( SectorState state )
+{
+	uint8_t n = 0;
+	for( uint8_t s = 0; s < KV_SECTORS; s++ ) n += _state[s] == state;
+	return n;
+}
+
+// Moves the live records out of the used sector with the fewest of them. Tombstones of keys that
+// were not put again go along, unless the sector is the oldest one and no compacted sector waits
+// for its erase: then no older record of their key is left to replay.
+bool KvStore::compact()
+{
+	int victim = -1;
+	int oldest = -1;
+	for( uint8_t s = 0; s < KV_SECTORS; s++ )
+	{
+		if( _state[s] != SECTOR_USED ) continue;
+		if( oldest < 0 || _sequence[s] < _sequence[ oldest ] ) oldest = s;
+		if( s != _head && ( victim < 0 || _live[s] < _live[ victim ] ) ) victim = s;
+	}
+	if( victim < 0 ) return false;
+	bool dirty = count_sectors( SECTOR_DIRTY ) > 0;
+	uint32_t offset = victim * FLASH_SECTOR_SIZE + sizeof( SectorHeader );
+	uint32_t end = ( victim + 1 ) * FLASH_SECTOR_SIZE;
+	while( offset + sizeof( Record ) <= end )
+	{
+		Record record;
+		uint8_t key[ KV_MAX_KEY ];
+		uint8_t value[ KV_MAX_VALUE ];
+		uint16_t slot;
+		if( FlashStorage::xip( FLASH_KV_OFFSET + offset )[0] == 0xFF || !read_record( offset, &record, key, value ) ) break;
+		uint32_t live = find( key, record.keyLen, &slot );
+		bool keep = record.valueLen ? live == offset : live == NO_OFFSET && ( victim != oldest || dirty );
+		if( keep && !append( key, record.keyLen, value, record.valueLen ) ) return false;
+		offset += record_size( record.keyLen, record.valueLen );
+	}
+	// The copies must be in flash before the originals can go
+	flush();
+	_state[ victim ] = SECTOR_DIRTY;
+	_compactions++;
+	return true;
+}
+
+// Before a put: enough sectors that are erased or can be, so compaction never runs out of room
+void KvStore::make_room()
+{
+	while( count_sectors( SECTOR_FREE ) + count_sectors( SECTOR_DIRTY ) < KV_SPARE_SECTORS && compact() )
+	{
+	}
+}
+
+bool KvStore::put( const uint8_t* key, uint8_t keyLen, const uint8_t* value, uint8_t valueLen )
+{
+	if( !keyLen || keyLen > KV_MAX_KEY || !valueLen || valueLen > KV_MAX_VALUE ) return false;
+	uint16_t slot;
+	uint32_t offset = find( key, keyLen, &slot );
+	if( offset != NO_OFFSET )
+	{
+		Record record;
+		uint8_t stored[ KV_MAX_KEY ];
+		uint8_t current[ KV_MAX_VALUE ];
+		if( read_record( offset, &record, stored, current ) && record.valueLen == valueLen && !memcmp( current, value, valueLen ) )
+			return true;		// Unchanged, nothing to wear the flash with
+	}
+	else if( _keys >= KV_MAX_KEYS )
+	{
+		LOGS_ERROR( "Credential store full, %d keys", KV_MAX_KEYS );
+		return false;
+	}
+	make_room();
+	return append( key, keyLen, value, valueLen );
+}
+
+bool KvStore::remove( const uint8_t* key, uint8_t keyLen )
+{
+	uint16_t slot;
+	if( !keyLen || keyLen > KV_MAX_KEY || find( key, keyLen, &slot ) == NO_OFFSET ) return false;
+	make_room();
+	return append( key, keyLen, nullptr, 0 );
+}
+
+void KvStore::step( uint32_t now_ms )
+{
+	if( _pageDirty && now_ms - _lastPut >= KV_FLUSH_DELAY_MS )
+	{
+		flush();
+		return;
+	}
+	for( uint8_t s = 0; s < KV_SECTORS; s++ )
+	{
+		if( _state[s] == SECTOR_DIRTY )
+		{
+			erase_sector( s );
+			return;
+		}
+	}
+	if( count_sectors( SECTOR_FREE ) < KV_SPARE_SECTORS ) compact();
+}
+
+KvStore::Stats KvStore::stats()
+{
+	Stats stats = {};
+	stats.keys = _keys;
+	stats.used_sectors = count_sectors( SECTOR_USED );
+	stats.free_sectors = count_sectors( SECTOR_FREE );
+	stats.min_erases = 0xFFFFFFFF;
+	for( uint8_t s = 0; s < KV_SECTORS; s++ )
+	{
+		stats.live_bytes += _live[s];
+		if( _erases[s] < stats.min_erases ) stats.min_erases = _erases[s];
+		if( _erases[s] > stats.max_erases ) stats.max_erases = _erases[s];
+	}
+	stats.compactions = _compactions;
+	return stats;
+}
@@ -0,0 +1,103 @@
+#ifndef _KV_STORE_H_
+#define _KV_STORE_H_
+#include <cstdint>
+#include "flash_layout.h"
+#include "usb_device.h"
+
+#define KV_MAGIC 0x3153564B			// "KVS1"
+#define KV_SECTORS ( FLASH_KV_SIZE / FLASH_SECTOR_SIZE )
+#define KV_MAX_KEY 11				// Longest UID and the vault's record type
+#define KV_MAX_VALUE ( MAX_PASS_LEN + 12 )	// A MAX_PASS_LEN password encrypted by the vault, with its nonce and tag
+#define KV_INDEX_SLOTS 1024			// Power of two
+#define KV_MAX_KEYS 512				// Keeps the index at most half full
+#define KV_SPARE_SECTORS 2			// Erased sectors compaction keeps ready, so a put never waits for an erase
+#define KV_FLUSH_DELAY_MS 1000		// Puts are collected in the page buffer this long before it is programmed
+
+// Maps a key (a card UID) to a value (its credential) in a log in flash.
+// A put appends a record to the newest sector and a remove appends a tombstone; nothing is
+// rewritten in place. Records are collected in a RAM copy of the page being filled and programmed
+// a page at a time, once the page is full or KV_FLUSH_DELAY_MS after the last put. Writes are batched
+// per 256 byte page, the unit flash programs in, not per 4 KB sector: a sector's worth of credentials
+// would sit in RAM, lost on a reset, until enough cards changed. The sector is the unit of erase and compaction.
+// A RAM index maps every key to the offset of its newest record, and get() reads that record straight
+// through XIP. step() does the rest in the background, one job per call: the delayed flush (one page
+// program), erasing a sector whose records were moved (its erase and the program of its header), or,
+// when fewer than KV_SPARE_SECTORS are erased, moving the live records out of the sector with the
+// fewest, which programs up to a sector's worth of pages. FlashStorage lets USB run between any two
+// of those operations, so no job holds the bus off longer than one erase. New sectors are taken in order of their
+// erase count, which is kept in the sector header, so erases spread over the whole region.
+// KV_MAX_KEYS records of the largest size fill about 12 of the 16 sectors, so when the spare
+// sectors run low there is always a used sector that is partly garbage to compact.
+class KvStore
+{
+public:
+	struct Stats
+	{
+		uint16_t keys;
+		uint8_t used_sectors;
+		uint8_t free_sectors;		// Erased and ready
+		uint32_t live_bytes;		// Newest record of every key
+		uint32_t min_erases;
+		uint32_t max_erases;
+		uint32_t compactions;
+	};
+
+	static void load();		// Replays the log, at startup
+	// value must have room for KV_MAX_VALUE bytes
+	static bool get( const uint8_t* key, uint8_t keyLen, uint8_t* value, uint8_t* valueLen );
+	static bool put( const uint8_t* key, uint8_t keyLen, const uint8_t* value, uint8_t valueLen );
+	static bool remove( const uint8_t* key, uint8_t keyLen );
+	static void flush();	// Programs the buffered page now
+	static void step( uint32_t now_ms );
+	static uint16_t count() { return _keys; }
+	static Stats stats();
+private:
+	enum SectorState : uint8_t { SECTOR_DIRTY, SECTOR_FREE, SECTOR_USED };
+	struct SectorHeader
+	{
+		uint32_t magic;
+		uint32_t erases;
+		uint32_t sequence;		// Order in the log, all ones while the sector is free
+		uint32_t reserved;
+	};
+	struct Record
+	{
+		uint8_t keyLen;			// 0xFF: erased, end of the sector's records
+		uint8_t valueLen;		// 0: tombstone
+		uint16_t check;
+		// Key, value, padding to 4 bytes
+	};
+	static const uint32_t NO_OFFSET = 0xFFFFFFFF;
+
+	static uint32_t record_size( uint8_t keyLen, uint8_t valueLen ) { return ( sizeof( Record ) + keyLen + valueLen + 3 ) & ~3u; }
+	static uint16_t check( const uint8_t* key, uint8_t keyLen, const uint8_t* value, uint8_t valueLen );
+	static void read( uint32_t offset, void* dst, uint32_t size );
+	static bool read_record( uint32_t offset, Record* record, uint8_t* key, uint8_t* value );
+	static uint32_t find( const uint8_t* key, uint8_t keyLen, uint16_t* slot );
+	static void index_erase( uint16_t slot );
+	static bool append( const uint8_t* key, uint8_t keyLen, const uint8_t* value, uint8_t valueLen );
+	static void write( const uint8_t* data, uint32_t size );
+	static bool open_sector();
+	static bool erase_sector( uint8_t sector );
+	static void apply( uint32_t offset, const uint8_t* key, uint8_t keyLen, uint8_t valueLen );
+	static void make_room();
+	static bool compact();
+	static uint8_t count_sectors( SectorState state );
+
+	static uint16_t _index[ KV_INDEX_SLOTS ];	// Record offset / 4 + 1, 0 if empty
+	static uint16_t _keys;
+	static uint16_t _live[ KV_SECTORS ];	// Bytes of live records per sector
+	static SectorState _state[ KV_SECTORS ];
+	static uint32_t _sequence[ KV_SECTORS ];
+	static uint32_t _erases[ KV_SECTORS ];
+	static uint32_t _nextSequence;
+	static uint32_t _compactions;
+	static int _head;					// Sector being appended to, -1 if none
+	static uint32_t _write;				// Offset in the region of the next record
+	static uint32_t _pageStart;			// Offset of the page in _page
+	static uint8_t _page[ FLASH_PAGE_SIZE ];
+	static bool _pageDirty;
+	static uint32_t _lastPut;
+};
+
+#endif
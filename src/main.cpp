@@ -9,19 +9,804 @@
 
 #include "log.h"
 #include "usb_device.h"
+#include "keymap.h"
+#include "settings.h"
 #include "MFRC522.h"
+#include "reader_poller.h"
+#include "allowlist.h"
+#include "mph_allowlist.h"
+#include "kv_store.h"
+#include "vault.h"
+#include "derived_password.h"
+#include "totp.h"
+#include "audit_log.h"
+#include "flash_storage.h"
+#include "mifare_image.h"
+#include "ndef.h"
+#include "type2_tag.h"
+#include "zeroize.h"
 
-#define CARD_READ_INTERVAL 5000
+#define HEALTH_CHECK_INTERVAL 250
+#define CALIBRATION_ATTEMPTS 20
+#define CDC_LINE_LEN 96		// "cred", a 10 byte UID in hex and a MAX_PASS_LEN password
+#define NTAG_MAX_PAGES 231		// NTAG216
+#define TAG_AREA_SIZE 888		// NTAG216 data area
+#define CREDENTIAL_TYPE "usb-passworder:password"	// NFC Forum external type of the record holding the password
+#define ENROLL_TIMEOUT_MS 60000		// Enrollment ends by itself after this long without a new card
+#define ENROLL_SAVE_DELAY_MS 2000	// Enrolled UIDs are saved once no new card came for this long
+#define ENROLL_BATCH 10				// or once this many are unsaved
 
 MFRC522::Uid myCard;
 
+// The TOTP of the card being typed, filled by totp_while_typing() while the first key of the password is down
+static MFRC522::Uid totpUid;
+static char totpText[ 1 + TOTP_MAX_DIGITS + 1 ];	// Separator and code
+static bool totpSkipped;
+static uint32_t totpUs;
+
+// Enrollment started by "enroll": every new card tapped is added to the allowlist instead of typing a password
+static bool enrolling;
+static uint16_t enrollUnsaved;		// Cards added since the last good save
+static uint16_t enrolled;
+static uint32_t enrollStart;
+static uint32_t enrollLast;
+static uint32_t enrollSaveTried;
+
+// Shared by all readers: the poller's presence checks and the CDC commands that activate a card.
+// A marginal tap gets another try within the same pass instead of waiting for the next one.
+static MFRC522::RetryPolicy retryPolicy = {
+	2,			// collisionRetries
+	2,			// errorRetries
+	1,			// timeoutRetries, only after the card answered
+	1000,		// timeoutBackoffUs
+	true,		// wakeupOnRetry
+	20000,		// deadlineUs
+	{}
+};
+
+// CS and RST pin of every reader on spi0. Add a line per antenna, e.g. { 9, 21 } for a second one.
+static const uint8_t readerPins[][2] = {
+	{ MFRC522_PIN_CS, MFRC522_PIN_RST },
+};
+#define READER_COUNT ( sizeof( readerPins ) / sizeof( readerPins[0] ) )
+
+ReaderPoller poller;
+MifareImage imager;
+static uint8_t tagArea[ TAG_AREA_SIZE ];
+static uint8_t tagWrite[ TAG_AREA_SIZE ];
+
+static void calibrate_antenna( MFRC522 &mfrc )
+{
+	char line[ CDC_LINE_LEN ];
+	MFRC522::GainCalibration results[ MFRC522::GAIN_STEPS ];
+	uint8_t gain;
+	UsbDevice::write_line( "Calibrating, keep the reference card on the reader\n\r" );
+	uint8_t status = mfrc.PCD_CalibrateAntennaGain( CALIBRATION_ATTEMPTS, &gain, results );
+	for( uint8_t i = 0; i < MFRC522::GAIN_STEPS; i++ )
+	{
+		snprintf( line, sizeof( line ), "RxGain 0x%02X: %u ok, %u errors, %u timeouts\n\r", results[i].gain,
+			results[i].successes, results[i].errors, results[i].timeouts );
+		UsbDevice::write_line( line );
+	}
+	if( status != MFRC522::STATUS_OK )
+	{
+		LOGS_ERROR( "Antenna calibration failed, no card answered" );
+		UsbDevice::write_line( "Calibration failed, no card answered\n\r" );
+		return;
+	}
+	Settings::set_rx_gain( gain );
+	bool saved = Settings::save();
+	LOGS_INFO( "Antenna gain calibrated to 0x%02X", gain );
+	snprintf( line, sizeof( line ), "RxGain 0x%02X selected%s\n\r", gain, saved ? " and saved" : ", save failed" );
+	UsbDevice::write_line( line );
+}
+
+static void image_card( uint8_t index )
+{
+	char line[ CDC_LINE_LEN ];
+	MFRC522 &mfrc = poller.reader( index );
+	MFRC522::Uid uid;
+	poller.finish( index );
+	// Cards are imaged before they are enrolled, so the allowlist must not drop them
+	mfrc.PICC_SetUidFilter( NULL );
+	uint8_t status = mfrc.PICC_Activate( &uid, true );
+	if( status == MFRC522::STATUS_OK ) status = imager.read( mfrc, &uid, UsbDevice::write );
+	mfrc.PICC_SetUidFilter( Allowlist::matches );
+	if( status != MFRC522::STATUS_OK )
+	{
+		LOGS_ERROR( "MIFARE Classic image failed, status %d", status );
+		snprintf( line, sizeof( line ), "\n\rImage failed, status %u\n\r", status );
+		UsbDevice::write_line( line );
+		return;
+	}
+	const MifareImage::Stats &stats = imager.stats();
+	LOGS_INFO( "Imaged %u sectors, %u bytes in %lu us", stats.sectors, stats.bytes, stats.duration_us );
+	snprintf( line, sizeof( line ), "\n\rImage %u bytes, %u sectors (%u unreadable), %u auths, %lu us\n\r",
+		stats.bytes, stats.sectors, stats.unreadable, stats.auths, stats.duration_us );
+	UsbDevice::write_line( line );
+}
+
+static void read_ntag( uint8_t index )
+{
+	static uint8_t pages[ 4 * NTAG_MAX_PAGES ];
+	char line[ CDC_LINE_LEN ];
+	MFRC522 &mfrc = poller.reader( index );
+	MFRC522::Uid uid;
+	uint8_t version[ MFRC522::UL_VERSION_SIZE ];
+	uint8_t signature[ MFRC522::UL_SIGNATURE_SIZE ];
+	uint32_t counter = 0;
+	uint16_t count = 0;
+	uint16_t size = sizeof( pages );
+	poller.finish( index );
+	mfrc.PICC_SetUidFilter( NULL );
+	uint8_t status = mfrc.PICC_Activate( &uid, true );
+	if( status == MFRC522::STATUS_OK ) status = mfrc.MIFARE_Ultralight_GetVersion( version );
+	if( status == MFRC522::STATUS_OK )
+	{
+		count = MFRC522::MIFARE_Ultralight_PageCount( version );
+		if( !count || count > NTAG_MAX_PAGES ) status = MFRC522::STATUS_INVALID;
+	}
+	uint32_t start = time_us_32();
+	// One FAST_READ for the whole memory, however large
+	if( status == MFRC522::STATUS_OK ) status = mfrc.MIFARE_Ultralight_FastRead( 0, count - 1, pages, &size );
+	uint32_t duration = time_us_32() - start;
+	if( status == MFRC522::STATUS_OK ) status = mfrc.MIFARE_Ultralight_ReadSignature( signature );
+	// Ultralight EV1 without NFC counter or NTAG with it disabled NAKs this, which is not an error
+	if( status == MFRC522::STATUS_OK && mfrc.MIFARE_Ultralight_ReadCounter( 2, &counter ) != MFRC522::STATUS_OK ) counter = 0xFFFFFFFF;
+	mfrc.PICC_HaltA();
+	mfrc.PICC_SetUidFilter( Allowlist::matches );
+	if( status != MFRC522::STATUS_OK )
+	{
+		LOGS_ERROR( "NTAG read failed, status %d", status );
+		snprintf( line, sizeof( line ), "NTAG read failed, status %u\n\r", status );
+		UsbDevice::write_line( line );
+		return;
+	}
+	LOGS_INFO( "NTAG %u pages read in %lu us", count, duration );
+	snprintf( line, sizeof( line ), "Type %02X/%02X, %u pages in %lu us, counter %ld\n\r", version[2], version[3], count,
+		duration, (long)counter );
+	UsbDevice::write_line( line );
+	UsbDevice::write( pages, size );
+	UsbDevice::write( signature, sizeof( signature ) );
+	UsbDevice::write_line( "\n\r" );
+}
+
+// Reads the data area of the Type 2 tag on a reader. The tag is halted again afterwards.
+static uint8_t read_tag( uint8_t index, const MFRC522::Uid *uid, Type2Tag &tag, std::span<const uint8_t> *message )
+{
+	MFRC522 &mfrc = poller.reader( index );
+	poller.finish( index );
+	uint8_t status = mfrc.PICC_ConfirmUid( uid, true );
+	if( status == MFRC522::STATUS_OK ) status = tag.read_message( tagArea, message );
+	mfrc.PICC_HaltA();
+	return status;
+}
+
+static bool find_credential( std::span<const uint8_t> message, std::span<const uint8_t> *password )
+{
+	NdefRecordReader records( message );
+	NdefRecord record;
+	while( records.next( &record ) )
+	{
+		if( record.tnf() == NDEF_TNF_EXTERNAL && record.type.size() == strlen( CREDENTIAL_TYPE ) &&
+			!memcmp( record.type.data(), CREDENTIAL_TYPE, record.type.size() ) )
+		{
+			*password = record.payload;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void totp_while_typing()
+{
+	uint32_t start = time_us_32();
+	uint8_t record[ TOTP_RECORD_HEADER + TOTP_MAX_SEED ];
+	uint8_t len;
+	totpText[0] = '\0';
+	if( !Vault::get_totp( totpUid, record, &len ) ) return;
+	if( len <= TOTP_RECORD_HEADER || record[0] < 6 || record[0] > TOTP_MAX_DIGITS ) LOGS_ERROR( "TOTP record invalid" );
+	else if( Totp::synced() )
+	{
+		uint8_t n = 0;
+		if( record[1] ) totpText[ n++ ] = record[1];
+		Totp::code( &record[ TOTP_RECORD_HEADER ], len - TOTP_RECORD_HEADER, Totp::now() / TOTP_STEP_S, record[0], &totpText[n] );
+	}
+	else totpSkipped = true;
+	zeroize( record, sizeof( record ) );
+	totpUs = time_us_32() - start;
+}
+
+// Types the password, then the separator and TOTP of the card if it has a TOTP record
+static bool send_password( const MFRC522::Uid &uid, const char *password, uint32_t len )
+{
+	totpUid = uid;
+	totpText[0] = '\0';
+	totpSkipped = false;
+	bool sent = UsbDevice::send_text( password, len, totp_while_typing );
+	if( sent && totpText[0] ) sent = UsbDevice::send_text( totpText, sizeof( totpText ) );
+	zeroize( totpText, sizeof( totpText ) );
+	if( totpSkipped )
+	{
+		LOGS_ERROR( "TOTP skipped, time not synced" );
+		UsbDevice::write_line( "TOTP skipped, send the time first\n\r" );
+	}
+	return sent;
+}
+
+// Types the derived password if that mode is on, else the password stored for the UID,
+// else the one on the tag if it is a Type 2 tag with a credential record. A stored password whose
+// record fails the vault's check is refused.
+// There is no built-in password to fall back on: an allowlisted card without a credential types
+// nothing and "No credential" goes out over CDC; "cred <uid> <password>" gives it one.
+// status is the result of reading the tag, STATUS_OK if the tag was not read.
+static bool type_password( uint8_t index, const MFRC522::Uid &uid, uint8_t *status )
+{
+	*status = MFRC522::STATUS_OK;
+	uint8_t stored[ MAX_PASS_LEN ];
+	uint8_t len;
+	if( Settings::derive_length() )
+	{
+		char derived[ MAX_PASS_LEN + 1 ];
+		bool sent = DerivedPassword::derive( uid.uidByte, uid.size, Settings::derive_profile(), Settings::derive_length(),
+			Settings::derive_symbols(), derived ) && send_password( uid, derived, Settings::derive_length() );
+		zeroize( derived, sizeof( derived ) );
+		return sent;
+	}
+	if( Vault::get( uid, stored, &len ) )
+	{
+		bool sent = send_password( uid, (const char *)stored, len );
+		zeroize( stored, sizeof( stored ) );
+		return sent;
+	}
+	if( Vault::has( uid ) )		// Failed its check: nothing is typed, not even the password on the tag
+	{
+		UsbDevice::write_line( "Credential refused, store it again with \"cred\"\n\r" );
+		return false;
+	}
+	if( uid.sak == 0x00 )		// MIFARE Ultralight and NTAG
+	{
+		Type2Tag tag( poller.reader( index ) );
+		std::span<const uint8_t> message;
+		std::span<const uint8_t> password;
+		*status = read_tag( index, &uid, tag, &message );
+		if( *status == MFRC522::STATUS_OK && find_credential( message, &password ) )
+		{
+			LOGS_INFO( "Password from tag, read in %lu us", tag.stats().duration_us );
+			return send_password( uid, (const char *)password.data(), password.size() );
+		}
+	}
+	LOGS_INFO( "No credential for the card" );
+	UsbDevice::write_line( "No credential\n\r" );
+	return false;
+}
+
+// Puts a credential record with the given password on the Type 2 tag on the first reader
+static void write_credential( const char *password )
+{
+	char line[ CDC_LINE_LEN ];
+	MFRC522 &mfrc = poller.reader( 0 );
+	MFRC522::Uid uid;
+	Type2Tag tag( mfrc );
+	std::span<const uint8_t> message;
+	poller.finish( 0 );
+	mfrc.PICC_SetUidFilter( NULL );		// Tags are provisioned before they are enrolled
+	uint8_t status = mfrc.PICC_Activate( &uid, true );
+	if( status == MFRC522::STATUS_OK && uid.sak != 0x00 ) status = MFRC522::STATUS_INVALID;
+	// What is on the tag now, so write() only touches the pages that change
+	if( status == MFRC522::STATUS_OK ) status = tag.read_message( tagArea, &message );
+	if( status == MFRC522::STATUS_OK )
+	{
+		NdefWriter writer( std::span<uint8_t>( tagWrite, tag.area_size() < sizeof( tagWrite ) ? tag.area_size() : sizeof( tagWrite ) ) );
+		writer.add( NDEF_TNF_EXTERNAL, std::span<const uint8_t>( (const uint8_t *)CREDENTIAL_TYPE, strlen( CREDENTIAL_TYPE ) ),
+			std::span<const uint8_t>( (const uint8_t *)password, strlen( password ) ) );
+		std::span<const uint8_t> tlvs = writer.finish();
+		status = tlvs.empty() ? (uint8_t)MFRC522::STATUS_NO_ROOM : tag.write( tlvs, std::span<const uint8_t>( tagArea, tag.loaded() ) );
+	}
+	mfrc.PICC_HaltA();
+	mfrc.PICC_SetUidFilter( Allowlist::matches );
+	if( status != MFRC522::STATUS_OK )
+	{
+		LOGS_ERROR( "Writing the credential failed, status %d", status );
+		snprintf( line, sizeof( line ), "Tag write failed, status %u\n\r", status );
+		UsbDevice::write_line( line );
+		return;
+	}
+	const Type2Tag::Stats &stats = tag.stats();
+	snprintf( line, sizeof( line ), "Tag written: %u pages, %u unchanged, %lu us\n\r", stats.pages_written,
+		stats.pages_skipped, stats.duration_us );
+	UsbDevice::write_line( line );
+}
+
+static void apply_power_profile()
+{
+	ReaderPoller::PowerProfile profile;
+	profile.fast_ms = Settings::poll_fast_ms();
+	profile.slow_ms = Settings::poll_slow_ms();
+	profile.hold_ms = Settings::poll_hold_ms();
+	poller.set_power_profile( profile );
+}
+
+static void print_power()
+{
+	char line[ CDC_LINE_LEN ];
+	const ReaderPoller::PowerProfile &profile = poller.power_profile();
+	if( profile.fast_ms ) snprintf( line, sizeof( line ), "Polling every %u..%u ms, fast for %u ms\n\r", profile.fast_ms,
+		profile.slow_ms, profile.hold_ms );
+	else snprintf( line, sizeof( line ), "Polling without power-down\n\r" );
+	UsbDevice::write_line( line );
+	for( uint8_t i = 0; i < poller.count(); i++ )
+	{
+		const ReaderPoller::PowerStats &power = poller.power_stats( i );
+		snprintf( line, sizeof( line ), "Reader %u: %lu uA avg, worst latency %lu us\n\r", i,
+			poller.average_current_ua( i ), poller.worst_latency_us( i ) );
+		UsbDevice::write_line( line );
+		snprintf( line, sizeof( line ), "  %lu wakes, wake-up %lu us, poll %lu us max\n\r", power.wakes, power.wake_us_max,
+			power.poll_us_max );
+		UsbDevice::write_line( line );
+	}
+}
+
+// "power" reports, "power off" polls flat out, "power <fast> <slow> <hold>" sets and saves the duty cycle
+static void set_power( const char *args )
+{
+	unsigned fast = 0, slow = 0, hold = 0;
+	if( !strcmp( args, "off" ) ) Settings::set_polling( 0, 0, 0 );
+	else if( sscanf( args, "%u %u %u", &fast, &slow, &hold ) == 3 && fast && slow >= fast && slow <= 0xFFFF && hold <= 0xFFFF )
+		Settings::set_polling( fast, slow, hold );
+	else
+	{
+		UsbDevice::write_line( "Usage: power off | power <fast ms> <slow ms> <hold ms>\n\r" );
+		return;
+	}
+	apply_power_profile();
+	UsbDevice::write_line( Settings::save() ? "Polling saved\n\r" : "Polling set, save failed\n\r" );
+}
+
+// Entry count and the time of a lookup for a UID that is not on the list, which is the longest search
+static void print_allowlist()
+{
+	char line[ CDC_LINE_LEN ];
+	MFRC522::Uid probe;
+	probe.size = 7;
+	memset( probe.uidByte, 0xFF, sizeof( probe.uidByte ) );
+	uint32_t start = time_us_32();
+	for( uint16_t i = 0; i < 1000; i++ )
+	{
+		probe.uidByte[6] = i;
+		Allowlist::contains( probe );
+	}
+	uint32_t took = time_us_32() - start;
+	snprintf( line, sizeof( line ), "Allowlist %u entries, lookup %lu.%03lu us\n\r", Allowlist::count(), took / 1000, took % 1000 );
+	UsbDevice::write_line( line );
+	if( !MphAllowlist::loaded() ) return;
+	start = time_us_32();
+	for( uint16_t i = 0; i < 1000; i++ )
+	{
+		probe.uidByte[5] = i >> 8;
+		probe.uidByte[6] = i;
+		MphAllowlist::contains( probe.uidByte, probe.size );
+	}
+	took = time_us_32() - start;
+	snprintf( line, sizeof( line ), "Hashed %lu entries, lookup %lu.%03lu us\n\r", MphAllowlist::count(), took / 1000, took % 1000 );
+	UsbDevice::write_line( line );
+}
+
+// UID in hex with no separators, 4, 7 or 10 bytes. rest points behind it.
+static bool parse_uid( const char *text, MFRC522::Uid *uid, const char **rest )
+{
+	uint8_t digits = 0;
+	while( isxdigit( (unsigned char)text[ digits ] ) && digits < 2 * sizeof( uid->uidByte ) ) digits++;
+	if( ( digits != 8 && digits != 14 && digits != 20 ) || ( text[ digits ] && text[ digits ] != ' ' ) ) return false;
+	uid->size = digits / 2;
+	for( uint8_t i = 0; i < uid->size; i++ )
+	{
+		char byte[3] = { text[ 2 * i ], text[ 2 * i + 1 ], '\0' };
+		uid->uidByte[i] = strtoul( byte, NULL, 16 );
+	}
+	*rest = text[ digits ] ? text + digits + 1 : text + digits;
+	return true;
+}
+
+// UID in hex with no separators, the form parse_uid() reads
+static void format_uid( const MFRC522::Uid &uid, char *text )
+{
+	for( uint8_t i = 0; i < uid.size; i++ ) snprintf( &text[ 2 * i ], 3, "%02X", uid.uidByte[i] );
+}
+
+static void save_enrolled()
+{
+	enrollSaveTried = board_millis();
+	if( Allowlist::save() ) enrollUnsaved = 0;
+	else UsbDevice::write_line( "Allowlist save failed\n\r" );
+}
+
+// Readers select every card completely and poll without power-down while enrolling
+static void start_enroll()
+{
+	if( enrolling )
+	{
+		UsbDevice::write_line( "Enrolling already\n\r" );
+		return;
+	}
+	for( uint8_t i = 0; i < poller.count(); i++ )
+	{
+		poller.finish( i );
+		poller.reader( i ).PICC_SetUidFilter( NULL );
+	}
+	ReaderPoller::PowerProfile flatOut = { 0, 0, 0 };
+	poller.set_power_profile( flatOut );
+	enrolling = true;
+	enrolled = 0;
+	enrollStart = enrollLast = board_millis();
+	UsbDevice::write_line( "Enrolling, tap the new cards one after the other, \"enroll stop\" ends\n\r" );
+}
+
+static void stop_enroll()
+{
+	char line[ CDC_LINE_LEN ];
+	if( !enrolling )
+	{
+		UsbDevice::write_line( "Not enrolling\n\r" );
+		return;
+	}
+	enrolling = false;
+	if( enrollUnsaved ) save_enrolled();
+	for( uint8_t i = 0; i < poller.count(); i++ )
+	{
+		poller.finish( i );
+		poller.reader( i ).PICC_SetUidFilter( Allowlist::matches );
+	}
+	apply_power_profile();
+	uint32_t took = enrollLast - enrollStart;
+	snprintf( line, sizeof( line ), "Enrolled %u cards in %lu.%03lu s, allowlist %u entries\n\r", enrolled,
+		(unsigned long)took / 1000, (unsigned long)took % 1000, Allowlist::count() );
+	UsbDevice::write_line( line );
+}
+
+// Adds the card unless it is listed already, in the sorted arrays or the hashed list, and logs it.
+// New cards are saved in batches: every ENROLL_BATCH cards, when the taps pause and when enrollment ends.
+// Allowlist::save() keeps the list it replaces until the new one is verified, so a reset loses at most a batch.
+static void enroll_card( const ReaderPoller::Event &event )
+{
+	char line[ CDC_LINE_LEN ];
+	char hex[ 2 * sizeof( event.uid.uidByte ) + 1 ];
+	format_uid( event.uid, hex );
+	if( Allowlist::contains( event.uid ) )
+	{
+		snprintf( line, sizeof( line ), "Already enrolled %s\n\r", hex );
+		UsbDevice::write_line( line );
+		return;
+	}
+	uint8_t status = MFRC522::STATUS_OK;
+	if( Allowlist::add( event.uid ) )
+	{
+		enrolled++;
+		enrollUnsaved++;
+		enrollLast = board_millis();
+		snprintf( line, sizeof( line ), "Enrolled %s, %u\n\r", hex, enrolled );
+	}
+	else
+	{
+		status = MFRC522::STATUS_NO_ROOM;
+		snprintf( line, sizeof( line ), "Allowlist full, %s not enrolled\n\r", hex );
+	}
+	UsbDevice::write_line( line );
+	AuditLog::record( event.uid, event.reader, AuditLog::ENROLLED, status, board_millis() - event.time_ms );
+	if( enrollUnsaved >= ENROLL_BATCH ) save_enrolled();
+}
+
+static void enroll_step( uint32_t now_ms )
+{
+	if( !enrolling ) return;
+	// A failed save is tried again after the next pause, not on every pass
+	if( enrollUnsaved && now_ms - enrollLast >= ENROLL_SAVE_DELAY_MS && now_ms - enrollSaveTried >= ENROLL_SAVE_DELAY_MS ) save_enrolled();
+	else if( now_ms - enrollLast >= ENROLL_TIMEOUT_MS ) stop_enroll();
+}
+
+// "cred <uid> <password>" stores the password for the card, "cred <uid>" removes it
+static void set_credential( const char *args )
+{
+	MFRC522::Uid uid;
+	const char *password;
+	if( !parse_uid( args, &uid, &password ) || strlen( password ) > MAX_PASS_LEN )
+	{
+		UsbDevice::write_line( "Usage: cred <uid hex> [password]\n\r" );
+		return;
+	}
+	if( !*password ) UsbDevice::write_line( Vault::remove( uid ) ? "Credential removed\n\r" : "No credential\n\r" );
+	else if( Vault::put( uid, (const uint8_t *)password, strlen( password ) ) ) UsbDevice::write_line( "Credential stored\n\r" );
+	else UsbDevice::write_line( "Credential store full\n\r" );
+}
+
+static void print_credentials()
+{
+	char line[ CDC_LINE_LEN ];
+	KvStore::Stats stats = KvStore::stats();
+	snprintf( line, sizeof( line ), "Credentials %u, %lu bytes live, sectors %u used %u free\n\r", stats.keys, stats.live_bytes,
+		stats.used_sectors, stats.free_sectors );
+	UsbDevice::write_line( line );
+	snprintf( line, sizeof( line ), "Erases %lu..%lu per sector, %lu compactions, longest pause %lu us\n\r", stats.min_erases,
+		stats.max_erases, stats.compactions, FlashStorage::max_pause_us() );
+	UsbDevice::write_line( line );
+	const Vault::Stats &vault = Vault::stats();
+	snprintf( line, sizeof( line ), "Vault %lu hits, %lu misses, cold %lu us max, warm %lu us max, %lu refused\n\r", vault.hits,
+		vault.misses, vault.cold_us_max, vault.warm_us_max, vault.rejected );
+	UsbDevice::write_line( line );
+}
+
+// "vault bench [uid]": cold and warm decryption of a stored credential, the default card's if no UID is given
+static void benchmark_vault( const char *args )
+{
+	char line[ CDC_LINE_LEN ];
+	MFRC522::Uid uid = myCard;
+	const char *rest;
+	uint32_t cold, warm;
+	if( *args && !parse_uid( args, &uid, &rest ) )
+	{
+		UsbDevice::write_line( "Usage: vault bench [uid hex]\n\r" );
+		return;
+	}
+	if( !Vault::benchmark( uid, 100, &cold, &warm ) )
+	{
+		UsbDevice::write_line( "No credential for that UID\n\r" );
+		return;
+	}
+	snprintf( line, sizeof( line ), "Cold %lu us, warm %lu us, budget %u us: %s\n\r", cold, warm, VAULT_BUDGET_US,
+		cold <= VAULT_BUDGET_US ? "ok" : "over" );
+	UsbDevice::write_line( line );
+}
+
+// Derivation time of a password of the configured length, or 16 characters, plus a SHA-256 known answer
+static void benchmark_derive()
+{
+	static const uint8_t abc[ SHA256_DIGEST_SIZE ] = {
+		0xBA, 0x78, 0x16, 0xBF, 0x8F, 0x01, 0xCF, 0xEA, 0x41, 0x41, 0x40, 0xDE, 0x5D, 0xAE, 0x22, 0x23,
+		0xB0, 0x03, 0x61, 0xA3, 0x96, 0x17, 0x7A, 0x9C, 0xB4, 0x10, 0xFF, 0x61, 0xF2, 0x00, 0x15, 0xAD,
+	};
+	char line[ CDC_LINE_LEN ];
+	char derived[ MAX_PASS_LEN + 1 ];
+	uint8_t digest[ SHA256_DIGEST_SIZE ];
+	Sha256 hash;
+	hash.update( (const uint8_t *)"abc", 3 );
+	hash.finish( digest );
+	uint8_t length = Settings::derive_length() ? Settings::derive_length() : 16;
+	uint32_t start = time_us_32();
+	for( uint8_t i = 0; i < 100; i++ )
+	{
+		DerivedPassword::derive( myCard.uidByte, myCard.size, Settings::derive_profile(), length, Settings::derive_symbols(), derived );
+	}
+	uint32_t took = ( time_us_32() - start ) / 100;
+	zeroize( derived, sizeof( derived ) );
+	snprintf( line, sizeof( line ), "SHA-256 %s, %u characters in %lu us\n\r", memcmp( digest, abc, sizeof( abc ) ) ? "FAILED" : "ok",
+		length, took );
+	UsbDevice::write_line( line );
+}
+
+// "derive" reports, "derive off" types stored passwords again,
+// "derive <length> <alnum|all> <profile>" types passwords derived from the UID and saves the mode
+static void set_derive( const char *args )
+{
+	char line[ CDC_LINE_LEN ];
+	unsigned length = 0;
+	char symbols[8];
+	char profile[ SETTINGS_PROFILE_SIZE ];
+	if( !*args )
+	{
+		if( Settings::derive_length() ) snprintf( line, sizeof( line ), "Derived passwords: %u characters, %s, profile \"%s\"\n\r",
+			Settings::derive_length(), Settings::derive_symbols() ? "all" : "alnum", Settings::derive_profile() );
+		else snprintf( line, sizeof( line ), "Stored passwords\n\r" );
+		UsbDevice::write_line( line );
+		return;
+	}
+	if( !strcmp( args, "bench" ) )
+	{
+		benchmark_derive();
+		return;
+	}
+	if( !strcmp( args, "off" ) ) Settings::set_derive( 0, false, "" );
+	else if( sscanf( args, "%u %7s %15s", &length, symbols, profile ) == 3 && length && length <= MAX_PASS_LEN &&
+		( !strcmp( symbols, "all" ) || !strcmp( symbols, "alnum" ) ) )
+		Settings::set_derive( length, !strcmp( symbols, "all" ), profile );
+	else
+	{
+		UsbDevice::write_line( "Usage: derive off | derive bench | derive <length> <alnum|all> <profile>\n\r" );
+		return;
+	}
+	UsbDevice::write_line( Settings::save() ? "Password mode saved\n\r" : "Password mode set, save failed\n\r" );
+}
+
+// "totp <uid> <base32 seed> [digits] [none|tab|enter]" stores the card's TOTP seed, "totp <uid>" removes it.
+// The separator is typed between the password and the code, tab by default. The seed is one word: a seed
+// given in space separated groups is refused rather than stored as its first group.
+static void set_totp( const char *args )
+{
+	MFRC522::Uid uid;
+	const char *rest;
+	char seed[ CDC_LINE_LEN ];
+	char separator[8] = "tab";
+	unsigned digits = TOTP_DIGITS;
+	uint8_t record[ TOTP_RECORD_HEADER + TOTP_MAX_SEED ];
+	uint8_t len;
+	int fields = 0;
+	int end = 0;
+	if( parse_uid( args, &uid, &rest ) && !*rest )
+	{
+		UsbDevice::write_line( Vault::remove_totp( uid ) ? "TOTP removed\n\r" : "No TOTP\n\r" );
+		return;
+	}
+	// end follows the last field read: anything after it, like the rest of a seed given in groups, is refused
+	if( parse_uid( args, &uid, &rest ) ) fields = sscanf( rest, "%95s%n %u%n %7s%n", seed, &end, &digits, &end, separator, &end );
+	if( fields < 1 || rest[ end + strspn( rest + end, " " ) ] || digits < 6 || digits > TOTP_MAX_DIGITS || !Totp::decode_base32( seed, &record[ TOTP_RECORD_HEADER ], &len ) ||
+		( strcmp( separator, "none" ) && strcmp( separator, "tab" ) && strcmp( separator, "enter" ) ) )
+	{
+		UsbDevice::write_line( "Usage: totp <uid hex> [base32 seed without spaces [6..8 digits] [none|tab|enter]]\n\r" );
+		return;
+	}
+	record[0] = digits;
+	record[1] = !strcmp( separator, "tab" ) ? '\t' : !strcmp( separator, "enter" ) ? '\n' : '\0';
+	bool stored = Vault::put_totp( uid, record, TOTP_RECORD_HEADER + len );
+	zeroize( record, sizeof( record ) );
+	zeroize( seed, sizeof( seed ) );
+	UsbDevice::write_line( stored ? "TOTP stored\n\r" : "Credential store full\n\r" );
+}
+
+// "time" reports, "time <unix seconds>" syncs the clock TOTP codes are computed from, e.g. date +%s from the host
+static void set_time( const char *args )
+{
+	char line[ CDC_LINE_LEN ];
+	unsigned long long seconds;
+	if( *args )
+	{
+		if( sscanf( args, "%llu", &seconds ) != 1 || seconds < 1000000000ull )
+		{
+			UsbDevice::write_line( "Usage: time [unix seconds]\n\r" );
+			return;
+		}
+		Totp::set_time( seconds );
+	}
+	if( !Totp::synced() )
+	{
+		UsbDevice::write_line( "Time not synced\n\r" );
+		return;
+	}
+	snprintf( line, sizeof( line ), "Time %llu, synced %lu s ago, last TOTP took %lu us while typing\n\r",
+		(unsigned long long)Totp::now(), (unsigned long)Totp::since_sync_s(), (unsigned long)totpUs );
+	UsbDevice::write_line( line );
+}
+
+// "audit" reports, "audit dump [sequence]" streams the tap records from that sequence on, or all that are kept:
+// a line "Audit <first sequence> <count>", count binary AuditLog::Record, then a line break.
+// After an interrupted transfer the host asks again from the sequence after the last record it got.
+// "audit uid <uid>" prints the hash the card's records hold; it is keyed, so only the device can tell.
+static void dump_audit( const char *args )
+{
+	char line[ CDC_LINE_LEN ];
+	unsigned long from = 0;
+	MFRC522::Uid uid;
+	const char *rest;
+	if( !strncmp( args, "uid ", 4 ) && parse_uid( args + 4, &uid, &rest ) && !*rest )
+	{
+		snprintf( line, sizeof( line ), "Audit hash %08lX\n\r", (unsigned long)AuditLog::uid_hash( uid ) );
+		UsbDevice::write_line( line );
+		return;
+	}
+	if( !*args )
+	{
+		snprintf( line, sizeof( line ), "Audit records %lu..%lu, %lu buffered, longest flash pause %lu us\n\r",
+			(unsigned long)AuditLog::oldest(), (unsigned long)AuditLog::next(), (unsigned long)AuditLog::buffered(),
+			(unsigned long)FlashStorage::max_pause_us() );
+		UsbDevice::write_line( line );
+		return;
+	}
+	if( strcmp( args, "dump" ) && sscanf( args, "dump %lu", &from ) != 1 )
+	{
+		UsbDevice::write_line( "Usage: audit [dump [sequence] | uid <uid hex>]\n\r" );
+		return;
+	}
+	// The header promises the count, so a page that cannot be programmed stops the dump before it
+	if( !AuditLog::flush() )
+	{
+		UsbDevice::write_line( "Audit log flush failed\n\r" );
+		return;
+	}
+	uint32_t first = AuditLog::first( from );
+	snprintf( line, sizeof( line ), "Audit %lu %lu\n\r", (unsigned long)first, (unsigned long)( AuditLog::next() - first ) );
+	UsbDevice::write_line( line );
+	if( !AuditLog::stream( first, UsbDevice::write ) ) UsbDevice::write_line( "Audit log flush failed\n\r" );
+	else UsbDevice::write_line( "\n\r" );
+}
+
+static void print_stats()
+{
+	char line[ CDC_LINE_LEN ];
+	const MFRC522::RetryStats &retry = retryPolicy.stats;
+	snprintf( line, sizeof( line ), "Activations %lu, %lu ok (%lu after a retry), retries %lu/%lu/%lu, deadline %lu\n\r",
+		retry.activations, retry.successes, retry.retrySuccesses, retry.collisionRetries, retry.errorRetries,
+		retry.timeoutRetries, retry.deadlineExpired );
+	UsbDevice::write_line( line );
+	snprintf( line, sizeof( line ), "Readers %u, poll rounds %lu\n\r", poller.count(), poller.rounds() );
+	UsbDevice::write_line( line );
+	for( uint8_t i = 0; i < poller.count(); i++ )
+	{
+		const MFRC522::HealthStats &health = poller.reader( i ).PCD_GetHealthStats();
+		snprintf( line, sizeof( line ), "Reader %u: health checks %lu, recoveries %lu (%lu failed, %lu deferred)\n\r", i,
+			health.checks, health.recoveries, health.failedRecoveries, health.deferredRecoveries );
+		UsbDevice::write_line( line );
+		const ReaderPoller::InventoryStats &inventory = poller.inventory_stats( i );
+		snprintf( line, sizeof( line ), "  stacks %lu, up to %u cards, %lu us max, %lu out of budget\n\r",
+			inventory.stacks, inventory.stack_max, inventory.stack_us_max, inventory.overruns );
+		UsbDevice::write_line( line );
+	}
+}
+
+static void handle_command( char *line )
+{
+	// read_line() keeps the line ending
+	size_t len = strlen( line );
+	while( len && isspace( (unsigned char)line[ len - 1 ] ) ) line[ --len ] = '\0';
+	if( !len ) return;
+
+	// The calibration card goes on the first reader, the gain found is used for all of them
+	if( !strcmp( line, "calibrate" ) )
+	{
+		poller.finish( 0 );
+		calibrate_antenna( poller.reader( 0 ) );
+	}
+	else if( !strcmp( line, "stats" ) ) print_stats();
+	// Binary MIFARE Classic image of the card on the first reader, see MifareImage for the format
+	else if( !strcmp( line, "image" ) ) image_card( 0 );
+	// Pages and originality signature of an NTAG21x/Ultralight EV1 on the first reader, binary after a summary line
+	else if( !strcmp( line, "ntag" ) ) read_ntag( 0 );
+	else if( !strncmp( line, "ndef write ", 11 ) ) write_credential( line + 11 );
+	else if( !strcmp( line, "power" ) ) print_power();
+	else if( !strcmp( line, "allowlist" ) ) print_allowlist();
+	// Adds every new card tapped to the allowlist until "enroll stop" or ENROLL_TIMEOUT_MS without one
+	else if( !strcmp( line, "enroll" ) ) start_enroll();
+	else if( !strcmp( line, "enroll stop" ) ) stop_enroll();
+	else if( !strncmp( line, "power ", 6 ) ) set_power( line + 6 );
+	else if( !strncmp( line, "cred ", 5 ) ) set_credential( line + 5 );
+	else if( !strcmp( line, "creds" ) ) print_credentials();
+	else if( !strcmp( line, "vault bench" ) ) benchmark_vault( "" );
+	else if( !strncmp( line, "vault bench ", 12 ) ) benchmark_vault( line + 12 );
+	else if( !strcmp( line, "derive" ) ) set_derive( "" );
+	else if( !strncmp( line, "derive ", 7 ) ) set_derive( line + 7 );
+	else if( !strncmp( line, "totp ", 5 ) ) set_totp( line + 5 );
+	else if( !strcmp( line, "time" ) ) set_time( "" );
+	else if( !strncmp( line, "time ", 5 ) ) set_time( line + 5 );
+	else if( !strcmp( line, "audit" ) ) dump_audit( "" );
+	else if( !strncmp( line, "audit ", 6 ) ) dump_audit( line + 6 );
+	else
+	{
+		LOGS_ERROR( "Unknown command: %s", line );
+		UsbDevice::write_line( "Unknown command\n\r" );
+	}
+}
+
 /*------------- MAIN -------------*/
 int main()
 {
 	stdio_init_all();
 	board_init();
 	UsbDevice::init();
-	MFRC522 mfrc;
+	if( !FlashStorage::image_fits() )
+		LOGS_ERROR( "Firmware ends at 0x%lx, past the data regions at 0x%x", FlashStorage::image_end(), FLASH_DATA_OFFSET );
+	Settings::load();
+	// A reader whose CS floats low answers while another one is set up
+	for( uint8_t i = 0; i < READER_COUNT; i++ )
+	{
+		gpio_init( readerPins[i][0] );
+		gpio_set_dir( readerPins[i][0], GPIO_OUT );
+		gpio_put( readerPins[i][0], 1 );
+	}
+	for( uint8_t i = 0; i < READER_COUNT; i++ )
+	{
+		MFRC522* reader = new MFRC522( Settings::rx_gain(), readerPins[i][0], readerPins[i][1] );
+		reader->PICC_SetUidFilter( Allowlist::matches );
+		reader->PICC_SetRetryPolicy( &retryPolicy );
+		poller.add( *reader );
+	}
+	apply_power_profile();
 	myCard.size = 7;
 	myCard.uidByte[0] = 0x53;
 	myCard.uidByte[1] = 0x03;
@@ -30,18 +815,67 @@ int main()
 	myCard.uidByte[4] = 0x50;
 	myCard.uidByte[5] = 0x00;
 	myCard.uidByte[6] = 0x01;
-	uint32_t last_sent_time = 0;
+	Allowlist::load();
+	MphAllowlist::load();
+	if( !Allowlist::count() && !MphAllowlist::loaded() ) Allowlist::add( myCard );		// Factory default until a list is stored
+	KvStore::load();
+	AuditLog::load();
+	Vault::init();
+	DerivedPassword::init( Settings::secret(), SETTINGS_SECRET_SIZE, Keymap::can_type );
+	AuditLog::init( Settings::secret(), SETTINGS_SECRET_SIZE );
+	if( !KvStore::count() ) Vault::put( myCard, (const uint8_t *)"MyT4st_pAs7", 11 );	// Factory default credential
+	uint32_t last_health_check = 0;
+	char command[ CDC_LINE_LEN ];
+	ReaderPoller::Event event;
 	LOGS_INFO( "Initialization done" );
 	for (;;)
 	{
 		UsbDevice::pool();
-		if( board_millis() - last_sent_time > CARD_READ_INTERVAL && mfrc.isCardPresent( myCard ) )
+		if( poller.poll( &event ) )
+		{
+			if( enrolling )
+			{
+				if( event.type == ReaderPoller::CARD_ARRIVED ) enroll_card( event );
+			}
+			else if( event.type == ReaderPoller::CARD_ARRIVED && Allowlist::contains( event.uid ) )
+			{
+				LOGS_INFO( "Card found on reader %d!", event.reader );
+				UsbDevice::write_line( "Card found!\n\r");
+				uint8_t status;
+				bool r = type_password( event.reader, event.uid, &status );
+				AuditLog::record( event.uid, event.reader, r ? AuditLog::ALLOWED : AuditLog::FAILED, status,
+					board_millis() - event.time_ms );
+			}
+			else if( event.type == ReaderPoller::CARD_PRESENT )
+			{
+				LOGS_DEBUG( "Card still on reader %d at %lu ms", event.reader, event.time_ms );
+			}
+			else if( event.type == ReaderPoller::CARD_REJECTED )
+			{
+				LOGS_INFO( "Unknown card on reader %d", event.reader );
+				UsbDevice::write_line( "Unknown card\n\r" );
+				AuditLog::record( event.uid, event.reader, AuditLog::DENIED, MFRC522::STATUS_UNKNOWN_CARD,
+					board_millis() - event.time_ms );
+			}
+			else if( event.type == ReaderPoller::CARD_REMOVED )
+			{
+				LOGS_INFO( "Card removed from reader %d at %lu ms", event.reader, event.time_ms );
+			}
+		}
+
+		if( UsbDevice::read_line( command, sizeof( command ) ) > 0 ) handle_command( command );
+
+		// Delayed flush, erase or compaction of the credential store, one flash operation per round
+		KvStore::step( board_millis() );
+		Vault::step( board_millis() );
+		// Batched programming of the tap records, after the tap was typed
+		AuditLog::step( board_millis() );
+		enroll_step( board_millis() );
+
+		if( board_millis() - last_health_check > HEALTH_CHECK_INTERVAL )
 		{
-			LOGS_INFO( "Card found!" );
-			UsbDevice::write_line( "Card found!\n\r");
-			bool r = UsbDevice::send_password();
-			//LOGS_DEBUG( "Posword send result: %s", r ? "true" : "false" );
-			last_sent_time = board_millis();
+			poller.check_health();
+			last_health_check = board_millis();
 		}
 
 		UsbDevice::send_empty_report();
@@ -0,0 +1,470 @@
+#include "mfrc522_async.h"
+#include <string.h>
+#include "pico/stdlib.h"
+
+#define INVENTORY_MAX_ERRORS 3		// Same as PICC_INVENTORY_MAX_ERRORS in MFRC522.cpp
+
+alignas(8) uint8_t AsyncFramePool::_slots[ASYNC_FRAME_SLOTS][ASYNC_FRAME_SIZE];
+uint8_t AsyncFramePool::_used = 0;
+
+static_assert( ASYNC_FRAME_SLOTS <= 8, "AsyncFramePool::_used is an 8 bit mask" );
+
+void* AsyncFramePool::allocate( size_t size )
+{
+	if( size > ASYNC_FRAME_SIZE )
+	{
+		return NULL;
+	}
+	for( uint8_t i = 0; i < ASYNC_FRAME_SLOTS; i++ )
+	{
+		if( !( _used & ( 1 << i ) ) )
+		{
+			_used |= 1 << i;
+			return _slots[i];
+		}
+	}
+	return NULL;
+}
+
+void AsyncFramePool::release( void* frame )
+{
+	uint8_t i = ( (uint8_t*)frame - &_slots[0][0] ) / ASYNC_FRAME_SIZE;
+	_used &= ~( 1 << i );
+}
+
+uint8_t AsyncFramePool::in_use()
+{
+	uint8_t count = 0;
+	for( uint8_t i = 0; i < ASYNC_FRAME_SLOTS; i++ )
+	{
+		count += ( _used >> i ) & 1;
+	}
+	return count;
+}
+
+AsyncTask& AsyncTask::operator=( AsyncTask&& other )
+{
+	if( this != &other )
+	{
+		if( _handle )
+		{
+			_handle.destroy();
+		}
+		_handle = other._handle;
+		other._handle = nullptr;
+	}
+	return *this;
+}
+
+AsyncTask::~AsyncTask()
+{
+	if( _handle )
+	{
+		_handle.destroy();
+	}
+}
+
+void AsyncTask::start()
+{
+	if( _handle && !_handle.done() )
+	{
+		_handle.resume();
+	}
+}
+
+uint8_t AsyncTask::status() const
+{
+	return _handle ? _handle.promise().status : (uint8_t)MFRC522::STATUS_NO_ROOM;
+}
+
+std::coroutine_handle<> AsyncTask::await_suspend( std::coroutine_handle<> awaiting )
+{
+	_handle.promise().continuation = awaiting;
+	return _handle;
+}
+
+MFRC522Async::Exchange MFRC522Async::transceive( uint8_t* sendData, uint8_t sendLen, uint8_t* backData, uint8_t* backLen,
+	uint8_t* validBits, uint8_t rxAlign, bool checkCRC )
+{
+	_backData = backData;
+	_backLen = backLen;
+	_validBits = validBits;
+	_rxAlign = rxAlign;
+	_checkCRC = checkCRC;
+	uint8_t status = _pcd->PCD_StartCommunication( MFRC522::PCD_Transceive, 0x30, sendData, sendLen, validBits ? *validBits : 0, rxAlign );
+	return Exchange{ *this, status };
+}
+
+bool MFRC522Async::Delay::await_ready()
+{
+	return time_us_64() >= until;
+}
+
+void MFRC522Async::poll()
+{
+	if( !_waiting )
+	{
+		return;
+	}
+	if( _resumeAt )
+	{
+		if( time_us_64() < _resumeAt )
+		{
+			return;
+		}
+		_resumeAt = 0;
+		std::coroutine_handle<> waiting = _waiting;
+		_waiting = nullptr;
+		waiting.resume();
+		return;
+	}
+	uint8_t status;
+	if( !_pcd->PCD_PollCommunication( &status ) )
+	{
+		return;
+	}
+	if( status == MFRC522::STATUS_OK )
+	{
+		status = _pcd->PCD_FinishCommunication( _backData, _backLen, _validBits, _rxAlign, _checkCRC );
+	}
+	_status = status;
+	std::coroutine_handle<> waiting = _waiting;
+	_waiting = nullptr;
+	waiting.resume();
+}
+
+AsyncTask MFRC522Async::requestA()
+{
+	return request_or_wakeup( MFRC522::PICC_CMD_REQA );
+}
+
+AsyncTask MFRC522Async::wakeupA()
+{
+	return request_or_wakeup( MFRC522::PICC_CMD_WUPA );
+}
+
+// Same frame as MFRC522::PICC_REQA_or_WUPA().
+AsyncTask MFRC522Async::request_or_wakeup( uint8_t command )
+{
+	uint8_t validBits = 7;		// Short frame, 7 bits
+	uint8_t size = sizeof( atqa );
+	if( _pcd->_txRate != MFRC522::BITRATE_106 || _pcd->_rxRate != MFRC522::BITRATE_106 )	// PICCs always wake up at 106 kBd
+	{
+		_pcd->PCD_SetBitRate( MFRC522::BITRATE_106, MFRC522::BITRATE_106 );
+	}
+	_pcd->PCD_ClearRegisterBitMask( MFRC522::CollReg, 0x80 );
+	_pcd->PCD_SetTimeoutProfile( MFRC522::TIMEOUT_REQA );
+	uint8_t status = co_await transceive( &command, 1, atqa, &size, &validBits );
+	if( status != MFRC522::STATUS_OK )
+	{
+		co_return status;
+	}
+	co_return ( size != 2 || validBits != 0 ) ? MFRC522::STATUS_ERROR : MFRC522::STATUS_OK;
+}
+
+// Same algorithm as MFRC522::PICC_Select() without a supplied UID.
+AsyncTask MFRC522Async::select()
+{
+	uint8_t buffer[9];			// SEL + NVB + 4 UID bytes + BCC + CRC_A
+	uint8_t status;
+	_pcd->PCD_ClearRegisterBitMask( MFRC522::CollReg, 0x80 );
+	for( uint8_t cascadeLevel = 1; cascadeLevel <= 3; cascadeLevel++ )
+	{
+		uint8_t uidIndex = 3 * ( cascadeLevel - 1 );
+		uint8_t knownBits = 0;
+		uint8_t* response;
+		uint8_t responseLength;
+		uint8_t txLastBits;
+		buffer[0] = MFRC522::PICC_CMD_SEL_CL1 + 2 * ( cascadeLevel - 1 );
+		for( ;; )
+		{
+			uint8_t sendLen;
+			if( knownBits >= 32 )		// SELECT
+			{
+				buffer[1] = 0x70;
+				buffer[6] = buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5];
+				status = _pcd->PCD_CalculateCRC( buffer, 7, &buffer[7] );
+				if( status != MFRC522::STATUS_OK )
+				{
+					co_return status;
+				}
+				txLastBits = 0;
+				sendLen = 9;
+				response = &buffer[6];
+				responseLength = 3;
+				_pcd->PCD_SetTimeoutProfile( MFRC522::TIMEOUT_SELECT );
+			}
+			else						// ANTICOLLISION
+			{
+				txLastBits = knownBits % 8;
+				uint8_t index = 2 + knownBits / 8;
+				buffer[1] = ( index << 4 ) + txLastBits;
+				sendLen = index + ( txLastBits ? 1 : 0 );
+				response = &buffer[index];
+				responseLength = sizeof( buffer ) - index;
+				_pcd->PCD_SetTimeoutProfile( MFRC522::TIMEOUT_ANTICOLLISION );
+			}
+			status = co_await transceive( buffer, sendLen, response, &responseLength, &txLastBits, txLastBits );
+			if( status == MFRC522::STATUS_COLLISION )
+			{
+				uint8_t coll = _pcd->PCD_ReadRegister( MFRC522::CollReg );
+				if( coll & 0x20 )		// CollPosNotValid
+				{
+					co_return MFRC522::STATUS_COLLISION;
+				}
+				uint8_t collisionPos = ( coll & 0x1F ) ? ( coll & 0x1F ) : 32;
+				if( collisionPos <= knownBits )
+				{
+					co_return MFRC522::STATUS_INTERNAL_ERROR;
+				}
+				knownBits = collisionPos;
+				uint8_t bit = ( knownBits - 1 ) % 8;
+				buffer[1 + knownBits / 8 + ( bit ? 1 : 0 )] |= 1 << bit;	// Pick the PICC with a 1 at the collision
+			}
+			else if( status != MFRC522::STATUS_OK )
+			{
+				co_return status;
+			}
+			else if( knownBits >= 32 )
+			{
+				break;
+			}
+			else
+			{
+				knownBits = 32;
+			}
+		}
+
+		bool cascadeTag = buffer[2] == MFRC522::PICC_CMD_CT;
+		for( uint8_t i = 0; i < ( cascadeTag ? 3 : 4 ); i++ )
+		{
+			uid.uidByte[uidIndex + i] = buffer[( cascadeTag ? 3 : 2 ) + i];
+		}
+		if( responseLength != 3 || txLastBits != 0 )	// SAK must be exactly 24 bits
+		{
+			co_return MFRC522::STATUS_ERROR;
+		}
+		status = _pcd->PCD_CalculateCRC( response, 1, &buffer[2] );
+		if( status != MFRC522::STATUS_OK )
+		{
+			co_return status;
+		}
+		if( buffer[2] != response[1] || buffer[3] != response[2] )
+		{
+			co_return MFRC522::STATUS_CRC_WRONG;
+		}
+		bool last = !( response[0] & 0x04 );	// Cascade bit clear => UID complete
+		uint8_t known = last ? 3 * cascadeLevel + 1 : 3 * cascadeLevel;
+		if( _pcd->_uidFilter && !_pcd->_uidFilter( uid.uidByte, known, last ? known : 0 ) )
+		{
+			uid.size = known;
+			co_return MFRC522::STATUS_UNKNOWN_CARD;
+		}
+		if( last )
+		{
+			uid.sak = response[0];
+			uid.size = 3 * cascadeLevel + 1;
+			co_return MFRC522::STATUS_OK;
+		}
+	}
+	co_return MFRC522::STATUS_INTERNAL_ERROR;
+}
+
+// Same frame as MFRC522::MIFARE_Read(); the sector must already be authenticated for MIFARE Classic.
+AsyncTask MFRC522Async::read( uint8_t blockAddr, uint8_t* buffer, uint8_t* bufferSize )
+{
+	if( buffer == NULL || *bufferSize < 18 )
+	{
+		co_return MFRC522::STATUS_NO_ROOM;
+	}
+	uint8_t command[4] = { MFRC522::PICC_CMD_MF_READ, blockAddr };
+	uint8_t status = _pcd->PCD_CalculateCRC( command, 2, &command[2] );
+	if( status != MFRC522::STATUS_OK )
+	{
+		co_return status;
+	}
+	_pcd->PCD_SetTimeoutProfile( MFRC522::TIMEOUT_MIFARE_READ );
+	uint8_t validBits = 0;
+	co_return co_await transceive( command, sizeof( command ), buffer, bufferSize, &validBits, 0, true );
+}
+
+// Same frame as MFRC522::PICC_HaltA(); only silence from the PICC is a success.
+AsyncTask MFRC522Async::haltA()
+{
+	uint8_t command[4] = { MFRC522::PICC_CMD_HLTA, 0 };
+	uint8_t status = _pcd->PCD_CalculateCRC( command, 2, &command[2] );
+	if( status != MFRC522::STATUS_OK )
+	{
+		co_return status;
+	}
+	_pcd->PCD_SetTimeoutProfile( MFRC522::TIMEOUT_HALT );
+	status = co_await transceive( command, sizeof( command ), NULL, NULL );
+	if( status == MFRC522::STATUS_TIMEOUT )
+	{
+		co_return MFRC522::STATUS_OK;
+	}
+	co_return status == MFRC522::STATUS_OK ? (uint8_t)MFRC522::STATUS_ERROR : status;
+}
+
+// SELECT with the complete UID at every cascade level, like MFRC522::PICC_ConfirmUid().
+AsyncTask MFRC522Async::confirm( const MFRC522::Uid* expected )
+{
+	uint8_t buffer[9];			// SEL + NVB + 4 UID bytes + BCC + CRC_A
+	uint8_t levels = ( expected->size - 1 ) / 3;
+	if( expected->size != 4 && expected->size != 7 && expected->size != 10 )
+	{
+		co_return MFRC522::STATUS_INVALID;
+	}
+	_pcd->PCD_SetTimeoutProfile( MFRC522::TIMEOUT_SELECT );
+	for( uint8_t level = 0; level < levels; level++ )
+	{
+		bool last = level == levels - 1;
+		const uint8_t* part = &expected->uidByte[ 3 * level ];
+		buffer[0] = MFRC522::PICC_CMD_SEL_CL1 + 2 * level;
+		buffer[1] = 0x70;
+		if( last )
+		{
+			memcpy( &buffer[2], part, 4 );
+		}
+		else
+		{
+			buffer[2] = MFRC522::PICC_CMD_CT;
+			memcpy( &buffer[3], part, 3 );
+		}
+		buffer[6] = buffer[2] ^ buffer[3] ^ buffer[4] ^ buffer[5];
+		uint8_t status = _pcd->PCD_CalculateCRC( buffer, 7, &buffer[7] );
+		if( status != MFRC522::STATUS_OK )
+		{
+			co_return status;
+		}
+		uint8_t sak[3];
+		uint8_t sakLength = sizeof( sak );
+		uint8_t validBits = 0;
+		status = co_await transceive( buffer, sizeof( buffer ), sak, &sakLength, &validBits, 0, true );
+		if( status != MFRC522::STATUS_OK )
+		{
+			co_return status;
+		}
+		if( sakLength != 3 || (bool)( sak[0] & 0x04 ) == last )	// Cascade bit must be set exactly until the last level
+		{
+			co_return MFRC522::STATUS_ERROR;
+		}
+		uid.sak = sak[0];
+	}
+	memcpy( uid.uidByte, expected->uidByte, expected->size );
+	uid.size = expected->size;
+	co_return MFRC522::STATUS_OK;
+}
+
+// Same retry rules as MFRC522::PICC_Activate(); an empty field is never retried.
+AsyncTask MFRC522Async::activate( bool wakeup, const MFRC522::Uid* expected )
+{
+	MFRC522::RetryPolicy* policy = _pcd->_retryPolicy;
+	uint8_t retries[3] = { 0, 0, 0 };		// Collision, error and timeout retries so far
+	bool cardSeen = false;
+	uint64_t start = time_us_64();
+	uint32_t backoffUs;
+	if( policy )
+	{
+		policy->stats.activations++;
+	}
+	for( ;; )
+	{
+		uint8_t status = co_await ( wakeup ? wakeupA() : requestA() );
+		if( status == MFRC522::STATUS_OK || status == MFRC522::STATUS_COLLISION )	// Several PICCs answering is fine
+		{
+			cardSeen = true;
+			if( !expected && status == MFRC522::STATUS_OK && _pcd->_uidFilter && !_pcd->_uidFilter( NULL, 0, MFRC522::PICC_UidSizeFromATQA( atqa ) ) )
+			{
+				uid.size = 0;
+				co_return MFRC522::STATUS_UNKNOWN_CARD;
+			}
+			status = co_await ( expected ? confirm( expected ) : select() );
+			if( status == MFRC522::STATUS_UNKNOWN_CARD )
+			{
+				co_await haltA();		// Only takes if the PICC is ACTIVE, ie it was dropped at the last cascade level
+				co_return status;
+			}
+			if( status == MFRC522::STATUS_OK )
+			{
+				status = co_await haltA();
+			}
+		}
+		if( status == MFRC522::STATUS_OK )
+		{
+			if( policy )
+			{
+				policy->stats.successes++;
+				if( retries[0] || retries[1] || retries[2] )
+				{
+					policy->stats.retrySuccesses++;
+				}
+			}
+			co_return MFRC522::STATUS_OK;
+		}
+		if( !_pcd->PICC_RetryAllowed( status, cardSeen, retries, start, &backoffUs ) )
+		{
+			co_return status;
+		}
+		if( policy->wakeupOnRetry )
+		{
+			wakeup = true;
+		}
+		if( backoffUs )
+		{
+			co_await Delay{ *this, time_us_64() + backoffUs };
+		}
+	}
+}
+
+AsyncTask MFRC522Async::inventory( MFRC522::Uid* uids, uint8_t maxUids, uint8_t* found, MFRC522::Uid* unknown, uint32_t budgetUs )
+{
+	uint64_t start = time_us_64();
+	uint8_t errors = 0;
+	MFRC522::UidFilter filter = _pcd->_uidFilter;
+	*found = 0;
+	unknown->size = 0xFF;
+	for( ;; )
+	{
+		if( time_us_64() - start >= budgetUs )
+		{
+			co_return MFRC522::STATUS_TIMEOUT;
+		}
+		uint8_t status = co_await requestA();
+		if( status == MFRC522::STATUS_TIMEOUT )		// Everybody is halted or gone
+		{
+			co_return MFRC522::STATUS_OK;
+		}
+		if( status != MFRC522::STATUS_OK && status != MFRC522::STATUS_COLLISION )
+		{
+			if( ++errors >= INVENTORY_MAX_ERRORS ) co_return status;
+			continue;
+		}
+		if( *found >= maxUids )
+		{
+			co_return MFRC522::STATUS_NO_ROOM;
+		}
+		if( status == MFRC522::STATUS_OK && filter && !filter( NULL, 0, MFRC522::PICC_UidSizeFromATQA( atqa ) ) )
+		{
+			unknown->size = 0;
+			co_return MFRC522::STATUS_OK;
+		}
+		// Stacked PICCs are all selected completely, see MFRC522::PICC_Inventory()
+		_pcd->_uidFilter = status == MFRC522::STATUS_COLLISION ? NULL : filter;
+		status = co_await select();
+		_pcd->_uidFilter = filter;
+		if( status == MFRC522::STATUS_UNKNOWN_CARD )		// The last PICC in the field, and not one we look for
+		{
+			*unknown = uid;
+			co_await haltA();
+			co_return MFRC522::STATUS_OK;
+		}
+		if( status != MFRC522::STATUS_OK )
+		{
+			if( ++errors >= INVENTORY_MAX_ERRORS ) co_return status;
+			continue;
+		}
+		uids[ (*found)++ ] = uid;
+		co_await haltA();
+	}
+}
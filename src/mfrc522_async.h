@@ -0,0 +1,140 @@
+#ifndef _MFRC522_ASYNC_H_
+#define _MFRC522_ASYNC_H_
+#include <coroutine>
+#include <cstddef>
+#include <cstdint>
+#include "MFRC522.h"
+
+#define ASYNC_FRAME_SLOTS 8		// Coroutine frames alive at the same time, including nested calls
+#define ASYNC_FRAME_SIZE 256	// Bytes per frame slot; a coroutine with a larger frame fails with STATUS_NO_ROOM
+
+// Fixed pool the coroutine frames are carved from, so the async API never touches the heap.
+class AsyncFramePool
+{
+private:
+	alignas(8) static uint8_t _slots[ASYNC_FRAME_SLOTS][ASYNC_FRAME_SIZE];
+	static uint8_t _used;		// Bit n set => _slots[n] is taken
+public:
+	static void* allocate( size_t size );
+	static void release( void* frame );
+	static uint8_t in_use();
+};
+
+// Coroutine returning one of the MFRC522::StatusCode values.
+// Awaiting it from another AsyncTask runs it to completion and yields its status.
+// A top level task is kicked off with start() and driven by MFRC522Async::poll() until done().
+class AsyncTask
+{
+public:
+	struct promise_type
+	{
+		uint8_t status = MFRC522::STATUS_INTERNAL_ERROR;
+		std::coroutine_handle<> continuation;
+
+		static void* operator new( size_t size ) noexcept { return AsyncFramePool::allocate( size ); }
+		static void operator delete( void* frame ) { AsyncFramePool::release( frame ); }
+		static AsyncTask get_return_object_on_allocation_failure() { return AsyncTask(); }
+
+		AsyncTask get_return_object() { return AsyncTask( std::coroutine_handle<promise_type>::from_promise( *this ) ); }
+		std::suspend_always initial_suspend() noexcept { return {}; }
+		struct FinalAwaiter
+		{
+			bool await_ready() noexcept { return false; }
+			std::coroutine_handle<> await_suspend( std::coroutine_handle<promise_type> h ) noexcept
+			{
+				std::coroutine_handle<> next = h.promise().continuation;
+				return next ? next : std::noop_coroutine();
+			}
+			void await_resume() noexcept {}
+		};
+		FinalAwaiter final_suspend() noexcept { return {}; }
+		void return_value( uint8_t value ) { status = value; }
+		void unhandled_exception() {}
+	};
+
+	AsyncTask() : _handle() {}
+	AsyncTask( AsyncTask&& other ) : _handle( other._handle ) { other._handle = nullptr; }
+	AsyncTask& operator=( AsyncTask&& other );
+	AsyncTask( const AsyncTask& ) = delete;
+	AsyncTask& operator=( const AsyncTask& ) = delete;
+	~AsyncTask();
+
+	bool valid() const { return (bool)_handle; }
+	bool done() const { return !_handle || _handle.done(); }
+	void start();
+	// Result of a finished task; STATUS_NO_ROOM if the frame could not be allocated.
+	uint8_t status() const;
+
+	bool await_ready() const { return done(); }
+	std::coroutine_handle<> await_suspend( std::coroutine_handle<> awaiting );
+	uint8_t await_resume() const { return status(); }
+private:
+	explicit AsyncTask( std::coroutine_handle<promise_type> handle ) : _handle( handle ) {}
+	std::coroutine_handle<promise_type> _handle;
+};
+
+// Non-blocking front end for MFRC522. Every exchange with the card suspends the
+// calling coroutine; poll() from the main loop resumes it once the MFRC522 is done,
+// so USB keeps being serviced while a card answers. Only one exchange can be in flight.
+class MFRC522Async
+{
+public:
+	// Default constructed it is not usable until a reader is assigned, so it can be held by value.
+	explicit MFRC522Async( MFRC522* pcd = NULL ) : uid(), atqa(), _pcd( pcd ), _waiting(), _resumeAt( 0 ), _status( MFRC522::STATUS_OK ),
+		_backData( NULL ), _backLen( NULL ), _validBits( NULL ), _rxAlign( 0 ), _checkCRC( false ) {}
+
+	// Call from the main loop; resumes the waiting coroutine when its exchange is over.
+	void poll();
+	bool busy() const { return (bool)_waiting; }
+
+	AsyncTask requestA();		// REQA, ATQA is left in atqa
+	AsyncTask wakeupA();		// WUPA, ATQA is left in atqa
+	AsyncTask select();			// Anticollision and select of one PICC, result is left in uid
+	AsyncTask confirm( const MFRC522::Uid* expected );	// SELECT of a known PICC without anticollision
+	AsyncTask read( uint8_t blockAddr, uint8_t* buffer, uint8_t* bufferSize );
+	AsyncTask haltA();
+	// REQA (or WUPA), select and HLTA in one go; the halted card only answers WUPA afterwards.
+	// With expected set only that PICC is selected, see confirm().
+	// Failed attempts are retried as the reader's RetryPolicy allows, like MFRC522::PICC_Activate();
+	// the backoff before a timeout retry suspends instead of sleeping.
+	AsyncTask activate( bool wakeup, const MFRC522::Uid* expected = NULL );
+	// Same as MFRC522::PICC_Inventory(). unknown gets the bytes of a PICC the UID filter dropped, size 0xFF if none.
+	AsyncTask inventory( MFRC522::Uid* uids, uint8_t maxUids, uint8_t* found, MFRC522::Uid* unknown, uint32_t budgetUs = MFRC522::INVENTORY_BUDGET_US );
+
+	MFRC522::Uid uid;
+	uint8_t atqa[2];
+private:
+	struct Exchange
+	{
+		MFRC522Async& owner;
+		uint8_t startStatus;
+		bool await_ready() { return startStatus != MFRC522::STATUS_OK; }
+		void await_suspend( std::coroutine_handle<> h ) { owner._waiting = h; }
+		uint8_t await_resume() { return startStatus != MFRC522::STATUS_OK ? startStatus : owner._status; }
+	};
+	// Suspends until time_us_64() reaches until, poll() resumes it
+	struct Delay
+	{
+		MFRC522Async& owner;
+		uint64_t until;
+		bool await_ready();
+		void await_suspend( std::coroutine_handle<> h ) { owner._waiting = h; owner._resumeAt = until; }
+		void await_resume() {}
+	};
+	Exchange transceive( uint8_t* sendData, uint8_t sendLen, uint8_t* backData, uint8_t* backLen,
+		uint8_t* validBits = NULL, uint8_t rxAlign = 0, bool checkCRC = false );
+	AsyncTask request_or_wakeup( uint8_t command );
+
+	MFRC522* _pcd;
+	std::coroutine_handle<> _waiting;	// Coroutine suspended on the exchange in flight, or on a Delay
+	uint64_t _resumeAt;					// Deadline of the Delay _waiting is suspended on, 0 => an exchange
+	uint8_t _status;
+	// Where PCD_FinishCommunication() leaves the answer to the exchange in flight
+	uint8_t* _backData;
+	uint8_t* _backLen;
+	uint8_t* _validBits;
+	uint8_t _rxAlign;
+	bool _checkCRC;
+};
+
+#endif
@@ -0,0 +1,130 @@
+#include "mifare_image.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "log.h"
+#include "bsp/board.h"
+
+MifareImage::MifareImage()
+	: _keys(), _keyCount( 0 ), _cards(), _uses( 0 ), _stats()
+{
+	MFRC522::MIFARE_Key transport;
+	memset( transport.keyByte, 0xFF, sizeof( transport.keyByte ) );
+	add_key( transport );
+}
+
+bool MifareImage::add_key( const MFRC522::MIFARE_Key& key )
+{
+	if( _keyCount >= MIFARE_IMAGE_MAX_KEYS )
+	{
+		LOGS_ERROR( "Too many MIFARE keys, %d supported", MIFARE_IMAGE_MAX_KEYS );
+		return false;
+	}
+	_keys[ _keyCount++ ] = key;
+	return true;
+}
+
+MifareImage::CachedCard& MifareImage::cached( const MFRC522::Uid& uid )
+{
+	CachedCard* victim = &_cards[0];
+	for( uint8_t i = 0; i < MIFARE_IMAGE_CACHED_CARDS; i++ )
+	{
+		CachedCard& card = _cards[i];
+		if( card.last_used && card.uid == uid )
+		{
+			card.last_used = ++_uses;
+			return card;
+		}
+		if( card.last_used < victim->last_used ) victim = &card;
+	}
+	victim->uid = uid;
+	victim->last_used = ++_uses;
+	memset( victim->key, MIFARE_IMAGE_NO_KEY, sizeof( victim->key ) );
+	return *victim;
+}
+
+uint8_t MifareImage::open_sector( MFRC522& pcd, MFRC522::Uid* uid, uint8_t block, uint8_t* key )
+{
+	// The cached key goes first, the other candidates follow in case the card was rekeyed
+	uint8_t first = *key == MIFARE_IMAGE_NO_KEY ? 0 : *key;
+	for( uint8_t n = 0; n < _keyCount; n++ )
+	{
+		uint8_t k = ( first + n ) % _keyCount;
+		_stats.auths++;
+		uint8_t status = pcd.PCD_Authenticate( MFRC522::PICC_CMD_MF_AUTH_KEY_A, block, &_keys[k], uid );
+		if( status == MFRC522::STATUS_OK && ( pcd.PCD_ReadRegister( MFRC522::Status2Reg ) & 0x08 ) )	// MFCrypto1On
+		{
+			*key = k;
+			return MFRC522::STATUS_OK;
+		}
+		// A PICC that refused the key stays mute until it is selected again
+		pcd.PCD_StopCrypto1();
+		_stats.reactivations++;
+		status = pcd.PICC_ConfirmUid( uid, true );
+		if( status != MFRC522::STATUS_OK ) return status;
+	}
+	*key = MIFARE_IMAGE_NO_KEY;
+	return MFRC522::STATUS_OK;
+}
+
+uint8_t MifareImage::read( MFRC522& pcd, MFRC522::Uid* uid, Sink sink )
+{
+	uint32_t start = time_us_32();
+	uint8_t piccType = pcd.PICC_GetType( uid->sak );
+	uint8_t sectors = 0;
+	if( piccType == MFRC522::PICC_TYPE_MIFARE_MINI ) sectors = 5;
+	else if( piccType == MFRC522::PICC_TYPE_MIFARE_1K ) sectors = 16;
+	else if( piccType == MFRC522::PICC_TYPE_MIFARE_4K ) sectors = 40;
+	if( !sectors ) return MFRC522::STATUS_INVALID;
+
+	_stats = Stats();
+	_stats.sectors = sectors;
+	CachedCard& card = cached( *uid );
+
+	// Large enough for the header and for a sector of 16 blocks
+	uint8_t record[ 1 + 16 * 16 ];
+	uint16_t len = 0;
+	record[ len++ ] = 'M';
+	record[ len++ ] = 'C';
+	record[ len++ ] = MIFARE_IMAGE_VERSION;
+	record[ len++ ] = piccType;
+	record[ len++ ] = uid->size;
+	memcpy( &record[ len ], uid->uidByte, uid->size );
+	len += uid->size;
+	record[ len++ ] = uid->sak;
+	record[ len++ ] = sectors;
+	sink( record, len );
+	_stats.bytes += len;
+
+	uint8_t status = MFRC522::STATUS_OK;
+	for( uint8_t sector = 0; sector < sectors; sector++ )
+	{
+		// Sectors 0..31 have 4 blocks, sectors 32..39 of the 4K have 16
+		uint8_t block = sector < 32 ? sector * 4 : 128 + ( sector - 32 ) * 16;
+		uint8_t blocks = sector < 32 ? 4 : 16;
+		status = open_sector( pcd, uid, block, &card.key[ sector ] );
+		if( status != MFRC522::STATUS_OK ) break;
+		record[0] = card.key[ sector ];
+		len = 1;
+		if( record[0] != MIFARE_IMAGE_NO_KEY )
+		{
+			status = pcd.MIFARE_ReadBlocks( block, blocks, &record[1] );
+			if( status == MFRC522::STATUS_MIFARE_NACK )
+			{
+				// The access bits deny key A some data block. Key A opened the sector, so the cache keeps it.
+				record[0] = MIFARE_IMAGE_NO_KEY;
+				pcd.PCD_StopCrypto1();
+				_stats.reactivations++;
+				status = pcd.PICC_ConfirmUid( uid, true );
+			}
+			else len += 16 * blocks;
+			if( status != MFRC522::STATUS_OK ) break;
+		}
+		if( record[0] == MIFARE_IMAGE_NO_KEY ) _stats.unreadable++;
+		sink( record, len );
+		_stats.bytes += len;
+	}
+	pcd.PICC_HaltA();		// Halt the PICC before stopping the encrypted session.
+	pcd.PCD_StopCrypto1();
+	_stats.duration_us = time_us_32() - start;
+	return status;
+}
@@ -0,0 +1,57 @@
+#ifndef _MIFARE_IMAGE_H_
+#define _MIFARE_IMAGE_H_
+#include <cstdint>
+#include "MFRC522.h"
+
+#define MIFARE_IMAGE_VERSION 1
+#define MIFARE_IMAGE_MAX_KEYS 8			// Key A candidates tried on a sector nobody opened yet
+#define MIFARE_IMAGE_CACHED_CARDS 8		// Cards whose working key per sector is remembered
+#define MIFARE_IMAGE_MAX_SECTORS 40		// MIFARE Classic 4K
+#define MIFARE_IMAGE_NO_KEY 0xFF		// Sector record: no candidate opened the sector, no blocks follow
+
+// Full-card image of a MIFARE Classic PICC as a compact binary stream.
+// Every sector is authenticated once with key A and its blocks are read back to back
+// with MFRC522::MIFARE_ReadBlocks(). The key that opened a sector is remembered per UID,
+// so imaging the same card again needs exactly one authentication per sector.
+// The stream handed to the sink is:
+//   header   'M' 'C' version, PICC type, UID size, UID bytes, SAK, number of sectors
+//   sector   index of the key that opened it (MIFARE_IMAGE_NO_KEY: none), then its blocks, 16 bytes each
+class MifareImage
+{
+public:
+	typedef void (*Sink)( const uint8_t* data, uint32_t len );
+	struct Stats
+	{
+		uint8_t sectors;			// Sectors in the image
+		uint8_t unreadable;			// Sectors no key opened
+		uint16_t auths;				// Authentications, failed ones included
+		uint16_t reactivations;		// WUPA + select after a failed authentication
+		uint16_t bytes;				// Bytes handed to the sink
+		uint32_t duration_us;
+	};
+
+	MifareImage();
+	// Key A candidates are tried in the order added. The default transport key is there from the start.
+	bool add_key( const MFRC522::MIFARE_Key& key );
+	// The PICC must be ACTIVE, selected with uid. It is halted afterwards.
+	uint8_t read( MFRC522& pcd, MFRC522::Uid* uid, Sink sink );
+	const Stats& stats() const { return _stats; }
+private:
+	struct CachedCard
+	{
+		MFRC522::Uid uid;
+		uint32_t last_used;
+		uint8_t key[ MIFARE_IMAGE_MAX_SECTORS ];		// Candidate index, MIFARE_IMAGE_NO_KEY if not known
+	};
+
+	CachedCard& cached( const MFRC522::Uid& uid );
+	uint8_t open_sector( MFRC522& pcd, MFRC522::Uid* uid, uint8_t block, uint8_t* key );
+
+	MFRC522::MIFARE_Key _keys[ MIFARE_IMAGE_MAX_KEYS ];
+	uint8_t _keyCount;
+	CachedCard _cards[ MIFARE_IMAGE_CACHED_CARDS ];
+	uint32_t _uses;
+	Stats _stats;
+};
+
+#endif
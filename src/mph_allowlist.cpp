@@ -0,0 +1,57 @@
+#include "mph_allowlist.h"
+#include <string.h>
+#include "flash_storage.h"
+#include "log.h"
+#include "bsp/board.h"
+
+const uint16_t* MphAllowlist::_pilots = nullptr;
+const uint32_t* MphAllowlist::_remap = nullptr;
+const uint32_t* MphAllowlist::_fingerprints = nullptr;
+uint32_t MphAllowlist::_keys = 0;
+uint32_t MphAllowlist::_buckets = 0;
+uint32_t MphAllowlist::_slots = 0;
+uint32_t MphAllowlist::_seed = 0;
+
+bool MphAllowlist::load()
+{
+	const uint8_t* flash = FlashStorage::xip( FLASH_MPH_OFFSET );
+	MphHeader header;
+	memcpy( &header, flash, sizeof( header ) );
+	_fingerprints = nullptr;
+	_keys = 0;
+	if( header.magic != MPH_MAGIC )
+	{
+		LOGS_INFO( "No hashed allowlist in flash" );
+		return false;
+	}
+	// Bound the counts first, so the sizes below cannot wrap
+	bool sane = header.keys && header.buckets && header.buckets <= FLASH_MPH_SIZE / 2 &&
+		header.slots >= header.keys && header.slots <= FLASH_MPH_SIZE / 4;
+	uint32_t pilotBytes = ( header.buckets * sizeof( uint16_t ) + 3 ) & ~3u;
+	uint32_t remapBytes = ( header.slots - header.keys ) * sizeof( uint32_t );
+	uint32_t size = pilotBytes + remapBytes + header.keys * sizeof( uint32_t );
+	if( !sane || sizeof( header ) + size > FLASH_MPH_SIZE ||
+		mph_checksum( 2166136261u, flash + sizeof( header ), size ) != header.checksum )
+	{
+		LOGS_ERROR( "Hashed allowlist in flash is corrupt" );
+		return false;
+	}
+	_pilots = (const uint16_t*)( flash + sizeof( header ) );
+	_remap = (const uint32_t*)( flash + sizeof( header ) + pilotBytes );
+	_fingerprints = (const uint32_t*)( flash + sizeof( header ) + pilotBytes + remapBytes );
+	_keys = header.keys;
+	_buckets = header.buckets;
+	_slots = header.slots;
+	_seed = header.seed;
+	LOGS_INFO( "Hashed allowlist loaded, %lu UIDs", _keys );
+	return true;
+}
+
+bool MphAllowlist::contains( const uint8_t* uid, uint8_t size )
+{
+	if( !_fingerprints ) return false;
+	uint64_t h = mph_hash( uid, size, _seed );
+	uint32_t slot = mph_slot( h, _pilots[ mph_bucket( h, _buckets ) ], _slots );
+	if( slot >= _keys ) slot = _remap[ slot - _keys ];
+	return _fingerprints[ slot ] == mph_fingerprint( uid, size, _seed );
+}
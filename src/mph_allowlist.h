@@ -0,0 +1,28 @@
+#ifndef _MPH_ALLOWLIST_H_
+#define _MPH_ALLOWLIST_H_
+#include <cstdint>
+#include "mph_format.h"
+
+// Read-only allowlist for more UIDs than fit in RAM, built on the host by tools/mph_build.cpp
+// and flashed to FLASH_MPH_OFFSET. Lookups read the image in place through XIP: one pilot and
+// one fingerprint, two flash cache lines per UID, plus a remap entry for about 1% of UIDs.
+// Nothing is copied to RAM.
+// A UID that is not on the list passes with a probability of 2^-32 (fingerprint collision).
+class MphAllowlist
+{
+public:
+	static bool load();		// Checks the image once at startup
+	static bool loaded() { return _fingerprints != nullptr; }
+	static uint32_t count() { return _keys; }
+	static bool contains( const uint8_t* uid, uint8_t size );
+private:
+	static const uint16_t* _pilots;
+	static const uint32_t* _remap;
+	static const uint32_t* _fingerprints;
+	static uint32_t _keys;			// Header fields kept in RAM, so a lookup touches no third cache line
+	static uint32_t _buckets;
+	static uint32_t _slots;
+	static uint32_t _seed;
+};
+
+#endif
@@ -0,0 +1,74 @@
+#ifndef _MPH_FORMAT_H_
+#define _MPH_FORMAT_H_
+#include <stdint.h>
+
+// Layout of the minimal perfect hash allowlist image, shared by the firmware and tools/mph_build.cpp.
+//   MphHeader
+//   uint16_t pilots[ buckets ], padded to a multiple of 4 bytes
+//   uint32_t remap[ slots - keys ]
+//   uint32_t fingerprints[ keys ]
+// A UID hashes to a bucket; the bucket's pilot moves it to a slot of its own in 0..slots-1.
+// slots is a little larger than keys so the last buckets still find free slots quickly; the few
+// UIDs placed at or above keys are moved to the slots left free below it through remap, which
+// makes the hash minimal. The slot holds a fingerprint of the UID that was placed there, which
+// tells members from other UIDs.
+
+#define MPH_MAGIC 0x3148504D		// "MPH1"
+#define MPH_BUCKET_LOAD 4			// Average keys per bucket
+#define MPH_SLOT_LOAD 0.99			// keys / slots
+#define MPH_FINGERPRINT_SEED 0x5BD1E995
+
+struct MphHeader
+{
+	uint32_t magic;
+	uint32_t keys;
+	uint32_t buckets;
+	uint32_t seed;				// Found by the builder, makes every bucket placeable
+	uint32_t checksum;			// FNV-1a over pilots, remap and fingerprints
+	uint32_t slots;
+	uint32_t reserved[2];
+};
+
+// Hash of size and UID bytes; the size keeps a 4 byte UID apart from a longer one with the same start.
+static inline uint64_t mph_hash( const uint8_t* uid, uint8_t size, uint32_t seed )
+{
+	uint64_t h = 0xCBF29CE484222325ull ^ seed ^ ( (uint64_t)size << 56 );
+	for( uint8_t i = 0; i < size; i++ ) h = ( h ^ uid[i] ) * 0x100000001B3ull;
+	h ^= h >> 33;
+	h *= 0xFF51AFD7ED558CCDull;
+	h ^= h >> 33;
+	h *= 0xC4CEB9FE1A85EC53ull;
+	h ^= h >> 33;
+	return h;
+}
+
+// x * n / 2^32, maps a 32 bit hash onto 0..n-1 without a division
+static inline uint32_t mph_reduce( uint32_t x, uint32_t n )
+{
+	return (uint32_t)( ( (uint64_t)x * n ) >> 32 );
+}
+
+static inline uint32_t mph_bucket( uint64_t h, uint32_t buckets )
+{
+	return mph_reduce( (uint32_t)h, buckets );
+}
+
+static inline uint32_t mph_slot( uint64_t h, uint16_t pilot, uint32_t slots )
+{
+	uint32_t p = ( pilot + 1u ) * 0x9E3779B1u;
+	p ^= p >> 15;
+	return mph_reduce( (uint32_t)( h >> 32 ) ^ p, slots );
+}
+
+static inline uint32_t mph_fingerprint( const uint8_t* uid, uint8_t size, uint32_t seed )
+{
+	return (uint32_t)mph_hash( uid, size, seed ^ MPH_FINGERPRINT_SEED );
+}
+
+static inline uint32_t mph_checksum( uint32_t hash, const uint8_t* p, uint32_t size )
+{
+	while( size-- ) hash = ( hash ^ *p++ ) * 16777619u;
+	return hash;
+}
+
+#endif
@@ -0,0 +1,175 @@
+#include "ndef.h"
+#include <string.h>
+
+NdefTlvReader::NdefTlvReader( std::span<const uint8_t> area, size_t offset, size_t areaSize )
+	: _area( area ), _areaSize( areaSize > area.size() ? areaSize : area.size() ), _offset( offset ), _truncated( false )
+{
+}
+
+bool NdefTlvReader::next( uint8_t* tag, std::span<const uint8_t>* value )
+{
+	size_t size = _area.size();
+	while( _offset < size && _area[ _offset ] == NDEF_TLV_NULL ) _offset++;		// NULL TLVs have no length byte
+	if( _offset >= size )
+	{
+		_truncated = _offset < _areaSize;		// The TLVs so far end on the last byte given, the next one is not loaded yet
+		return false;
+	}
+	if( _area[ _offset ] == NDEF_TLV_TERMINATOR ) return false;
+
+	size_t pos = _offset + 1;
+	size_t len;
+	if( pos >= size )
+	{
+		_truncated = true;
+		return false;
+	}
+	if( _area[ pos ] == 0xFF )		// Three byte length format
+	{
+		if( pos + 2 >= size )
+		{
+			_truncated = true;
+			return false;
+		}
+		len = ( _area[ pos + 1 ] << 8 ) | _area[ pos + 2 ];
+		pos += 3;
+	}
+	else
+	{
+		len = _area[ pos ];
+		pos += 1;
+	}
+	if( pos + len > size )
+	{
+		_truncated = true;
+		return false;
+	}
+	*tag = _area[ _offset ];
+	*value = _area.subspan( pos, len );
+	_offset = pos + len;
+	return true;
+}
+
+NdefRecordReader::NdefRecordReader( std::span<const uint8_t> message )
+	: _message( message ), _offset( 0 ), _done( message.empty() ), _error( false )
+{
+}
+
+bool NdefRecordReader::next( NdefRecord* record )
+{
+	if( _done ) return false;
+	size_t size = _message.size();
+	size_t pos = _offset;
+	// Header, type length and the shortest payload length
+	if( pos + 3 > size )
+	{
+		_error = _done = true;
+		return false;
+	}
+	uint8_t header = _message[ pos++ ];
+	uint8_t typeLen = _message[ pos++ ];
+	uint32_t payloadLen;
+	if( header & NDEF_SR )
+	{
+		payloadLen = _message[ pos++ ];
+	}
+	else
+	{
+		if( pos + 4 > size )
+		{
+			_error = _done = true;
+			return false;
+		}
+		payloadLen = (uint32_t)_message[ pos ] << 24 | (uint32_t)_message[ pos + 1 ] << 16 | _message[ pos + 2 ] << 8 | _message[ pos + 3 ];
+		pos += 4;
+	}
+	uint8_t idLen = 0;
+	if( header & NDEF_IL )
+	{
+		if( pos >= size )
+		{
+			_error = _done = true;
+			return false;
+		}
+		idLen = _message[ pos++ ];
+	}
+	if( pos + typeLen + idLen > size || payloadLen > size - pos - typeLen - idLen )
+	{
+		_error = _done = true;
+		return false;
+	}
+	record->header = header;
+	record->type = _message.subspan( pos, typeLen );
+	pos += typeLen;
+	record->id = _message.subspan( pos, idLen );
+	pos += idLen;
+	record->payload = _message.subspan( pos, payloadLen );
+	pos += payloadLen;
+	_offset = pos;
+	_done = ( header & NDEF_ME ) || pos >= size;
+	return true;
+}
+
+NdefWriter::NdefWriter( std::span<uint8_t> buffer )
+	: _buffer( buffer ), _len( HEADER_ROOM ), _last( 0 ), _empty( true ), _overflow( buffer.size() < HEADER_ROOM )
+{
+}
+
+bool NdefWriter::add( uint8_t tnf, std::span<const uint8_t> type, std::span<const uint8_t> payload, std::span<const uint8_t> id )
+{
+	if( _overflow ) return false;
+	bool shortRecord = payload.size() < 0x100;
+	size_t need = 2 + ( shortRecord ? 1 : 4 ) + ( id.empty() ? 0 : 1 ) + type.size() + id.size() + payload.size();
+	if( type.size() > 0xFF || id.size() > 0xFF || _len + need > _buffer.size() )
+	{
+		_overflow = true;
+		return false;
+	}
+	uint8_t* out = &_buffer[ _len ];
+	_last = _len;
+	*out++ = ( _empty ? NDEF_MB : 0 ) | ( shortRecord ? NDEF_SR : 0 ) | ( id.empty() ? 0 : NDEF_IL ) | ( tnf & NDEF_TNF_MASK );
+	*out++ = type.size();
+	if( shortRecord )
+	{
+		*out++ = payload.size();
+	}
+	else
+	{
+		*out++ = payload.size() >> 24;
+		*out++ = payload.size() >> 16;
+		*out++ = payload.size() >> 8;
+		*out++ = payload.size();
+	}
+	if( !id.empty() ) *out++ = id.size();
+	memcpy( out, type.data(), type.size() );
+	out += type.size();
+	memcpy( out, id.data(), id.size() );
+	out += id.size();
+	memcpy( out, payload.data(), payload.size() );
+	_len += need;
+	_empty = false;
+	return true;
+}
+
+std::span<const uint8_t> NdefWriter::finish()
+{
+	if( _overflow || _len + 1 > _buffer.size() ) return {};
+	if( !_empty ) _buffer[ _last ] |= NDEF_ME;
+	size_t length = _len - HEADER_ROOM;
+	size_t start;
+	if( length < 0xFF )
+	{
+		start = HEADER_ROOM - 2;
+		_buffer[ start + 1 ] = length;
+	}
+	else
+	{
+		start = 0;
+		_buffer[1] = 0xFF;
+		_buffer[2] = length >> 8;
+		_buffer[3] = length;
+	}
+	_buffer[ start ] = NDEF_TLV_MESSAGE;
+	_buffer[ _len++ ] = NDEF_TLV_TERMINATOR;
+	return std::span<const uint8_t>( &_buffer[ start ], _len - start );
+}
@@ -0,0 +1,94 @@
+#ifndef _NDEF_H_
+#define _NDEF_H_
+#include <cstddef>
+#include <cstdint>
+#include <span>
+
+// TLV blocks of a Type 2 tag data area (NFC Forum Type 2 Tag, section 2.3)
+#define NDEF_TLV_NULL 0x00
+#define NDEF_TLV_LOCK_CONTROL 0x01
+#define NDEF_TLV_MEMORY_CONTROL 0x02
+#define NDEF_TLV_MESSAGE 0x03
+#define NDEF_TLV_PROPRIETARY 0xFD
+#define NDEF_TLV_TERMINATOR 0xFE
+
+// First byte of an NDEF record
+#define NDEF_MB 0x80			// Message begin
+#define NDEF_ME 0x40			// Message end
+#define NDEF_CF 0x20			// Chunk flag
+#define NDEF_SR 0x10			// Short record, one byte payload length
+#define NDEF_IL 0x08			// ID length present
+#define NDEF_TNF_MASK 0x07
+
+#define NDEF_TNF_EMPTY 0x00
+#define NDEF_TNF_WELL_KNOWN 0x01
+#define NDEF_TNF_MIME 0x02
+#define NDEF_TNF_URI 0x03
+#define NDEF_TNF_EXTERNAL 0x04
+
+// One record of an NDEF message. The spans point into the buffer the message was parsed from.
+struct NdefRecord
+{
+	uint8_t header;				// MB ME CF SR IL and the TNF
+	std::span<const uint8_t> type;
+	std::span<const uint8_t> id;
+	std::span<const uint8_t> payload;
+	uint8_t tnf() const { return header & NDEF_TNF_MASK; }
+};
+
+// Walks the TLV blocks of a data area in place.
+// area may be the first part of a data area of areaSize bytes. A TLV that runs past the end of the
+// bytes given, or running out of them before the area ends, sets truncated(); offset() is where the
+// next TLV starts, so a caller that reads the tag piece by piece can continue from there with more bytes.
+class NdefTlvReader
+{
+public:
+	// areaSize 0 => area is the whole data area
+	NdefTlvReader( std::span<const uint8_t> area, size_t offset = 0, size_t areaSize = 0 );
+	// false at the terminator TLV, at the end of the data area, or when more bytes are needed
+	bool next( uint8_t* tag, std::span<const uint8_t>* value );
+	bool truncated() const { return _truncated; }
+	size_t offset() const { return _offset; }
+private:
+	std::span<const uint8_t> _area;
+	size_t _areaSize;
+	size_t _offset;
+	bool _truncated;
+};
+
+// Walks the records of an NDEF message in place.
+class NdefRecordReader
+{
+public:
+	NdefRecordReader( std::span<const uint8_t> message );
+	// false after the record with ME, or when the message is malformed (error() is set then)
+	bool next( NdefRecord* record );
+	bool error() const { return _error; }
+private:
+	std::span<const uint8_t> _message;
+	size_t _offset;
+	bool _done;
+	bool _error;
+};
+
+// Builds an NDEF message TLV and the terminator TLV straight into a page buffer.
+// Records go in at offset 4; finish() puts the TLV header right in front of them,
+// short or long form depending on the message length, so nothing is moved afterwards.
+class NdefWriter
+{
+public:
+	NdefWriter( std::span<uint8_t> buffer );
+	bool add( uint8_t tnf, std::span<const uint8_t> type, std::span<const uint8_t> payload, std::span<const uint8_t> id = {} );
+	// The TLVs to write from the first data page on; empty if the buffer was too small.
+	std::span<const uint8_t> finish();
+	bool overflow() const { return _overflow; }
+private:
+	static const size_t HEADER_ROOM = 4;		// 0x03 0xFF and a 16 bit length
+	std::span<uint8_t> _buffer;
+	size_t _len;
+	size_t _last;				// Offset of the header byte of the last record
+	bool _empty;
+	bool _overflow;
+};
+
+#endif
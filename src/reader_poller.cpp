@@ -0,0 +1,292 @@
+#include "reader_poller.h"
+#include "pico/stdlib.h"
+#include "bsp/board.h"
+#include "log.h"
+
+ReaderPoller::ReaderPoller()
+	: _readers(), _queue(), _queue_head( 0 ), _queue_len( 0 ), _count( 0 ), _next( 0 ), _healthDue( 0 ), _rounds( 0 ), _profile()
+{
+}
+
+bool ReaderPoller::add( MFRC522& reader )
+{
+	if( _count >= POLLER_MAX_READERS )
+	{
+		LOGS_ERROR( "Too many readers, %d supported", POLLER_MAX_READERS );
+		return false;
+	}
+	_readers[ _count ].pcd = &reader;
+	_readers[ _count ].async = MFRC522Async( &reader );
+	_readers[ _count ].state = SEARCHING;
+	_readers[ _count ].since_us = time_us_64();
+	_count++;
+	return true;
+}
+
+// An exchange takes a fraction of a millisecond, so stepping each reader once per main loop
+// round would pace the card by the main loop instead: keep going while any exchange is in flight.
+bool ReaderPoller::poll( Event* event )
+{
+	uint64_t start = time_us_64();
+	bool busy = true;
+	while( busy && !_queue_len && time_us_64() - start < POLLER_PASS_US )
+	{
+		busy = false;
+		for( uint8_t n = 0; n < _count && !_queue_len; n++ )
+		{
+			busy |= step( _next );
+			_next = ( _next + 1 ) % _count;
+		}
+	}
+	if( !_queue_len ) return false;
+	*event = _queue[ _queue_head ];
+	_queue_head = ( _queue_head + 1 ) % POLLER_QUEUE_SIZE;
+	_queue_len--;
+	return true;
+}
+
+void ReaderPoller::push( uint8_t type, uint8_t reader, uint32_t time_ms, const MFRC522::Uid& uid )
+{
+	if( _queue_len >= POLLER_QUEUE_SIZE )
+	{
+		LOGS_ERROR( "Poller event queue full, event %d dropped", type );
+		return;
+	}
+	Event& event = _queue[ ( _queue_head + _queue_len++ ) % POLLER_QUEUE_SIZE ];
+	event.type = type;
+	event.reader = reader;
+	event.time_ms = time_ms;
+	event.uid = uid;
+}
+
+// Returns true while the reader has an exchange in flight
+bool ReaderPoller::step( uint8_t index )
+{
+	Reader& r = _readers[ index ];
+	r.async.poll();
+	if( !r.task.done() ) return true;
+
+	uint32_t now = board_millis();
+	if( r.task.valid() )
+	{
+		uint8_t status = r.task.status();
+		r.task = AsyncTask();
+		_rounds++;
+		if( r.state == SEARCHING )
+		{
+			uint32_t took = time_us_64() - r.task_start_us;
+			if( took > r.power.poll_us_max ) r.power.poll_us_max = took;
+			record_inventory( index, status, took );
+			bool seen = r.found_count || r.unknown.size != 0xFF;
+			if( status != MFRC522::STATUS_TIMEOUT || r.found_count ) inventory_done( index, now );
+			if( r.state == SEARCHING && _profile.fast_ms ) sleep( index, now, seen );
+		}
+		else if( status == MFRC522::STATUS_OK && r.async.uid == r.uid )
+		{
+			r.misses = 0;
+			if( now - r.last_report >= PRESENCE_REPORT_MS )
+			{
+				r.last_report = now;
+				if( !r.shadowed ) push( CARD_PRESENT, index, now, r.uid );
+			}
+		}
+		else if( ++r.misses >= PRESENCE_MISSES )
+		{
+			r.state = SEARCHING;
+			r.last_activity = now;
+			// Still on another reader: that one reports it from now on
+			if( !r.shadowed && !hand_over( index ) ) push( CARD_REMOVED, index, now, r.uid );
+		}
+		r.next_check = now + PRESENCE_CHECK_MS;
+	}
+
+	if( r.state == TRACKING && (int32_t)( now - r.next_check ) < 0 ) return false;
+	if( r.asleep )
+	{
+		if( (int32_t)( now - r.next_poll ) < 0 ) return false;
+		wake( index );
+	}
+	if( _healthDue & ( 1 << index ) )
+	{
+		run_health_check( index );
+		_healthDue &= ~( 1 << index );
+	}
+	if( r.state == TRACKING )
+	{
+		// The tracked card is confirmed by its UID, which skips the anticollision rounds
+		r.task = r.async.activate( true, &r.uid );
+	}
+	else
+	{
+		r.task = r.async.inventory( r.found, POLLER_INVENTORY_MAX, &r.found_count, &r.unknown );
+		r.task_start_us = time_us_64();
+	}
+	r.task.start();
+	return !r.task.done();
+}
+
+void ReaderPoller::finish( uint8_t index )
+{
+	Reader& r = _readers[ index ];
+	while( !r.task.done() ) r.async.poll();
+	if( r.asleep ) wake( index );
+}
+
+void ReaderPoller::set_power_profile( const PowerProfile& profile )
+{
+	_profile = profile;
+	uint64_t now = time_us_64();
+	for( uint8_t i = 0; i < _count; i++ )
+	{
+		Reader& r = _readers[i];
+		if( r.asleep ) wake( i );
+		r.period = profile.fast_ms;
+		r.power = PowerStats();
+		r.since_us = now;
+	}
+}
+
+void ReaderPoller::sleep( uint8_t index, uint32_t now, bool activity )
+{
+	Reader& r = _readers[ index ];
+	if( activity ) r.last_activity = now;
+	if( now - r.last_activity < _profile.hold_ms ) r.period = _profile.fast_ms;
+	else r.period = r.period * 2 < _profile.slow_ms ? r.period * 2 : _profile.slow_ms;
+	if( r.period < _profile.fast_ms ) r.period = _profile.fast_ms;
+	r.pcd->PCD_SoftPowerDown();
+	uint64_t t = time_us_64();
+	r.power.awake_us += t - r.since_us;
+	r.since_us = t;
+	r.asleep = true;
+	r.next_poll = now + r.period;
+}
+
+void ReaderPoller::wake( uint8_t index )
+{
+	Reader& r = _readers[ index ];
+	uint64_t t = time_us_64();
+	r.power.asleep_us += t - r.since_us;
+	r.since_us = t;
+	r.asleep = false;
+	r.power.wakes++;
+	// A chip that does not come back is reset by the next health check
+	if( !r.pcd->PCD_SoftPowerUp() ) LOGS_ERROR( "Reader %d did not come out of power-down", index );
+	uint32_t took = time_us_64() - t;
+	if( took > r.power.wake_us_max ) r.power.wake_us_max = took;
+}
+
+uint32_t ReaderPoller::average_current_ua( uint8_t index ) const
+{
+	const Reader& r = _readers[ index ];
+	uint64_t current = time_us_64() - r.since_us;
+	uint64_t awake = r.power.awake_us + ( r.asleep ? 0 : current );
+	uint64_t asleep = r.power.asleep_us + ( r.asleep ? current : 0 );
+	if( !( awake + asleep ) ) return POWER_ACTIVE_UA;
+	return ( awake * POWER_ACTIVE_UA + asleep * POWER_DOWN_UA ) / ( awake + asleep );
+}
+
+uint32_t ReaderPoller::worst_latency_us( uint8_t index ) const
+{
+	const PowerStats& power = _readers[ index ].power;
+	uint32_t latency = power.poll_us_max;
+	if( _profile.fast_ms )
+	{
+		uint16_t period = _profile.slow_ms > _profile.fast_ms ? _profile.slow_ms : _profile.fast_ms;
+		latency += period * 1000 + power.wake_us_max;
+	}
+	return latency;
+}
+
+void ReaderPoller::inventory_done( uint8_t index, uint32_t now )
+{
+	Reader& r = _readers[ index ];
+	if( !r.found_count && r.unknown.size == 0xFF )	// Field is empty
+	{
+		r.has_rejected = false;
+		return;
+	}
+	for( uint8_t i = 0; i < r.found_count; i++ )
+	{
+		const MFRC522::Uid& uid = r.found[i];
+		if( r.state == SEARCHING && r.pcd->PICC_UidAllowed( &uid ) )
+		{
+			r.uid = uid;
+			r.state = TRACKING;
+			r.misses = 0;
+			r.shadowed = tracked_elsewhere( index, uid );
+			r.last_report = now;
+			r.next_check = now + PRESENCE_CHECK_MS;
+			if( !r.shadowed ) push( CARD_ARRIVED, index, now, uid );
+		}
+		else if( !r.pcd->PICC_UidAllowed( &uid ) )
+		{
+			push( CARD_REJECTED, index, now, uid );		// Halted, so it is only seen again after a re-tap
+		}
+	}
+	// A card dropped before its last cascade level is not halted and shows up in the next inventory again
+	if( r.unknown.size != 0xFF && !( r.has_rejected && r.rejected == r.unknown ) )
+	{
+		r.rejected = r.unknown;
+		r.has_rejected = true;
+		push( CARD_REJECTED, index, now, r.unknown );
+	}
+}
+
+bool ReaderPoller::tracked_elsewhere( uint8_t index, const MFRC522::Uid& uid )
+{
+	for( uint8_t i = 0; i < _count; i++ )
+	{
+		if( i != index && _readers[i].state == TRACKING && !_readers[i].shadowed && _readers[i].uid == uid ) return true;
+	}
+	return false;
+}
+
+// Hands the card of a reader that lost it to another reader that still has it
+bool ReaderPoller::hand_over( uint8_t index )
+{
+	const MFRC522::Uid& uid = _readers[ index ].uid;
+	for( uint8_t i = 0; i < _count; i++ )
+	{
+		Reader& other = _readers[i];
+		if( i != index && other.state == TRACKING && other.shadowed && other.uid == uid )
+		{
+			other.shadowed = false;
+			LOGS_INFO( "Card moved from reader %d to reader %d", index, i );
+			return true;
+		}
+	}
+	return false;
+}
+
+// A stack of three cards takes about 3 ms each; one that runs out of INVENTORY_BUDGET_US is logged
+void ReaderPoller::record_inventory( uint8_t index, uint8_t status, uint32_t took_us )
+{
+	Reader& r = _readers[ index ];
+	InventoryStats& stats = r.inventory;
+	if( r.found_count > stats.stack_max ) stats.stack_max = r.found_count;
+	if( r.found_count > 1 )
+	{
+		stats.stacks++;
+		if( took_us > stats.stack_us_max ) stats.stack_us_max = took_us;
+		LOGS_DEBUG( "Reader %d listed %d cards in %lu us", index, r.found_count, took_us );
+	}
+	if( status == MFRC522::STATUS_TIMEOUT && r.found_count )
+	{
+		stats.overruns++;
+		LOGS_ERROR( "Reader %d inventory out of budget after %d cards, %lu us", index, r.found_count, took_us );
+	}
+}
+
+void ReaderPoller::run_health_check( uint8_t index )
+{
+	MFRC522& pcd = *_readers[ index ].pcd;
+	const MFRC522::HealthStats &health = pcd.PCD_GetHealthStats();
+	uint32_t recoveries = health.recoveries;
+	uint8_t fault = pcd.PCD_CheckHealth();
+	if( fault != MFRC522::HEALTH_OK && health.recoveries != recoveries )		// Not deferred by the backoff
+	{
+		const MFRC522::RecoveryRecord &record = health.recent[( health.recoveries - 1 ) % MFRC522::HEALTH_HISTORY_SIZE];
+		LOGS_ERROR( "Reader %d fault %d, recovery %s in %lu us (%lu recoveries, %lu failed)", index, fault,
+			record.success ? "done" : "failed", record.durationUs, health.recoveries, health.failedRecoveries );
+	}
+}
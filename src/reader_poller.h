@@ -0,0 +1,144 @@
+#ifndef _READER_POLLER_H_
+#define _READER_POLLER_H_
+#include <cstdint>
+#include "MFRC522.h"
+#include "mfrc522_async.h"
+
+#define POLLER_MAX_READERS 4
+#define PRESENCE_CHECK_MS 25		// Time between two WUPAs to a card that is on the reader
+#define PRESENCE_MISSES 3			// WUPAs in a row without the card before it counts as removed
+#define PRESENCE_REPORT_MS 1000		// Interval of CARD_PRESENT events while a card stays on the reader
+#define POLLER_INVENTORY_MAX 4		// Stacked cards listed per reader in one go
+#define POLLER_QUEUE_SIZE 8			// Events waiting to be returned by poll()
+#define POLLER_PASS_US 5000			// Longest poll() keeps driving exchanges in flight before it returns to the main loop
+#define POWER_ACTIVE_UA 67000		// MFRC522 with the field on: transmitter 60 mA, analog and digital supply 7 mA
+#define POWER_DOWN_UA 10			// MFRC522 in soft power-down
+
+// Polls several MFRC522 sharing one SPI bus and tracks the card on each of them.
+// Without a card a reader runs an inventory, which costs one REQA while the field is empty;
+// while one reader waits for its answer the others are serviced, so an idle round costs about
+// one REQA timeout no matter how many readers there are. With a PowerProfile set the reader
+// then goes to soft power-down until its next poll; otherwise the next inventory starts at once.
+// The inventory selects and halts every card in the field. The first one the UID filter
+// allows is tracked; only a WUPA reaches it now, which is how the poller tells that it is
+// still there. The other cards are reported as rejected.
+// A card seen by several readers is reported by the first one; it is only removed once the
+// last reader holding it loses it.
+class ReaderPoller
+{
+public:
+	enum EventType
+	{
+		CARD_ARRIVED,
+		CARD_PRESENT,		// Sent every PRESENCE_REPORT_MS while the card stays
+		CARD_REMOVED,
+		CARD_REJECTED		// Not on the UID filter; uid holds the bytes read before the select was dropped
+	};
+	struct Event
+	{
+		uint8_t type;			// One of EventType
+		uint8_t reader;			// Index in the order readers were added
+		uint32_t time_ms;		// board_millis() when the change was seen
+		MFRC522::Uid uid;
+	};
+
+	// Duty cycle of a reader without a card. It polls every fast_ms while a card was seen within
+	// hold_ms, then the period doubles up to slow_ms. Between polls the MFRC522 is in soft power-down.
+	struct PowerProfile
+	{
+		uint16_t fast_ms;		// 0 => no power-down, poll back to back
+		uint16_t slow_ms;
+		uint16_t hold_ms;
+	};
+	struct PowerStats
+	{
+		uint64_t awake_us;
+		uint64_t asleep_us;
+		uint32_t wakes;
+		uint32_t wake_us_max;		// Oscillator start-up after soft power-down
+		uint32_t poll_us_max;		// Longest inventory of a reader that was searching
+	};
+	struct InventoryStats
+	{
+		uint32_t stacks;			// Inventories that listed more than one card
+		uint32_t overruns;			// Inventories that ran out of INVENTORY_BUDGET_US with cards left in the field
+		uint32_t stack_us_max;		// Longest of the stacked inventories
+		uint8_t stack_max;			// Most cards listed in one inventory
+	};
+
+	ReaderPoller();
+	bool add( MFRC522& reader );
+	uint8_t count() const { return _count; }
+	MFRC522& reader( uint8_t index ) { return *_readers[index].pcd; }
+
+	// Drives the readers until each one is idle or waiting for its next check, something changed,
+	// or POLLER_PASS_US went by. Returns true and fills event while something changed.
+	bool poll( Event* event );
+	// Runs PCD_CheckHealth() on each reader the next time it is between two exchanges.
+	void check_health() { _healthDue = ( 1 << _count ) - 1; }
+	// Completes the exchange in flight on a reader so its MFRC522 can be used directly until the next poll().
+	void finish( uint8_t index );
+	uint32_t rounds() const { return _rounds; }
+
+	void set_power_profile( const PowerProfile& profile );
+	const PowerProfile& power_profile() const { return _profile; }
+	const PowerStats& power_stats( uint8_t index ) const { return _readers[index].power; }
+	const InventoryStats& inventory_stats( uint8_t index ) const { return _readers[index].inventory; }
+	// Estimate from the time spent awake and in power-down, using POWER_ACTIVE_UA and POWER_DOWN_UA
+	uint32_t average_current_ua( uint8_t index ) const;
+	// Card placed right after a poll: the slowest period, the wake-up and the inventory that sees it
+	uint32_t worst_latency_us( uint8_t index ) const;
+private:
+	enum State
+	{
+		SEARCHING,		// Inventory until an allowed card shows up
+		TRACKING		// Card halted, WUPA every PRESENCE_CHECK_MS
+	};
+	struct Reader
+	{
+		MFRC522* pcd;
+		MFRC522Async async;
+		AsyncTask task;			// inventory() or activate() in flight
+		uint8_t state;
+		uint8_t misses;			// WUPAs in a row the tracked card did not answer
+		bool shadowed;			// The card is reported by another reader already, stay quiet about it
+		uint32_t next_check;
+		uint32_t last_report;
+		MFRC522::Uid uid;		// Card being tracked
+		MFRC522::Uid rejected;	// Last card dropped by the UID filter, reported once until the field is empty
+		bool has_rejected;
+		MFRC522::Uid found[ POLLER_INVENTORY_MAX ];
+		uint8_t found_count;
+		MFRC522::Uid unknown;	// Card the inventory dropped part way through the select
+		bool asleep;			// MFRC522 in soft power-down until next_poll
+		uint32_t next_poll;
+		uint32_t period;		// Current poll period while searching, fast_ms..slow_ms
+		uint32_t last_activity;	// board_millis() when the last card was seen
+		uint64_t since_us;		// Start of the current awake or asleep span
+		uint64_t task_start_us;
+		PowerStats power;
+		InventoryStats inventory;
+	};
+
+	bool step( uint8_t index );
+	void inventory_done( uint8_t index, uint32_t now );
+	void push( uint8_t type, uint8_t reader, uint32_t time_ms, const MFRC522::Uid& uid );
+	bool tracked_elsewhere( uint8_t index, const MFRC522::Uid& uid );
+	bool hand_over( uint8_t index );
+	void record_inventory( uint8_t index, uint8_t status, uint32_t took_us );
+	void sleep( uint8_t index, uint32_t now, bool activity );
+	void wake( uint8_t index );
+	void run_health_check( uint8_t index );
+
+	Reader _readers[ POLLER_MAX_READERS ];
+	Event _queue[ POLLER_QUEUE_SIZE ];
+	uint8_t _queue_head;
+	uint8_t _queue_len;
+	uint8_t _count;
+	uint8_t _next;			// Reader poll() looks at first, so no reader starves the others
+	uint8_t _healthDue;		// Bit n set => reader n gets a health check before its next exchange
+	uint32_t _rounds;		// Activations completed on all readers together
+	PowerProfile _profile;
+};
+
+#endif
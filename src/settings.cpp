@@ -0,0 +1,123 @@
+#include "settings.h"
+#include <stddef.h>
+#include <string.h>
+#include "flash_storage.h"
+#include "zeroize.h"
+#include "bsp/board.h"
+#include "log.h"
+
+Settings::Data Settings::_data;
+Settings::Secret Settings::_secret;
+
+uint32_t Settings::fnv1a( const uint8_t* p, const uint8_t* end )
+{
+	uint32_t hash = 2166136261u;
+	while( p < end )
+	{
+		hash = ( hash ^ *p++ ) * 16777619u;
+	}
+	return hash;
+}
+
+uint32_t Settings::checksum( const Data& data, uint32_t size )
+{
+	return fnv1a( (const uint8_t*)&data + offsetof( Data, checksum ) + sizeof( data.checksum ), (const uint8_t*)&data + size );
+}
+
+void Settings::load()
+{
+	memcpy( &_data, FlashStorage::xip( FLASH_SETTINGS_OFFSET ), sizeof( Data ) );
+	// Keeps the vault secret of "UPS3" settings, derived passwords start off
+	if( _data.magic == SETTINGS_MAGIC_V3 && _data.checksum == checksum( _data, offsetof( Data, derive_length ) ) )
+	{
+		LOGS_INFO( "Settings upgraded" );
+		_data.magic = SETTINGS_MAGIC;
+		_data.derive_length = 0;
+		_data.derive_symbols = 0;
+		memset( _data.derive_profile, 0, sizeof( _data.derive_profile ) );
+	}
+	else if( _data.magic != SETTINGS_MAGIC || _data.checksum != checksum( _data, sizeof( Data ) ) )
+	{
+		LOGS_INFO( "No stored settings, using defaults" );
+		memset( &_data, 0, sizeof( Data ) );
+		_data.magic = SETTINGS_MAGIC;
+		_data.rx_gain = SETTINGS_RX_GAIN_UNSET;
+		_data.poll_fast_ms = SETTINGS_POLL_FAST_MS;
+		_data.poll_slow_ms = SETTINGS_POLL_SLOW_MS;
+		_data.poll_hold_ms = SETTINGS_POLL_HOLD_MS;
+	}
+	memcpy( &_secret, FlashStorage::xip( FLASH_SECRET_OFFSET ), sizeof( Secret ) );
+	if( _secret.magic == SETTINGS_SECRET_MAGIC &&
+		_secret.checksum == fnv1a( _secret.secret, _secret.secret + SETTINGS_SECRET_SIZE ) )
+	{
+		memset( _data.old_secret, 0, sizeof( _data.old_secret ) );
+	}
+	else
+	{
+		// Not written yet: a build that kept the secret in the settings may have left one there
+		memset( &_secret, 0, sizeof( Secret ) );
+		memcpy( _secret.secret, _data.old_secret, SETTINGS_SECRET_SIZE );
+	}
+}
+
+void Settings::set_polling( uint16_t fast_ms, uint16_t slow_ms, uint16_t hold_ms )
+{
+	_data.poll_fast_ms = fast_ms;
+	_data.poll_slow_ms = slow_ms;
+	_data.poll_hold_ms = hold_ms;
+}
+
+void Settings::set_derive( uint8_t length, bool symbols, const char* profile )
+{
+	_data.derive_length = length;
+	_data.derive_symbols = symbols;
+	memset( _data.derive_profile, 0, sizeof( _data.derive_profile ) );
+	strncpy( _data.derive_profile, profile, sizeof( _data.derive_profile ) - 1 );
+}
+
+bool Settings::has_secret()
+{
+	for( uint8_t i = 0; i < SETTINGS_SECRET_SIZE; i++ )
+	{
+		if( _secret.secret[i] ) return true;
+	}
+	return false;
+}
+
+bool Settings::save_secret( const uint8_t* secret )
+{
+	static_assert( sizeof( Secret ) <= FLASH_PAGE_SIZE, "The secret must fit in one flash page" );
+	uint8_t page[ FLASH_PAGE_SIZE ];
+	memmove( _secret.secret, secret, SETTINGS_SECRET_SIZE );
+	_secret.magic = SETTINGS_SECRET_MAGIC;
+	_secret.checksum = fnv1a( _secret.secret, _secret.secret + SETTINGS_SECRET_SIZE );
+	memset( page, 0xFF, sizeof( page ) );
+	memcpy( page, &_secret, sizeof( Secret ) );
+	FlashStorage::erase( FLASH_SECRET_OFFSET, FLASH_SECRET_SIZE );
+	FlashStorage::program( FLASH_SECRET_OFFSET, page, sizeof( page ) );
+	zeroize( page, sizeof( Secret ) );
+	bool ok = memcmp( FlashStorage::xip( FLASH_SECRET_OFFSET ), &_secret, sizeof( Secret ) ) == 0;
+	if( !ok )
+	{
+		LOGS_ERROR( "Secret verify failed" );
+		_secret.magic = 0;
+		return false;
+	}
+	// The next save() drops the old copy from the settings sector
+	memset( _data.old_secret, 0, sizeof( _data.old_secret ) );
+	return true;
+}
+
+bool Settings::save()
+{
+	static_assert( sizeof( Data ) <= FLASH_PAGE_SIZE, "Settings must fit in one flash page" );
+	uint8_t page[ FLASH_PAGE_SIZE ];
+	memset( page, 0xFF, sizeof( page ) );
+	_data.checksum = checksum( _data, sizeof( Data ) );
+	memcpy( page, &_data, sizeof( Data ) );
+	FlashStorage::erase( FLASH_SETTINGS_OFFSET, FLASH_SETTINGS_SIZE );
+	FlashStorage::program( FLASH_SETTINGS_OFFSET, page, sizeof( page ) );
+	bool ok = memcmp( FlashStorage::xip( FLASH_SETTINGS_OFFSET ), &_data, sizeof( Data ) ) == 0;
+	if( !ok ) LOGS_ERROR( "Settings verify failed" );
+	return ok;
+}
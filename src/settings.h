@@ -0,0 +1,65 @@
+#ifndef _SETTINGS_H_
+#define _SETTINGS_H_
+#include <cstdint>
+
+#define SETTINGS_MAGIC 0x34535055	// "UPS4"
+#define SETTINGS_MAGIC_V3 0x33535055	// "UPS3", the same fields up to the secret; upgraded on load
+#define SETTINGS_RX_GAIN_UNSET 0xFF
+#define SETTINGS_POLL_FAST_MS 50		// Default reader duty cycle, see ReaderPoller::PowerProfile
+#define SETTINGS_POLL_SLOW_MS 300
+#define SETTINGS_POLL_HOLD_MS 5000
+#define SETTINGS_SECRET_SIZE 16
+#define SETTINGS_SECRET_MAGIC 0x31434553	// "SEC1", the device secret sector
+#define SETTINGS_PROFILE_SIZE 16
+
+class Settings
+{
+private:
+	struct Data
+	{
+		uint32_t magic;
+		uint32_t checksum;		// FNV-1a over everything after this field
+		uint8_t rx_gain;		// RFCfgReg RxGain bits found by calibration, SETTINGS_RX_GAIN_UNSET if never calibrated
+		uint16_t poll_fast_ms;	// Poll period after card activity, 0 => no power-down
+		uint16_t poll_slow_ms;	// Poll period when idle
+		uint16_t poll_hold_ms;	// How long activity keeps the fast period
+		uint8_t old_secret[ SETTINGS_SECRET_SIZE ];	// Device secret of builds that kept it here, zero once it is moved
+		uint8_t derive_length;	// Length of derived passwords, 0 => stored passwords are typed
+		uint8_t derive_symbols;	// Derived passwords use punctuation too, not just letters and digits
+		char derive_profile[ SETTINGS_PROFILE_SIZE ];	// Site profile mixed into derived passwords, NUL padded
+	};
+	// The device secret has a sector of its own, FLASH_SECRET_OFFSET: the settings sector is erased by
+	// every save, and a power cut then would lose the key of every stored credential
+	struct Secret
+	{
+		uint32_t magic;			// SETTINGS_SECRET_MAGIC once the sector is written
+		uint32_t checksum;		// FNV-1a over secret
+		uint8_t secret[ SETTINGS_SECRET_SIZE ];	// Random device secret of the credential vault, all zero until generated
+	};
+	static Data _data;
+	static Secret _secret;
+	static uint32_t fnv1a( const uint8_t* p, const uint8_t* end );
+	static uint32_t checksum( const Data& data, uint32_t size );
+public:
+	static void load();
+	static bool save();
+	static uint8_t rx_gain() { return _data.rx_gain; }
+	static void set_rx_gain( uint8_t gain ) { _data.rx_gain = gain; }
+	static uint16_t poll_fast_ms() { return _data.poll_fast_ms; }
+	static uint16_t poll_slow_ms() { return _data.poll_slow_ms; }
+	static uint16_t poll_hold_ms() { return _data.poll_hold_ms; }
+	static void set_polling( uint16_t fast_ms, uint16_t slow_ms, uint16_t hold_ms );
+	static const uint8_t* secret() { return _secret.secret; }
+	static bool has_secret();
+	// The secret came from its sector; false if there was none, or it is still the one in the settings
+	static bool secret_saved() { return _secret.magic == SETTINGS_SECRET_MAGIC; }
+	// Writes the secret to its sector, which nothing else erases, and drops the copy in the settings
+	static bool save_secret( const uint8_t* secret );
+	static uint8_t derive_length() { return _data.derive_length; }
+	static bool derive_symbols() { return _data.derive_symbols; }
+	static const char* derive_profile() { return _data.derive_profile; }
+	// length 0 turns derived passwords off; profile is cut to SETTINGS_PROFILE_SIZE - 1 characters
+	static void set_derive( uint8_t length, bool symbols, const char* profile );
+};
+
+#endif
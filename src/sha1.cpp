@@ -0,0 +1,164 @@
+#include "sha1.h"
+#include <string.h>
+#include "zeroize.h"
+#if __has_include( "pico/platform.h" )
+#include "pico/platform.h"
+#else
+#define __not_in_flash_func( f ) f		// Host build, see tools/crypto_bench.cpp
+#endif
+
+static const uint32_t INITIAL[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+
+static inline uint32_t rol( uint32_t x, uint8_t n )
+{
+	return ( x << n ) | ( x >> ( 32 - n ) );
+}
+
+static inline uint32_t load_be( const uint8_t* p )
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void store_be( uint8_t* p, uint32_t x )
+{
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+#define SHA1_CH( b, c, d ) ( d ^ ( b & ( c ^ d ) ) )
+#define SHA1_PARITY( b, c, d ) ( b ^ c ^ d )
+#define SHA1_MAJ( b, c, d ) ( ( b & c ) | ( d & ( b | c ) ) )
+
+// One round. The caller renames the variables for the next one, so only b and e are written.
+#define SHA1_ROUND( a, b, c, d, e, f, k, w ) \
+	e += rol( a, 5 ) + f( b, c, d ) + k + ( w ); \
+	b = rol( b, 30 );
+
+#define SHA1_FIVE( i, f, k, w ) \
+	SHA1_ROUND( a, b, c, d, e, f, k, w( i ) ) \
+	SHA1_ROUND( e, a, b, c, d, f, k, w( i + 1 ) ) \
+	SHA1_ROUND( d, e, a, b, c, f, k, w( i + 2 ) ) \
+	SHA1_ROUND( c, d, e, a, b, f, k, w( i + 3 ) ) \
+	SHA1_ROUND( b, c, d, e, a, f, k, w( i + 4 ) )
+
+// Rounds 0..15 take the block words, later ones expand the ring in place
+#define SHA1_LOAD( i ) ( W[ i ] = load_be( &block[ 4 * ( i ) ] ) )
+#define SHA1_EXPAND( i ) ( W[ ( i ) & 15 ] = rol( W[ ( ( i ) - 3 ) & 15 ] ^ W[ ( ( i ) - 8 ) & 15 ] ^ \
+	W[ ( ( i ) - 14 ) & 15 ] ^ W[ ( i ) & 15 ], 1 ) )
+
+void __not_in_flash_func( Sha1::compress )( uint32_t* state, const uint8_t* block )
+{
+	uint32_t W[16];
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	SHA1_FIVE( 0, SHA1_CH, 0x5A827999, SHA1_LOAD )
+	SHA1_FIVE( 5, SHA1_CH, 0x5A827999, SHA1_LOAD )
+	SHA1_FIVE( 10, SHA1_CH, 0x5A827999, SHA1_LOAD )
+	SHA1_ROUND( a, b, c, d, e, SHA1_CH, 0x5A827999, SHA1_LOAD( 15 ) )
+	SHA1_ROUND( e, a, b, c, d, SHA1_CH, 0x5A827999, SHA1_EXPAND( 16 ) )
+	SHA1_ROUND( d, e, a, b, c, SHA1_CH, 0x5A827999, SHA1_EXPAND( 17 ) )
+	SHA1_ROUND( c, d, e, a, b, SHA1_CH, 0x5A827999, SHA1_EXPAND( 18 ) )
+	SHA1_ROUND( b, c, d, e, a, SHA1_CH, 0x5A827999, SHA1_EXPAND( 19 ) )
+	for( uint8_t i = 20; i < 40; i += 5 )
+	{
+		SHA1_FIVE( i, SHA1_PARITY, 0x6ED9EBA1, SHA1_EXPAND )
+	}
+	for( uint8_t i = 40; i < 60; i += 5 )
+	{
+		SHA1_FIVE( i, SHA1_MAJ, 0x8F1BBCDC, SHA1_EXPAND )
+	}
+	for( uint8_t i = 60; i < 80; i += 5 )
+	{
+		SHA1_FIVE( i, SHA1_PARITY, 0xCA62C1D6, SHA1_EXPAND )
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+Sha1::Sha1()
+	: _length( 0 )
+{
+	memcpy( _state, INITIAL, sizeof( _state ) );
+}
+
+Sha1::Sha1( const uint32_t* state, uint64_t length )
+	: _length( length )
+{
+	memcpy( _state, state, sizeof( _state ) );
+}
+
+void Sha1::update( const uint8_t* data, size_t len )
+{
+	size_t used = _length % SHA1_BLOCK_SIZE;
+	_length += len;
+	if( used )
+	{
+		size_t n = SHA1_BLOCK_SIZE - used < len ? SHA1_BLOCK_SIZE - used : len;
+		memcpy( &_block[ used ], data, n );
+		data += n;
+		len -= n;
+		if( used + n < SHA1_BLOCK_SIZE ) return;
+		compress( _state, _block );
+	}
+	for( ; len >= SHA1_BLOCK_SIZE; data += SHA1_BLOCK_SIZE, len -= SHA1_BLOCK_SIZE ) compress( _state, data );
+	memcpy( _block, data, len );
+}
+
+void Sha1::finish( uint8_t* digest )
+{
+	size_t used = _length % SHA1_BLOCK_SIZE;
+	uint64_t bits = _length * 8;
+	_block[ used++ ] = 0x80;
+	if( used > SHA1_BLOCK_SIZE - 8 )
+	{
+		memset( &_block[ used ], 0, SHA1_BLOCK_SIZE - used );
+		compress( _state, _block );
+		used = 0;
+	}
+	memset( &_block[ used ], 0, SHA1_BLOCK_SIZE - 8 - used );
+	store_be( &_block[ SHA1_BLOCK_SIZE - 8 ], bits >> 32 );
+	store_be( &_block[ SHA1_BLOCK_SIZE - 4 ], bits );
+	compress( _state, _block );
+	for( uint8_t i = 0; i < 5; i++ ) store_be( &digest[ 4 * i ], _state[i] );
+}
+
+void HmacSha1::set_key( const uint8_t* key, size_t len )
+{
+	uint8_t pad[ SHA1_BLOCK_SIZE ];
+	memset( pad, 0, sizeof( pad ) );
+	if( len > SHA1_BLOCK_SIZE )
+	{
+		Sha1 hash;
+		hash.update( key, len );
+		hash.finish( pad );
+	}
+	else memcpy( pad, key, len );
+	for( uint8_t i = 0; i < SHA1_BLOCK_SIZE; i++ ) pad[i] ^= 0x36;
+	memcpy( _inner, INITIAL, sizeof( _inner ) );
+	Sha1::compress( _inner, pad );
+	for( uint8_t i = 0; i < SHA1_BLOCK_SIZE; i++ ) pad[i] ^= 0x36 ^ 0x5C;
+	memcpy( _outer, INITIAL, sizeof( _outer ) );
+	Sha1::compress( _outer, pad );
+	zeroize( pad, sizeof( pad ) );
+}
+
+void HmacSha1::compute( const uint8_t* message, size_t len, uint8_t* mac ) const
+{
+	uint8_t digest[ SHA1_DIGEST_SIZE ];
+	Sha1 inner( _inner, SHA1_BLOCK_SIZE );
+	inner.update( message, len );
+	inner.finish( digest );
+	Sha1 outer( _outer, SHA1_BLOCK_SIZE );
+	outer.update( digest, sizeof( digest ) );
+	outer.finish( mac );
+}
+
+void HmacSha1::wipe()
+{
+	zeroize( _inner, sizeof( _inner ) );
+	zeroize( _outer, sizeof( _outer ) );
+}
@@ -0,0 +1,41 @@
+#ifndef _SHA1_H_
+#define _SHA1_H_
+#include <cstddef>
+#include <cstdint>
+
+#define SHA1_BLOCK_SIZE 64
+#define SHA1_DIGEST_SIZE 20
+
+// SHA-1 (FIPS 180-4) for the Cortex-M0+, only as the hash of HMAC-SHA1 for TOTP.
+// Built like Sha256: compress() runs from RAM, rounds are unrolled by five with the working variables
+// renamed instead of shifted, and the message schedule is a ring of 16 words expanded in place.
+// Rounds 0..19 are straight-line code, the other three stages loop over one group of five.
+class Sha1
+{
+public:
+	Sha1();
+	// Continues from a midstate after length bytes, e.g. the precomputed key block of an HMAC
+	Sha1( const uint32_t* state, uint64_t length );
+	void update( const uint8_t* data, size_t len );
+	void finish( uint8_t* digest );
+	static void compress( uint32_t* state, const uint8_t* block );
+private:
+	uint32_t _state[5];
+	uint8_t _block[ SHA1_BLOCK_SIZE ];
+	uint64_t _length;
+};
+
+// HMAC-SHA1 (RFC 2104) with the key blocks hashed once by set_key(), so the MAC of a TOTP counter
+// costs two compressions.
+class HmacSha1
+{
+public:
+	void set_key( const uint8_t* key, size_t len );
+	void compute( const uint8_t* message, size_t len, uint8_t* mac ) const;
+	void wipe();
+private:
+	uint32_t _inner[5];
+	uint32_t _outer[5];
+};
+
+#endif
@@ -0,0 +1,170 @@
+#include "sha256.h"
+#include <string.h>
+#include "zeroize.h"
+#if __has_include( "pico/platform.h" )
+#include "pico/platform.h"
+#else
+#define __not_in_flash_func( f ) f		// Host build, see tools/crypto_bench.cpp
+#define __not_in_flash( group )
+#endif
+
+static const uint32_t __not_in_flash( "sha256" ) K[64] = {
+	0x428A2F98, 0x71374491, 0xB5C0FBCF, 0xE9B5DBA5, 0x3956C25B, 0x59F111F1, 0x923F82A4, 0xAB1C5ED5,
+	0xD807AA98, 0x12835B01, 0x243185BE, 0x550C7DC3, 0x72BE5D74, 0x80DEB1FE, 0x9BDC06A7, 0xC19BF174,
+	0xE49B69C1, 0xEFBE4786, 0x0FC19DC6, 0x240CA1CC, 0x2DE92C6F, 0x4A7484AA, 0x5CB0A9DC, 0x76F988DA,
+	0x983E5152, 0xA831C66D, 0xB00327C8, 0xBF597FC7, 0xC6E00BF3, 0xD5A79147, 0x06CA6351, 0x14292967,
+	0x27B70A85, 0x2E1B2138, 0x4D2C6DFC, 0x53380D13, 0x650A7354, 0x766A0ABB, 0x81C2C92E, 0x92722C85,
+	0xA2BFE8A1, 0xA81A664B, 0xC24B8B70, 0xC76C51A3, 0xD192E819, 0xD6990624, 0xF40E3585, 0x106AA070,
+	0x19A4C116, 0x1E376C08, 0x2748774C, 0x34B0BCB5, 0x391C0CB3, 0x4ED8AA4A, 0x5B9CCA4F, 0x682E6FF3,
+	0x748F82EE, 0x78A5636F, 0x84C87814, 0x8CC70208, 0x90BEFFFA, 0xA4506CEB, 0xBEF9A3F7, 0xC67178F2,
+};
+
+static const uint32_t INITIAL[8] = {
+	0x6A09E667, 0xBB67AE85, 0x3C6EF372, 0xA54FF53A, 0x510E527F, 0x9B05688C, 0x1F83D9AB, 0x5BE0CD19,
+};
+
+static inline uint32_t ror( uint32_t x, uint8_t n )
+{
+	return ( x >> n ) | ( x << ( 32 - n ) );
+}
+
+static inline uint32_t load_be( const uint8_t* p )
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void store_be( uint8_t* p, uint32_t x )
+{
+	p[0] = x >> 24;
+	p[1] = x >> 16;
+	p[2] = x >> 8;
+	p[3] = x;
+}
+
+// One round. The caller renames the variables for the next one, so only d and h are written.
+#define SHA256_ROUND( a, b, c, d, e, f, g, h, i, w ) \
+	t = h + ( ror( e, 6 ) ^ ror( e, 11 ) ^ ror( e, 25 ) ) + ( g ^ ( e & ( f ^ g ) ) ) + K[ i ] + ( w ); \
+	d += t; \
+	h = t + ( ror( a, 2 ) ^ ror( a, 13 ) ^ ror( a, 22 ) ) + ( ( a & b ) | ( c & ( a | b ) ) );
+
+#define SHA256_EIGHT( i, w ) \
+	SHA256_ROUND( a, b, c, d, e, f, g, h, i, w( i ) ) \
+	SHA256_ROUND( h, a, b, c, d, e, f, g, i + 1, w( i + 1 ) ) \
+	SHA256_ROUND( g, h, a, b, c, d, e, f, i + 2, w( i + 2 ) ) \
+	SHA256_ROUND( f, g, h, a, b, c, d, e, i + 3, w( i + 3 ) ) \
+	SHA256_ROUND( e, f, g, h, a, b, c, d, i + 4, w( i + 4 ) ) \
+	SHA256_ROUND( d, e, f, g, h, a, b, c, i + 5, w( i + 5 ) ) \
+	SHA256_ROUND( c, d, e, f, g, h, a, b, i + 6, w( i + 6 ) ) \
+	SHA256_ROUND( b, c, d, e, f, g, h, a, i + 7, w( i + 7 ) )
+
+// Rounds 0..15 take the block words, later ones expand the ring in place
+#define SHA256_LOAD( i ) ( W[ i ] = load_be( &block[ 4 * ( i ) ] ) )
+#define SHA256_EXPAND( i ) ( W[ ( i ) & 15 ] += ( ror( W[ ( ( i ) - 2 ) & 15 ], 17 ) ^ ror( W[ ( ( i ) - 2 ) & 15 ], 19 ) ^ \
+	( W[ ( ( i ) - 2 ) & 15 ] >> 10 ) ) + W[ ( ( i ) - 7 ) & 15 ] + ( ror( W[ ( ( i ) - 15 ) & 15 ], 7 ) ^ \
+	ror( W[ ( ( i ) - 15 ) & 15 ], 18 ) ^ ( W[ ( ( i ) - 15 ) & 15 ] >> 3 ) ) )
+
+void __not_in_flash_func( Sha256::compress )( uint32_t* state, const uint8_t* block )
+{
+	uint32_t W[16];
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+	uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+	uint32_t t;
+	SHA256_EIGHT( 0, SHA256_LOAD )
+	SHA256_EIGHT( 8, SHA256_LOAD )
+	for( uint8_t i = 16; i < 64; i += 8 )
+	{
+		SHA256_EIGHT( i, SHA256_EXPAND )
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+	state[5] += f;
+	state[6] += g;
+	state[7] += h;
+}
+
+Sha256::Sha256()
+	: _length( 0 )
+{
+	memcpy( _state, INITIAL, sizeof( _state ) );
+}
+
+Sha256::Sha256( const uint32_t* state, uint64_t length )
+	: _length( length )
+{
+	memcpy( _state, state, sizeof( _state ) );
+}
+
+void Sha256::update( const uint8_t* data, size_t len )
+{
+	size_t used = _length % SHA256_BLOCK_SIZE;
+	_length += len;
+	if( used )
+	{
+		size_t n = SHA256_BLOCK_SIZE - used < len ? SHA256_BLOCK_SIZE - used : len;
+		memcpy( &_block[ used ], data, n );
+		data += n;
+		len -= n;
+		if( used + n < SHA256_BLOCK_SIZE ) return;
+		compress( _state, _block );
+	}
+	for( ; len >= SHA256_BLOCK_SIZE; data += SHA256_BLOCK_SIZE, len -= SHA256_BLOCK_SIZE ) compress( _state, data );
+	memcpy( _block, data, len );
+}
+
+void Sha256::finish( uint8_t* digest )
+{
+	size_t used = _length % SHA256_BLOCK_SIZE;
+	uint64_t bits = _length * 8;
+	_block[ used++ ] = 0x80;
+	if( used > SHA256_BLOCK_SIZE - 8 )
+	{
+		memset( &_block[ used ], 0, SHA256_BLOCK_SIZE - used );
+		compress( _state, _block );
+		used = 0;
+	}
+	memset( &_block[ used ], 0, SHA256_BLOCK_SIZE - 8 - used );
+	store_be( &_block[ SHA256_BLOCK_SIZE - 8 ], bits >> 32 );
+	store_be( &_block[ SHA256_BLOCK_SIZE - 4 ], bits );
+	compress( _state, _block );
+	for( uint8_t i = 0; i < 8; i++ ) store_be( &digest[ 4 * i ], _state[i] );
+}
+
+void HmacSha256::set_key( const uint8_t* key, size_t len )
+{
+	uint8_t pad[ SHA256_BLOCK_SIZE ];
+	memset( pad, 0, sizeof( pad ) );
+	if( len > SHA256_BLOCK_SIZE )
+	{
+		Sha256 hash;
+		hash.update( key, len );
+		hash.finish( pad );
+	}
+	else memcpy( pad, key, len );
+	for( uint8_t i = 0; i < SHA256_BLOCK_SIZE; i++ ) pad[i] ^= 0x36;
+	memcpy( _inner, INITIAL, sizeof( _inner ) );
+	Sha256::compress( _inner, pad );
+	for( uint8_t i = 0; i < SHA256_BLOCK_SIZE; i++ ) pad[i] ^= 0x36 ^ 0x5C;
+	memcpy( _outer, INITIAL, sizeof( _outer ) );
+	Sha256::compress( _outer, pad );
+	zeroize( pad, sizeof( pad ) );
+}
+
+void HmacSha256::compute( const uint8_t* message, size_t len, uint8_t* mac ) const
+{
+	uint8_t digest[ SHA256_DIGEST_SIZE ];
+	Sha256 inner( _inner, SHA256_BLOCK_SIZE );
+	inner.update( message, len );
+	inner.finish( digest );
+	Sha256 outer( _outer, SHA256_BLOCK_SIZE );
+	outer.update( digest, sizeof( digest ) );
+	outer.finish( mac );
+}
+
+void HmacSha256::wipe()
+{
+	zeroize( _inner, sizeof( _inner ) );
+	zeroize( _outer, sizeof( _outer ) );
+}
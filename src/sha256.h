@@ -0,0 +1,42 @@
+#ifndef _SHA256_H_
+#define _SHA256_H_
+#include <cstddef>
+#include <cstdint>
+
+#define SHA256_BLOCK_SIZE 64
+#define SHA256_DIGEST_SIZE 32
+
+// SHA-256 (FIPS 180-4) for the Cortex-M0+.
+// compress() runs from RAM with the round constants in RAM, so nothing waits for the XIP cache.
+// The rounds are unrolled by eight with the working variables renamed instead of shifted, and the
+// message schedule is a ring of 16 words expanded in place as the rounds go.
+class Sha256
+{
+public:
+	Sha256();
+	// Continues from a midstate after length bytes, e.g. the precomputed key block of an HMAC
+	Sha256( const uint32_t* state, uint64_t length );
+	void update( const uint8_t* data, size_t len );
+	void finish( uint8_t* digest );
+	const uint32_t* state() const { return _state; }
+	static void compress( uint32_t* state, const uint8_t* block );
+private:
+	uint32_t _state[8];
+	uint8_t _block[ SHA256_BLOCK_SIZE ];
+	uint64_t _length;
+};
+
+// HMAC-SHA256 (RFC 2104) with the key blocks hashed once by set_key(), so a MAC of a short
+// message costs two compressions.
+class HmacSha256
+{
+public:
+	void set_key( const uint8_t* key, size_t len );
+	void compute( const uint8_t* message, size_t len, uint8_t* mac ) const;
+	void wipe();
+private:
+	uint32_t _inner[8];
+	uint32_t _outer[8];
+};
+
+#endif
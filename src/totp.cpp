@@ -0,0 +1,74 @@
+#include "totp.h"
+#include <ctype.h>
+#include "sha1.h"
+#include "zeroize.h"
+#if __has_include( "pico/time.h" )
+#include "pico/time.h"
+#else
+static uint64_t time_us_64() { return 0; }		// Host build, see tools/crypto_bench.cpp
+#endif
+
+uint64_t Totp::_epoch_us = 0;
+uint64_t Totp::_synced_us = 0;
+
+void Totp::set_time( uint64_t unix_s )
+{
+	_synced_us = time_us_64();
+	_epoch_us = unix_s * 1000000 - _synced_us;
+}
+
+uint64_t Totp::now()
+{
+	return ( _epoch_us + time_us_64() ) / 1000000;
+}
+
+uint32_t Totp::since_sync_s()
+{
+	return ( time_us_64() - _synced_us ) / 1000000;
+}
+
+void Totp::code( const uint8_t* seed, uint8_t len, uint64_t step, uint8_t digits, char* code )
+{
+	uint8_t counter[8];
+	uint8_t mac[ SHA1_DIGEST_SIZE ];
+	HmacSha1 hmac;
+	for( uint8_t i = 0; i < 8; i++ ) counter[i] = step >> ( 56 - 8 * i );
+	hmac.set_key( seed, len );
+	hmac.compute( counter, sizeof( counter ), mac );
+	hmac.wipe();
+	// Dynamic truncation: 31 bits at the offset the last nibble gives
+	uint8_t offset = mac[ SHA1_DIGEST_SIZE - 1 ] & 0x0F;
+	uint32_t value = ( mac[ offset ] & 0x7F ) << 24 | mac[ offset + 1 ] << 16 | mac[ offset + 2 ] << 8 | mac[ offset + 3 ];
+	for( uint8_t i = digits; i > 0; i-- )
+	{
+		code[ i - 1 ] = '0' + value % 10;
+		value /= 10;
+	}
+	code[ digits ] = '\0';
+	zeroize( mac, sizeof( mac ) );
+}
+
+bool Totp::decode_base32( const char* text, uint8_t* seed, uint8_t* len )
+{
+	uint32_t bits = 0;
+	uint8_t count = 0;
+	*len = 0;
+	for( ; *text && *text != '='; text++ )
+	{
+		char c = toupper( (unsigned char)*text );
+		uint8_t value;
+		if( c == ' ' ) continue;
+		if( c >= 'A' && c <= 'Z' ) value = c - 'A';
+		else if( c >= '2' && c <= '7' ) value = c - '2' + 26;
+		else return false;
+		bits = bits << 5 | value;
+		count += 5;
+		if( count >= 8 )
+		{
+			if( *len == TOTP_MAX_SEED ) return false;
+			count -= 8;
+			seed[ ( *len )++ ] = bits >> count;
+		}
+	}
+	return *len > 0;
+}
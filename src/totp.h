@@ -0,0 +1,31 @@
+#ifndef _TOTP_H_
+#define _TOTP_H_
+#include <cstdint>
+
+#define TOTP_STEP_S 30			// RFC 6238 time step
+#define TOTP_DIGITS 6			// Default code length
+#define TOTP_MAX_DIGITS 8
+#define TOTP_MAX_SEED 32		// Bytes, a 52 character base32 seed
+#define TOTP_RECORD_HEADER 2	// A card's TOTP record in the vault: digits, separator ('\0', '\t' or '\n'), then the seed
+
+// RFC 6238 time-based one-time passwords with HMAC-SHA1.
+// There is no RTC: the host sends the Unix time over CDC ("time <seconds>") and the RP2040 timer,
+// which runs off the crystal, carries it until the next sync or reset. Until the first sync
+// synced() is false and no code is typed.
+class Totp
+{
+public:
+	static void set_time( uint64_t unix_s );
+	static bool synced() { return _epoch_us != 0; }
+	static uint64_t now();					// Unix seconds
+	static uint32_t since_sync_s();
+	// code must have room for digits + 1 characters
+	static void code( const uint8_t* seed, uint8_t len, uint64_t step, uint8_t digits, char* code );
+	// RFC 4648 base32 as authenticator apps show it: case, spaces and padding are ignored
+	static bool decode_base32( const char* text, uint8_t* seed, uint8_t* len );
+private:
+	static uint64_t _epoch_us;		// Unix time at timer zero
+	static uint64_t _synced_us;		// Timer at the last sync
+};
+
+#endif
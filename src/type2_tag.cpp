@@ -0,0 +1,141 @@
+#include "type2_tag.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "ndef.h"
+
+Type2Tag::Type2Tag( MFRC522& pcd )
+	: _pcd( pcd ), _areaSize( 0 ), _loaded( 0 ), _stats()
+{
+}
+
+uint8_t Type2Tag::read_message( std::span<uint8_t> buffer, std::span<const uint8_t>* message )
+{
+	uint32_t start = time_us_32();
+	uint8_t chunk[ TYPE2_READ_SIZE + 2 ];		// MIFARE_Read() wants room for the CRC_A
+	uint8_t size = sizeof( chunk );
+	_stats = Stats();
+	_loaded = 0;
+	*message = {};
+
+	// The capability container comes with the first three data pages
+	uint8_t status = _pcd.MIFARE_Read( TYPE2_CC_PAGE, chunk, &size );
+	_stats.reads++;
+	if( status != MFRC522::STATUS_OK ) return status;
+	if( chunk[0] != TYPE2_CC_MAGIC ) return MFRC522::STATUS_INVALID;
+	_areaSize = chunk[2] * 8;
+	size_t limit = _areaSize < buffer.size() ? _areaSize : buffer.size();
+	size_t have = limit < TYPE2_READ_SIZE - 4 ? limit : TYPE2_READ_SIZE - 4;
+	memcpy( buffer.data(), &chunk[4], have );
+	_loaded = have;
+
+	size_t offset = 0;
+	for( ;; )
+	{
+		NdefTlvReader tlv( buffer.first( have ), offset, _areaSize );
+		uint8_t tag;
+		std::span<const uint8_t> value;
+		while( tlv.next( &tag, &value ) )
+		{
+			if( tag == NDEF_TLV_MESSAGE )
+			{
+				*message = value;
+				_stats.duration_us = time_us_32() - start;
+				return MFRC522::STATUS_OK;
+			}
+		}
+		if( !tlv.truncated() ) break;		// Terminator or end of the area, no message on the tag
+		if( have >= limit ) return limit < _areaSize ? MFRC522::STATUS_NO_ROOM : MFRC522::STATUS_ERROR;
+		offset = tlv.offset();
+
+		// Read the next 4 pages in place while the CRC_A still fits behind them, the tail through chunk
+		uint8_t page = TYPE2_DATA_PAGE + have / 4;
+		size_t n = limit - have < TYPE2_READ_SIZE ? limit - have : TYPE2_READ_SIZE;
+		size = sizeof( chunk );
+		if( have + sizeof( chunk ) <= buffer.size() )
+		{
+			status = _pcd.MIFARE_Read( page, &buffer[ have ], &size );
+		}
+		else
+		{
+			status = _pcd.MIFARE_Read( page, chunk, &size );
+			memcpy( &buffer[ have ], chunk, n );
+		}
+		_stats.reads++;
+		if( status != MFRC522::STATUS_OK ) return status;
+		have += n;
+		_loaded = have;
+	}
+	_stats.duration_us = time_us_32() - start;
+	return MFRC522::STATUS_OK;
+}
+
+uint8_t Type2Tag::write_run( uint16_t first, uint16_t count, std::span<const uint8_t> tlvs )
+{
+	// Whole pages straight from tlvs, a partial last page padded with NULL TLVs
+	uint16_t whole = tlvs.size() / 4 > first ? tlvs.size() / 4 - first : 0;
+	if( whole > count ) whole = count;
+	uint8_t status = MFRC522::STATUS_OK;
+	if( whole ) status = _pcd.MIFARE_Ultralight_WritePages( TYPE2_DATA_PAGE + first, &tlvs[ 4 * first ], whole );
+	if( status == MFRC522::STATUS_OK && whole < count )
+	{
+		uint8_t page[4] = { NDEF_TLV_NULL, NDEF_TLV_NULL, NDEF_TLV_NULL, NDEF_TLV_NULL };
+		size_t at = 4 * ( first + whole );
+		if( at < tlvs.size() ) memcpy( page, &tlvs[ at ], tlvs.size() - at );
+		status = _pcd.MIFARE_Ultralight_WritePages( TYPE2_DATA_PAGE + first + whole, page, 1 );
+	}
+	if( status == MFRC522::STATUS_OK ) _stats.pages_written += count;
+	return status;
+}
+
+uint8_t Type2Tag::write( std::span<const uint8_t> tlvs, std::span<const uint8_t> current )
+{
+	uint32_t start = time_us_32();
+	uint16_t pages = ( tlvs.size() + 3 ) / 4;
+	if( !pages || ( _areaSize && tlvs.size() > _areaSize ) ) return MFRC522::STATUS_INVALID;
+	_stats.pages_written = 0;
+	_stats.pages_skipped = 0;
+
+	// Compare page by page against what is on the tag, a partial last page as padded by write_run()
+	auto same = [&]( uint16_t p ) -> bool
+	{
+		if( current.size() < 4u * ( p + 1 ) ) return false;
+		uint8_t page[4] = { NDEF_TLV_NULL, NDEF_TLV_NULL, NDEF_TLV_NULL, NDEF_TLV_NULL };
+		size_t n = tlvs.size() - 4u * p < 4 ? tlvs.size() - 4u * p : 4;
+		memcpy( page, &tlvs[ 4 * p ], n );
+		return !memcmp( page, &current[ 4 * p ], 4 );
+	};
+
+	uint8_t status = MFRC522::STATUS_OK;
+	bool headerSame = same( 0 );
+	bool restSame = true;
+	for( uint16_t p = 1; p < pages && restSame; p++ ) restSame = same( p );
+	if( !restSame && current.size() >= 4 && current[0] == NDEF_TLV_MESSAGE )
+	{
+		// Empty NDEF message while the rest changes
+		uint8_t empty[4] = { NDEF_TLV_MESSAGE, 0x00, NDEF_TLV_TERMINATOR, NDEF_TLV_NULL };
+		status = _pcd.MIFARE_Ultralight_WritePages( TYPE2_DATA_PAGE, empty, 1 );
+		_stats.pages_written++;
+		headerSame = false;
+	}
+	// Runs of changed pages go out as one batch each
+	for( uint16_t p = 1; p < pages && status == MFRC522::STATUS_OK; )
+	{
+		if( same( p ) )
+		{
+			_stats.pages_skipped++;
+			p++;
+			continue;
+		}
+		uint16_t end = p + 1;
+		while( end < pages && !same( end ) ) end++;
+		status = write_run( p, end - p, tlvs );
+		p = end;
+	}
+	if( status == MFRC522::STATUS_OK )
+	{
+		if( headerSame ) _stats.pages_skipped++;
+		else status = write_run( 0, 1, tlvs );
+	}
+	_stats.duration_us = time_us_32() - start;
+	return status;
+}
@@ -0,0 +1,47 @@
+#ifndef _TYPE2_TAG_H_
+#define _TYPE2_TAG_H_
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "MFRC522.h"
+
+#define TYPE2_CC_PAGE 3
+#define TYPE2_DATA_PAGE 4
+#define TYPE2_CC_MAGIC 0xE1			// Capability container byte 0 of a tag formatted for NDEF
+#define TYPE2_READ_SIZE 16			// A READ returns 4 pages
+
+// NDEF data area of an NFC Forum Type 2 tag (MIFARE Ultralight, NTAG) on MFRC522.
+// Reading goes 4 pages at a time straight into the caller's buffer and stops as soon as
+// the NDEF message TLV is complete, so a short credential costs one or two READs on any tag size.
+class Type2Tag
+{
+public:
+	struct Stats
+	{
+		uint16_t reads;				// READ commands
+		uint16_t pages_written;
+		uint16_t pages_skipped;		// Pages write() left alone because they already held the data
+		uint32_t duration_us;		// Of the last read_message() or write()
+	};
+
+	Type2Tag( MFRC522& pcd );
+	// The PICC must be ACTIVE. buffer receives the data area from page 4 on; message points into it,
+	// and is empty if the tag holds no NDEF message.
+	uint8_t read_message( std::span<uint8_t> buffer, std::span<const uint8_t>* message );
+	// Writes TLVs as built by NdefWriter::finish() from page 4 on. Pages equal to current, the data
+	// area as read by read_message(), are skipped. The NDEF length is zeroed first and the page
+	// holding it written last, so a tap cut short leaves an empty message rather than a broken one.
+	uint8_t write( std::span<const uint8_t> tlvs, std::span<const uint8_t> current = {} );
+	uint16_t area_size() const { return _areaSize; }
+	size_t loaded() const { return _loaded; }		// Bytes of the data area read_message() put in the buffer
+	const Stats& stats() const { return _stats; }
+private:
+	uint8_t write_run( uint16_t first, uint16_t count, std::span<const uint8_t> tlvs );
+
+	MFRC522& _pcd;
+	uint16_t _areaSize;			// Bytes from page 4 on, from the capability container
+	size_t _loaded;
+	Stats _stats;
+};
+
+#endif
@@ -1,15 +1,24 @@
 #include "usb_device.h"
 #include <stdlib.h>
+#include <string.h>
 #include <ctype.h>
 #include "tusb.h"
 #include "bsp/board.h"
 #include "log.h"
+#include "keymap.h"
 
 
 
 bool UsbDevice::_start_pass = false;
 uint8_t UsbDevice::_current_pos = 0;
-char UsbDevice::password[MAX_PASS_LEN] = "MyT4st_pAs7";""
+uint32_t UsbDevice::_last_empty_report = 0;
+
+static_assert( KEYMAP_SHIFT == KEYBOARD_MODIFIER_LEFTSHIFT && Keymap::KEY_A == HID_KEY_A && Keymap::KEY_1 == HID_KEY_1 &&
+	Keymap::KEY_9 == HID_KEY_9 && Keymap::KEY_0 == HID_KEY_0 && Keymap::KEY_ENTER == HID_KEY_ENTER && Keymap::KEY_TAB == HID_KEY_TAB &&
+	Keymap::KEY_MINUS == HID_KEY_MINUS && Keymap::KEY_EQUAL == HID_KEY_EQUAL && Keymap::KEY_BRACKET_LEFT == HID_KEY_BRACKET_LEFT &&
+	Keymap::KEY_BRACKET_RIGHT == HID_KEY_BRACKET_RIGHT && Keymap::KEY_BACKSLASH == HID_KEY_BACKSLASH &&
+	Keymap::KEY_SEMICOLON == HID_KEY_SEMICOLON && Keymap::KEY_APOSTROPHE == HID_KEY_APOSTROPHE && Keymap::KEY_COMMA == HID_KEY_COMMA &&
+	Keymap::KEY_PERIOD == HID_KEY_PERIOD && Keymap::KEY_SLASH == HID_KEY_SLASH, "Keymap usage IDs differ from TinyUSB's" );
 
 bool UsbDevice::init()
 {
@@ -80,15 +89,31 @@ void UsbDevice::write_line( const char *buffer )
 
 }
 
+void UsbDevice::write( const uint8_t *data, uint32_t len )
+{
+	if ( !tud_cdc_n_connected( 0 ) ) return;
+	uint32_t timeout = board_millis() + HID_NOT_READY_MAX_INTERVAL;
+	// TinyUSB sends every full packet on its own, only the tail needs the flush
+	while ( len && board_millis() < timeout )
+	{
+		uint32_t written = tud_cdc_n_write( 0, data, len );
+		data += written;
+		len -= written;
+		if( len ) tud_task();
+	}
+	tud_cdc_n_write_flush( 0 );
+	if( len ) LOGS_ERROR( "CDC write timed out, %lu bytes dropped", len );
+}
+
 bool UsbDevice::is_hid_ready()
 {
 	uint32_t timeout = board_millis() + HID_NOT_READY_MAX_INTERVAL;
-	do{
+	tud_task();
+	while( !tud_hid_ready() && (board_millis() < timeout) ) {
 		tud_task();
-		sleep_ms(10);
-	} while( !tud_hid_ready() && (board_millis() < timeout) );
+	}
 	// skip if hid is not ready yet
-	if( !tud_hid_ready ){
+	if( !tud_hid_ready() ){
 		LOGS_ERROR( "Abort sending pass, HID not ready" );
 		return false;
 	} 
@@ -105,94 +130,41 @@ bool UsbDevice::is_hid_ready()
 	return true;
 }
 
-bool UsbDevice::send_password()
+bool UsbDevice::send_text( const char *text, uint32_t len, void (*while_typing)() )
 {
 	if( !is_hid_ready() ) return false;
 
 	uint8_t keycode[6] = { 0 };
 	uint8_t modifier = 0;
-	for( int i = 0; password[i]; i++ )
+	for( uint32_t i = 0; i < len && text[i]; i++ )
 	{
-		keycode[0] = char_to_hid_keycode( password[i], &modifier );
+		keycode[0] = Keymap::keycode( text[i], &modifier );
 		while (!tud_hid_ready()) {
 			tud_task();
 		}
 		tud_hid_keyboard_report( REPORT_ID_KEYBOARD, modifier, keycode) ;
-		sleep_ms(25);
+		absolute_time_t release = make_timeout_time_ms( 25 );
+		if( !i && while_typing ) while_typing();
+		sleep_until( release );
 		while (!tud_hid_ready()) {
 			tud_task();
 		}
 		tud_hid_keyboard_report( REPORT_ID_KEYBOARD, 0, NULL );
 		sleep_ms(25);
-		LOGS_DEBUG( "Letter:(%c) sent", (char)password[i] );
+		LOGS_DEBUG( "Letter:(%c) sent", text[i] );
 	}
 	LOGS_INFO( "Password sent" );
 	return true;
 }
 
+// Called every main loop round, so it never waits: with the endpoint busy the report goes out next round
 bool UsbDevice::send_empty_report()
 {
-	if( !is_hid_ready() ) return false;
-	while (!tud_hid_ready()) {
-			tud_task();
-	}
+	tud_task();
+	if( board_millis() - _last_empty_report < EMPTY_REPORT_INTERVAL_MS ) return true;
+	if( tud_suspended() || !tud_hid_ready() ) return false;
+	_last_empty_report = board_millis();
 	tud_hid_keyboard_report( REPORT_ID_KEYBOARD, 0, NULL ) ;
-	sleep_ms(10);
 	LOGS_DEBUG( "Empty report sent" );
 	return true;
 }
-
-uint8_t UsbDevice::char_to_hid_keycode( char c, uint8_t* modifier )
-{
-	if( !c ) return 0;
-	*modifier = 0;
-
-	// Handle letters (A-Z, a-z)
-	if ( isalpha( c ) )
-	{
-		if ( isupper( c ) ) *modifier = KEYBOARD_MODIFIER_LEFTSHIFT;
-		return HID_KEY_A + ( toupper( c ) - 'A' );
-	}
-
-	// Handle numbers (0-9)
-	if ( isdigit( c ) )
-	{
-		return HID_KEY_0 + ( c - '0' );
-	}
-
-	// Handle some punctuation
-	switch ( c )
-	{
-		case '!': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_1;
-		case '@': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_2;
-		case '#': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_3;
-		case '$': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_4;
-		case '%': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_5;
-		case '^': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_6;
-		case '&': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_7;
-		case '*': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_8;
-		case '(': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_9;
-		case ')': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_0;
-		case '-': return HID_KEY_MINUS;
-		case '_': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_MINUS;
-		case '=': return HID_KEY_EQUAL;
-		case '+': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_EQUAL;
-		case '[': return HID_KEY_BRACKET_LEFT;
-		case '{': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_BRACKET_LEFT;
-		case ']': return HID_KEY_BRACKET_RIGHT;
-		case '}': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_BRACKET_RIGHT;
-		case '\\': return HID_KEY_BACKSLASH;
-		case '|': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_BACKSLASH;
-		case ';': return HID_KEY_SEMICOLON;
-		case ':': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_SEMICOLON;
-		case '\'': return HID_KEY_APOSTROPHE;
-		case '\"': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_APOSTROPHE;
-		case ',': return HID_KEY_COMMA;
-		case '<': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_COMMA;
-		case '.': return HID_KEY_PERIOD;
-		case '>': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_PERIOD;
-		case '/': return HID_KEY_SLASH;
-		case '?': *modifier = KEYBOARD_MODIFIER_LEFTSHIFT; return HID_KEY_SLASH;
-		default: return 0;
-	}
-}
\ No newline at end of file
@@ -1,26 +1,30 @@
 #ifndef _USB_H_
 #define _USB_H_
+#include <cstddef>
 #include <cstdint>
 
 #define CDC_TUSK_INTERVAL 1000
 #define HID_NOT_READY_MAX_INTERVAL 1000
 #define MAX_PASS_LEN 64
+#define EMPTY_REPORT_INTERVAL_MS 20		// send_empty_report() sends at most this often
 
 class UsbDevice
 {
 private:
-	static uint8_t char_to_hid_keycode( char c, uint8_t* modifier );
 	static bool _start_pass;
 	static uint8_t _current_pos;
-	static char password[MAX_PASS_LEN];
+	static uint32_t _last_empty_report;
 	static bool is_hid_ready();
 public:
 	static bool init();
 	static void pool();
-	static bool send_password();
+	// Types len characters, e.g. a stored password. while_typing runs while the first key is down,
+	// in the time the key is held anyway, as long as it takes less than that.
+	static bool send_text( const char *text, uint32_t len, void (*while_typing)() = NULL );
 	static bool send_empty_report();
 	static int read_line( char *buffer, uint32_t max_len );
 	static void write_line( const char *buffer );
+	static void write( const uint8_t *data, uint32_t len );	// Binary data, no logging per call
 };
 
 
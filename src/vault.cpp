@@ -0,0 +1,319 @@
+#include "vault.h"
+#include <string.h>
+#include "pico/stdlib.h"
+#include "pico/rand.h"
+#include "pico/unique_id.h"
+#include "kv_store.h"
+#include "settings.h"
+#include "totp.h"
+#include "zeroize.h"
+#include "log.h"
+#include "bsp/board.h"
+
+static_assert( VAULT_NONCE_SIZE + MAX_PASS_LEN + VAULT_TAG_SIZE <= KV_MAX_VALUE, "The store must hold an encrypted password" );
+static_assert( sizeof( MFRC522::Uid::uidByte ) < AES_BLOCK_SIZE - 2, "A UID block holds the UID, its size and the domain" );
+static_assert( VAULT_NONCE_SIZE + TOTP_RECORD_HEADER + TOTP_MAX_SEED + VAULT_TAG_SIZE <= KV_MAX_VALUE, "The store must hold an encrypted TOTP record" );
+static_assert( sizeof( MFRC522::Uid::uidByte ) + 1 <= KV_MAX_KEY, "The store must hold a TOTP record key" );
+
+Aes128 Vault::_device;
+HmacSha256 Vault::_mac;
+Vault::Slot Vault::_cache[ VAULT_CACHE_SLOTS ];
+Vault::Stats Vault::_stats;
+
+void Vault::init()
+{
+	if( !Settings::has_secret() )
+	{
+		rng_128_t random;
+		if( KvStore::count() ) LOGS_ERROR( "Vault: device secret lost, the stored credentials will be refused" );
+		do
+		{
+			get_rand_128( &random );
+		} while( !random.r[0] && !random.r[1] );
+		if( !Settings::save_secret( (const uint8_t*)random.r ) ) LOGS_ERROR( "Vault: saving the device secret failed" );
+		else LOGS_INFO( "Vault: device secret generated" );
+		zeroize( &random, sizeof( random ) );
+	}
+	else if( !Settings::secret_saved() )
+	{
+		if( !Settings::save_secret( Settings::secret() ) ) LOGS_ERROR( "Vault: moving the device secret failed" );
+		else LOGS_INFO( "Vault: device secret moved out of the settings" );
+	}
+	Aes128 secret;
+	pico_unique_board_id_t id;
+	uint8_t block[ AES_BLOCK_SIZE ];
+	uint8_t key[ AES_BLOCK_SIZE ];
+	pico_get_unique_board_id( &id );
+	memset( block, 0, sizeof( block ) );
+	memcpy( block, id.id, sizeof( id.id ) );
+	block[ AES_BLOCK_SIZE - 2 ] = 'D';
+	block[ AES_BLOCK_SIZE - 1 ] = 'K';
+	secret.expand( Settings::secret() );
+	secret.encrypt( block, key );
+	_device.expand( key );
+	block[ AES_BLOCK_SIZE - 2 ] = 'M';
+	secret.encrypt( block, key );
+	_mac.set_key( key, sizeof( key ) );
+	secret.wipe();
+	zeroize( key, sizeof( key ) );
+	clear_cache();
+}
+
+// One block: UID bytes, zero padding, UID size and a domain byte, encrypted with the device key
+void Vault::derive( const MFRC522::Uid& uid, Aes128* key )
+{
+	uint8_t block[ AES_BLOCK_SIZE ];
+	uint8_t cardKey[ AES_BLOCK_SIZE ];
+	memset( block, 0, sizeof( block ) );
+	memcpy( block, uid.uidByte, uid.size );
+	block[ AES_BLOCK_SIZE - 2 ] = uid.size;
+	block[ AES_BLOCK_SIZE - 1 ] = 'C';
+	_device.encrypt( block, cardKey );
+	key->expand( cardKey );
+	zeroize( cardKey, sizeof( cardKey ) );
+}
+
+// AES-CTR: the counter block is the nonce followed by a big-endian block counter
+void Vault::crypt( const Aes128& key, const uint8_t* nonce, const uint8_t* in, uint8_t* out, uint8_t len )
+{
+	uint8_t counter[ AES_BLOCK_SIZE ];
+	uint8_t stream[ AES_BLOCK_SIZE ];
+	memset( counter, 0, sizeof( counter ) );
+	memcpy( counter, nonce, VAULT_NONCE_SIZE );
+	for( uint8_t done = 0; done < len; done += AES_BLOCK_SIZE )
+	{
+		counter[ AES_BLOCK_SIZE - 1 ] = done / AES_BLOCK_SIZE;
+		key.encrypt( counter, stream );
+		for( uint8_t i = 0; i < AES_BLOCK_SIZE && done + i < len; i++ ) out[ done + i ] = in[ done + i ] ^ stream[i];
+	}
+	zeroize( stream, sizeof( stream ) );
+}
+
+// HMAC-SHA256 over the store key length, the store key, the nonce and the ciphertext, cut to VAULT_TAG_SIZE
+void Vault::tag( const uint8_t* key, uint8_t keyLen, const uint8_t* sealed, uint8_t len, uint8_t* out )
+{
+	uint8_t message[ 1 + KV_MAX_KEY + KV_MAX_VALUE ];
+	uint8_t mac[ SHA256_DIGEST_SIZE ];
+	message[0] = keyLen;
+	memcpy( &message[1], key, keyLen );
+	memcpy( &message[ 1 + keyLen ], sealed, len );
+	_mac.compute( message, 1 + keyLen + len, mac );
+	memcpy( out, mac, VAULT_TAG_SIZE );
+}
+
+// Writes a random nonce, plain encrypted under cardKey and the tag to sealed, returns their size
+uint8_t Vault::seal( const uint8_t* key, uint8_t keyLen, const Aes128& cardKey, const uint8_t* plain, uint8_t len,
+	uint8_t* sealed )
+{
+	uint64_t nonce = get_rand_64();
+	memcpy( sealed, &nonce, VAULT_NONCE_SIZE );
+	crypt( cardKey, sealed, plain, &sealed[ VAULT_NONCE_SIZE ], len );
+	tag( key, keyLen, sealed, VAULT_NONCE_SIZE + len, &sealed[ VAULT_NONCE_SIZE + len ] );
+	return VAULT_NONCE_SIZE + len + VAULT_TAG_SIZE;
+}
+
+// Decrypts a sealed record of at most maxLen bytes, only once its tag matches
+bool Vault::open( const uint8_t* key, uint8_t keyLen, const Aes128& cardKey, const uint8_t* sealed, uint8_t size,
+	uint8_t maxLen, uint8_t* plain, uint8_t* len )
+{
+	uint8_t expected[ VAULT_TAG_SIZE ];
+	uint8_t n = size > VAULT_NONCE_SIZE + VAULT_TAG_SIZE ? size - VAULT_NONCE_SIZE - VAULT_TAG_SIZE : 0;
+	uint8_t diff = !n || n > maxLen;
+	if( !diff )
+	{
+		tag( key, keyLen, sealed, VAULT_NONCE_SIZE + n, expected );
+		for( uint8_t i = 0; i < VAULT_TAG_SIZE; i++ ) diff |= expected[i] ^ sealed[ VAULT_NONCE_SIZE + n + i ];
+	}
+	if( diff )
+	{
+		_stats.rejected++;
+		LOGS_ERROR( "Vault: record failed its check, not used" );
+		return false;
+	}
+	crypt( cardKey, sealed, &sealed[ VAULT_NONCE_SIZE ], plain, n );
+	*len = n;
+	return true;
+}
+
+void Vault::wipe( Slot& slot )
+{
+	slot.key.wipe();
+	zeroize( slot.password, sizeof( slot.password ) );
+	slot.len = 0;
+	slot.used = false;
+	slot.last_used = 0;
+}
+
+void Vault::clear_cache()
+{
+	for( uint8_t i = 0; i < VAULT_CACHE_SLOTS; i++ ) wipe( _cache[i] );
+}
+
+// The slot of uid, or the least recently used one wiped and set up for it with the card key schedule
+Vault::Slot& Vault::slot_for( const MFRC522::Uid& uid, bool* hit )
+{
+	Slot* victim = &_cache[0];
+	for( uint8_t i = 0; i < VAULT_CACHE_SLOTS; i++ )
+	{
+		Slot& slot = _cache[i];
+		if( slot.used && slot.uid == uid )
+		{
+			*hit = true;
+			return slot;
+		}
+		if( !slot.used || ( victim->used && slot.last_used < victim->last_used ) ) victim = &slot;
+	}
+	*hit = false;
+	wipe( *victim );
+	victim->uid = uid;
+	derive( uid, &victim->key );
+	victim->used = true;
+	return *victim;
+}
+
+bool Vault::get( const MFRC522::Uid& uid, uint8_t* password, uint8_t* len )
+{
+	uint32_t start = time_us_32();
+	bool hit;
+	uint8_t stored[ KV_MAX_VALUE ];
+	uint8_t size;
+	if( !KvStore::get( uid.uidByte, uid.size, stored, &size ) ) return false;
+	Slot& slot = slot_for( uid, &hit );
+	if( !slot.len )
+	{
+		hit = false;
+		if( !open( uid.uidByte, uid.size, slot.key, stored, size, MAX_PASS_LEN, slot.password, &slot.len ) )
+		{
+			wipe( slot );
+			return false;
+		}
+	}
+	slot.last_used = board_millis();
+	memcpy( password, slot.password, slot.len );
+	*len = slot.len;
+	uint32_t took = time_us_32() - start;
+	if( hit )
+	{
+		_stats.hits++;
+		if( took > _stats.warm_us_max ) _stats.warm_us_max = took;
+	}
+	else
+	{
+		_stats.misses++;
+		if( took > _stats.cold_us_max ) _stats.cold_us_max = took;
+	}
+	return true;
+}
+
+bool Vault::put( const MFRC522::Uid& uid, const uint8_t* password, uint8_t len )
+{
+	if( !len || len > MAX_PASS_LEN ) return false;
+	bool hit;
+	uint8_t stored[ KV_MAX_VALUE ];
+	Slot& slot = slot_for( uid, &hit );
+	uint8_t size = seal( uid.uidByte, uid.size, slot.key, password, len, stored );
+	if( !KvStore::put( uid.uidByte, uid.size, stored, size ) )
+	{
+		wipe( slot );
+		return false;
+	}
+	// The card is likely tapped next, so the slot keeps what was just stored
+	memcpy( slot.password, password, len );
+	slot.len = len;
+	slot.last_used = board_millis();
+	return true;
+}
+
+bool Vault::remove( const MFRC522::Uid& uid )
+{
+	for( uint8_t i = 0; i < VAULT_CACHE_SLOTS; i++ )
+	{
+		if( _cache[i].used && _cache[i].uid == uid ) wipe( _cache[i] );
+	}
+	return KvStore::remove( uid.uidByte, uid.size );
+}
+
+bool Vault::has( const MFRC522::Uid& uid )
+{
+	uint8_t stored[ KV_MAX_VALUE ];
+	uint8_t size;
+	return KvStore::get( uid.uidByte, uid.size, stored, &size );
+}
+
+// The UID followed by VAULT_TOTP_TAG, one byte longer than any password key of the same UID size
+uint8_t Vault::totp_key( const MFRC522::Uid& uid, uint8_t* key )
+{
+	memcpy( key, uid.uidByte, uid.size );
+	key[ uid.size ] = VAULT_TOTP_TAG;
+	return uid.size + 1;
+}
+
+bool Vault::get_totp( const MFRC522::Uid& uid, uint8_t* record, uint8_t* len )
+{
+	bool hit;
+	uint8_t key[ KV_MAX_KEY ];
+	uint8_t stored[ KV_MAX_VALUE ];
+	uint8_t size;
+	uint8_t keyLen = totp_key( uid, key );
+	if( !KvStore::get( key, keyLen, stored, &size ) ) return false;
+	Slot& slot = slot_for( uid, &hit );
+	slot.last_used = board_millis();
+	return open( key, keyLen, slot.key, stored, size, TOTP_RECORD_HEADER + TOTP_MAX_SEED, record, len );
+}
+
+bool Vault::put_totp( const MFRC522::Uid& uid, const uint8_t* record, uint8_t len )
+{
+	if( !len || len > TOTP_RECORD_HEADER + TOTP_MAX_SEED ) return false;
+	bool hit;
+	uint8_t key[ KV_MAX_KEY ];
+	uint8_t stored[ KV_MAX_VALUE ];
+	uint8_t keyLen = totp_key( uid, key );
+	Slot& slot = slot_for( uid, &hit );
+	uint8_t size = seal( key, keyLen, slot.key, record, len, stored );
+	slot.last_used = board_millis();
+	return KvStore::put( key, keyLen, stored, size );
+}
+
+bool Vault::remove_totp( const MFRC522::Uid& uid )
+{
+	uint8_t key[ KV_MAX_KEY ];
+	uint8_t keyLen = totp_key( uid, key );
+	return KvStore::remove( key, keyLen );
+}
+
+void Vault::step( uint32_t now_ms )
+{
+	for( uint8_t i = 0; i < VAULT_CACHE_SLOTS; i++ )
+	{
+		if( _cache[i].used && now_ms - _cache[i].last_used >= VAULT_CACHE_TIMEOUT_MS ) wipe( _cache[i] );
+	}
+}
+
+bool Vault::benchmark( const MFRC522::Uid& uid, uint16_t rounds, uint32_t* cold_us, uint32_t* warm_us )
+{
+	uint8_t password[ MAX_PASS_LEN ];
+	uint8_t len;
+	uint32_t cold = 0;
+	uint32_t warm = 0;
+	Stats saved = _stats;
+	for( uint16_t i = 0; i < rounds; i++ )
+	{
+		clear_cache();
+		uint32_t start = time_us_32();
+		if( !get( uid, password, &len ) )
+		{
+			_stats = saved;
+			return false;
+		}
+		cold += time_us_32() - start;
+		start = time_us_32();
+		get( uid, password, &len );
+		warm += time_us_32() - start;
+	}
+	zeroize( password, sizeof( password ) );
+	clear_cache();
+	_stats = saved;
+	*cold_us = cold / rounds;
+	*warm_us = warm / rounds;
+	return true;
+}
@@ -0,0 +1,86 @@
+#ifndef _VAULT_H_
+#define _VAULT_H_
+#include <cstdint>
+#include "MFRC522.h"
+#include "aes128.h"
+#include "sha256.h"
+#include "usb_device.h"
+
+#define VAULT_NONCE_SIZE 8
+#define VAULT_TAG_SIZE 4				// Truncated HMAC-SHA256 after the ciphertext; a forgery costs a tap per guess
+#define VAULT_CACHE_SLOTS 4				// Cards whose key schedule and password stay decrypted in RAM
+#define VAULT_CACHE_TIMEOUT_MS 60000	// A slot unused this long is zeroized
+#define VAULT_BUDGET_US 2000			// Cold path budget: well below what a tap followed by typing lets anyone notice
+#define VAULT_TOTP_TAG 'T'				// Appended to the UID for the key of a card's TOTP record
+
+// Credentials encrypted at rest in the KvStore.
+// The device key is AES(secret, board ID): the secret is random, generated once and kept in a flash
+// sector of its own (see Settings::save_secret()), and the board ID is the unique ID of the flash
+// chip, so a copy of the flash on another board decrypts nothing. Each card has its own key,
+// AES(device key, UID block), and its password is stored as a random nonce, the password encrypted
+// with AES-CTR under that key, and a tag: HMAC-SHA256 over the store key, nonce and ciphertext under
+// the MAC key, AES(secret, board ID with another domain), cut to VAULT_TAG_SIZE bytes. A record whose
+// tag does not match, written under another secret, by a build without tags or damaged, is refused
+// and counted, never decrypted into something to type.
+// The device key schedule is expanded once at startup. A tap that misses the cache derives the card
+// key, expands its schedule and decrypts (the cold path); the schedule and the password then stay in
+// one of VAULT_CACHE_SLOTS slots, so the next tap is a copy (the warm path). Slots are zeroized when
+// evicted, when the credential changes and after VAULT_CACHE_TIMEOUT_MS without use.
+// A card can also have a TOTP record, encrypted the same way under the UID followed by VAULT_TOTP_TAG.
+// It is decrypted on every use and never cached, only the card key schedule is shared.
+class Vault
+{
+public:
+	struct Stats
+	{
+		uint32_t hits;
+		uint32_t misses;
+		uint32_t cold_us_max;
+		uint32_t warm_us_max;
+		uint32_t rejected;		// Records refused for a wrong tag
+	};
+
+	static void init();		// After Settings::load() and KvStore::load()
+	// password must have room for MAX_PASS_LEN bytes
+	static bool get( const MFRC522::Uid& uid, uint8_t* password, uint8_t* len );
+	static bool put( const MFRC522::Uid& uid, const uint8_t* password, uint8_t len );
+	static bool remove( const MFRC522::Uid& uid );
+	static bool has( const MFRC522::Uid& uid );		// A password record is stored, readable or not
+	// record must have room for TOTP_RECORD_HEADER + TOTP_MAX_SEED bytes
+	static bool get_totp( const MFRC522::Uid& uid, uint8_t* record, uint8_t* len );
+	static bool put_totp( const MFRC522::Uid& uid, const uint8_t* record, uint8_t len );
+	static bool remove_totp( const MFRC522::Uid& uid );
+	static void step( uint32_t now_ms );	// Zeroizes the slots that timed out
+	static void clear_cache();
+	// Average cold and warm get() of a stored credential over rounds calls
+	static bool benchmark( const MFRC522::Uid& uid, uint16_t rounds, uint32_t* cold_us, uint32_t* warm_us );
+	static const Stats& stats() { return _stats; }
+private:
+	struct Slot
+	{
+		MFRC522::Uid uid;
+		Aes128 key;
+		uint8_t password[ MAX_PASS_LEN ];
+		uint8_t len;
+		bool used;
+		uint32_t last_used;
+	};
+
+	static Slot& slot_for( const MFRC522::Uid& uid, bool* hit );
+	static void wipe( Slot& slot );
+	static void derive( const MFRC522::Uid& uid, Aes128* key );
+	static uint8_t totp_key( const MFRC522::Uid& uid, uint8_t* key );
+	static void crypt( const Aes128& key, const uint8_t* nonce, const uint8_t* in, uint8_t* out, uint8_t len );
+	static void tag( const uint8_t* key, uint8_t keyLen, const uint8_t* sealed, uint8_t len, uint8_t* out );
+	static uint8_t seal( const uint8_t* key, uint8_t keyLen, const Aes128& cardKey, const uint8_t* plain, uint8_t len,
+		uint8_t* sealed );
+	static bool open( const uint8_t* key, uint8_t keyLen, const Aes128& cardKey, const uint8_t* sealed, uint8_t size,
+		uint8_t maxLen, uint8_t* plain, uint8_t* len );
+
+	static Aes128 _device;
+	static HmacSha256 _mac;
+	static Slot _cache[ VAULT_CACHE_SLOTS ];
+	static Stats _stats;
+};
+
+#endif
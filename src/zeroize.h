@@ -0,0 +1,14 @@
+#ifndef _ZEROIZE_H_
+#define _ZEROIZE_H_
+#include <cstddef>
+#include <cstdint>
+
+// Clears keys, pads and plaintext once they are no longer needed. The stores go through a volatile
+// pointer, so the compiler can not drop them as dead stores to memory nothing reads again.
+inline void zeroize( void* data, size_t size )
+{
+	volatile uint8_t* p = (volatile uint8_t*)data;
+	while( size-- ) *p++ = 0;
+}
+
+#endif
@@ -0,0 +1,140 @@
+// Host tests of the Allowlist: capacity shared by all UID sizes, lookups after inserts that move
+// the arrays behind them, and saves that a reset at any flash operation can not lose.
+//
+//   g++ -std=c++20 -O2 -Isrc -Itools/host -o allowlist_test tools/allowlist_test.cpp tools/host/host.cpp src/allowlist.cpp src/mph_allowlist.cpp src/flash_storage.cpp
+//   allowlist_test
+//
+// Exits non-zero if any check fails.
+
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "host.h"
+#include "../src/allowlist.h"
+
+static int failures = 0;
+
+static void check( const char* name, bool ok )
+{
+	printf( "%-44s %s\n", name, ok ? "ok" : "FAILED" );
+	if( !ok ) failures++;
+}
+
+static std::mt19937 generator( 7 );
+
+static MFRC522::Uid random_uid( uint8_t size )
+{
+	MFRC522::Uid uid = {};
+	uid.size = size;
+	for( uint8_t i = 0; i < size; i++ ) uid.uidByte[i] = generator();
+	return uid;
+}
+
+static bool all_listed( const std::vector<MFRC522::Uid>& uids )
+{
+	for( const MFRC522::Uid& uid : uids ) if( !Allowlist::contains( uid ) ) return false;
+	return true;
+}
+
+static void test_capacity()
+{
+	Allowlist::clear();
+	std::vector<MFRC522::Uid> uids;
+	bool added = true;
+	for( uint32_t i = 0; i < ALLOWLIST_WORDS && added; i++ )
+	{
+		MFRC522::Uid uid = random_uid( 4 );
+		if( Allowlist::contains( uid ) ) continue;
+		added = Allowlist::add( uid );
+		uids.push_back( uid );
+	}
+	check( "Allowlist: 15000 4 byte NUIDs fit", added && Allowlist::count() == ALLOWLIST_WORDS && all_listed( uids ) );
+	MFRC522::Uid more = random_uid( 4 );
+	more.uidByte[0] ^= 0x80;
+	check( "Allowlist: one more does not", Allowlist::contains( more ) || !Allowlist::add( more ) );
+
+	Allowlist::clear();
+	uids.clear();
+	added = true;
+	for( uint32_t i = 0; i < 5000 && added; i++ )
+	{
+		MFRC522::Uid uid4 = random_uid( 4 ), uid7 = random_uid( 7 );
+		if( Allowlist::contains( uid4 ) || Allowlist::contains( uid7 ) ) continue;
+		added = Allowlist::add( uid4 ) && Allowlist::add( uid7 );
+		uids.push_back( uid4 );
+		uids.push_back( uid7 );
+	}
+	check( "Allowlist: 5000 4 and 5000 7 byte UIDs fit", added && Allowlist::words_used() <= ALLOWLIST_WORDS && all_listed( uids ) );
+	bool prefixes = true;
+	for( const MFRC522::Uid& uid : uids )
+		prefixes = prefixes && Allowlist::matches( uid.uidByte, 3, uid.size ) && Allowlist::matches( uid.uidByte, uid.size, 0 );
+	check( "Allowlist: prefixes match", prefixes );
+
+	// Removing the 4 byte UIDs moves the 7 byte ones down
+	for( uint32_t i = 0; i < uids.size(); i += 2 ) Allowlist::remove( uids[i] );
+	bool gone = true, kept = true;
+	for( uint32_t i = 0; i < uids.size(); i++ )
+	{
+		if( i % 2 ) kept = kept && Allowlist::contains( uids[i] );
+		else gone = gone && !Allowlist::contains( uids[i] );
+	}
+	check( "Allowlist: remove", gone && kept && Allowlist::count() == uids.size() / 2 );
+}
+
+static void test_save()
+{
+	Allowlist::clear();
+	std::vector<MFRC522::Uid> uids;
+	for( uint32_t i = 0; i < 3000; i++ )
+	{
+		uids.push_back( random_uid( i % 3 ? 7 : 10 ) );
+		Allowlist::add( uids.back() );
+	}
+	bool saved = Allowlist::save();
+	Allowlist::clear();
+	Allowlist::load();
+	check( "Allowlist: save and load", saved && Allowlist::count() == uids.size() && all_listed( uids ) );
+
+	// A reset at any erase or program of a save leaves the list of the save before
+	MFRC522::Uid added = random_uid( 4 );
+	Allowlist::add( added );
+	uint32_t before = host_flash_erases() + host_flash_programs();
+	saved = Allowlist::save();
+	uint32_t operations = host_flash_erases() + host_flash_programs() - before;
+	bool kept = saved;
+	for( uint32_t after = 0; after < operations; after++ )
+	{
+		Allowlist::add( added );
+		host_fail_flash( 1000, after );
+		kept = kept && !Allowlist::save();
+		host_fail_flash( 0 );
+		Allowlist::clear();
+		Allowlist::load();
+		kept = kept && Allowlist::contains( added ) && Allowlist::count() == uids.size() + 1;
+		// The next save gets cut short with the UID removed, so the list must come back with it
+		Allowlist::remove( added );
+		host_fail_flash( 1000, after );
+		kept = kept && !Allowlist::save();
+		host_fail_flash( 0 );
+		Allowlist::clear();
+		Allowlist::load();
+		kept = kept && Allowlist::contains( added );
+	}
+	check( "Allowlist: interrupted saves keep the last", kept );
+
+	Allowlist::remove( added );
+	saved = Allowlist::save();
+	Allowlist::clear();
+	Allowlist::load();
+	check( "Allowlist: the next save takes over", saved && !Allowlist::contains( added ) && all_listed( uids ) );
+}
+
+int main()
+{
+	memset( host_flash, 0xFF, FLASH_SETTINGS_OFFSET + FLASH_SETTINGS_SIZE );
+	test_capacity();
+	test_save();
+	printf( "%s\n", failures ? "FAILED" : "all passed" );
+	return failures ? 1 : 0;
+}
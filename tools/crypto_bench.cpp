@@ -0,0 +1,185 @@
+// Known-answer tests and a host benchmark of the firmware's hash, MAC and cipher code.
+//
+//   g++ -std=c++20 -O2 -Isrc -o crypto_bench tools/crypto_bench.cpp src/sha256.cpp src/derived_password.cpp src/sha1.cpp src/totp.cpp src/aes128.cpp src/keymap.cpp
+//   crypto_bench
+//
+// Exits non-zero if any vector fails. The timings are for the host; on the device "derive bench" over
+// CDC times a derivation the same way, "time" shows how long the last TOTP took and "vault bench"
+// times the vault's cold and warm paths.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "../src/sha256.h"
+#include "../src/derived_password.h"
+#include "../src/sha1.h"
+#include "../src/totp.h"
+#include "../src/aes128.h"
+#include "../src/keymap.h"
+
+static int failures = 0;
+
+static std::string hex( const uint8_t* data, size_t len )
+{
+	std::string out;
+	char byte[3];
+	for( size_t i = 0; i < len; i++ )
+	{
+		snprintf( byte, sizeof( byte ), "%02x", data[i] );
+		out += byte;
+	}
+	return out;
+}
+
+static void expect( const char* name, const std::string& got, const char* want )
+{
+	bool ok = got == want;
+	printf( "%-28s %s\n", name, ok ? "ok" : "FAILED" );
+	if( !ok )
+	{
+		printf( "  got  %s\n  want %s\n", got.c_str(), want );
+		failures++;
+	}
+}
+
+static std::string sha256( const std::string& message, size_t repeat = 1 )
+{
+	uint8_t digest[ SHA256_DIGEST_SIZE ];
+	Sha256 hash;
+	for( size_t i = 0; i < repeat; i++ ) hash.update( (const uint8_t*)message.data(), message.size() );
+	hash.finish( digest );
+	return hex( digest, sizeof( digest ) );
+}
+
+static std::string hmac_sha256( const std::string& key, const std::string& message )
+{
+	uint8_t mac[ SHA256_DIGEST_SIZE ];
+	HmacSha256 hmac;
+	hmac.set_key( (const uint8_t*)key.data(), key.size() );
+	hmac.compute( (const uint8_t*)message.data(), message.size(), mac );
+	return hex( mac, sizeof( mac ) );
+}
+
+static std::string sha1( const std::string& message, size_t repeat = 1 )
+{
+	uint8_t digest[ SHA1_DIGEST_SIZE ];
+	Sha1 hash;
+	for( size_t i = 0; i < repeat; i++ ) hash.update( (const uint8_t*)message.data(), message.size() );
+	hash.finish( digest );
+	return hex( digest, sizeof( digest ) );
+}
+
+static std::string hmac_sha1( const std::string& key, const std::string& message )
+{
+	uint8_t mac[ SHA1_DIGEST_SIZE ];
+	HmacSha1 hmac;
+	hmac.set_key( (const uint8_t*)key.data(), key.size() );
+	hmac.compute( (const uint8_t*)message.data(), message.size(), mac );
+	return hex( mac, sizeof( mac ) );
+}
+
+static std::string totp( uint64_t time, const char* base32 )
+{
+	uint8_t seed[ TOTP_MAX_SEED ];
+	uint8_t len = 0;
+	char code[ TOTP_MAX_DIGITS + 1 ];
+	if( !Totp::decode_base32( base32, seed, &len ) ) return "bad seed";
+	Totp::code( seed, len, time / TOTP_STEP_S, 8, code );
+	return code;
+}
+
+static std::string aes128( const uint8_t* key, const uint8_t* plain )
+{
+	uint8_t cipher[ AES_BLOCK_SIZE ];
+	Aes128 aes;
+	aes.expand( key );
+	aes.encrypt( plain, cipher );
+	aes.wipe();
+	return hex( cipher, sizeof( cipher ) );
+}
+
+template<typename F> static double ns_per_call( F f, unsigned calls )
+{
+	auto start = std::chrono::steady_clock::now();
+	for( unsigned i = 0; i < calls; i++ ) f();
+	return std::chrono::duration<double, std::nano>( std::chrono::steady_clock::now() - start ).count() / calls;
+}
+
+int main()
+{
+	// FIPS 180-4 examples
+	expect( "SHA-256 empty", sha256( "" ), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855" );
+	expect( "SHA-256 abc", sha256( "abc" ), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad" );
+	expect( "SHA-256 448 bits", sha256( "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq" ),
+		"248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1" );
+	expect( "SHA-256 million a", sha256( std::string( 1000, 'a' ), 1000 ),
+		"cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0" );
+	// RFC 4231 test cases 1, 2 and 6
+	expect( "HMAC-SHA256 case 1", hmac_sha256( std::string( 20, '\x0b' ), "Hi There" ),
+		"b0344c61d8db38535ca8afceaf0bf12b881dc200c9833da726e9376c2e32cff7" );
+	expect( "HMAC-SHA256 case 2", hmac_sha256( "Jefe", "what do ya want for nothing?" ),
+		"5bdcc146bf60754e6a042426089575c75a003f089d2739839dec58b964ec3843" );
+	expect( "HMAC-SHA256 case 6", hmac_sha256( std::string( 131, '\xaa' ), "Test Using Larger Than Block-Size Key - Hash Key First" ),
+		"60e431591ee0b67f0d8a26aacbf5b77f8e0bc6213728c5140546040f0ee37f54" );
+
+	// FIPS 180-4 examples, RFC 2202 test cases 1, 2 and 6
+	expect( "SHA-1 abc", sha1( "abc" ), "a9993e364706816aba3e25717850c26c9cd0d89d" );
+	expect( "SHA-1 448 bits", sha1( "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq" ),
+		"84983e441c3bd26ebaae4aa1f95129e5e54670f1" );
+	expect( "SHA-1 million a", sha1( std::string( 1000, 'a' ), 1000 ), "34aa973cd4c4daa4f61eeb2bdbad27316534016f" );
+	expect( "HMAC-SHA1 case 1", hmac_sha1( std::string( 20, '\x0b' ), "Hi There" ), "b617318655057264e28bc0b6fb378c8ef146be00" );
+	expect( "HMAC-SHA1 case 2", hmac_sha1( "Jefe", "what do ya want for nothing?" ), "effcdf6ae5eb2fa2d27416d5f184df9c259a7c79" );
+	expect( "HMAC-SHA1 case 6", hmac_sha1( std::string( 80, '\xaa' ), "Test Using Larger Than Block-Size Key - Hash Key First" ),
+		"aa4ae5e15272d00e95705637ce8a3b55ed402112" );
+	// RFC 6238 appendix B, SHA-1 seed "12345678901234567890" in base32
+	const char* seed = "GEZDGNBVGY3TQOJQGEZDGNBVGY3TQOJQ";
+	expect( "TOTP 59", totp( 59, seed ), "94287082" );
+	expect( "TOTP 1111111109", totp( 1111111109, seed ), "07081804" );
+	expect( "TOTP 1111111111", totp( 1111111111, seed ), "14050471" );
+	expect( "TOTP 1234567890", totp( 1234567890, seed ), "89005924" );
+	expect( "TOTP 2000000000", totp( 2000000000, seed ), "69279037" );
+	expect( "TOTP 20000000000", totp( 20000000000ull, seed ), "65353130" );
+	expect( "TOTP lower case seed", totp( 59, "gezd gnbv gy3t qojq gezd gnbv gy3t qojq" ), "94287082" );
+
+	// FIPS-197 appendix B and appendix C.1
+	const uint8_t aesKeyB[ AES_BLOCK_SIZE ] = { 0x2b, 0x7e, 0x15, 0x16, 0x28, 0xae, 0xd2, 0xa6, 0xab, 0xf7, 0x15, 0x88, 0x09, 0xcf, 0x4f, 0x3c };
+	const uint8_t aesPlainB[ AES_BLOCK_SIZE ] = { 0x32, 0x43, 0xf6, 0xa8, 0x88, 0x5a, 0x30, 0x8d, 0x31, 0x31, 0x98, 0xa2, 0xe0, 0x37, 0x07, 0x34 };
+	expect( "AES-128 appendix B", aes128( aesKeyB, aesPlainB ), "3925841d02dc09fbdc118597196a0b32" );
+	uint8_t aesKey[ AES_BLOCK_SIZE ];
+	uint8_t aesPlain[ AES_BLOCK_SIZE ];
+	for( uint8_t i = 0; i < AES_BLOCK_SIZE; i++ )
+	{
+		aesKey[i] = i;
+		aesPlain[i] = i * 0x11;
+	}
+	expect( "AES-128 appendix C.1", aes128( aesKey, aesPlain ), "69c4e0d86a7b0430d8cdb78070b4c55a" );
+
+	// Derived passwords for secret 00..0f and the factory default card
+	uint8_t secret[16];
+	for( uint8_t i = 0; i < sizeof( secret ); i++ ) secret[i] = i;
+	const uint8_t uid[7] = { 0x53, 0x03, 0xAB, 0xB2, 0x50, 0x00, 0x01 };
+	char password[ 64 + 1 ];
+	DerivedPassword::init( secret, sizeof( secret ), Keymap::can_type );
+	DerivedPassword::derive( uid, sizeof( uid ), "vpn", 20, true, password );
+	expect( "Derived vpn 20 all", password, "@F#NS]Q#J!dTE;WyF:r$" );
+	DerivedPassword::derive( uid, sizeof( uid ), "mail", 64, false, password );
+	expect( "Derived mail 64 alnum", password,
+		"JSeOVimkrA2AfMQ2ZB6nKA9wVU1P69ywoMgM4wvq4MhS8aSGFSbZ4dEe48TR1I22" );
+
+	uint32_t state[8] = {};
+	uint8_t block[ SHA256_BLOCK_SIZE ] = {};
+	double compress = ns_per_call( [&]() { Sha256::compress( state, block ); block[0] = state[0]; }, 1000000 );
+	double derive = ns_per_call( [&]() { DerivedPassword::derive( uid, sizeof( uid ), "vpn", 20, true, password ); }, 100000 );
+	printf( "compress %.0f ns (%.1f MB/s), 20 character password %.0f ns\n", compress, SHA256_BLOCK_SIZE * 1000.0 / compress, derive );
+	uint32_t state1[5] = {};
+	uint8_t code[ TOTP_MAX_DIGITS + 1 ];
+	double compress1 = ns_per_call( [&]() { Sha1::compress( state1, block ); block[0] = state1[0]; }, 1000000 );
+	double code6 = ns_per_call( [&]() { Totp::code( block, 20, block[0], 6, (char*)code ); block[0] = code[0]; }, 100000 );
+	printf( "SHA-1 compress %.0f ns (%.1f MB/s), 6 digit TOTP %.0f ns\n", compress1, SHA1_BLOCK_SIZE * 1000.0 / compress1, code6 );
+	Aes128 aes;
+	double expand = ns_per_call( [&]() { aes.expand( block ); block[0]++; }, 1000000 );
+	double encrypt = ns_per_call( [&]() { aes.encrypt( block, block ); }, 1000000 );
+	printf( "AES-128 key schedule %.0f ns, block %.0f ns (%.1f MB/s)\n", expand, encrypt, AES_BLOCK_SIZE * 1000.0 / encrypt );
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,9 @@
+#ifndef _HOST_BSP_BOARD_H_
+#define _HOST_BSP_BOARD_H_
+#include <stdint.h>
+#include <stdio.h>
+#include "pico/stdlib.h"
+
+uint32_t board_millis();
+
+#endif
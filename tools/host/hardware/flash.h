@@ -0,0 +1,11 @@
+#ifndef _HOST_HARDWARE_FLASH_H_
+#define _HOST_HARDWARE_FLASH_H_
+#include "pico/stdlib.h"
+
+#define FLASH_PAGE_SIZE 256u
+#define FLASH_SECTOR_SIZE 4096u
+
+void flash_range_erase( uint32_t offset, size_t size );
+void flash_range_program( uint32_t offset, const uint8_t* data, size_t size );
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _HOST_HARDWARE_SPI_H_
+#define _HOST_HARDWARE_SPI_H_
+#include "pico/stdlib.h"
+
+typedef struct spi_inst spi_inst_t;
+extern spi_inst_t* spi0_ptr;
+#define spi0 spi0_ptr
+
+uint spi_init( spi_inst_t* spi, uint baudrate );
+int spi_write_blocking( spi_inst_t* spi, const uint8_t* src, size_t len );
+int spi_write_read_blocking( spi_inst_t* spi, const uint8_t* src, uint8_t* dst, size_t len );
+
+#endif
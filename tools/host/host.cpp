@@ -0,0 +1,116 @@
+#include "host.h"
+#include <cassert>
+#include <cstring>
+#include <random>
+#include "pico/stdlib.h"
+#include "pico/flash.h"
+#include "pico/rand.h"
+#include "pico/unique_id.h"
+#include "hardware/flash.h"
+#include "hardware/spi.h"
+#include "bsp/board.h"
+#include "tusb.h"
+
+extern "C" uint8_t host_flash[ PICO_FLASH_SIZE_BYTES ];
+uint8_t host_flash[ PICO_FLASH_SIZE_BYTES ];
+// FlashStorage takes the end of the image from this linker symbol
+asm( ".globl __flash_binary_end\n.set __flash_binary_end, host_flash + 0x40000" );
+
+static uint64_t now_us = 0;
+static int failures = 0;
+static int failAfter = 0;
+static uint32_t erases = 0;
+static uint32_t programs = 0;
+static HostSpiDevice* spiDevice = nullptr;
+static unsigned spiCs = ~0u;
+static bool levels[ 32 ];
+static std::mt19937_64 generator( 1 );
+spi_inst_t* spi0_ptr = nullptr;
+
+void host_attach_spi( HostSpiDevice* device, unsigned csPin )
+{
+	spiDevice = device;
+	spiCs = csPin;
+}
+
+void host_advance_us( uint64_t us ) { now_us += us; }
+void host_fail_flash( int operations, int after )
+{
+	failures = operations;
+	failAfter = after;
+}
+uint32_t host_flash_erases() { return erases; }
+uint32_t host_flash_programs() { return programs; }
+
+uint64_t time_us_64() { return now_us++; }
+uint32_t time_us_32() { return (uint32_t)time_us_64(); }
+uint32_t board_millis() { return now_us / 1000; }
+void sleep_us( uint64_t us ) { now_us += us; }
+void sleep_ms( uint32_t ms ) { now_us += 1000ull * ms; }
+void tight_loop_contents() {}
+
+void gpio_init( uint ) {}
+void gpio_set_dir( uint, bool ) {}
+void gpio_set_function( uint, int ) {}
+void gpio_pull_up( uint ) {}
+bool gpio_get( uint pin ) { return levels[ pin % 32 ]; }
+bool gpio_get_out_level( uint pin ) { return levels[ pin % 32 ]; }
+void gpio_put( uint pin, bool value )
+{
+	levels[ pin % 32 ] = value;
+	if( spiDevice && pin == spiCs ) spiDevice->select( !value );
+}
+
+uint spi_init( spi_inst_t*, uint baudrate ) { return baudrate; }
+int spi_write_blocking( spi_inst_t*, const uint8_t* src, size_t len )
+{
+	for( size_t i = 0; i < len; i++ ) if( spiDevice ) spiDevice->transfer( src[i] );
+	return len;
+}
+int spi_write_read_blocking( spi_inst_t*, const uint8_t* src, uint8_t* dst, size_t len )
+{
+	// The firmware sends a NULL source for a single stop byte
+	for( size_t i = 0; i < len; i++ ) dst[i] = spiDevice ? spiDevice->transfer( src ? src[i] : 0 ) : 0;
+	return len;
+}
+
+void flash_range_erase( uint32_t offset, size_t size )
+{
+	assert( offset % FLASH_SECTOR_SIZE == 0 && size % FLASH_SECTOR_SIZE == 0 && offset + size <= PICO_FLASH_SIZE_BYTES );
+	memset( &host_flash[ offset ], 0xFF, size );
+	erases++;
+}
+
+void flash_range_program( uint32_t offset, const uint8_t* data, size_t size )
+{
+	assert( offset % FLASH_PAGE_SIZE == 0 && size % FLASH_PAGE_SIZE == 0 && offset + size <= PICO_FLASH_SIZE_BYTES );
+	for( size_t i = 0; i < size; i++ ) host_flash[ offset + i ] &= data[i];		// Programming only clears bits
+	programs++;
+}
+
+int flash_safe_execute( void (*func)( void* ), void* param, uint32_t )
+{
+	if( failures && failAfter ) failAfter--;
+	else if( failures )
+	{
+		failures--;
+		return PICO_ERROR_TIMEOUT;
+	}
+	func( param );
+	return PICO_OK;
+}
+
+uint64_t get_rand_64() { return generator(); }
+uint32_t get_rand_32() { return (uint32_t)generator(); }
+void get_rand_128( rng_128_t* rand128 )
+{
+	rand128->r[0] = generator();
+	rand128->r[1] = generator();
+}
+
+void pico_get_unique_board_id( pico_unique_board_id_t* id )
+{
+	for( uint8_t i = 0; i < PICO_UNIQUE_BOARD_ID_SIZE_BYTES; i++ ) id->id[i] = 0xE6 + i;
+}
+
+void tud_task() {}
@@ -0,0 +1,29 @@
+#ifndef _HOST_H_
+#define _HOST_H_
+#include <cstddef>
+#include <cstdint>
+
+// Stand-ins for the Pico SDK, TinyUSB and the board, so the host tests under tools/ can build
+// the firmware sources unchanged with -Itools/host. Flash is an array behind the XIP window,
+// the clock is virtual and moves one microsecond per read and by whatever sleep_us() asks for,
+// and an SPI device can be attached behind a chip select pin.
+
+#define HOST_IMAGE_END 0x40000		// Where the pretend firmware image ends, see FlashStorage::image_end()
+
+extern "C" uint8_t host_flash[];
+
+// Something on the SPI bus, selected while its chip select pin is low
+class HostSpiDevice
+{
+public:
+	virtual void select( bool selected ) = 0;
+	virtual uint8_t transfer( uint8_t out ) = 0;
+};
+
+void host_attach_spi( HostSpiDevice* device, unsigned csPin );
+void host_advance_us( uint64_t us );
+void host_fail_flash( int operations, int after = 0 );		// flash_safe_execute() calls fail, operations of them after the next after
+uint32_t host_flash_erases();
+uint32_t host_flash_programs();
+
+#endif
@@ -0,0 +1,121 @@
+#include "mfrc522_sim.h"
+#include "MFRC522.h"
+
+#define REG( name ) ( MFRC522::name >> 1 )
+#define PCD_IDLE 0x00
+#define PCD_CALC_CRC 0x03
+#define PCD_TRANSCEIVE 0x0C
+
+uint16_t Mfrc522Sim::crc_a( const uint8_t* data, size_t len )
+{
+	uint16_t crc = 0x6363;
+	for( size_t i = 0; i < len; i++ )
+	{
+		uint8_t b = data[i] ^ ( crc & 0xFF );
+		b ^= b << 4;
+		crc = ( crc >> 8 ) ^ ( (uint16_t)b << 8 ) ^ ( (uint16_t)b << 3 ) ^ ( b >> 4 );
+	}
+	return crc;
+}
+
+void Mfrc522Sim::select( bool selected )
+{
+	_first = selected;
+	_reading = false;
+}
+
+// The first byte of an access is the address, bit 7 set for a read. A read returns the register
+// named by the byte before, so each further byte names the next register to read, 0 the last.
+uint8_t Mfrc522Sim::transfer( uint8_t out )
+{
+	uint8_t in = _reading ? read( _reg ) : 0;
+	if( _first )
+	{
+		_first = false;
+		_reading = out & 0x80;
+		_reg = ( out >> 1 ) & 0x3F;
+	}
+	else if( _reading ) _reg = ( out >> 1 ) & 0x3F;
+	else write( _reg, out );
+	return in;
+}
+
+uint8_t Mfrc522Sim::read( uint8_t reg )
+{
+	if( reg == REG( FIFODataReg ) )
+	{
+		if( _fifo.empty() ) return 0;
+		uint8_t value = _fifo.front();
+		_fifo.erase( _fifo.begin() );
+		return value;
+	}
+	if( reg == REG( FIFOLevelReg ) ) return _fifo.size();
+	if( reg == REG( VersionReg ) ) return 0x92;
+	return _regs[ reg ];
+}
+
+void Mfrc522Sim::write( uint8_t reg, uint8_t value )
+{
+	if( reg == REG( FIFODataReg ) ) _fifo.push_back( value );
+	else if( reg == REG( FIFOLevelReg ) )
+	{
+		if( value & 0x80 ) _fifo.clear();
+	}
+	else if( reg == REG( ComIrqReg ) || reg == REG( DivIrqReg ) )
+	{
+		// Set1 sets the marked bits, else they are cleared
+		if( value & 0x80 ) _regs[ reg ] |= value & 0x7F;
+		else _regs[ reg ] &= ~value;
+	}
+	else if( reg == REG( CommandReg ) )
+	{
+		_regs[ reg ] = value & 0x0F;
+		if( ( value & 0x0F ) == PCD_CALC_CRC )
+		{
+			uint16_t crc = crc_a( _fifo.data(), _fifo.size() );
+			_regs[ REG( CRCResultRegL ) ] = crc & 0xFF;
+			_regs[ REG( CRCResultRegH ) ] = crc >> 8;
+			_regs[ REG( DivIrqReg ) ] |= 0x04;
+		}
+	}
+	else
+	{
+		_regs[ reg ] = value;
+		if( reg == REG( BitFramingReg ) && ( value & 0x80 ) && _regs[ REG( CommandReg ) ] == PCD_TRANSCEIVE ) transceive();
+	}
+}
+
+void Mfrc522Sim::transceive()
+{
+	uint8_t txLastBits = _regs[ REG( BitFramingReg ) ] & 0x07;
+	_regs[ REG( BitFramingReg ) ] &= 0x7F;
+	std::vector<uint8_t> frame( _fifo );
+	_fifo.clear();
+	if( _regs[ REG( TxModeReg ) ] & 0x80 )		// TxCRCEn
+	{
+		uint16_t crc = crc_a( frame.data(), frame.size() );
+		frame.push_back( crc & 0xFF );
+		frame.push_back( crc >> 8 );
+	}
+	frames++;
+	if( txLastBits ) shortFrames++;
+	std::vector<uint8_t> reply;
+	uint8_t replyLastBits = 0;
+	_regs[ REG( ErrorReg ) ] = 0;
+	_regs[ REG( ComIrqReg ) ] |= 0x40;		// TxIRq
+	if( !_picc->receive( frame, txLastBits, &reply, &replyLastBits ) )
+	{
+		_regs[ REG( ComIrqReg ) ] |= 0x01;	// TimerIRq
+		return;
+	}
+	// RxCRCEn checks and drops the CRC_A of a whole byte answer; a 4 bit ACK passes as it is
+	if( ( _regs[ REG( RxModeReg ) ] & 0x80 ) && !replyLastBits )
+	{
+		if( reply.size() < 2 || crc_a( reply.data(), reply.size() - 2 ) != ( reply[ reply.size() - 2 ] | reply.back() << 8 ) )
+			_regs[ REG( ErrorReg ) ] |= 0x04;
+		else reply.resize( reply.size() - 2 );
+	}
+	_fifo = reply;
+	_regs[ REG( ControlReg ) ] = replyLastBits;
+	_regs[ REG( ComIrqReg ) ] |= 0x30;		// RxIRq, IdleIRq
+}
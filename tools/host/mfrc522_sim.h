@@ -0,0 +1,43 @@
+#ifndef _MFRC522_SIM_H_
+#define _MFRC522_SIM_H_
+#include <cstdint>
+#include <vector>
+#include "host.h"
+
+// A PICC in the simulated field. frame is what went over the air, the CRC_A included if the
+// MFRC522 appended it, and txLastBits the valid bits of its last byte, 0 for all 8. Returns false
+// to stay silent, which the MFRC522 reports as a timeout.
+class SimPicc
+{
+public:
+	virtual bool receive( const std::vector<uint8_t>& frame, uint8_t txLastBits, std::vector<uint8_t>* reply,
+		uint8_t* replyLastBits ) = 0;
+};
+
+// The registers, FIFO, CRC coprocessor and Transceive command of an MFRC522 behind the host SPI bus,
+// enough for the firmware's frame exchanges with one PICC. Frames go out when StartSend is set and
+// the answer is in the FIFO by the next register access; the streaming FIFO alerts are not simulated.
+class Mfrc522Sim : public HostSpiDevice
+{
+public:
+	explicit Mfrc522Sim( SimPicc* picc ) : _picc( picc ) {}
+	void select( bool selected ) override;
+	uint8_t transfer( uint8_t out ) override;
+	static uint16_t crc_a( const uint8_t* data, size_t len );
+
+	uint32_t frames = 0;		// Frames sent
+	uint32_t shortFrames = 0;	// Of them with fewer than 8 bits in the last byte
+private:
+	uint8_t read( uint8_t reg );
+	void write( uint8_t reg, uint8_t value );
+	void transceive();
+
+	SimPicc* _picc;
+	uint8_t _regs[ 64 ] = {};
+	std::vector<uint8_t> _fifo;
+	bool _first = false;
+	bool _reading = false;
+	uint8_t _reg = 0;
+};
+
+#endif
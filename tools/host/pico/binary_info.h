@@ -0,0 +1,4 @@
+#ifndef _HOST_PICO_BINARY_INFO_H_
+#define _HOST_PICO_BINARY_INFO_H_
+#define bi_decl( declaration )
+#endif
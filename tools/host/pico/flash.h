@@ -0,0 +1,10 @@
+#ifndef _HOST_PICO_FLASH_H_
+#define _HOST_PICO_FLASH_H_
+#include "pico/stdlib.h"
+
+#define PICO_OK 0
+#define PICO_ERROR_TIMEOUT -1
+
+int flash_safe_execute( void (*func)( void* ), void* param, uint32_t enter_exit_timeout_ms );
+
+#endif
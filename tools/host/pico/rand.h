@@ -0,0 +1,11 @@
+#ifndef _HOST_PICO_RAND_H_
+#define _HOST_PICO_RAND_H_
+#include <stdint.h>
+
+typedef struct { uint64_t r[2]; } rng_128_t;
+
+uint32_t get_rand_32();
+uint64_t get_rand_64();
+void get_rand_128( rng_128_t* rand128 );
+
+#endif
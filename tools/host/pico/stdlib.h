@@ -0,0 +1,32 @@
+#ifndef _HOST_PICO_STDLIB_H_
+#define _HOST_PICO_STDLIB_H_
+#include <stdint.h>
+#include <stddef.h>
+#include "host.h"
+
+typedef unsigned int uint;
+
+#define PICO_FLASH_SIZE_BYTES ( 2 * 1024 * 1024 )
+#define XIP_BASE ( (uintptr_t)host_flash )
+#define GPIO_IN 0
+#define GPIO_OUT 1
+#define GPIO_FUNC_SPI 1
+#define __not_in_flash( group )
+#define __not_in_flash_func( func ) func
+#define __no_inline_not_in_flash_func( func ) func
+#define __time_critical_func( func ) func
+
+uint64_t time_us_64();
+uint32_t time_us_32();
+void sleep_us( uint64_t us );
+void sleep_ms( uint32_t ms );
+void tight_loop_contents();
+void gpio_init( uint pin );
+void gpio_set_dir( uint pin, bool out );
+void gpio_set_function( uint pin, int function );
+void gpio_pull_up( uint pin );
+void gpio_put( uint pin, bool value );
+bool gpio_get( uint pin );
+bool gpio_get_out_level( uint pin );
+
+#endif
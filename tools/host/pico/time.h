@@ -0,0 +1,4 @@
+#ifndef _HOST_PICO_TIME_H_
+#define _HOST_PICO_TIME_H_
+#include "pico/stdlib.h"
+#endif
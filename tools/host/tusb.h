@@ -0,0 +1,6 @@
+#ifndef _HOST_TUSB_H_
+#define _HOST_TUSB_H_
+
+void tud_task();
+
+#endif
@@ -0,0 +1,268 @@
+// Builds the minimal perfect hash allowlist image for MphAllowlist from a CSV of UIDs.
+//
+//   g++ -std=c++17 -O2 -o mph_build tools/mph_build.cpp
+//   mph_build uids.csv allowlist.bin [--uf2 allowlist.uf2] [--address 0x10161000]
+//
+// The first column of each line is a UID in hex, 4, 7 or 10 bytes; ':', '-' and spaces
+// between the digits are ignored. Empty lines, lines starting with '#' and a header line
+// are skipped. The .bin goes to FLASH_MPH_OFFSET; the .uf2 can be copied to the board in
+// BOOTSEL mode and lands at --address, by default where FLASH_MPH_OFFSET is with 2 MB flash.
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <set>
+#include <string>
+#include <vector>
+#include "../src/mph_format.h"
+
+#define MPH_DEFAULT_ADDRESS 0x10161000
+#define MPH_REGION_SIZE ( 512 * 1024 )		// FLASH_MPH_SIZE
+#define MPH_MAX_SEEDS 100
+#define UF2_FAMILY_RP2040 0xE48BFF56
+
+typedef std::vector<uint8_t> Uid;
+
+static bool parse_uid( const std::string& field, Uid* uid )
+{
+	std::string hex;
+	for( char c : field )
+	{
+		if( isxdigit( (unsigned char)c ) ) hex += c;
+		else if( c != ':' && c != '-' && c != ' ' && c != '"' && c != '\t' && c != '\r' ) return false;
+	}
+	if( hex.size() != 8 && hex.size() != 14 && hex.size() != 20 ) return false;
+	uid->clear();
+	for( size_t i = 0; i < hex.size(); i += 2 ) uid->push_back( (uint8_t)strtoul( hex.substr( i, 2 ).c_str(), nullptr, 16 ) );
+	return true;
+}
+
+static bool read_csv( const char* path, std::vector<Uid>* uids )
+{
+	std::ifstream in( path );
+	if( !in )
+	{
+		fprintf( stderr, "Cannot open %s\n", path );
+		return false;
+	}
+	std::set<Uid> seen;
+	std::string line;
+	for( unsigned number = 1; std::getline( in, line ); number++ )
+	{
+		std::string field = line.substr( 0, line.find_first_of( ",;" ) );
+		if( field.find_first_not_of( " \t\r" ) == std::string::npos || field[ field.find_first_not_of( " \t" ) ] == '#' ) continue;
+		Uid uid;
+		if( !parse_uid( field, &uid ) )
+		{
+			if( number == 1 ) continue;		// Header
+			fprintf( stderr, "%s:%u: not a 4, 7 or 10 byte UID: %s\n", path, number, field.c_str() );
+			return false;
+		}
+		if( seen.insert( uid ).second ) uids->push_back( uid );
+		else fprintf( stderr, "%s:%u: duplicate UID skipped\n", path, number );
+	}
+	return true;
+}
+
+// Places every bucket, largest first, at the first pilot whose slots are all still free
+static bool build( const std::vector<Uid>& uids, uint32_t seed, MphHeader* header, std::vector<uint16_t>* pilots,
+	std::vector<uint32_t>* remap, std::vector<uint32_t>* fingerprints )
+{
+	uint32_t keys = uids.size();
+	uint32_t slots = (uint32_t)std::ceil( keys / MPH_SLOT_LOAD );
+	uint32_t buckets = ( keys + MPH_BUCKET_LOAD - 1 ) / MPH_BUCKET_LOAD;
+	std::vector<uint64_t> hashes( keys );
+	std::vector<std::vector<uint32_t>> members( buckets );
+	for( uint32_t i = 0; i < keys; i++ )
+	{
+		hashes[i] = mph_hash( uids[i].data(), uids[i].size(), seed );
+		members[ mph_bucket( hashes[i], buckets ) ].push_back( i );
+	}
+	std::vector<uint32_t> order( buckets );
+	for( uint32_t b = 0; b < buckets; b++ ) order[b] = b;
+	std::stable_sort( order.begin(), order.end(), [&]( uint32_t a, uint32_t b ) { return members[a].size() > members[b].size(); } );
+
+	std::vector<int64_t> owner( slots, -1 );
+	std::vector<uint32_t> chosen;
+	pilots->assign( buckets, 0 );
+	for( uint32_t b : order )
+	{
+		if( members[b].empty() ) break;
+		bool placed = false;
+		for( uint32_t pilot = 0; pilot <= 0xFFFF && !placed; pilot++ )
+		{
+			chosen.clear();
+			placed = true;
+			for( uint32_t i : members[b] )
+			{
+				uint32_t slot = mph_slot( hashes[i], pilot, slots );
+				if( owner[ slot ] >= 0 || std::find( chosen.begin(), chosen.end(), slot ) != chosen.end() )
+				{
+					placed = false;
+					break;
+				}
+				chosen.push_back( slot );
+			}
+			if( placed )
+			{
+				( *pilots )[b] = pilot;
+				for( size_t k = 0; k < chosen.size(); k++ ) owner[ chosen[k] ] = members[b][k];
+			}
+		}
+		if( !placed ) return false;
+	}
+
+	// Slots at or above keys that got a UID are sent to the free slots below keys
+	remap->assign( slots - keys, 0 );
+	uint32_t free = 0;
+	for( uint32_t slot = keys; slot < slots; slot++ )
+	{
+		if( owner[ slot ] < 0 ) continue;
+		while( owner[ free ] >= 0 ) free++;
+		( *remap )[ slot - keys ] = free;
+		owner[ free++ ] = owner[ slot ];
+	}
+	fingerprints->assign( keys, 0 );
+	for( uint32_t slot = 0; slot < keys; slot++ )
+	{
+		const Uid& uid = uids[ owner[ slot ] ];
+		( *fingerprints )[ slot ] = mph_fingerprint( uid.data(), uid.size(), seed );
+	}
+
+	memset( header, 0, sizeof( *header ) );
+	header->magic = MPH_MAGIC;
+	header->keys = keys;
+	header->buckets = buckets;
+	header->seed = seed;
+	header->slots = slots;
+	return true;
+}
+
+static std::vector<uint8_t> serialize( MphHeader header, const std::vector<uint16_t>& pilots, const std::vector<uint32_t>& remap,
+	const std::vector<uint32_t>& fingerprints )
+{
+	std::vector<uint8_t> body( pilots.size() * 2, 0 );
+	memcpy( body.data(), pilots.data(), body.size() );
+	body.resize( ( body.size() + 3 ) & ~(size_t)3, 0 );
+	size_t at = body.size();
+	body.resize( at + remap.size() * 4 + fingerprints.size() * 4 );
+	memcpy( &body[ at ], remap.data(), remap.size() * 4 );
+	memcpy( &body[ at + remap.size() * 4 ], fingerprints.data(), fingerprints.size() * 4 );
+	header.checksum = mph_checksum( 2166136261u, body.data(), body.size() );
+
+	std::vector<uint8_t> image( sizeof( header ) + body.size() );
+	memcpy( image.data(), &header, sizeof( header ) );
+	memcpy( image.data() + sizeof( header ), body.data(), body.size() );
+	return image;
+}
+
+// Same lookup as MphAllowlist::contains(), on the image in memory
+static bool lookup( const std::vector<uint8_t>& image, const Uid& uid )
+{
+	MphHeader header;
+	memcpy( &header, image.data(), sizeof( header ) );
+	const uint8_t* body = image.data() + sizeof( header );
+	const uint16_t* pilots = (const uint16_t*)body;
+	const uint32_t* remap = (const uint32_t*)( body + ( ( header.buckets * 2 + 3 ) & ~3u ) );
+	const uint32_t* fingerprints = remap + ( header.slots - header.keys );
+	uint64_t h = mph_hash( uid.data(), uid.size(), header.seed );
+	uint32_t slot = mph_slot( h, pilots[ mph_bucket( h, header.buckets ) ], header.slots );
+	if( slot >= header.keys ) slot = remap[ slot - header.keys ];
+	return fingerprints[ slot ] == mph_fingerprint( uid.data(), uid.size(), header.seed );
+}
+
+static bool write_file( const char* path, const std::vector<uint8_t>& data )
+{
+	FILE* f = fopen( path, "wb" );
+	bool ok = f && fwrite( data.data(), 1, data.size(), f ) == data.size();
+	if( f ) ok = fclose( f ) == 0 && ok;
+	if( !ok ) fprintf( stderr, "Cannot write %s\n", path );
+	return ok;
+}
+
+static std::vector<uint8_t> to_uf2( const std::vector<uint8_t>& image, uint32_t address )
+{
+	const uint32_t payload = 256;
+	uint32_t blocks = ( image.size() + payload - 1 ) / payload;
+	std::vector<uint8_t> uf2( blocks * 512, 0 );
+	for( uint32_t b = 0; b < blocks; b++ )
+	{
+		uint32_t* block = (uint32_t*)&uf2[ b * 512 ];
+		block[0] = 0x0A324655;				// Magic start 0
+		block[1] = 0x9E5D5157;				// Magic start 1
+		block[2] = 0x00002000;				// Family ID present
+		block[3] = address + b * payload;
+		block[4] = payload;
+		block[5] = b;
+		block[6] = blocks;
+		block[7] = UF2_FAMILY_RP2040;
+		size_t n = std::min<size_t>( payload, image.size() - b * payload );
+		memset( &uf2[ b * 512 + 32 ], 0xFF, payload );
+		memcpy( &uf2[ b * 512 + 32 ], &image[ b * payload ], n );
+		block[127] = 0x0AB16F30;			// Magic end
+	}
+	return uf2;
+}
+
+int main( int argc, char** argv )
+{
+	const char* uf2Path = nullptr;
+	uint32_t address = MPH_DEFAULT_ADDRESS;
+	std::vector<const char*> paths;
+	for( int i = 1; i < argc; i++ )
+	{
+		if( !strcmp( argv[i], "--uf2" ) && i + 1 < argc ) uf2Path = argv[ ++i ];
+		else if( !strcmp( argv[i], "--address" ) && i + 1 < argc ) address = strtoul( argv[ ++i ], nullptr, 0 );
+		else paths.push_back( argv[i] );
+	}
+	if( paths.size() != 2 )
+	{
+		fprintf( stderr, "Usage: %s uids.csv allowlist.bin [--uf2 allowlist.uf2] [--address 0x%08X]\n", argv[0], MPH_DEFAULT_ADDRESS );
+		return 2;
+	}
+
+	std::vector<Uid> uids;
+	if( !read_csv( paths[0], &uids ) ) return 1;
+	if( uids.empty() )
+	{
+		fprintf( stderr, "No UIDs in %s\n", paths[0] );
+		return 1;
+	}
+
+	MphHeader header;
+	std::vector<uint16_t> pilots;
+	std::vector<uint32_t> remap, fingerprints;
+	uint32_t seed = 1;
+	while( !build( uids, seed, &header, &pilots, &remap, &fingerprints ) )
+	{
+		if( ++seed > MPH_MAX_SEEDS )
+		{
+			fprintf( stderr, "No seed places all buckets\n" );
+			return 1;
+		}
+	}
+	std::vector<uint8_t> image = serialize( header, pilots, remap, fingerprints );
+	if( image.size() > MPH_REGION_SIZE )
+	{
+		fprintf( stderr, "Image of %zu bytes does not fit the %u byte flash region\n", image.size(), MPH_REGION_SIZE );
+		return 1;
+	}
+	for( const Uid& uid : uids )
+	{
+		if( !lookup( image, uid ) )
+		{
+			fprintf( stderr, "Self-check failed\n" );
+			return 1;
+		}
+	}
+
+	if( !write_file( paths[1], image ) ) return 1;
+	if( uf2Path && !write_file( uf2Path, to_uf2( image, address ) ) ) return 1;
+	printf( "%zu UIDs, %u buckets, %u slots, seed %u, %zu bytes (%.2f bytes per UID)\n", uids.size(), header.buckets,
+		header.slots, seed, image.size(), (double)image.size() / uids.size() );
+	return 0;
+}
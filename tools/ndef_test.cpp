@@ -0,0 +1,164 @@
+// Host tests of the NDEF TLV parser, record parser and writer the firmware uses on Type 2 tags.
+//
+//   g++ -std=c++20 -O2 -Isrc -o ndef_test tools/ndef_test.cpp src/ndef.cpp
+//   ndef_test
+//
+// Exits non-zero if any check fails. The tag is read the way Type2Tag::read_message() does it:
+// the 12 data bytes that come with the capability container, then 16 bytes per READ.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "../src/ndef.h"
+
+static int failures = 0;
+
+static void check( const char* name, bool ok )
+{
+	printf( "%-44s %s\n", name, ok ? "ok" : "FAILED" );
+	if( !ok ) failures++;
+}
+
+static std::span<const uint8_t> bytes( const std::string& s )
+{
+	return std::span<const uint8_t>( (const uint8_t*)s.data(), s.size() );
+}
+
+// Finds the NDEF message TLV in area, handing the parser 12 bytes first and then 16 more at a time.
+// Returns the number of bytes that had to be loaded, 0 if there is no message.
+static size_t read_like_tag( const std::vector<uint8_t>& area, std::span<const uint8_t>* message )
+{
+	size_t have = area.size() < 12 ? area.size() : 12;
+	size_t offset = 0;
+	for( ;; )
+	{
+		NdefTlvReader tlv( std::span<const uint8_t>( area.data(), have ), offset, area.size() );
+		uint8_t tag;
+		std::span<const uint8_t> value;
+		while( tlv.next( &tag, &value ) )
+		{
+			if( tag == NDEF_TLV_MESSAGE )
+			{
+				*message = value;
+				return have;
+			}
+		}
+		if( !tlv.truncated() || have >= area.size() ) return 0;
+		offset = tlv.offset();
+		have = have + 16 < area.size() ? have + 16 : area.size();
+	}
+}
+
+static void test_tlv_reader()
+{
+	uint8_t tag;
+	std::span<const uint8_t> value;
+
+	// Lock Control, Memory Control and NULL TLVs that end exactly on the first 12 byte boundary
+	std::vector<uint8_t> area = {
+		0x01, 0x03, 0xA0, 0x10, 0x44,
+		0x02, 0x03, 0x00, 0x00, 0x00,
+		0x00, 0x00,
+		0x03, 0x03, 0xD0, 0x00, 0x00,
+		0xFE
+	};
+	area.resize( 48, 0x00 );
+	NdefTlvReader first( std::span<const uint8_t>( area.data(), 12 ), 0, area.size() );
+	check( "TLV: lock control", first.next( &tag, &value ) && tag == NDEF_TLV_LOCK_CONTROL && value.size() == 3 );
+	check( "TLV: memory control", first.next( &tag, &value ) && tag == NDEF_TLV_MEMORY_CONTROL && value.size() == 3 );
+	check( "TLV: end of loaded bytes is truncated", !first.next( &tag, &value ) && first.truncated() && first.offset() == 12 );
+	std::span<const uint8_t> message;
+	check( "TLV: message after the 12 byte boundary", read_like_tag( area, &message ) == 28 && message.size() == 3 &&
+		message[0] == 0xD0 );
+
+	// The same without an area size: the bytes given are the whole area
+	NdefTlvReader whole( std::span<const uint8_t>( area.data(), 12 ) );
+	whole.next( &tag, &value );
+	whole.next( &tag, &value );
+	check( "TLV: end of a whole area is not truncated", !whole.next( &tag, &value ) && !whole.truncated() );
+
+	// Terminator ends the walk even with bytes to spare
+	std::vector<uint8_t> empty = { 0x00, 0xFE, 0x03, 0x00 };
+	NdefTlvReader terminated( empty, 0, 64 );
+	check( "TLV: terminator", !terminated.next( &tag, &value ) && !terminated.truncated() );
+	check( "TLV: no message before the terminator", read_like_tag( empty, &message ) == 0 );
+
+	// A value running past the loaded bytes, and a three byte length split by the boundary
+	std::vector<uint8_t> split = { 0x03, 0x10, 0xD1 };
+	NdefTlvReader partial( split, 0, 64 );
+	check( "TLV: value past the loaded bytes", !partial.next( &tag, &value ) && partial.truncated() && partial.offset() == 0 );
+	std::vector<uint8_t> longForm = { 0x03, 0xFF, 0x01 };
+	NdefTlvReader header( longForm, 0, 64 );
+	check( "TLV: split three byte length", !header.next( &tag, &value ) && header.truncated() );
+	longForm = { 0xFD, 0xFF, 0x01, 0x00 };
+	longForm.resize( 4 + 256, 0x5A );
+	longForm.push_back( 0xFE );
+	NdefTlvReader proprietary( longForm );
+	check( "TLV: three byte length", proprietary.next( &tag, &value ) && tag == NDEF_TLV_PROPRIETARY && value.size() == 256 );
+}
+
+static void test_writer()
+{
+	uint8_t buffer[ 512 ];
+	const std::string type = "usb-passworder:password";
+	std::string password = "MyT4st_pAs7";
+
+	// Short message: the TLV header goes right in front of the record, short form
+	NdefWriter writer( buffer );
+	check( "Writer: add short record", writer.add( NDEF_TNF_EXTERNAL, bytes( type ), bytes( password ) ) );
+	std::span<const uint8_t> tlvs = writer.finish();
+	size_t recordLen = 3 + type.size() + password.size();
+	check( "Writer: short TLV", tlvs.size() == 2 + recordLen + 1 && tlvs[0] == NDEF_TLV_MESSAGE && tlvs[1] == recordLen &&
+		tlvs[ tlvs.size() - 1 ] == NDEF_TLV_TERMINATOR );
+	check( "Writer: MB, ME and SR", tlvs[2] == ( NDEF_MB | NDEF_ME | NDEF_SR | NDEF_TNF_EXTERNAL ) );
+
+	std::vector<uint8_t> area( tlvs.begin(), tlvs.end() );
+	area.resize( 144, 0x00 );
+	std::span<const uint8_t> message;
+	check( "Writer: read back", read_like_tag( area, &message ) == 12 + 2 * 16 && message.size() == recordLen );
+	NdefRecordReader records( message );
+	NdefRecord record;
+	check( "Records: one record", records.next( &record ) && record.tnf() == NDEF_TNF_EXTERNAL &&
+		std::string( record.type.begin(), record.type.end() ) == type &&
+		std::string( record.payload.begin(), record.payload.end() ) == password );
+	check( "Records: ME ends the message", !records.next( &record ) && !records.error() );
+
+	// Two records, the second one long with an ID: three byte TLV length
+	std::string big( 300, 'x' );
+	std::string id = "k1";
+	NdefWriter two( buffer );
+	two.add( NDEF_TNF_WELL_KNOWN, bytes( "T" ), bytes( "\x02" "enhi" ) );
+	check( "Writer: add long record", two.add( NDEF_TNF_MIME, bytes( "a/b" ), bytes( big ), bytes( id ) ) );
+	tlvs = two.finish();
+	size_t length = ( 3 + 1 + 5 ) + ( 2 + 4 + 1 + 3 + 2 + big.size() );
+	check( "Writer: long TLV", tlvs.size() == 4 + length + 1 && tlvs[0] == NDEF_TLV_MESSAGE && tlvs[1] == 0xFF &&
+		( tlvs[2] << 8 | tlvs[3] ) == (int)length );
+	area.assign( tlvs.begin(), tlvs.end() );
+	area.resize( 496, 0x00 );
+	check( "Writer: long read back", read_like_tag( area, &message ) && message.size() == length );
+	NdefRecordReader both( message );
+	check( "Records: first of two", both.next( &record ) && record.header == ( NDEF_MB | NDEF_SR | NDEF_TNF_WELL_KNOWN ) );
+	check( "Records: second of two", both.next( &record ) && record.header == ( NDEF_ME | NDEF_IL | NDEF_TNF_MIME ) &&
+		record.payload.size() == big.size() && std::string( record.id.begin(), record.id.end() ) == id );
+	check( "Records: done", !both.next( &record ) && !both.error() );
+
+	// Malformed: payload length past the end of the message
+	uint8_t broken[] = { NDEF_MB | NDEF_ME | NDEF_SR | NDEF_TNF_MIME, 1, 9, 'a', 'b' };
+	NdefRecordReader bad( broken );
+	check( "Records: payload past the end", !bad.next( &record ) && bad.error() );
+
+	// Too small a buffer
+	uint8_t small[ 16 ];
+	NdefWriter tight( small );
+	check( "Writer: overflow", !tight.add( NDEF_TNF_EXTERNAL, bytes( type ), bytes( password ) ) && tight.overflow() &&
+		tight.finish().empty() );
+}
+
+int main()
+{
+	test_tlv_reader();
+	test_writer();
+	printf( "%s\n", failures ? "FAILED" : "all passed" );
+	return failures ? 1 : 0;
+}
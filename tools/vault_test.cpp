@@ -0,0 +1,185 @@
+// Host tests of the Vault over the simulated flash in tools/host: credentials round trip through
+// the KvStore encrypted and tagged, records that were not sealed under this device's secret are
+// refused, and the device secret of older settings moves to its own sector without losing a record.
+//
+//   g++ -std=c++20 -O2 -Isrc -Itools/host -o vault_test tools/vault_test.cpp tools/host/host.cpp src/vault.cpp src/kv_store.cpp src/settings.cpp src/aes128.cpp src/sha256.cpp src/flash_storage.cpp src/MFRC522.cpp
+//   vault_test
+//
+// Exits non-zero if any check fails.
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "host.h"
+#include "pico/rand.h"
+#include "../src/vault.h"
+#include "../src/kv_store.h"
+#include "../src/settings.h"
+
+#define CARDS 10
+
+static int failures = 0;
+
+static void check( const char* name, bool ok )
+{
+	printf( "%-44s %s\n", name, ok ? "ok" : "FAILED" );
+	if( !ok ) failures++;
+}
+
+// The layout of Settings::Data, as builds with the secret in the settings sector wrote it
+struct SettingsImage
+{
+	uint32_t magic;
+	uint32_t checksum;
+	uint8_t rx_gain;
+	uint16_t poll_fast_ms;
+	uint16_t poll_slow_ms;
+	uint16_t poll_hold_ms;
+	uint8_t old_secret[ SETTINGS_SECRET_SIZE ];
+	uint8_t derive_length;		// "UPS3" ends before this field
+	uint8_t derive_symbols;
+	char derive_profile[ SETTINGS_PROFILE_SIZE ];
+};
+
+static MFRC522::Uid cards[ CARDS ];
+
+static std::string password( int card )
+{
+	return "password-" + std::to_string( card ) + "-xyzxyzxyzxyzxyz";
+}
+
+static bool has_password( int card )
+{
+	uint8_t buffer[ MAX_PASS_LEN ];
+	uint8_t len;
+	std::string expected = password( card );
+	return Vault::get( cards[ card ], buffer, &len ) && len == expected.size() && !memcmp( buffer, expected.data(), len );
+}
+
+static bool all_readable()
+{
+	for( int i = 0; i < CARDS; i++ ) if( !has_password( i ) ) return false;
+	return true;
+}
+
+// What main() does at startup
+static void boot()
+{
+	Settings::load();
+	KvStore::load();
+	Vault::init();
+}
+
+static bool in_flash( const void* data, size_t len )
+{
+	return memmem( host_flash, PICO_FLASH_SIZE_BYTES, data, len ) != nullptr;
+}
+
+static void test_round_trip()
+{
+	boot();
+	bool stored = true;
+	for( int i = 0; i < CARDS; i++ )
+	{
+		cards[i].size = 7;
+		for( uint8_t j = 0; j < 7; j++ ) cards[i].uidByte[j] = get_rand_32();
+		stored = stored && Vault::put( cards[i], (const uint8_t*)password( i ).data(), password( i ).size() );
+	}
+	KvStore::flush();
+	check( "Vault: put", stored );
+	check( "Vault: no plaintext in flash", !in_flash( "password-", 9 ) );
+	boot();
+	check( "Vault: get after a reset", all_readable() );
+	bool first = has_password( 0 );
+	uint32_t hits = Vault::stats().hits;
+	check( "Vault: the next get from the cache", first && has_password( 0 ) && Vault::stats().hits == hits + 1 );
+
+	uint8_t record[10] = { 6, '\t', 1, 2, 3, 4, 5, 6, 7, 8 }, buffer[40];
+	uint8_t len;
+	check( "Vault: TOTP record", Vault::put_totp( cards[0], record, sizeof( record ) ) &&
+		Vault::get_totp( cards[0], buffer, &len ) && len == sizeof( record ) && !memcmp( buffer, record, len ) );
+}
+
+static void test_refused()
+{
+	uint8_t buffer[ KV_MAX_VALUE ];
+	uint8_t len;
+	uint32_t rejected = Vault::stats().rejected;
+	// What a build without tags stored
+	MFRC522::Uid plain = {};
+	plain.size = 4;
+	memcpy( plain.uidByte, "\x01\x02\x03\x04", 4 );
+	KvStore::put( plain.uidByte, plain.size, (const uint8_t*)"plaintext-pass", 14 );
+	check( "Vault: untagged record refused", !Vault::get( plain, buffer, &len ) && Vault::has( plain ) &&
+		Vault::stats().rejected == rejected + 1 );
+
+	// Another card's record copied over
+	KvStore::get( cards[1].uidByte, cards[1].size, buffer, &len );
+	KvStore::put( cards[2].uidByte, cards[2].size, buffer, len );
+	Vault::clear_cache();
+	check( "Vault: swapped record refused", !has_password( 2 ) && Vault::stats().rejected == rejected + 2 && has_password( 1 ) );
+	Vault::put( cards[2], (const uint8_t*)password( 2 ).data(), password( 2 ).size() );
+	KvStore::flush();
+
+	// The secret sector is not touched by a settings save; without it nothing decrypts
+	Settings::save();
+	boot();
+	check( "Vault: secret survives a settings save", all_readable() );
+}
+
+static void write_settings( uint32_t magic, const uint8_t* secret )
+{
+	SettingsImage image;
+	memset( &image, 0, sizeof( image ) );
+	image.magic = magic;
+	image.rx_gain = SETTINGS_RX_GAIN_UNSET;
+	image.poll_fast_ms = SETTINGS_POLL_FAST_MS;
+	image.poll_slow_ms = SETTINGS_POLL_SLOW_MS;
+	image.poll_hold_ms = SETTINGS_POLL_HOLD_MS;
+	memcpy( image.old_secret, secret, SETTINGS_SECRET_SIZE );
+	// FNV-1a over everything after the checksum, up to the end of the version's fields
+	uint32_t end = magic == SETTINGS_MAGIC_V3 ? offsetof( SettingsImage, derive_length ) : sizeof( image );
+	image.checksum = 2166136261u;
+	for( uint32_t i = offsetof( SettingsImage, checksum ) + sizeof( image.checksum ); i < end; i++ )
+		image.checksum = ( image.checksum ^ ( (const uint8_t*)&image )[i] ) * 16777619u;
+	memset( host_flash + FLASH_SETTINGS_OFFSET, 0xFF, FLASH_SETTINGS_SIZE );
+	memcpy( host_flash + FLASH_SETTINGS_OFFSET, &image, sizeof( image ) );
+}
+
+// The device as a build that kept the secret in the settings left it: the records are sealed under
+// the same secret, but its sector was never written
+static void test_move( uint32_t magic, const char* name )
+{
+	uint8_t secret[ SETTINGS_SECRET_SIZE ];
+	memcpy( secret, Settings::secret(), sizeof( secret ) );
+	write_settings( magic, secret );
+	memset( host_flash + FLASH_SECRET_OFFSET, 0xFF, FLASH_SECRET_SIZE );
+	boot();
+	bool moved = Settings::secret_saved() && !memcmp( Settings::secret(), secret, sizeof( secret ) ) && all_readable();
+	// The next settings save drops the old copy
+	Settings::save();
+	boot();
+	bool dropped = !memmem( host_flash + FLASH_SETTINGS_OFFSET, FLASH_SETTINGS_SIZE, secret, sizeof( secret ) );
+	check( name, moved && dropped && Settings::secret_saved() && all_readable() );
+}
+
+static void test_lost_secret()
+{
+	uint32_t rejected = Vault::stats().rejected;
+	memset( host_flash + FLASH_SECRET_OFFSET, 0xFF, FLASH_SECRET_SIZE );
+	boot();
+	check( "Vault: records refused with a new secret", !has_password( 3 ) && Vault::stats().rejected == rejected + 1 );
+}
+
+int main()
+{
+	memset( host_flash, 0xFF, PICO_FLASH_SIZE_BYTES );
+	test_round_trip();
+	test_refused();
+	test_move( SETTINGS_MAGIC_V3, "Vault: secret moved from UPS3 settings" );
+	test_move( SETTINGS_MAGIC, "Vault: secret moved from UPS4 settings" );
+	test_lost_secret();
+	printf( "%s\n", failures ? "FAILED" : "all passed" );
+	return failures ? 1 : 0;
+}